@@ -0,0 +1,163 @@
+#include "ActionPipeline.h"
+
+
+bool TActionToken::Ok() const
+{
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    return !pipeline.cancelled && !pipeline.stopping && std::chrono::steady_clock::now() < deadline;
+}
+
+
+bool TActionToken::Cancelled() const
+{
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    return pipeline.cancelled || pipeline.stopping;
+}
+
+
+bool TActionToken::Wait(uint32_t ms)
+{
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    if (until > deadline)
+        until = deadline;
+
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    pipeline.wakeup.wait_until(lock, until, [this] { return pipeline.cancelled || pipeline.stopping; });
+    return !pipeline.cancelled && !pipeline.stopping && std::chrono::steady_clock::now() < deadline;
+}
+
+
+TActionPipeline::TActionPipeline(std::function<void()> aNotify)
+    : notify(aNotify)
+{
+}
+
+
+TActionPipeline::~TActionPipeline()
+{
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+}
+
+
+void TActionPipeline::Add(TTimeoutAction *action)
+{
+    if (actions.size() < MaxActions && !worker.joinable())
+        actions.emplace_back(action);
+    else
+        delete action;
+}
+
+
+bool TActionPipeline::Start()
+{
+    if (actions.empty())
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running)
+            return false;
+        running = runRequested = true;
+        cancelled = false;
+    }
+    // The worker is started with the first run, so a pipeline that is never
+    // used costs no thread.
+    if (!worker.joinable())
+        worker = std::thread(&TActionPipeline::WorkerThread, this);
+    wakeup.notify_all();
+    return true;
+}
+
+
+void TActionPipeline::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        cancelled = true;
+    }
+    wakeup.notify_all();
+}
+
+
+bool TActionPipeline::Running() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return running;
+}
+
+
+std::vector<TActionReport> TActionPipeline::TakeReports()
+{
+    std::vector<TActionReport> taken;
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.swap(reports);
+    return taken;
+}
+
+
+void TActionPipeline::Report(size_t action, TActionOutcome outcome, uint32_t elapsed)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reports.push_back(TActionReport{ action, outcome, elapsed });
+    }
+    if (notify)
+        notify();
+}
+
+
+void TActionPipeline::WorkerThread()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return runRequested || stopping; });
+            if (stopping)
+                return;
+            runRequested = false;
+        }
+
+        for (size_t i = 0; i < actions.size(); i++) {
+            TTimeoutAction &action = *actions[i];
+            auto start = std::chrono::steady_clock::now();
+            auto deadline = action.Timeout == 0 ? std::chrono::steady_clock::time_point::max()
+                : start + std::chrono::milliseconds(action.Timeout);
+            TActionToken token(*this, deadline);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping)
+                    return;
+                if (cancelled) {
+                    reports.push_back(TActionReport{ i, AO_Skipped, 0 });
+                    continue;
+                }
+            }
+
+            bool ok = action.Run(token);
+            auto end = std::chrono::steady_clock::now();
+            uint32_t elapsed = uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+            TActionOutcome outcome = AO_Done;
+            if (!ok) {
+                std::lock_guard<std::mutex> lock(mutex);
+                outcome = cancelled || stopping ? AO_Cancelled : end >= deadline ? AO_TimedOut : AO_Failed;
+            }
+            Report(i, outcome, elapsed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        // The skipped ones, and the end of the run.
+        if (notify)
+            notify();
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// Platform neutral pipeline of the actions taken when the idle timeout
+// expires: lock, disconnect, log off, sleep, run a script, and so on, in
+// the configured order, on a worker thread of its own, so that actions that
+// take seconds never hold up the thread that checks the idle time.
+// Each action has a timeout, and a run is cancelled when the user comes
+// back: the action that runs is told to stop, and the ones after it are
+// skipped. Stopping is cooperative; an action that takes time waits with
+// TActionToken::Wait(), or checks Ok() often, and returns when it's false.
+// An action that fails or times out doesn't stop the ones after it.
+// How each action ended is queued, and the notify callback is called from
+// the worker, so that the owner can take the reports on its own thread,
+// e.g. after posting itself a message, like the settings stores do.
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+enum TActionOutcome : uint8_t
+{
+    AO_Done,
+    AO_Failed,
+    AO_TimedOut,
+    AO_Cancelled,   // The user came back while it ran.
+    AO_Skipped      // The run was cancelled before it.
+};
+
+
+class TActionPipeline;
+
+
+// Tells a running action when to give up.
+class TActionToken
+{
+public:
+    // False once the run has been cancelled or the action's time is up.
+    bool Ok() const;
+
+    // True once the run has been cancelled, rather than timed out.
+    bool Cancelled() const;
+
+    // Waits ms, or less if Ok() becomes false meanwhile. Returns Ok().
+    bool Wait(uint32_t ms);
+
+private:
+    friend class TActionPipeline;
+
+    TActionToken(TActionPipeline &aPipeline, std::chrono::steady_clock::time_point aDeadline)
+        : pipeline(aPipeline), deadline(aDeadline) {}
+
+    TActionPipeline &pipeline;
+    const std::chrono::steady_clock::time_point deadline;
+};
+
+
+class TTimeoutAction
+{
+public:
+    static const uint32_t DefaultTimeout = 60000;  // ms
+
+    TTimeoutAction(const wchar_t *aName, uint32_t aTimeout = DefaultTimeout) : Name(aName), Timeout(aTimeout) {}
+    virtual ~TTimeoutAction() {}
+
+    // Runs on the worker. Returns false if the action failed.
+    virtual bool Run(TActionToken &token) = 0;
+
+    const std::wstring Name;
+    const uint32_t Timeout;  // ms; 0 for none.
+};
+
+
+struct TActionReport
+{
+    size_t action;          // Index, in the order added.
+    TActionOutcome outcome;
+    uint32_t elapsed;       // ms
+};
+
+
+class TActionPipeline
+{
+public:
+    static const size_t MaxActions = 16;
+
+    // notify is called from the worker whenever reports have been queued.
+    TActionPipeline(std::function<void()> notify);
+
+    // Cancels a run, and waits for the action that runs to return.
+    ~TActionPipeline();
+
+    // Takes ownership. Only before the first Start().
+    void Add(TTimeoutAction *action);
+
+    bool   Empty() const { return actions.empty(); }
+    size_t Size() const { return actions.size(); }
+    const TTimeoutAction &Action(size_t index) const { return *actions[index]; }
+
+    // Starts a run of all actions, in order, and returns right away. Returns
+    // false if the previous run hasn't ended yet.
+    bool Start();
+
+    // Cancels the run, if any; doesn't wait for it to end.
+    void Cancel();
+
+    // True from Start() until the last action of the run has ended.
+    bool Running() const;
+
+    // The reports queued since the last call.
+    std::vector<TActionReport> TakeReports();
+
+private:
+    friend class TActionToken;
+
+    void WorkerThread();
+    void Report(size_t action, TActionOutcome outcome, uint32_t elapsed);
+
+    std::vector<std::unique_ptr<TTimeoutAction>> actions;
+    std::function<void()> notify;
+    std::thread worker;
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeup;     // For the worker, and for waiting actions.
+    bool runRequested = false;
+    bool running = false;
+    bool cancelled = false;             // Of the current run.
+    bool stopping = false;
+    std::vector<TActionReport> reports;
+};
@@ -0,0 +1,136 @@
+#include "ActivityLog.h"
+
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "EventJournal.h"
+
+
+static inline uint32_t PopCount(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    return uint32_t(__popcnt64(x));
+#elif defined(_MSC_VER)
+    return __popcnt(uint32_t(x)) + __popcnt(uint32_t(x >> 32));
+#else
+    return uint32_t(__builtin_popcountll(x));
+#endif
+}
+
+
+bool TActivityLog::Open(const wchar_t *fName, uint32_t capacity)
+{
+    Close();
+
+    if (capacity == 0 || !file.Open(fName, sizeof(TActivityHeader) + size_t(capacity) * sizeof(TActivityDay)))
+        return false;
+
+    header = (TActivityHeader *)file.Data();
+    days = (TActivityDay *)(file.Data() + sizeof(TActivityHeader));
+
+    if (memcmp(header->magic, ActivityLogMagic, sizeof ActivityLogMagic) != 0
+        || header->version != ActivityLogVersion
+        || header->headerSize != sizeof(TActivityHeader)
+        || header->daySize != sizeof(TActivityDay)
+        || header->capacity != capacity) {
+        memset(header, 0, sizeof(TActivityHeader));
+        memcpy(header->magic, ActivityLogMagic, sizeof ActivityLogMagic);
+        header->version = ActivityLogVersion;
+        header->headerSize = sizeof(TActivityHeader);
+        header->daySize = sizeof(TActivityDay);
+        header->capacity = capacity;
+        header->createdTime = TEventJournal::TimeNow();
+        memset(days, 0, size_t(capacity) * sizeof(TActivityDay));
+        for (uint32_t i = 0; i < capacity; i++)
+            days[i].day = TActivityDay::UnusedDay;
+    }
+    return true;
+}
+
+
+void TActivityLog::Mark(TActivityMark mark, int64_t localTime)
+{
+    if (!header)
+        return;
+
+    int32_t day = DayOf(localTime);
+    int minute = MinuteOf(localTime);
+    TActivityDay &slot = days[uint32_t(day) % header->capacity];
+    if (slot.day != day) {
+        memset(&slot, 0, sizeof slot);
+        slot.day = day;
+    }
+    slot.bits[mark][minute / 64] |= uint64_t(1) << (minute % 64);
+}
+
+
+const TActivityDay *TActivityLog::Day(int32_t day) const
+{
+    if (!header || day == TActivityDay::UnusedDay)
+        return NULL;
+
+    const TActivityDay &slot = days[uint32_t(day) % header->capacity];
+    return slot.day == day ? &slot : NULL;
+}
+
+
+int32_t TActivityLog::LastDay() const
+{
+    int32_t last = TActivityDay::UnusedDay;
+    for (uint32_t i = 0; header && i < header->capacity; i++) {
+        if (days[i].day > last)
+            last = days[i].day;
+    }
+    return last;
+}
+
+
+uint32_t TActivityLog::Count(TActivityMark mark, int32_t day, int firstMinute, int minutes) const
+{
+    const TActivityDay *record = Day(day);
+    return record != NULL ? CountBits(record->bits[mark], firstMinute, minutes) : 0;
+}
+
+
+int TActivityLog::HourTotals(TActivityMark mark, int32_t firstDay, int32_t lastDay, uint32_t hours[24]) const
+{
+    int found = 0;
+    for (int32_t day = firstDay; day <= lastDay; day++) {
+        const TActivityDay *record = Day(day);
+        if (record == NULL)
+            continue;
+        found++;
+        for (int hour = 0; hour < 24; hour++)
+            hours[hour] += CountBits(record->bits[mark], hour * 60, 60);
+    }
+    return found;
+}
+
+
+// Whole words are counted as they are; the words at either end are masked.
+uint32_t TActivityLog::CountBits(const uint64_t *bits, int first, int count)
+{
+    if (first < 0) {
+        count += first;
+        first = 0;
+    }
+    if (first + count > TActivityDay::MinutesPerDay)
+        count = TActivityDay::MinutesPerDay - first;
+    if (count <= 0)
+        return 0;
+
+    int last = first + count - 1;
+    int firstWord = first / 64, lastWord = last / 64;
+    uint64_t firstMask = ~uint64_t(0) << (first % 64);
+    uint64_t lastMask = ~uint64_t(0) >> (63 - last % 64);
+
+    if (firstWord == lastWord)
+        return PopCount(bits[firstWord] & firstMask & lastMask);
+
+    uint32_t n = PopCount(bits[firstWord] & firstMask);
+    for (int i = firstWord + 1; i < lastWord; i++)
+        n += PopCount(bits[i]);
+    return n + PopCount(bits[lastWord] & lastMask);
+}
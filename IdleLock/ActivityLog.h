@@ -0,0 +1,107 @@
+#pragma once
+
+// Long-term record of when the user was active, as one bit per minute.
+// The log is a pre-sized, memory-mapped file: a header followed by a ring
+// of day records, each holding a bitmap of the minutes with input and
+// bitmaps of the minutes in which the session was locked and unlocked.
+// Day d (in local time) lives in slot d % capacity; a slot is cleared when
+// a new day takes it over, so the ring always holds the last capacity days.
+// A year of days takes about 220 kB. Queries count bits with popcount, a
+// word at a time, and never touch more than the days they cover.
+// The layout is shared with the offline report in Tools/ActivityReport.cpp,
+// so bump ActivityLogVersion on any change to it.
+
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+
+static const uint32_t ActivityLogVersion = 1;
+static const char     ActivityLogMagic[8] = { 'I', 'D', 'L', 'A', 'C', 'T', 'V', 0 };
+
+
+enum TActivityMark
+{
+    AM_Active = 0,      // There was input.
+    AM_Lock,            // The session was locked.
+    AM_Unlock,          // The session was unlocked.
+    AM_MarkCount
+};
+
+
+struct TActivityHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t daySize;
+    uint32_t capacity;        // Number of days in the ring.
+    int64_t  createdTime;     // ms since 1970-01-01 UTC.
+    uint8_t  reserved[32];
+};
+
+
+struct TActivityDay
+{
+    static const int MinutesPerDay = 1440;
+    static const int Words = (MinutesPerDay + 63) / 64;
+    static const int32_t UnusedDay = INT32_MIN;
+
+    int32_t  day;             // Days since 1970-01-01 in local time; UnusedDay for an unused slot.
+    uint32_t reserved;
+    uint64_t bits[AM_MarkCount][Words];  // Bit m % 64 of word m / 64 is minute m of the day.
+};
+
+static_assert(sizeof(TActivityHeader) == 64, "Activity log header layout changed.");
+static_assert(sizeof(TActivityDay) == 560, "Activity log day layout changed.");
+
+
+class TActivityLog
+{
+public:
+    static const uint32_t DefaultCapacity = 400;  // Days; 220 kB.
+    static const int64_t  MsPerDay = 86400000;
+
+    // Opens an existing log or creates a new one. An existing log with
+    // another layout or capacity is started over.
+    bool Open(const wchar_t *fName, uint32_t capacity = DefaultCapacity);
+    void Close() { file.Close(); header = NULL; days = NULL; }
+
+    bool IsOpen() const { return header != NULL; }
+    uint32_t Capacity() const { return header ? header->capacity : 0; }
+
+    // Sets the bit of the minute that contains localTime (ms since
+    // 1970-01-01 in local time, see TPlatformBackend::LocalTime()).
+    void Mark(TActivityMark mark, int64_t localTime);
+
+    // The record of the given day, or NULL if the ring doesn't hold it.
+    const TActivityDay *Day(int32_t day) const;
+
+    // The newest day in the ring, or TActivityDay::UnusedDay if it is empty.
+    int32_t LastDay() const;
+
+    // Number of marked minutes of the given day, from firstMinute on.
+    uint32_t Count(TActivityMark mark, int32_t day, int firstMinute = 0, int minutes = TActivityDay::MinutesPerDay) const;
+
+    // Adds the marked minutes in each hour of the days firstDay..lastDay to
+    // hours. Returns the number of those days that the ring holds.
+    int HourTotals(TActivityMark mark, int32_t firstDay, int32_t lastDay, uint32_t hours[24]) const;
+
+    static int32_t DayOf(int64_t localTime)
+    {
+        return int32_t(localTime >= 0 ? localTime / MsPerDay : (localTime - MsPerDay + 1) / MsPerDay);
+    }
+
+    static int MinuteOf(int64_t localTime)
+    {
+        return int((localTime - int64_t(DayOf(localTime)) * MsPerDay) / 60000);
+    }
+
+    // Marked minutes in [first, first + count) of a day's bitmap.
+    static uint32_t CountBits(const uint64_t *bits, int first, int count);
+
+private:
+    TMappedFile      file;
+    TActivityHeader *header = NULL;
+    TActivityDay    *days = NULL;
+};
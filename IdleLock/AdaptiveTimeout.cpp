@@ -0,0 +1,126 @@
+#include "AdaptiveTimeout.h"
+
+#include <math.h>
+#include <algorithm>
+
+
+static const double Growth = 1.1;
+
+// The share of false locks to aim for, how much each lock makes the older
+// ones count less (about the last 50 locks matter), and the share of the
+// false lock pauses that a raised timeout covers.
+static const double TargetShare = .05;
+static const double Forget = .98;
+static const double CoverQuantile = .9;
+
+
+void TQuantileSketch::Add(uint32_t value, double aWeight)
+{
+    buckets[BucketIndex(value)] += aWeight;
+    weight += aWeight;
+}
+
+
+void TQuantileSketch::Decay(double factor)
+{
+    for (double &bucket : buckets)
+        bucket *= factor;
+    weight *= factor;
+}
+
+
+double TQuantileSketch::Fraction(uint32_t value) const
+{
+    if (weight <= 0.)
+        return 0.;
+
+    int last = BucketIndex(value);
+    double below = 0.;
+    for (int i = 0; i <= last; i++)
+        below += buckets[i];
+    return std::min(below / weight, 1.);
+}
+
+
+uint32_t TQuantileSketch::Quantile(double q) const
+{
+    if (weight <= 0.)
+        return 0;
+
+    double target = q * weight;
+    double below = 0.;
+    for (int i = 0; i < BucketCount - 1; i++) {
+        below += buckets[i];
+        if (below >= target)
+            return BucketUpperBound(i);
+    }
+    return BucketUpperBound(BucketCount - 1);
+}
+
+
+int TQuantileSketch::BucketIndex(uint32_t value)
+{
+    if (value < MinValue)
+        return 0;
+    int i = 1 + int(log(double(value) / MinValue) / log(Growth));
+    return i < BucketCount ? i : BucketCount - 1;
+}
+
+
+uint32_t TQuantileSketch::BucketUpperBound(int bucket)
+{
+    if (bucket >= BucketCount - 1)
+        return UINT32_MAX;
+    return uint32_t(MinValue * pow(Growth, bucket));
+}
+
+
+void TAdaptiveTimeout::SetMaxTimeout(uint32_t aMaxTimeout)
+{
+    maxTimeout = aMaxTimeout;
+    if (maxTimeout == 0) {
+        learned = 0;
+        lockedTimes = TQuantileSketch();
+        falseLockPauses = TQuantileSketch();
+    }
+}
+
+
+uint32_t TAdaptiveTimeout::Timeout(uint32_t base) const
+{
+    if (learned <= base || maxTimeout <= base)
+        return base;
+    return std::min(learned, maxTimeout);
+}
+
+
+bool TAdaptiveTimeout::LockEnded(uint32_t base, uint32_t idleTime, uint32_t lockedTime)
+{
+    bool falseLock = lockedTime <= FalseLockTime;
+    lockedTimes.Decay(Forget);
+    lockedTimes.Add(lockedTime);
+    if (falseLock) {
+        falseLockPauses.Decay(Forget);
+        falseLockPauses.Add(idleTime + lockedTime);
+    }
+
+    // Nothing to learn if the maximum leaves no room.
+    if (maxTimeout <= base)
+        return falseLock;
+
+    uint32_t current = Timeout(base);
+    uint32_t step = (maxTimeout - base) / 8;
+    if (step < MinStep)
+        step = MinStep;
+    double share = FalseLockShare();
+
+    if (falseLock && share > TargetShare) {
+        // Past most of the pauses that were cut short, and then some.
+        uint32_t cover = falseLockPauses.Quantile(CoverQuantile);
+        uint32_t raised = std::max(cover, current) + step;
+        learned = std::min(raised, maxTimeout);
+    } else if (!falseLock && share < TargetShare && current > base) {
+        learned = current - std::min(step / 4, current - base);
+    }
+    return falseLock;
+}
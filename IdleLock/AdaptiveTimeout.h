@@ -0,0 +1,78 @@
+#pragma once
+
+// Learns a longer timeout from false locks: idle locks that the user undoes
+// within seconds, because they were there all along (reading, in a
+// meeting). The lock-to-unlock times of the idle locks, and how long the
+// user had sat still when a false lock was undone, are kept in streaming
+// quantile sketches of fixed size, which forget old locks a little with
+// each new one. While more than TargetShare of the recent idle locks were
+// false, each false lock raises the timeout past most of those pauses;
+// while fewer were, each true lock lowers it a little. The timeout never
+// goes below the configured one, nor above the maximum set by the admin.
+
+#include <stdint.h>
+
+
+// Weights of values in logarithmic buckets: bucket 0 holds the values below
+// MinValue, bucket i > 0 those below MinValue * Growth^i, and the last one
+// everything above. That covers 1 s to 50 hours of ms at 10% resolution, in
+// 1 kB, however many values are added.
+class TQuantileSketch
+{
+public:
+    static const int BucketCount = 128;
+    static const uint32_t MinValue = 1000;
+
+    void Add(uint32_t value, double weight = 1.);
+
+    // Multiplies all weights by factor, so that older values count less.
+    void Decay(double factor);
+
+    double Weight() const { return weight; }
+
+    // The share of the weight at or below value, to the bucket.
+    double Fraction(uint32_t value) const;
+
+    // The upper bound of the bucket in which the share q of the weight is
+    // reached; 0 if there are no values.
+    uint32_t Quantile(double q) const;
+
+    static int BucketIndex(uint32_t value);
+    static uint32_t BucketUpperBound(int bucket);
+
+private:
+    double buckets[BucketCount] = {};
+    double weight = 0.;
+};
+
+
+class TAdaptiveTimeout
+{
+public:
+    static const uint32_t FalseLockTime = 20000;  // An unlock this soon makes a false lock.
+    static const uint32_t MinStep = 60000;
+
+    // 0 turns the adaptation off, and forgets what was learned.
+    void SetMaxTimeout(uint32_t aMaxTimeout);
+    uint32_t MaxTimeout() const { return maxTimeout; }
+    bool Enabled() const { return maxTimeout != 0; }
+
+    // The timeout to use instead of base, the configured one.
+    uint32_t Timeout(uint32_t base) const;
+
+    // An idle lock, requested at idleTime under the base timeout, was undone
+    // lockedTime later. Returns true if it was a false lock.
+    bool LockEnded(uint32_t base, uint32_t idleTime, uint32_t lockedTime);
+
+    // Of the recent idle locks, weighted.
+    double FalseLockShare() const { return lockedTimes.Weight() > 0. ? lockedTimes.Fraction(FalseLockTime) : 0.; }
+
+    const TQuantileSketch &LockedTimes() const { return lockedTimes; }
+    const TQuantileSketch &FalseLockPauses() const { return falseLockPauses; }
+
+private:
+    uint32_t maxTimeout = 0;
+    uint32_t learned = 0;               // 0 until a false lock.
+    TQuantileSketch lockedTimes;        // Lock to unlock, of the idle locks.
+    TQuantileSketch falseLockPauses;    // Idle time at the unlock, of the false locks.
+};
@@ -0,0 +1,267 @@
+#include "AsyncLogger.h"
+
+#include <algorithm>
+
+#include "Stats.h"
+#include "TextUtil.h"
+
+
+TAsyncLogger::TAsyncLogger(const wchar_t *fName, uint64_t aMaxFileSize, int aMaxFiles)
+    : fileName(fName), maxFileSize(aMaxFileSize), maxFiles(aMaxFiles)
+{
+    for (uint32_t i = 0; i < RingSize; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+
+    file = OpenFile(fName, "ab");
+    opened = file != NULL;
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        fileSize = (uint64_t)ftell(file);
+    }
+
+    writer = std::thread(&TAsyncLogger::WriterThread, this);
+    Log(L"Logging started.");
+}
+
+
+TAsyncLogger::~TAsyncLogger()
+{
+    Log(L"Closing log.");
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeWriter.notify_one();
+    writer.join();
+
+    if (file)
+        fclose(file);
+}
+
+
+// Called from any thread. Never blocks; drops the line if the ring is full.
+void TAsyncLogger::Log(const wchar_t *text)
+{
+    if (!opened)
+        return;
+
+    TStats::Add(SC_LogLines);
+    TStatScope scope(ST_Log);
+
+    // Claim a slot (bounded MPMC queue, Vyukov style).
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    TRecord *record;
+    for (;;) {
+        record = &ring[pos & (RingSize - 1)];
+        uint32_t sequence = record->sequence.load(std::memory_order_acquire);
+        int32_t diff = int32_t(sequence - pos);
+
+        if (diff == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->time = time(NULL);
+    int i = 0;
+    for (; text[i] && i < RecordTextLength - 1; i++)
+        record->text[i] = text[i];
+    record->text[i] = 0;
+    record->sequence.store(pos + 1, std::memory_order_release);
+
+    // Don't wait for the flush interval if a full batch is pending.
+    if (pos - dequeuePos.load(std::memory_order_relaxed) == BatchSize)
+        wakeWriter.notify_one();
+}
+
+
+void TAsyncLogger::Reopen(const wchar_t *fName)
+{
+    Log(L"Log moved.");
+    Flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reopenName = fName;
+    }
+    Flush();
+    opened = true;
+    Log(L"Logging started.");
+}
+
+
+void TAsyncLogger::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    uint32_t ticket = ++flushRequests;
+    wakeWriter.notify_one();
+    flushed.wait(lock, [&] { return int32_t(flushesDone - ticket) >= 0 || stop; });
+}
+
+
+void TAsyncLogger::WriterThread()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        bool stopping = stop;
+        uint32_t requests = flushRequests;
+        lock.unlock();
+
+        while (WriteBatch())
+            ;
+        WriteFile(true);
+
+        lock.lock();
+        if (!reopenName.empty()) {
+            if (file)
+                fclose(file);
+            fileName.swap(reopenName);
+            reopenName.clear();
+            file = OpenFile(fileName.c_str(), "ab");
+            fileSize = 0;
+            if (file) {
+                fseek(file, 0, SEEK_END);
+                fileSize = (uint64_t)ftell(file);
+            }
+        }
+        flushesDone = requests;
+        flushed.notify_all();
+
+        if (stopping)
+            break;
+        // The duration takes its count by reference, so not FlushInterval
+        // itself, which has no definition.
+        if (!stop && flushRequests == requests)
+            wakeWriter.wait_for(lock, std::chrono::milliseconds(int(FlushInterval)));
+    }
+}
+
+
+// Formats up to BatchSize records into the buffer.
+// Returns true if there may be more records to process.
+bool TAsyncLogger::WriteBatch()
+{
+    uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+    uint32_t n = 0;
+
+    for (; n < BatchSize; n++, pos++) {
+        TRecord &record = ring[pos & (RingSize - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != pos + 1)
+            break;
+
+        buffer += TimeStamp(record.time);
+        AppendUtf8(buffer, record.text);
+        buffer += '\n';
+
+        record.sequence.store(pos + RingSize, std::memory_order_release);
+    }
+    dequeuePos.store(pos, std::memory_order_relaxed);
+
+    if (buffer.size() >= 64 * 1024)
+        WriteFile(false);
+
+    return n == BatchSize;
+}
+
+
+void TAsyncLogger::WriteFile(bool flush)
+{
+    if (buffer.empty())
+        return;
+
+    // Reopened after it was lost in a rotation, with a note of the gap.
+    if (!file && lostFile) {
+        file = OpenFile(fileName.c_str(), "ab");
+        if (file) {
+            fseek(file, 0, SEEK_END);
+            fileSize = (uint64_t)ftell(file);
+            lostFile = false;
+            uint64_t lost = dropped.load(std::memory_order_relaxed) - droppedAtLoss;
+            ErrorLine(("Could not reopen the log file after rotating it; " + std::to_string(lost)
+                + " lines were lost.").c_str());
+        }
+    }
+
+    if (file && fileSize > 0 && fileSize + buffer.size() > maxFileSize)
+        Rotate();
+
+    // With no file to write to (it couldn't be opened, or reopened after a
+    // rotation), the lines are dropped rather than kept piling up.
+    if (file) {
+        fwrite(buffer.data(), 1, buffer.size(), file);
+        fileSize += buffer.size();
+        if (flush)
+            fflush(file);
+    } else {
+        dropped.fetch_add(uint64_t(std::count(buffer.begin(), buffer.end(), '\n')), std::memory_order_relaxed);
+    }
+    buffer.clear();
+}
+
+
+// log -> log.1 -> log.2 ... -> log.<maxFiles>, which is deleted.
+// The log is moved aside first, so that if it can't be (a reader holds it
+// open on Windows), it and the older ones stay as they are; it then grows
+// past the limit, and the next write tries again.
+void TAsyncLogger::Rotate()
+{
+    fclose(file);
+
+    std::wstring moved = fileName + L".rotating";
+    RemoveFile(moved.c_str());
+    bool rotated = RenameFile(fileName.c_str(), moved.c_str());
+    if (rotated) {
+        std::wstring oldest = fileName + L"." + std::to_wstring(maxFiles);
+        RemoveFile(oldest.c_str());
+        for (int i = maxFiles - 1; i >= 1; i--) {
+            std::wstring from = fileName + L"." + std::to_wstring(i);
+            std::wstring to = fileName + L"." + std::to_wstring(i + 1);
+            RenameFile(from.c_str(), to.c_str());
+        }
+        if (maxFiles > 0)
+            RenameFile(moved.c_str(), (fileName + L".1").c_str());
+        else
+            RemoveFile(moved.c_str());
+        fileSize = 0;
+    } else if (!rotateFailed) {
+        ErrorLine("Could not rotate the log file; it grows past its size limit.");
+    }
+    rotateFailed = !rotated;
+
+    file = OpenFile(fileName.c_str(), "ab");
+    if (!file) {
+        lostFile = true;
+        droppedAtLoss = dropped.load(std::memory_order_relaxed);
+    }
+}
+
+
+// Goes before the lines in the buffer.
+void TAsyncLogger::ErrorLine(const char *text)
+{
+    buffer.insert(0, std::string(TimeStamp(time(NULL))) + text + "\n");
+}
+
+
+// Formatting the time is the expensive part of a log line, and most lines
+// are logged in bursts, so only format once per second.
+const char *TAsyncLogger::TimeStamp(time_t t)
+{
+    if (t != stampTime || stamp[0] == 0) {
+        tm tmStruct;
+#ifdef _WIN32
+        localtime_s(&tmStruct, &t);
+#else
+        localtime_r(&t, &tmStruct);
+#endif
+        strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S  ", &tmStruct);
+        stampTime = t;
+    }
+    return stamp;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// Logger that keeps file I/O off the calling thread.
+// Log() copies the text into a fixed-size record in a lock-free ring buffer
+// and returns. A writer thread formats the records, writes them in batches,
+// flushes when a batch is full or FlushInterval has passed, and rotates the
+// file when it grows beyond the size limit.
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Logger.h"
+
+
+class TAsyncLogger : public TLogger
+{
+public:
+    static const int      RecordTextLength = 120;           // Longer lines are truncated.
+    static const uint32_t RingSize = 1024;                  // Must be a power of two.
+    static const uint32_t BatchSize = 64;                   // Records that trigger a write.
+    static const int      FlushInterval = 500;              // ms
+    static const uint64_t DefaultMaxFileSize = 1 << 20;
+    static const int      DefaultMaxFiles = 3;              // Rotated files kept, besides the current one.
+
+    TAsyncLogger(const wchar_t *fName, uint64_t maxFileSize = DefaultMaxFileSize, int maxFiles = DefaultMaxFiles);
+    ~TAsyncLogger();
+
+    void Log(const wchar_t *text) override;
+
+    // The writer thread switches files after writing what was logged before.
+    void Reopen(const wchar_t *fName) override;
+
+    // Blocks until everything logged so far has been written to the file.
+    void Flush();
+
+    // Number of lines lost because the ring buffer was full, or there was no
+    // file to write them to.
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct TRecord
+    {
+        std::atomic<uint32_t> sequence;
+        time_t  time;
+        wchar_t text[RecordTextLength];
+    };
+
+    void WriterThread();
+    bool WriteBatch();
+    void WriteFile(bool flush);
+    void Rotate();
+    void ErrorLine(const char *text);
+    const char *TimeStamp(time_t t);
+
+    TRecord ring[RingSize];
+    std::atomic<uint32_t> enqueuePos{ 0 };
+    std::atomic<uint32_t> dequeuePos{ 0 };  // Only written by the writer thread.
+    std::atomic<uint64_t> dropped{ 0 };
+
+    std::mutex              mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable flushed;
+    std::atomic<bool>       stop{ false };
+    uint32_t                flushRequests = 0;
+    uint32_t                flushesDone = 0;
+    std::wstring            reopenName;     // Set until the writer thread has switched to it.
+
+    std::atomic<bool> opened{ false };  // Read by Log() on any thread.
+    std::wstring fileName;
+    FILE        *file = NULL;
+    uint64_t     fileSize = 0;
+    uint64_t     maxFileSize;
+    int          maxFiles;
+    bool         rotateFailed = false;  // Logged once until a rotation succeeds.
+    bool         lostFile = false;      // Not reopened after a rotation; retried on each write.
+    uint64_t     droppedAtLoss = 0;
+    std::string  buffer;        // Formatted text not yet written.
+
+    time_t       stampTime = 0;
+    char         stamp[32] = {};  // Cached formatting of stampTime.
+
+    std::thread  writer;        // Started last, when everything else is initialized.
+};
@@ -0,0 +1,151 @@
+#include "ControlServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Stats.h"
+
+
+bool TLineBuffer::Add(const char *data, size_t size)
+{
+    // Drop what has been taken before growing the buffer.
+    if (start > 0 && start == buffer.size()) {
+        buffer.clear();
+        start = 0;
+    } else if (start > MaxLine) {
+        buffer.erase(0, start);
+        start = 0;
+    }
+    buffer.append(data, size);
+    return buffer.size() - start <= MaxLine || buffer.find('\n', start) != std::string::npos;
+}
+
+
+bool TLineBuffer::NextLine(std::string &line)
+{
+    size_t end = buffer.find('\n', start);
+    if (end == std::string::npos)
+        return false;
+
+    size_t lineEnd = end > start && buffer[end - 1] == '\r' ? end - 1 : end;
+    line.assign(buffer, start, lineEnd - start);
+    start = end + 1;
+    return true;
+}
+
+
+std::string TControlServer::Handle(uint32_t client, const std::string &request, bool &settingsChanged)
+{
+    TStats::Add(SC_ControlRequests);
+    TStatScope scope(ST_ControlRequest);
+    settingsChanged = false;
+
+    size_t space = request.find(' ');
+    std::string command = request.substr(0, space);
+    std::string argument = space == std::string::npos ? std::string() : request.substr(space + 1);
+
+    if (command == "get") {
+        // Just the state.
+    } else if (command == "timeout") {
+        char *end;
+        long minutes = strtol(argument.c_str(), &end, 10);
+        if (argument.empty() || *end != 0 || minutes <= 0 || minutes > 24 * 60)
+            return "error timeout must be 1 to 1440 minutes";
+        Engine.SetTimeout(int(minutes) * 60000);
+        settingsChanged = true;
+    } else if (command == "warning") {
+        char *end;
+        long seconds = strtol(argument.c_str(), &end, 10);
+        if (argument.empty() || *end != 0 || seconds < 0 || seconds > 600)
+            return "error warning must be 0 to 600 seconds";
+        Engine.SetWarningTime(uint32_t(seconds) * 1000);
+        settingsChanged = true;
+    } else if (command == "enable" || command == "disable") {
+        Engine.Enable(command == "enable");
+        settingsChanged = true;
+    } else if (command == "screensaver") {
+        if (argument != "on" && argument != "off")
+            return "error screensaver must be on or off";
+        Engine.RequireScreensaver(argument == "on");
+        settingsChanged = true;
+    } else if (command == "subscribe") {
+        if (std::find(subscribers.begin(), subscribers.end(), client) == subscribers.end())
+            subscribers.push_back(client);
+    } else if (command == "unsubscribe") {
+        ClientClosed(client);
+    } else {
+        return "error unknown request";
+    }
+
+    uint32_t lockIn = Engine.Enabled() && !Engine.IsLocked() ? Engine.Scheduler().TimeUntilDeadline() : 0;
+    char buf[64];
+    snprintf(buf, sizeof buf, " locked=%d lockin=%u", Engine.IsLocked() ? 1 : 0, lockIn);
+    return "ok " + Settings() + buf;
+}
+
+
+void TControlServer::ClientClosed(uint32_t client)
+{
+    auto i = std::find(subscribers.begin(), subscribers.end(), client);
+    if (i != subscribers.end())
+        subscribers.erase(i);
+}
+
+
+void TControlServer::Publish()
+{
+    bool locked = Engine.IsLocked();
+    if (locked != publishedLocked) {
+        PushAll(locked ? "event lock\n" : "event unlock\n");
+        publishedLocked = locked;
+    }
+
+    // A warning that ends with the lock wasn't cancelled.
+    bool warning = Engine.Warning();
+    if (warning != publishedWarning) {
+        if (warning) {
+            char buf[40];
+            snprintf(buf, sizeof buf, "event warning %u\n", Engine.Scheduler().TimeUntilDeadline());
+            PushAll(buf);
+        } else if (!locked) {
+            PushAll("event warning cancelled\n");
+        }
+        publishedWarning = warning;
+    }
+
+    std::string settings = Settings();
+    if (settings != publishedSettings) {
+        PushAll("event settings " + settings + "\n");
+        publishedSettings = settings;
+    }
+
+    uint32_t deadline = 0;
+    bool deadlineValid = Engine.Enabled() && !locked && Engine.Scheduler().Deadline(deadline);
+    if (deadlineValid != publishedDeadlineValid || (deadlineValid && deadline != publishedDeadline)) {
+        char buf[40];
+        snprintf(buf, sizeof buf, "event countdown %u\n", deadlineValid ? Engine.Scheduler().TimeUntilDeadline() : 0);
+        PushAll(buf);
+        publishedDeadlineValid = deadlineValid;
+        publishedDeadline = deadline;
+    }
+}
+
+
+std::string TControlServer::Settings()
+{
+    char buf[80];
+    snprintf(buf, sizeof buf, "enabled=%d timeout=%d screensaver=%d warning=%u",
+        Engine.Enabled() ? 1 : 0, Engine.GetTimeout() / 60000, Engine.IsScreenSaverRequired() ? 1 : 0,
+        Engine.GetWarningTime() / 1000);
+    return buf;
+}
+
+
+void TControlServer::PushAll(const std::string &line)
+{
+    for (uint32_t client : subscribers) {
+        TStats::Add(SC_ControlEvents);
+        Push(client, line);
+    }
+}
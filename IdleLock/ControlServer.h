@@ -0,0 +1,93 @@
+#pragma once
+
+// Platform neutral part of the local control endpoint, through which scripts
+// and monitoring agents can read and change the settings, and subscribe to
+// lock, unlock, countdown and warning events. Requests and responses are
+// single lines:
+//
+//   get                  ok enabled=1 timeout=20 screensaver=0 warning=30 locked=0 lockin=512000
+//   timeout <minutes>    the same as get, after the change
+//   warning <seconds>    0 for no warning
+//   enable
+//   disable
+//   screensaver on|off
+//   subscribe            ok ..., followed by events as they happen:
+//                          event lock
+//                          event unlock
+//                          event countdown <ms>  (a new lock deadline; 0 = none)
+//                          event warning <ms>    (the lock warning has started)
+//                          event warning cancelled
+//                          event settings enabled=1 timeout=20 screensaver=0 warning=30
+//   unsubscribe
+//
+// Failed requests are answered with "error <message>". lockin is the time in
+// ms until a lock is due, 0 if that isn't known (disabled, locked, or waiting
+// for the screensaver). Answers come from the engine's in-memory state;
+// setting changes are persisted by the settings store in the background.
+// The transports (a named pipe on Windows, a Unix domain socket on Linux)
+// derive from TControlServer and call it on the thread that runs the engine.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "LockEngine.h"
+
+
+// Splits a byte stream into lines.
+class TLineBuffer
+{
+public:
+    static const size_t MaxLine = 1024;
+
+    // Returns false if the pending line has grown longer than MaxLine.
+    bool Add(const char *data, size_t size);
+
+    // Takes the next complete line, without the line end.
+    bool NextLine(std::string &line);
+
+private:
+    std::string buffer;
+    size_t start = 0;
+};
+
+
+class TControlServer
+{
+public:
+    TControlServer(TLockEngine &engine) : Engine(engine) {}
+    virtual ~TControlServer() {}
+
+    // Handles a request line from the given client and returns the response,
+    // without the line end. settingsChanged is set if a setting was changed,
+    // in which case the caller should check the idle timeout again.
+    std::string Handle(uint32_t client, const std::string &request, bool &settingsChanged);
+
+    // Forgets the client's subscription.
+    void ClientClosed(uint32_t client);
+
+    // Pushes events to the subscribers for what has changed since the last
+    // call. Call after every check, session event and settings change.
+    void Publish();
+
+    size_t Subscribers() const { return subscribers.size(); }
+
+protected:
+    // Sends a line, with its line end, to the client, without waiting.
+    virtual void Push(uint32_t client, const std::string &line) = 0;
+
+    TLockEngine &Engine;
+
+private:
+    std::string Settings();
+    void PushAll(const std::string &line);
+
+    std::vector<uint32_t> subscribers;
+
+    // What the subscribers have last been told.
+    bool        publishedLocked = false;
+    bool        publishedWarning = false;
+    std::string publishedSettings;
+    bool        publishedDeadlineValid = false;
+    uint32_t    publishedDeadline = 0;
+};
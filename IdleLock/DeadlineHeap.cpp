@@ -0,0 +1,92 @@
+#include "DeadlineHeap.h"
+
+
+void TDeadlineHeap::Set(uint32_t key, uint32_t deadline)
+{
+    auto it = index.find(key);
+    if (it == index.end()) {
+        heap.push_back(TEntry{ deadline, key });
+        index[key] = heap.size() - 1;
+        SiftUp(heap.size() - 1);
+        return;
+    }
+
+    size_t i = it->second;
+    bool earlier = Before(deadline, heap[i].deadline);
+    heap[i].deadline = deadline;
+    if (earlier)
+        SiftUp(i);
+    else
+        SiftDown(i);
+}
+
+
+bool TDeadlineHeap::Remove(uint32_t key)
+{
+    auto it = index.find(key);
+    if (it == index.end())
+        return false;
+
+    size_t i = it->second;
+    index.erase(it);
+
+    TEntry last = heap.back();
+    heap.pop_back();
+    if (i < heap.size()) {
+        // Put the last entry in the hole, and move it whichever way it belongs.
+        bool earlier = Before(last.deadline, heap[i].deadline);
+        Place(i, last);
+        if (earlier)
+            SiftUp(i);
+        else
+            SiftDown(i);
+    }
+    return true;
+}
+
+
+void TDeadlineHeap::Clear()
+{
+    heap.clear();
+    index.clear();
+}
+
+
+void TDeadlineHeap::SiftUp(size_t i)
+{
+    TEntry entry = heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!Before(entry.deadline, heap[parent].deadline))
+            break;
+        Place(i, heap[parent]);
+        i = parent;
+    }
+    Place(i, entry);
+}
+
+
+void TDeadlineHeap::SiftDown(size_t i)
+{
+    TEntry entry = heap[i];
+    size_t n = heap.size();
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && Before(heap[child + 1].deadline, heap[child].deadline))
+            child++;
+        if (!Before(heap[child].deadline, entry.deadline))
+            break;
+        Place(i, heap[child]);
+        i = child;
+    }
+    Place(i, entry);
+}
+
+
+void TDeadlineHeap::Place(size_t i, const TEntry &entry)
+{
+    heap[i] = entry;
+    index[entry.key] = i;
+}
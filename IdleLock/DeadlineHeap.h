@@ -0,0 +1,50 @@
+#pragma once
+
+// Indexed binary min-heap of deadlines, at most one per key.
+// Deadlines are tick counts that wrap around like GetTickCount(), so they are
+// ordered by their signed difference, which is correct as long as all of them
+// are within 24 days of each other. Setting, moving and removing a deadline
+// is O(log n); finding the earliest one is O(1).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+
+class TDeadlineHeap
+{
+public:
+    // Adds a deadline for key, or moves its existing one.
+    void Set(uint32_t key, uint32_t deadline);
+
+    // Returns false if key had no deadline.
+    bool Remove(uint32_t key);
+
+    bool Contains(uint32_t key) const { return index.count(key) != 0; }
+    bool Empty() const { return heap.empty(); }
+    size_t Size() const { return heap.size(); }
+
+    // The earliest deadline and its key. The heap must not be empty.
+    uint32_t TopKey() const { return heap[0].key; }
+    uint32_t TopDeadline() const { return heap[0].deadline; }
+
+    void Pop() { Remove(heap[0].key); }
+    void Clear();
+
+    static bool Before(uint32_t a, uint32_t b) { return int32_t(a - b) < 0; }
+
+private:
+    struct TEntry
+    {
+        uint32_t deadline;
+        uint32_t key;
+    };
+
+    void SiftUp(size_t i);
+    void SiftDown(size_t i);
+    void Place(size_t i, const TEntry &entry);
+
+    std::vector<TEntry> heap;
+    std::unordered_map<uint32_t, size_t> index;  // Key -> position in heap.
+};
@@ -0,0 +1,66 @@
+#include "EngineCheckpoint.h"
+
+#include <stddef.h>
+#include <string.h>
+
+
+bool TEngineCheckpoint::Open(const wchar_t *fName)
+{
+    Close();
+
+    if (!file.Open(fName, sizeof(TCheckpointFile)))
+        return false;
+    data = (TCheckpointFile *)file.Data();
+
+    if (memcmp(data->magic, CheckpointMagic, sizeof CheckpointMagic) != 0
+        || data->version != CheckpointVersion
+        || data->size != sizeof(TCheckpointFile)) {
+        memset(data, 0, sizeof(TCheckpointFile));
+        memcpy(data->magic, CheckpointMagic, sizeof CheckpointMagic);
+        data->version = CheckpointVersion;
+        data->size = sizeof(TCheckpointFile);
+    }
+
+    // Carry on from the last save, so that the next one goes to the other slot.
+    sequence = 0;
+    for (const TCheckpointSlot &slot : data->slots) {
+        if (slot.sequence > sequence && slot.checksum == Checksum(slot))
+            sequence = slot.sequence;
+    }
+    return true;
+}
+
+
+bool TEngineCheckpoint::Load(TCheckpointState &state) const
+{
+    if (data == NULL || sequence == 0)
+        return false;
+    state = data->slots[sequence % 2].state;
+    return true;
+}
+
+
+void TEngineCheckpoint::Save(const TCheckpointState &state)
+{
+    if (data == NULL)
+        return;
+
+    // The checksum goes last; until it matches, the slot doesn't count, and
+    // the other one still holds the last save.
+    TCheckpointSlot &slot = data->slots[++sequence % 2];
+    slot.state = state;
+    slot.sequence = sequence;
+    slot.checksum = Checksum(slot);
+}
+
+
+// FNV-1a; this only has to catch a save that was cut short.
+uint32_t TEngineCheckpoint::Checksum(const TCheckpointSlot &slot)
+{
+    const uint8_t *p = (const uint8_t *)&slot;
+    size_t n = offsetof(TCheckpointSlot, checksum);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
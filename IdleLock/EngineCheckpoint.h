@@ -0,0 +1,90 @@
+#pragma once
+
+// The part of the lock engine's state that a restart would otherwise lose:
+// whether the session is locked (and whether we locked it), when it was
+// unlocked, and at what idle time the screensaver was seen. The engine
+// saves it on every change, in a small memory-mapped file, and restores it
+// at startup once it has checked it against the tick count and the
+// session's lock state (see TLockEngine::SetCheckpoint()).
+// A save is a copy of 56 bytes into the mapping, with no system call; the
+// system writes the page back. The file has two slots, written in turns,
+// each with a sequence number and a checksum, so a save that was cut short
+// leaves the one before it to load. A crash of the process loses nothing;
+// a crash of the system can lose the last saves, which the checks at
+// startup then treat like any other stale state.
+// Bump CheckpointVersion on any change to the layout.
+
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+
+static const uint32_t CheckpointVersion = 1;
+static const char     CheckpointMagic[8] = { 'I', 'D', 'L', 'C', 'K', 'P', 'T', 0 };
+
+
+// Flags
+static const uint32_t CF_Locked = 0x01;
+static const uint32_t CF_IdleLocked = 0x02;          // Locked by the engine.
+static const uint32_t CF_UnlockedTickValid = 0x04;
+
+
+struct TCheckpointState
+{
+    int64_t  savedTime;            // The backend's LocalTime() at the save.
+    uint32_t savedTick;            // The tick count at the save.
+    uint32_t lastInputTick;        // At the save; a later one means there was input since.
+    uint32_t flags;                // CF_*
+    uint32_t unlockedTick;
+    uint32_t screenSaverActiveAt;  // The idle time at which the screensaver was seen; 0 if not.
+    uint32_t lockedTick;
+    uint32_t lockIdleTime;         // The idle time at the last lock request.
+    uint32_t reserved;
+};
+
+
+struct TCheckpointSlot
+{
+    uint64_t sequence;             // 0 for a slot never written.
+    TCheckpointState state;
+    uint32_t checksum;             // Of sequence and state.
+    uint32_t reserved;
+};
+
+
+struct TCheckpointFile
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint8_t  reserved[16];
+    TCheckpointSlot slots[2];
+};
+
+static_assert(sizeof(TCheckpointState) == 40, "Checkpoint state layout changed.");
+static_assert(sizeof(TCheckpointFile) == 32 + 2 * 56, "Checkpoint file layout changed.");
+
+
+class TEngineCheckpoint
+{
+public:
+    // Opens an existing checkpoint file or creates a new one. A file with
+    // another layout is started over.
+    bool Open(const wchar_t *fName);
+    void Close() { file.Close(); data = NULL; }
+
+    bool IsOpen() const { return data != NULL; }
+
+    // The last complete save. Returns false if there is none.
+    bool Load(TCheckpointState &state) const;
+
+    // Saves state in the slot not holding the last save.
+    void Save(const TCheckpointState &state);
+
+private:
+    static uint32_t Checksum(const TCheckpointSlot &slot);
+
+    TMappedFile file;
+    TCheckpointFile *data = NULL;
+    uint64_t sequence = 0;         // Of the last save.
+};
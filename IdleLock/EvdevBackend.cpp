@@ -0,0 +1,486 @@
+#include "EvdevBackend.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+
+TEvdevBackend::TEvdevBackend(const std::string &aInputPath, const std::string &aLockCommand)
+    : inputPath(aInputPath), lockCommand(aLockCommand)
+{
+    // No input seen yet; count from startup.
+    lastInputTick = TickCount();
+    SleptTime();
+    sessionFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+
+TEvdevBackend::~TEvdevBackend()
+{
+    Stop();
+    if (locker.joinable())
+        locker.join();
+    if (sessionFd >= 0)
+        close(sessionFd);
+}
+
+
+uint32_t TEvdevBackend::TickCount()
+{
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return uint32_t(uint64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+uint32_t TEvdevBackend::SleptTime()
+{
+    timespec boot, monotonic;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    int64_t offset = (int64_t(boot.tv_sec) - monotonic.tv_sec) * 1000 + (boot.tv_nsec - monotonic.tv_nsec) / 1000000;
+
+    // The two readings are a little apart, so small differences are noise.
+    uint64_t previous = sleepOffset;
+    sleepOffset = uint64_t(offset > 0 ? offset : 0);
+    return sleepOffset >= previous + 1000 ? uint32_t(sleepOffset - previous) : 0;
+}
+
+
+bool TEvdevBackend::Start()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd < 0 || stopFd < 0)
+        return false;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = stopFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &ev);
+
+    // Watched before the directory is read, so that no device plugged in
+    // between is missed; one seen twice is only opened once.
+    std::vector<std::string> paths;
+    DIR *dir = opendir(inputPath.c_str());
+    if (dir != NULL) {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, inputPath.c_str(), IN_CREATE | IN_ATTRIB) >= 0) {
+            ev.data.fd = inotifyFd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, inotifyFd, &ev);
+        }
+
+        while (dirent *entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "event", 5) == 0)
+                paths.push_back(inputPath + "/" + entry->d_name);
+        }
+        closedir(dir);
+    } else {
+        paths.push_back(inputPath);
+    }
+
+    for (const std::string &path : paths)
+        OpenDevice(path);
+
+    watcher = std::thread(&TEvdevBackend::WatchThread, this);
+    return !inputDevices.empty();
+}
+
+
+// Returns true if the device is watched (now or already).
+bool TEvdevBackend::OpenDevice(const std::string &path)
+{
+    for (const TInputDevice &device : inputDevices) {
+        if (device.path == path)
+            return true;
+    }
+
+    // A FIFO is opened for writing too, so that it stays open, rather than
+    // hang up, when its writer goes away.
+    struct stat st;
+    bool fifo = stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+    int fd = open(path.c_str(), (fifo ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        AddDevice(fd, path);
+        return true;
+    }
+    if (errno == EPERM) {
+        // A regular file can't be watched; take what's in it now.
+        AddDevice(fd, path);
+        ReadEvents(inputDevices.back());
+        inputDevices.pop_back();
+    }
+    close(fd);
+    return false;
+}
+
+
+void TEvdevBackend::Stop()
+{
+    if (watcher.joinable()) {
+        uint64_t one = 1;
+        if (write(stopFd, &one, sizeof one) == sizeof one)
+            watcher.join();
+        else
+            watcher.detach();
+    }
+
+    for (const TInputDevice &device : inputDevices)
+        close(device.fd);
+    inputDevices.clear();
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+    if (stopFd >= 0)
+        close(stopFd);
+    if (epollFd >= 0)
+        close(epollFd);
+    inotifyFd = stopFd = epollFd = -1;
+}
+
+
+void TEvdevBackend::WatchThread()
+{
+    epoll_event events[16];
+
+    for (;;) {
+        int n = epoll_wait(epollFd, events, 16, -1);
+        if (n < 0 && errno != EINTR)
+            return;
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == stopFd)
+                return;
+            if (events[i].data.fd == inotifyFd) {
+                DirectoryChanged();
+                continue;
+            }
+            // What is left to read comes first; a device that is gone
+            // would otherwise be reported again and again.
+            for (size_t j = 0; j < inputDevices.size(); j++) {
+                if (inputDevices[j].fd == events[i].data.fd) {
+                    if (!ReadEvents(inputDevices[j]) || (events[i].events & (EPOLLHUP | EPOLLERR)) != 0)
+                        RemoveDevice(j);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+void TEvdevBackend::RemoveDevice(size_t index)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, inputDevices[index].fd, NULL);
+    close(inputDevices[index].fd);
+    inputDevices.erase(inputDevices.begin() + index);
+}
+
+
+// A node is created before udev has given it its permissions, so a change
+// of attributes is a second chance to open it.
+void TEvdevBackend::DirectoryChanged()
+{
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        ssize_t bytes = read(inotifyFd, buf, sizeof buf);
+        if (bytes <= 0)
+            return;
+
+        for (ssize_t offset = 0; offset < bytes; ) {
+            const inotify_event *event = (const inotify_event *)(buf + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->len > 0 && strncmp(event->name, "event", 5) == 0)
+                OpenDevice(inputPath + "/" + event->name);
+        }
+    }
+}
+
+
+// The filter knows a device by its name and path, since either may be what
+// a rule names; FIFOs and files have no name.
+void TEvdevBackend::AddDevice(int fd, const std::string &path)
+{
+    TInputDevice device;
+    device.fd = fd;
+    device.id = 0;
+    device.path = path;
+    if (filter != NULL) {
+        char name[256] = "";
+        if (ioctl(fd, EVIOCGNAME(sizeof name - 1), name) < 0)
+            name[0] = 0;
+        device.id = filter->AddDevice(name[0] != 0 ? std::string(name) + " " + path : path);
+    }
+    inputDevices.push_back(device);
+}
+
+
+// Reads all pending events from the device. Only key, button, motion and
+// touch events count as input; sync and misc events don't. With a filter,
+// each batch read goes through it, by the events' own timestamps.
+// Returns false if the device is gone: unplugged (ENODEV), or at its end.
+bool TEvdevBackend::ReadEvents(TInputDevice &device)
+{
+    bool gone = false;
+
+    input_event events[64];
+    TInputEvent filtered[64];
+    bool active = false;
+    uint64_t count = 0;
+
+    for (;;) {
+        // A device reads whole records, but a FIFO may have only part of
+        // one; it is kept, and goes before what is read next.
+        char *data = (char *)events;
+        memcpy(data, device.partial.data(), device.partial.size());
+        ssize_t bytes = read(device.fd, data + device.partial.size(), sizeof events - device.partial.size());
+        if (bytes <= 0) {
+            gone = bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EINTR);
+            break;
+        }
+
+        size_t total = device.partial.size() + size_t(bytes);
+        size_t n = total / sizeof(input_event);
+        device.partial.assign(data + n * sizeof(input_event), total % sizeof(input_event));
+        if (n == 0)
+            continue;
+        if (filter == NULL) {
+            for (size_t i = 0; i < n; i++) {
+                if (events[i].type == EV_KEY || events[i].type == EV_REL || events[i].type == EV_ABS) {
+                    active = true;
+                    count++;
+                }
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            filtered[i] = Translate(device, events[i]);
+        uint64_t accepted = filter->Accepted();
+        if (filter->Process(filtered, n)) {
+            active = true;
+            count += filter->Accepted() - accepted;
+        }
+    }
+
+    if (active) {
+        lastInputTick.store(TickCount(), std::memory_order_relaxed);
+        inputEvents.fetch_add(count, std::memory_order_relaxed);
+    }
+    return !gone;
+}
+
+
+// Touchpads and tablets report absolute positions, which become moves from
+// the previous one; a new touch starts over, rather than jump.
+TInputEvent TEvdevBackend::Translate(TInputDevice &device, const input_event &event)
+{
+    TInputEvent result;
+    result.time = uint32_t(uint64_t(event.input_event_sec) * 1000 + event.input_event_usec / 1000);
+    result.device = device.id;
+    result.kind = IK_Other;
+    result.dx = result.dy = 0;
+
+    switch (event.type) {
+    case EV_KEY:
+        if (event.code == BTN_TOUCH && event.value == 0)
+            device.absXValid = device.absYValid = false;
+        if (event.value == 2)
+            result.kind = IK_KeyRepeat;
+        else if (event.value == 1)
+            result.kind = event.code >= BTN_MISC && event.code < KEY_OK ? IK_Button : IK_Key;
+        break;
+
+    case EV_REL:
+        result.kind = event.code == REL_X || event.code == REL_Y ? IK_Move : IK_Wheel;
+        if (event.code == REL_X)
+            result.dx = event.value;
+        else if (event.code == REL_Y)
+            result.dy = event.value;
+        break;
+
+    case EV_ABS:
+        if (event.code != ABS_X && event.code != ABS_Y)
+            break;
+        result.kind = IK_Move;
+        if (event.code == ABS_X) {
+            result.dx = device.absXValid ? event.value - device.absX : 0;
+            device.absX = event.value;
+            device.absXValid = true;
+        } else {
+            result.dy = device.absYValid ? event.value - device.absY : 0;
+            device.absY = event.value;
+            device.absYValid = true;
+        }
+        break;
+    }
+    return result;
+}
+
+
+bool TEvdevBackend::LockSession()
+{
+    if (lockCommand.empty() || locking.exchange(true))
+        return false;
+
+    if (locker.joinable())
+        locker.join();
+    locker = std::thread(&TEvdevBackend::LockThread, this);
+    return true;
+}
+
+
+// Runs the lock command and reports the session as locked until it exits.
+void TEvdevBackend::LockThread()
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", lockCommand.c_str(), (char *)NULL);
+        _exit(127);
+    }
+
+    if (pid > 0) {
+        QueueSessionEvent(true);
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+
+        QueueSessionEvent(false);
+    }
+
+    locking = false;
+}
+
+
+void TEvdevBackend::QueueSessionEvent(bool locked)
+{
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        sessionEvents.push_back(locked);
+    }
+    uint64_t one = 1;
+    if (write(sessionFd, &one, sizeof one) != sizeof one)
+        return;
+}
+
+
+void TEvdevBackend::DispatchSessionEvents()
+{
+    uint64_t count;
+    if (read(sessionFd, &count, sizeof count) < 0 && errno != EAGAIN)
+        return;
+
+    std::vector<bool> events;
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        events.swap(sessionEvents);
+    }
+
+    for (bool locked : events) {
+        if (sink == NULL)
+            break;
+        if (locked)
+            sink->SessionLocked();
+        else
+            sink->SessionUnlocked();
+    }
+}
+
+
+void TEvdevBackend::StartSessionEvents(TSessionEventSink &aSink)
+{
+    sink = &aSink;
+}
+
+
+void TEvdevBackend::StopSessionEvents()
+{
+    sink = NULL;
+}
+
+
+static bool ReadSysfsLine(const std::string &path, std::string &line)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+
+    char buf[64];
+    bool ok = fgets(buf, sizeof buf, f) != NULL;
+    fclose(f);
+    if (ok) {
+        line = buf;
+        while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+            line.pop_back();
+    }
+    return ok;
+}
+
+
+// On AC if any mains supply is online; unknown without a mains supply
+// (e.g. a desktop that reports none).
+TPowerSource TEvdevBackend::PowerSource()
+{
+    const char *dirName = "/sys/class/power_supply";
+    DIR *dir = opendir(dirName);
+    if (dir == NULL)
+        return PS_Unknown;
+
+    TPowerSource power = PS_Unknown;
+    while (dirent *entry = readdir(dir)) {
+        std::string base = std::string(dirName) + "/" + entry->d_name;
+        std::string type, online;
+        if (entry->d_name[0] == '.' || !ReadSysfsLine(base + "/type", type) || type != "Mains")
+            continue;
+        if (ReadSysfsLine(base + "/online", online) && online == "1") {
+            power = PS_AC;
+            break;
+        }
+        power = PS_Battery;
+    }
+
+    closedir(dir);
+    return power;
+}
+
+
+TDockState TEvdevBackend::DockState()
+{
+    const char *dirName = "/sys/devices/platform";
+    DIR *dir = opendir(dirName);
+    if (dir == NULL)
+        return DS_Unknown;
+
+    TDockState dock = DS_Unknown;
+    while (dirent *entry = readdir(dir)) {
+        std::string docked;
+        if (strncmp(entry->d_name, "dock.", 5) != 0
+            || !ReadSysfsLine(std::string(dirName) + "/" + entry->d_name + "/docked", docked))
+            continue;
+        if (docked == "1") {
+            dock = DS_Docked;
+            break;
+        }
+        dock = DS_Undocked;
+    }
+
+    closedir(dir);
+    return dock;
+}
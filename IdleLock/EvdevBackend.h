@@ -0,0 +1,123 @@
+#pragma once
+
+// Linux backend. The last input time comes from evdev devices
+// (/dev/input/event*), which are watched with epoll on a background thread,
+// so no polling is involved. Anything that produces evdev records can stand
+// in for the devices, e.g. a FIFO fed with recorded or synthetic events.
+// Locking runs a configurable command. The session counts as locked while
+// the command runs, so use a locker that stays in the foreground until the
+// session is unlocked (e.g. "i3lock -n" or "swaylock").
+// Session events are queued and delivered to the sink on the thread that
+// calls DispatchSessionEvents(), when SessionEventFd() becomes readable,
+// like window messages are on Windows.
+// The tick count is CLOCK_BOOTTIME, which, like GetTickCount() on Windows,
+// keeps counting while the system is suspended.
+// With an input filter (see InputFilter.h), only the events it lets through
+// count; it runs on the watch thread, on each batch read from a device.
+// When inputPath is a directory, it is watched with inotify, so that devices
+// plugged in later are watched too; a device that goes away (unplugged, or
+// a file at its end) is dropped.
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "InputFilter.h"
+#include "PlatformBackend.h"
+
+struct input_event;
+
+
+class TEvdevBackend : public TPlatformBackend
+{
+public:
+    // inputPath is a directory whose event* entries are watched, or a single
+    // evdev device, FIFO or file.
+    TEvdevBackend(const std::string &inputPath, const std::string &lockCommand);
+    ~TEvdevBackend();
+
+    // Applies filter, which must outlive the backend, to the devices opened
+    // by Start(); call before it.
+    void SetInputFilter(TInputFilter *aFilter) { filter = aFilter; }
+
+    // Opens the input devices and starts watching them, and the directory
+    // for new ones.
+    bool Start();
+    void Stop();
+
+    uint32_t TickCount() override;
+    uint32_t LastInputTick() override { return lastInputTick.load(std::memory_order_relaxed); }
+    bool ScreenSaverRunning() override { return false; }
+    bool LockSession() override;
+    void StartSessionEvents(TSessionEventSink &aSink) override;
+    void StopSessionEvents() override;
+    // Locked while our lock command runs. One started before a restart
+    // can't be waited for, so the session then counts as unlocked.
+    TSessionState SessionState() override { return locking.load() ? SS_Locked : SS_Unlocked; }
+
+    // From /sys; there are no calls for these.
+    TPowerSource PowerSource() override;
+    TDockState DockState() override;
+
+    int  SessionEventFd() const { return sessionFd; }
+    void DispatchSessionEvents();
+
+    // The ms the system has been suspended since the last call, 0 if less
+    // than a second, from the
+    // difference between CLOCK_BOOTTIME and CLOCK_MONOTONIC, which doesn't
+    // count the suspend. Linux doesn't announce a suspend to an unprivileged
+    // process without D-Bus, so this is how a resume is noticed.
+    uint32_t SleptTime();
+
+    // Number of input events counted as user activity so far.
+    uint64_t InputEvents() const { return inputEvents.load(std::memory_order_relaxed); }
+
+    // What the filter gets for an evdev event of the device; public for
+    // replaying recorded events (Tools/InputReplay.cpp).
+    struct TInputDevice
+    {
+        int      fd;
+        uint16_t id;            // The filter's.
+        std::string path;
+        std::string partial;    // The start of a record cut off by the last read (FIFOs).
+        bool     absXValid = false;
+        bool     absYValid = false;
+        int32_t  absX = 0;      // Last absolute position, to make moves of.
+        int32_t  absY = 0;
+    };
+
+    static TInputEvent Translate(TInputDevice &device, const input_event &event);
+
+private:
+    void WatchThread();
+    bool OpenDevice(const std::string &path);
+    void AddDevice(int fd, const std::string &path);
+    void RemoveDevice(size_t index);
+    void DirectoryChanged();
+    bool ReadEvents(TInputDevice &device);
+    void LockThread();
+    void QueueSessionEvent(bool locked);
+
+    std::string inputPath;
+    std::string lockCommand;
+    std::vector<TInputDevice> inputDevices;  // Only touched by the watch thread while it runs.
+    TInputFilter *filter = NULL;
+    int epollFd = -1;
+    int stopFd = -1;          // eventfd that ends the watch thread.
+    int inotifyFd = -1;       // Watches inputPath, if a directory, for new devices.
+    int sessionFd = -1;       // eventfd signalled when session events are queued.
+    std::thread watcher;
+    std::thread locker;
+
+    uint64_t sleepOffset = 0; // CLOCK_BOOTTIME - CLOCK_MONOTONIC in ms, as of the last SleptTime().
+
+    std::atomic<uint32_t> lastInputTick;
+    std::atomic<uint64_t> inputEvents{ 0 };
+    std::atomic<bool>     locking{ false };
+
+    std::mutex sessionMutex;
+    std::vector<bool> sessionEvents;  // Queued; true for locked, false for unlocked.
+    TSessionEventSink *sink = NULL;
+};
@@ -0,0 +1,49 @@
+#include "EventJournal.h"
+
+#include <string.h>
+#include <chrono>
+
+
+bool TEventJournal::Open(const wchar_t *fName, uint32_t capacity)
+{
+    Close();
+
+    if (!file.Open(fName, sizeof(TJournalHeader) + size_t(capacity) * sizeof(TJournalRecord)))
+        return false;
+
+    header = (TJournalHeader *)file.Data();
+    records = (TJournalRecord *)(file.Data() + sizeof(TJournalHeader));
+
+    if (memcmp(header->magic, JournalMagic, sizeof JournalMagic) != 0
+        || header->version != JournalVersion
+        || header->headerSize != sizeof(TJournalHeader)
+        || header->recordSize != sizeof(TJournalRecord)
+        || header->capacity != capacity) {
+        memset(header, 0, sizeof(TJournalHeader));
+        memcpy(header->magic, JournalMagic, sizeof JournalMagic);
+        header->version = JournalVersion;
+        header->headerSize = sizeof(TJournalHeader);
+        header->recordSize = sizeof(TJournalRecord);
+        header->capacity = capacity;
+        header->createdTime = TimeNow();
+    }
+    return true;
+}
+
+
+void TEventJournal::Append(TJournalRecord &record)
+{
+    if (!header)
+        return;
+
+    record.time = TimeNow();
+    records[header->writeCount % header->capacity] = record;
+    header->writeCount++;
+}
+
+
+int64_t TEventJournal::TimeNow()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
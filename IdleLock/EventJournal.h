@@ -0,0 +1,117 @@
+#pragma once
+
+// Compact binary journal of the lock engine's decision inputs and outputs.
+// The journal is a pre-sized, memory-mapped file: a header followed by a
+// ring of fixed-width records. Appending a record is a plain memory write.
+// When the ring is full, the oldest records are overwritten; writeCount in
+// the header tells readers where the ring starts.
+// The layout is shared with the offline decoder in Tools/JournalDecode.cpp,
+// so bump JournalVersion on any change to it.
+
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+
+static const uint32_t JournalVersion = 1;
+static const char     JournalMagic[8] = { 'I', 'D', 'L', 'J', 'R', 'N', 'L', 0 };
+
+
+enum TJournalEvent : uint8_t
+{
+    JE_Started = 1,
+    JE_Stopped,
+    JE_Check,               // LockIfIdleTimeout() ran; value = ms to next check.
+    JE_LockRequested,       // LockWorkStation() called; value = lock latency in ms.
+    JE_SessionLocked,       // WTS lock notification.
+    JE_SessionUnlocked,     // WTS unlock notification.
+    JE_ScreenSaverStarted,
+    JE_ScreenSaverCleared,  // Input seen after the screensaver started.
+    JE_SettingsChanged,
+    JE_DisplayOff,          // Counts as the screensaver having started.
+    JE_WarningStarted,      // value = ms until the lock.
+    JE_WarningCancelled,    // Input or a settings change before the lock.
+    JE_Suspended,
+    JE_Resumed,
+    JE_FalseLock,           // An idle lock undone within seconds; value = ms locked.
+    JE_TimeoutAdapted,      // value = the adaptive timeout in ms.
+    JE_Inhibited,           // A lock was due, but held off; value = mask of the inhibitors.
+    JE_InhibitionEnded,     // The idle time counts from the last inhibitor's end.
+    JE_ActionDone,          // A timeout action succeeded; value = ms it took.
+    JE_ActionFailed,        // A timeout action failed or timed out; value = ms it took.
+    JE_ActionsCancelled,    // Input or an unlock while the timeout actions ran.
+    JE_Restored,            // State taken over from the checkpoint; value = its age in ms.
+    JE_EventCount
+};
+
+
+enum TLockReason : uint8_t
+{
+    LR_None = 0,
+    LR_IdleTimeout,              // Idle time reached the timeout.
+    LR_IdleTimeoutScreenSaver,   // Ditto, and the required screensaver was seen.
+    LR_ReasonCount
+};
+
+
+// Flags
+static const uint8_t JF_Locked = 0x01;
+static const uint8_t JF_Enabled = 0x02;
+static const uint8_t JF_RequireScreenSaver = 0x04;
+
+
+struct TJournalHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t capacity;        // Number of records in the ring.
+    uint64_t writeCount;      // Records written since the journal was created.
+    int64_t  createdTime;     // ms since 1970-01-01 UTC.
+    uint8_t  reserved[24];
+};
+
+
+struct TJournalRecord
+{
+    int64_t  time;                  // ms since 1970-01-01 UTC.
+    uint32_t tick;                  // Tick count (GetTickCount()).
+    uint32_t idleTime;              // ms
+    uint32_t screenSaverActiveAt;   // Idle time at which the screensaver was seen, 0 if not.
+    uint32_t idleTimeout;           // ms
+    uint8_t  event;                 // TJournalEvent
+    uint8_t  flags;                 // JF_*
+    uint8_t  reason;                // TLockReason
+    uint8_t  reserved;
+    uint32_t value;                 // Depends on event.
+};
+
+static_assert(sizeof(TJournalHeader) == 64, "Journal header layout changed.");
+static_assert(sizeof(TJournalRecord) == 32, "Journal record layout changed.");
+
+
+class TEventJournal
+{
+public:
+    static const uint32_t DefaultCapacity = 1 << 16;  // 2 MB
+
+    // Opens an existing journal or creates a new one. An existing journal
+    // with another layout or capacity is started over.
+    bool Open(const wchar_t *fName, uint32_t capacity = DefaultCapacity);
+    void Close() { file.Close(); header = NULL; records = NULL; }
+
+    bool IsOpen() const { return header != NULL; }
+
+    // Fills in time and appends the record.
+    void Append(TJournalRecord &record);
+
+    uint64_t WriteCount() const { return header ? header->writeCount : 0; }
+
+    static int64_t TimeNow();
+
+private:
+    TMappedFile     file;
+    TJournalHeader *header = NULL;
+    TJournalRecord *records = NULL;
+};
@@ -0,0 +1,117 @@
+#include "FileSettingsStore.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+
+TFileSettingsStore::TFileSettingsStore(const std::string &aFileName) : fileName(aFileName)
+{
+    // Watch the directory rather than the file, so that replacing the file
+    // (as editors and Save() do) is seen too.
+    size_t slash = fileName.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : fileName.substr(0, slash + 1);
+    baseName = slash == std::string::npos ? fileName : fileName.substr(slash + 1);
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0)
+        inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+
+TFileSettingsStore::~TFileSettingsStore()
+{
+    Stop();
+
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+    if (wakeFd >= 0)
+        close(wakeFd);
+}
+
+
+bool TFileSettingsStore::Load(TSettings &stored)
+{
+    FILE *f = fopen(fileName.c_str(), "r");
+    if (f == NULL)
+        return false;
+
+    char line[128];
+    char name[64];
+    long value;
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (sscanf(line, " %63[^= ] = %ld", name, &value) != 2)
+            continue;
+
+        if (strcmp(name, "LockTimeout") == 0)
+            stored.lockTimeout = (int)value;
+        else if (strcmp(name, "RequireScreenSaver") == 0)
+            stored.requireScreenSaver = value != 0;
+        else if (strcmp(name, "Enabled") == 0)
+            stored.enabled = value != 0;
+    }
+
+    fclose(f);
+    return true;
+}
+
+
+// The file is small, so it is always written as a whole, atomically.
+bool TFileSettingsStore::Save(const TSettings &stored, unsigned)
+{
+    std::string tempName = fileName + ".tmp";
+    FILE *f = fopen(tempName.c_str(), "w");
+    if (f == NULL)
+        return false;
+
+    fprintf(f, "LockTimeout=%d\nRequireScreenSaver=%d\nEnabled=%d\n",
+        stored.lockTimeout, stored.requireScreenSaver ? 1 : 0, stored.enabled ? 1 : 0);
+
+    bool ok = fclose(f) == 0;
+    return ok && rename(tempName.c_str(), fileName.c_str()) == 0;
+}
+
+
+TSettingsStore::TWaitResult TFileSettingsStore::Wait(int timeout)
+{
+    pollfd fds[2] = { { wakeFd, POLLIN, 0 }, { inotifyFd, POLLIN, 0 } };
+
+    if (poll(fds, 2, timeout) <= 0)
+        return WR_Timeout;
+
+    if (fds[0].revents & POLLIN) {
+        uint64_t count;
+        if (read(wakeFd, &count, sizeof count) < 0 && errno != EAGAIN)
+            return WR_Timeout;
+        return WR_Woken;
+    }
+
+    // Only changes to our file count.
+    bool changed = false;
+    alignas(inotify_event) char buf[4096];
+    ssize_t len;
+    while ((len = read(inotifyFd, buf, sizeof buf)) > 0) {
+        for (char *p = buf; p < buf + len; ) {
+            inotify_event *event = (inotify_event *)p;
+            if (event->len > 0 && baseName == event->name)
+                changed = true;
+            p += sizeof(inotify_event) + event->len;
+        }
+    }
+    return changed ? WR_Changed : WR_Woken;
+}
+
+
+void TFileSettingsStore::Wake()
+{
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof one) != sizeof one)
+        return;
+}
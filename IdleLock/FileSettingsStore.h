@@ -0,0 +1,29 @@
+#pragma once
+
+// Settings stored in a text file of name=value lines, using the same names
+// as the registry values. Changes to the file are picked up through
+// inotify, so this store is Linux only.
+
+#include <string>
+
+#include "SettingsStore.h"
+
+
+class TFileSettingsStore : public TSettingsStore
+{
+public:
+    TFileSettingsStore(const std::string &fileName);
+    ~TFileSettingsStore();
+
+protected:
+    bool Load(TSettings &stored) override;
+    bool Save(const TSettings &stored, unsigned fields) override;
+    TWaitResult Wait(int timeout) override;
+    void Wake() override;
+
+private:
+    std::string fileName;
+    std::string baseName;
+    int inotifyFd = -1;
+    int wakeFd = -1;
+};
@@ -0,0 +1,76 @@
+#include "IconRaster.h"
+
+#include <math.h>
+
+
+static const double Pi = 3.14159265358979323846;
+static const int SubSamples = 4;  // Per axis, for anti-aliasing.
+
+
+void TIconRaster::DrawCountdownRing(TIconImage &image, double fraction, uint32_t color)
+{
+    if (fraction <= 0 || image.size <= 0)
+        return;
+
+    double center = image.size / 2.;
+    double outer = center;
+    double inner = center - (image.size >= 32 ? image.size / 8. : 2.);
+    double maxAngle = (fraction >= 1 ? 1 : fraction) * 2 * Pi;
+
+    for (int y = 0; y < image.size; y++) {
+        for (int x = 0; x < image.size; x++) {
+            int hits = 0;
+
+            for (int sy = 0; sy < SubSamples; sy++) {
+                for (int sx = 0; sx < SubSamples; sx++) {
+                    double dx = x + (sx + .5) / SubSamples - center;
+                    double dy = y + (sy + .5) / SubSamples - center;
+                    double r = sqrt(dx * dx + dy * dy);
+                    if (r < inner || r > outer)
+                        continue;
+
+                    // Clockwise from 12 o'clock; y grows downwards.
+                    double angle = atan2(dx, -dy);
+                    if (angle < 0)
+                        angle += 2 * Pi;
+                    if (angle <= maxAngle)
+                        hits++;
+                }
+            }
+
+            if (hits != 0) {
+                uint32_t &pixel = image.pixels[size_t(y) * image.size + x];
+                pixel = Blend(pixel, color, double(hits) / (SubSamples * SubSamples));
+            }
+        }
+    }
+}
+
+
+std::vector<TIconImage> TIconRaster::RenderCountdownFrames(const TIconImage &base, int frameCount)
+{
+    std::vector<TIconImage> frames(frameCount, base);
+    for (int i = 0; i < frameCount; i++)
+        DrawCountdownRing(frames[i], double(i + 1) / frameCount);
+    return frames;
+}
+
+
+// "Over" compositing with straight (non-premultiplied) alpha.
+uint32_t TIconRaster::Blend(uint32_t pixel, uint32_t color, double coverage)
+{
+    double srcA = ((color >> 24) & 0xFF) / 255. * coverage;
+    double dstA = ((pixel >> 24) & 0xFF) / 255.;
+    double outA = srcA + dstA * (1 - srcA);
+    if (outA <= 0)
+        return 0;
+
+    uint32_t result = uint32_t(outA * 255 + .5) << 24;
+    for (int shift = 0; shift <= 16; shift += 8) {
+        double src = ((color >> shift) & 0xFF);
+        double dst = ((pixel >> shift) & 0xFF);
+        double out = (src * srcA + dst * dstA * (1 - srcA)) / outA;
+        result |= uint32_t(out + .5) << shift;
+    }
+    return result;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Platform neutral rasterization of tray icon images.
+// Images are square, 32 bits per pixel, 0xAARRGGBB (straight alpha), top row
+// first, which is also the layout of a top-down 32 bpp Windows DIB.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+struct TIconImage
+{
+    int size = 0;
+    std::vector<uint32_t> pixels;
+
+    TIconImage() {}
+    TIconImage(int aSize) : size(aSize), pixels(size_t(aSize) * aSize, 0) {}
+};
+
+
+class TIconRaster
+{
+public:
+    static const uint32_t RingColor = 0xFFFFB000;
+
+    // Draws a ring along the edge of the image, starting at 12 o'clock and
+    // going clockwise, covering fraction (0..1) of the full circle.
+    // The ring is anti-aliased and blended over the image.
+    static void DrawCountdownRing(TIconImage &image, double fraction, uint32_t color = RingColor);
+
+    // Renders frameCount images of base with a countdown ring. Frame i shows
+    // (i + 1) / frameCount of the ring, so the last frame has a full ring.
+    static std::vector<TIconImage> RenderCountdownFrames(const TIconImage &base, int frameCount);
+
+    // Blends color with the given coverage (0..1) over pixel.
+    static uint32_t Blend(uint32_t pixel, uint32_t color, double coverage);
+};
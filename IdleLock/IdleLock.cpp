@@ -1,27 +1,76 @@
 // IdleLock.cpp
 // Locks the workstation after a specified amount of idle time.
 // The user selects the time by clicking the tray icon. 
-// If "Only lock if screensaver is active" is selected,
-// the screensaver timeout must be shorter than the "Turn off display"
-// timeout. Otherwise, the system (Vista and later) will never report that
-// the screensaver has been activated, and according to Stackoverflow.com
-// it's not possible to reliably detect that the monitor has been turned off
-// by the system.
+// If "Only lock if screensaver is active" is selected, the display being
+// turned off by the system also counts as the screensaver being active, since
+// the system (Vista and later) will then never report that the screensaver
+// has been activated. Both are taken from notifications rather than polled
+// for; see TWin32Backend::StartDisplayEvents().
+// With -warning <seconds>, a notification is shown that long before a lock,
+// and the tray icon counts down the seconds; input cancels it.
+// With -activity <file>, the minutes with input, and locks and unlocks, are
+// recorded in the file (see ActivityLog.h).
+// With -checkpoint <file>, whether the session is locked, when it was
+// unlocked and whether the screensaver was seen are kept in the file, on
+// every change, and a restart carries on from there (see EngineCheckpoint.h).
+// With -adaptive <minutes>, the timeout is raised, up to that many minutes,
+// while too many locks are undone within seconds (see AdaptiveTimeout.h).
+// With -inhibit power,fullscreen,<program>.exe,..., no lock comes while a
+// program asks for the display to stay on, the foreground window is full
+// screen, or one of the programs runs (see InhibitorSet.h); the idle time
+// then counts from when that was seen to end.
+// With -inputfilter, only keyboard and mouse input that looks like a user's
+// counts, so that mouse jitter or a mouse jiggler doesn't keep the session
+// unlocked; -inputrules <file> gives rules by device instead of the
+// defaults (see InputFilter.h and Win32RawInput.h).
+// With -action <kind>[:<seconds>], given once or more, the actions are taken
+// in that order instead of only locking when the timeout expires, on a
+// thread of their own (see ActionPipeline.h): lock, disconnect, logoff,
+// sleep, signal (a broadcast for kiosk programs), or run <command>. The
+// seconds are the action's timeout; input cancels what is left of them.
+// With -headless, there is no tray icon or menu, and the window is a
+// message-only window; settings come from the registry and -control.
+// Only one instance runs per session: a later launch hands its command line
+// to it and exits (see SingleInstance.h). With -status, a later launch
+// prints the running instance's state, from shared memory, and exits.
 //
 
 
 #include "stdafx.h"
 #include "wtsapi32.h"
+#include <dbt.h>
+#include <mmsystem.h>
 #include "AboutBox.h"
 #include "IdleLock.h"
 
+#include "AsyncLogger.h"
 #include "Logger.h"
+#include "PipeControlServer.h"
+#include "ProcessInhibitor.h"
+#include "RegistrySettingsStore.h"
+#include "SessionMonitor.h"
+#include "SingleInstance.h"
+#include "Stats.h"
+#include "TextUtil.h"
+#include "TimeoutActions.h"
+#include "TrayIconCache.h"
+#include "Win32Actions.h"
+#include "Win32Backend.h"
+#include "Win32Inhibitors.h"
 #include "WorkStationLocker.h"
+#include "WtsSessionBackend.h"
 
 // -----------------------------------------------------------------------------
 
-static const int CheckTimeoutInterval = 30000;  // How often we check to see if it's time to lock.
+static const wchar_t *AppRegKeyName = L"Software\\Wezeku\\IdleLock";
+static const int CheckTimeoutTimerId = 1;
+static const wchar_t *ServiceWindowClass = L"IdleLockService";
 static const int TrayIconUId = 100;
+static const uint32_t TrayCountdownTime = 60000;  // The tray icon counts down the last minute before a lock.
+
+// GUID_ACDC_POWER_SOURCE, defined here for the same reason as the GUIDs in
+// Win32Backend.cpp.
+static const GUID PowerSourceGuid = { 0x5d3e9a59, 0xe9d5, 0x4b00, { 0xa6, 0xbd, 0xff, 0x34, 0xff, 0x51, 0x65, 0x48 } };
 
 // -----------------------------------------------------------------------------
 // Win32 API bare metal stuff.
@@ -29,23 +78,63 @@ static const int TrayIconUId = 100;
 
 #define MAX_LOADSTRING 100
 #define WM_USER_SHELLICON WM_USER + 1
+#define WM_USER_SETTINGSCHANGED WM_USER + 2
+#define WM_USER_DUMPSTATS WM_USER + 3
+#define WM_USER_DISPLAYEVENT WM_USER + 4
+#define WM_USER_CONTROL WM_USER + 5
+#define WM_USER_ACTIONS WM_USER + 6
+#ifndef WM_DPICHANGED
+#define WM_DPICHANGED 0x02E0
+#endif
+#ifndef TIMERV_NO_COALESCING
+#define TIMERV_NO_COALESCING 0xFFFFFFFF
+#endif
+
+// Windows 8 and later, so looked up at run time.
+typedef UINT_PTR (WINAPI *TSetCoalescableTimer)(HWND, UINT_PTR, UINT, TIMERPROC, ULONG);
+typedef HPOWERNOTIFY (WINAPI *TRegisterSuspendResumeNotification)(HANDLE, DWORD);
+typedef BOOL (WINAPI *TUnregisterSuspendResumeNotification)(HPOWERNOTIFY);
 
 NOTIFYICONDATA      nidApp;
 TCHAR               szAppTitle[MAX_LOADSTRING];
 TCHAR               szWindowClass[MAX_LOADSTRING];
 HMENU               hPopMenu = NULL;
 HINSTANCE           hInstance = NULL;
+TWin32Backend      *Backend = NULL;
 TWorkStationLocker *WorkStationLocker = NULL;
 TLogger            *Logger = NULL;
+TWtsSessionBackend *SessionBackend = NULL;
+TSessionMonitor    *SessionMonitor = NULL;
+TPipeControlServer *ControlServer = NULL;
+TSingleInstance    *Instance = NULL;
+const wchar_t      *StatsFileName = NULL;
+bool                WarningShown = false;
+bool                Headless = false;
 double              IconScaling;
+TTrayIconCache      TrayIcons;
 
 ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
 HMENU               CreateIdleLockMenu();
+HPOWERNOTIFY        RegisterSuspendResume(HWND hWnd);
+void                UnregisterSuspendResume(HPOWERNOTIFY notify);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
+LRESULT CALLBACK    ServiceWndProc(HWND, UINT, WPARAM, LPARAM);
+int                 RunSessionService(HINSTANCE hInstance, int timeout);
+void                CheckSessions(HWND hWnd);
+void                SetCheckTimer(HWND hWnd, DWORD delay, ULONG tolerance);
 double              GetIconScaling(HWND hWnd);
 void                UpdateTrayIcon(TWorkStationLocker &workStationLocker);
-HICON               LoadTrayIcon(HINSTANCE hInstance, int resourceId);
+void                UpdateWarning(TWorkStationLocker &workStationLocker);
+void                CheckIdleTimeout(HWND hWnd);
+void                BuildTrayIcons();
+void                DumpStats();
+void                LoadPolicy(TLockEngine &engine, const wchar_t *fileName);
+void                AddInhibitors(TInhibitorSet &inhibitors, const wchar_t *list);
+void                LoadInputRules(TInputFilter &filter, const wchar_t *fileName);
+void                AddAction(TActionPipeline &actions, TPlatformBackend &backend, const wchar_t *spec, const wchar_t *command);
+bool                ApplyCommandLine(HWND hWnd, LPARAM copyData);
+int                 PrintStatus();
 
 
 
@@ -58,10 +147,102 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 
     int argc;
     LPWSTR *argv = CommandLineToArgvW(lpCmdLine, &argc);
-    if (argc == 2 && lstrcmpiW(argv[0], L"-logfile") == 0) {
-        Logger = new TLogger(argv[1]);
-    } else {
+    const wchar_t *logFileName = NULL;
+    const wchar_t *journalFileName = NULL;
+    const wchar_t *activityFileName = NULL;
+    const wchar_t *checkpointFileName = NULL;
+    const wchar_t *policyFileName = NULL;
+    const wchar_t *inhibitorList = NULL;
+    const wchar_t *inputRulesFileName = NULL;
+    bool asyncLog = false;
+    bool filterInput = false;
+    bool serviceMode = false;
+    bool dumpStats = false;
+    bool status = false;
+    bool control = false;
+    int serviceTimeout = TLockEngine::DefaultTimeout;
+    int warningSeconds = 0;
+    int adaptiveMinutes = 0;
+    std::vector<std::pair<const wchar_t *, const wchar_t *>> actionSpecs;  // With run's command.
+
+    for (int i = 0; i < argc; i++) {
+        if (lstrcmpiW(argv[i], L"-logfile") == 0 && i + 1 < argc)
+            logFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-asynclog") == 0)
+            asyncLog = true;
+        else if (lstrcmpiW(argv[i], L"-journal") == 0 && i + 1 < argc)
+            journalFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-activity") == 0 && i + 1 < argc)
+            activityFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-checkpoint") == 0 && i + 1 < argc)
+            checkpointFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-policy") == 0 && i + 1 < argc)
+            policyFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-service") == 0)
+            serviceMode = true;
+        else if (lstrcmpiW(argv[i], L"-timeout") == 0 && i + 1 < argc)
+            serviceTimeout = _wtoi(argv[++i]) * 60000;
+        else if (lstrcmpiW(argv[i], L"-stats") == 0 && i + 1 < argc)
+            StatsFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-dumpstats") == 0)
+            dumpStats = true;
+        else if (lstrcmpiW(argv[i], L"-status") == 0)
+            status = true;
+        else if (lstrcmpiW(argv[i], L"-control") == 0)
+            control = true;
+        else if (lstrcmpiW(argv[i], L"-warning") == 0 && i + 1 < argc)
+            warningSeconds = _wtoi(argv[++i]);
+        else if (lstrcmpiW(argv[i], L"-adaptive") == 0 && i + 1 < argc)
+            adaptiveMinutes = _wtoi(argv[++i]);
+        else if (lstrcmpiW(argv[i], L"-inhibit") == 0 && i + 1 < argc)
+            inhibitorList = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-inputfilter") == 0)
+            filterInput = true;
+        else if (lstrcmpiW(argv[i], L"-inputrules") == 0 && i + 1 < argc)
+            inputRulesFileName = argv[++i];
+        else if (lstrcmpiW(argv[i], L"-headless") == 0)
+            Headless = true;
+        else if (lstrcmpiW(argv[i], L"-action") == 0 && i + 1 < argc) {
+            const wchar_t *spec = argv[++i];
+            const wchar_t *command = NULL;
+            if (_wcsnicmp(spec, L"run", 3) == 0 && (spec[3] == 0 || spec[3] == L':') && i + 1 < argc)
+                command = argv[++i];
+            actionSpecs.push_back(std::make_pair(spec, command));
+        }
+    }
+
+    if (dumpStats) {
+        // Ask the running instance to dump its statistics; our signal.
+        LoadString(hInstance, IDC_IDLELOCK, szWindowClass, MAX_LOADSTRING);
+        HWND target = FindWindow(szWindowClass, NULL);
+        if (target == NULL)
+            target = FindWindowEx(HWND_MESSAGE, NULL, szWindowClass, NULL);
+        if (target == NULL)
+            target = FindWindowEx(HWND_MESSAGE, NULL, ServiceWindowClass, NULL);
+        return target != NULL && PostMessage(target, WM_USER_DUMPSTATS, 0, 0) ? 0 : 1;
+    }
+    if (status)
+        return PrintStatus();
+
+    // One instance per session, or two timers race to lock and two lockers
+    // to write the settings. Before the log is opened, which a later launch
+    // leaves to the running instance.
+    TSingleInstance instance;
+    if (!serviceMode && !instance.Claim(Headless))
+        return TSingleInstance::HandOff(lpCmdLine) ? 0 : 1;
+
+    if (logFileName == NULL) {
         Logger = new TLogger(); 
+    } else if (asyncLog) {
+        Logger = new TAsyncLogger(logFileName);
+    } else {
+        Logger = new TLogger(logFileName);
+    }
+
+    if (serviceMode) {
+        int result = RunSessionService(hInstance, serviceTimeout);
+        delete Logger;
+        return result;
     }
 
     MSG msg;
@@ -75,64 +256,227 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
     if (!InitInstance (hInstance, nCmdShow)) {
         return FALSE;
     }
+    instance.SetWindow(nidApp.hWnd);
+
+    TEventJournal journal;
+    if (journalFileName != NULL && !journal.Open(journalFileName))
+        Logger->Log(L"Could not open journal file.");
+    TActivityLog activityLog;
+    if (activityFileName != NULL && !activityLog.Open(activityFileName))
+        Logger->Log(L"Could not open activity file.");
+    TEngineCheckpoint checkpoint;
+    if (checkpointFileName != NULL && !checkpoint.Open(checkpointFileName))
+        Logger->Log(L"Could not open checkpoint file.");
+
+    // A message-only window doesn't get the WM_POWERBROADCAST broadcasts,
+    // so ask for the ones the locker needs. The power source is sent right
+    // after registering; that only recompiles the policy.
+    HPOWERNOTIFY suspendResumeNotify = NULL;
+    HPOWERNOTIFY powerSourceNotify = NULL;
+    if (Headless) {
+        suspendResumeNotify = RegisterSuspendResume(nidApp.hWnd);
+        powerSourceNotify = RegisterPowerSettingNotification(nidApp.hWnd, &PowerSourceGuid, DEVICE_NOTIFY_WINDOW_HANDLE);
+    }
 
     {
 
-        TWorkStationLocker wl(nidApp.hWnd, *Logger);
+        HWND hWnd = nidApp.hWnd;
+        TRegistrySettingsStore settingsStore(AppRegKeyName);
+        settingsStore.Start([hWnd] { PostMessage(hWnd, WM_USER_SETTINGSCHANGED, 0, 0); });
+
+        // The reader outlives the backend that asks it for the last input.
+        TInputFilter inputFilter;
+        TRawInputReader rawInput(inputFilter);
+        TWin32Backend backend(hWnd, WM_USER_DISPLAYEVENT);
+        Backend = &backend;
+        // Ended before the backend, which the lock action uses.
+        TActionPipeline actions([hWnd] { PostMessage(hWnd, WM_USER_ACTIONS, 0, 0); });
+        for (const auto &spec : actionSpecs)
+            AddAction(actions, backend, spec.first, spec.second);
+        TWorkStationLocker wl(backend, *Logger, settingsStore);
         WorkStationLocker = &wl;
+        if (journal.IsOpen())
+            wl.SetJournal(&journal);
+        if (activityLog.IsOpen())
+            wl.SetActivityLog(&activityLog);
+        if (checkpoint.IsOpen())
+            wl.SetCheckpoint(&checkpoint);
+        if (policyFileName != NULL)
+            LoadPolicy(wl, policyFileName);
+        if (warningSeconds > 0)
+            wl.SetWarningTime(uint32_t(warningSeconds) * 1000);
+        if (adaptiveMinutes > 0)
+            wl.SetAdaptiveTimeout(uint32_t(adaptiveMinutes) * 60000);
+        TInhibitorSet inhibitors(backend);
+        if (inhibitorList != NULL)
+            AddInhibitors(inhibitors, inhibitorList);
+        if (!inhibitors.Empty())
+            wl.SetInhibitors(&inhibitors);
+        if (!actions.Empty())
+            wl.SetActions(&actions);
+        if (filterInput) {
+            if (inputRulesFileName != NULL)
+                LoadInputRules(inputFilter, inputRulesFileName);
+            if (rawInput.Start())
+                backend.SetRawInput(&rawInput);
+            else
+                Logger->Log(L"Could not register for raw input.");
+        }
+
+        // Control requests and event subscriptions on \\.\pipe\IdleLock.<session id>.
+        TPipeControlServer controlServer(wl, *Logger, hWnd, WM_USER_CONTROL);
+        if (control) {
+            if (controlServer.Start())
+                ControlServer = &controlServer;
+            else
+                Logger->Log(L"Could not start the control pipe.");
+        }
+
+        Instance = &instance;
         UpdateTrayIcon(*WorkStationLocker);
+        CheckIdleTimeout(nidApp.hWnd);
 
         // Main message loop:
         while (GetMessage(&msg, NULL, 0, 0)) {
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
+        ControlServer = NULL;
+        Instance = NULL;
     }
 
+    UnregisterSuspendResume(suspendResumeNotify);
+    if (powerSourceNotify != NULL)
+        UnregisterPowerSettingNotification(powerSourceNotify);
     delete Logger;
 
     return (int) msg.wParam;
 }
 
 
+// Locks idle sessions on the whole host, e.g. a terminal server, instead of
+// just the session we run in. Has no tray icon; one process handles all
+// sessions, so run it once per host as an administrator (e.g. at startup
+// from the Task Scheduler), rather than in every session.
+int RunSessionService(HINSTANCE hInstance, int timeout)
+{
+    WNDCLASSEX wcex = {};
+    wcex.cbSize         = sizeof(WNDCLASSEX);
+    wcex.lpfnWndProc    = ServiceWndProc;
+    wcex.hInstance      = hInstance;
+    wcex.lpszClassName  = ServiceWindowClass;
+    RegisterClassEx(&wcex);
+
+    HWND hWnd = CreateWindow(ServiceWindowClass, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+    if (!hWnd)
+        return FALSE;
+
+    // Running elevated, so let -dumpstats from a normal user through.
+    ChangeWindowMessageFilterEx(hWnd, WM_USER_DUMPSTATS, MSGFLT_ALLOW, NULL);
+
+    // Without this (before Windows 8), a resume is only noticed by the
+    // sessions' input.
+    HPOWERNOTIFY suspendResumeNotify = RegisterSuspendResume(hWnd);
+
+    MSG msg;
+    {
+        TWtsSessionBackend backend(hWnd);
+        TSessionMonitor monitor(backend, *Logger);
+        SessionBackend = &backend;
+        SessionMonitor = &monitor;
+
+        monitor.SetTimeout(timeout);
+        backend.Start(monitor);
+        Logger->Log(L"Monitoring all sessions.");
+        CheckSessions(hWnd);
+
+        while (GetMessage(&msg, NULL, 0, 0)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        backend.Stop();
+        SessionMonitor = NULL;
+        SessionBackend = NULL;
+    }
+
+    UnregisterSuspendResume(suspendResumeNotify);
+
+    return (int) msg.wParam;
+}
+
+
+// Message-only windows don't get the suspend and resume broadcasts; this
+// asks for them to be sent to hWnd. Returns NULL before Windows 8.
+HPOWERNOTIFY RegisterSuspendResume(HWND hWnd)
+{
+    TRegisterSuspendResumeNotification registerSuspendResume = (TRegisterSuspendResumeNotification)
+        GetProcAddress(GetModuleHandle(L"user32.dll"), "RegisterSuspendResumeNotification");
+    return registerSuspendResume != NULL
+        ? registerSuspendResume(hWnd, DEVICE_NOTIFY_WINDOW_HANDLE)
+        : NULL;
+}
+
+
+void UnregisterSuspendResume(HPOWERNOTIFY notify)
+{
+    TUnregisterSuspendResumeNotification unregisterSuspendResume = (TUnregisterSuspendResumeNotification)
+        GetProcAddress(GetModuleHandle(L"user32.dll"), "UnregisterSuspendResumeNotification");
+    if (notify != NULL && unregisterSuspendResume != NULL)
+        unregisterSuspendResume(notify);
+}
+
+
+// A headless instance's class has no icons, cursor or menu to load.
 ATOM MyRegisterClass(HINSTANCE hInstance)
 {
-    WNDCLASSEX wcex;
+    WNDCLASSEX wcex = {};
 
     wcex.cbSize = sizeof(WNDCLASSEX);
-
-    wcex.style          = CS_HREDRAW | CS_VREDRAW;
     wcex.lpfnWndProc    = WndProc;
-    wcex.cbClsExtra     = 0;
-    wcex.cbWndExtra     = 0;
     wcex.hInstance      = hInstance;
+    wcex.lpszClassName  = szWindowClass;
+    if (Headless)
+        return RegisterClassEx(&wcex);
+
+    wcex.style          = CS_HREDRAW | CS_VREDRAW;
     wcex.hIcon          = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_IDLELOCK));
     wcex.hCursor        = LoadCursor(NULL, IDC_ARROW);
     wcex.hbrBackground  = (HBRUSH)(COLOR_WINDOW+1);
     wcex.lpszMenuName   = MAKEINTRESOURCE(IDC_IDLELOCK);
-    wcex.lpszClassName  = szWindowClass;
     wcex.hIconSm        = LoadIcon(wcex.hInstance, MAKEINTRESOURCE(IDI_IDLELOCK));
 
     return RegisterClassEx(&wcex);
 }
 
 
-// Saves instance handle and creates main window.
+// Saves instance handle and creates main window. When headless, that is a
+// message-only window, and the tray icon and menu aren't created; nidApp
+// only holds the window handle then.
 BOOL InitInstance(HINSTANCE aHInstance, int nCmdShow)
 {
     hInstance = aHInstance;
 
     HWND hWnd;
-    hWnd = CreateWindow(szWindowClass, szAppTitle, WS_OVERLAPPEDWINDOW,
-       CW_USEDEFAULT, CW_USEDEFAULT, 0, 0, NULL, NULL, hInstance, NULL);
+    if (Headless)
+        hWnd = CreateWindow(szWindowClass, szAppTitle, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, hInstance, NULL);
+    else
+        hWnd = CreateWindow(szWindowClass, szAppTitle, WS_OVERLAPPEDWINDOW,
+           CW_USEDEFAULT, CW_USEDEFAULT, 0, 0, NULL, NULL, hInstance, NULL);
 
     if (!hWnd) {
         return FALSE;
     }
+
+    nidApp.hWnd = hWnd;
+    if (Headless)
+        return TRUE;
     
+    // The real size of the tray icon isn't known until it has been added.
+    TrayIcons.Build(hInstance, GetSystemMetrics(SM_CXSMICON));
+
     nidApp.cbSize           = sizeof NOTIFYICONDATA;
-    nidApp.hIcon            = LoadTrayIcon(hInstance, IDI_IDLELOCK); 
-    nidApp.hWnd             = (HWND) hWnd;     // The window which will process this apps messages.
+    nidApp.hIcon            = TrayIcons.Locked();
     nidApp.uID              = TrayIconUId;
     nidApp.uFlags           = NIF_ICON | NIF_MESSAGE | NIF_TIP;
     nidApp.uCallbackMessage = WM_USER_SHELLICON; 
@@ -140,15 +484,91 @@ BOOL InitInstance(HINSTANCE aHInstance, int nCmdShow)
     Shell_NotifyIcon(NIM_ADD, &nidApp); 
 
     IconScaling = GetIconScaling(hWnd);
+    BuildTrayIcons();
 
     hPopMenu = CreateIdleLockMenu();
-    // Send us WM_TIMER messages every <CheckTimeoutInterval> seconds.
-    SetTimer(hWnd, 1, CheckTimeoutInterval, NULL);
     
     return TRUE;
 }
 
 
+// Checks if it's time to lock, and arms the timer for the next check.
+// The timer is re-armed with the delay the locker computes from the remaining
+// idle time, so we only wake up when a lock can actually be due.
+void CheckIdleTimeout(HWND hWnd)
+{
+    DWORD delay = WorkStationLocker->LockIfIdleTimeout();
+    SetCheckTimer(hWnd, delay, WorkStationLocker->TimerTolerance());
+
+    UpdateWarning(*WorkStationLocker);
+    UpdateTrayIcon(*WorkStationLocker);
+    if (ControlServer != NULL)
+        ControlServer->Publish();
+    if (Instance != NULL)
+        Instance->Publish(*WorkStationLocker, delay);
+}
+
+
+// Shows the notification when the lock warning starts, and removes it when
+// input cancels the warning. During the warning, the timer resolution is
+// raised, so that the countdown ticks and the lock are on time; the default
+// resolution is restored afterwards, since it costs power. Headless, only
+// the resolution is changed; control clients get the warning as an event.
+void UpdateWarning(TWorkStationLocker &workStationLocker)
+{
+    bool warning = workStationLocker.Warning();
+    if (warning == WarningShown)
+        return;
+    WarningShown = warning;
+
+    if (warning) {
+        timeBeginPeriod(1);
+        uint32_t left = workStationLocker.Scheduler().TimeUntilDeadline();
+        swprintf_s(nidApp.szInfo, L"Locking in %u seconds. Move the mouse or press a key to stay unlocked.", (left + 999) / 1000);
+        wcscpy_s(nidApp.szInfoTitle, szAppTitle);
+        nidApp.dwInfoFlags = NIIF_WARNING;
+    } else {
+        timeEndPeriod(1);
+        nidApp.szInfo[0] = 0;
+    }
+
+    // Only shown if the user hasn't been locked meanwhile.
+    if (!Headless && (warning || !workStationLocker.IsLocked())) {
+        nidApp.uFlags = NIF_INFO;
+        Shell_NotifyIcon(NIM_MODIFY, &nidApp);
+    }
+}
+
+
+// Like CheckIdleTimeout(), for all sessions. Only the sessions whose
+// deadline has passed are checked.
+void CheckSessions(HWND hWnd)
+{
+    DWORD delay = SessionMonitor->CheckDueSessions();
+
+    SYSTEM_POWER_STATUS status;
+    bool onBattery = GetSystemPowerStatus(&status) && status.ACLineStatus == 0;
+    SetCheckTimer(hWnd, delay, TLockScheduler::Tolerance(delay, onBattery));
+}
+
+
+// Arms the check timer, or stops it if delay is 0. Where available, the timer
+// may come up to tolerance ms late, so that the system can coalesce it with
+// other timers; 0 means that it must be on time.
+void SetCheckTimer(HWND hWnd, DWORD delay, ULONG tolerance)
+{
+    static TSetCoalescableTimer setCoalescableTimer =
+        (TSetCoalescableTimer)GetProcAddress(GetModuleHandle(L"user32.dll"), "SetCoalescableTimer");
+
+    if (delay == 0)
+        KillTimer(hWnd, CheckTimeoutTimerId);
+    else if (setCoalescableTimer != NULL)
+        setCoalescableTimer(hWnd, CheckTimeoutTimerId, delay, NULL, tolerance == 0 ? TIMERV_NO_COALESCING : tolerance);
+    else
+        SetTimer(hWnd, CheckTimeoutTimerId, delay, NULL);
+}
+
+
 double GetIconScaling(HWND hWnd)
 {
     RECT trayIconRect;
@@ -169,29 +589,202 @@ double GetIconScaling(HWND hWnd)
 }
 
 
+// Only tells the shell about the icon when the icon or the tooltip has changed,
+// since this is called on every idle check.
 void UpdateTrayIcon(TWorkStationLocker &workStationLocker)
 {
-    if (workStationLocker.Enabled())
-        swprintf_s(nidApp.szTip, sizeof nidApp.szTip, L"%s - %d minutes", szAppTitle, workStationLocker.GetTimeout() / 60000);
-    else
-        swprintf_s(nidApp.szTip, sizeof nidApp.szTip, L"%s - Disabled", szAppTitle);
+    wchar_t tip[sizeof nidApp.szTip / sizeof nidApp.szTip[0]];
+    HICON icon;
+
+    if (Headless)
+        return;
+
+    if (workStationLocker.Enabled()) {
+        swprintf_s(tip, L"%s - %d minutes", szAppTitle, workStationLocker.GetTimeout() / 60000);
+
+        // Count down over the warning if it is longer than the usual minute.
+        uint32_t left = workStationLocker.Scheduler().TimeUntilDeadline();
+        uint32_t countdownTime = workStationLocker.GetWarningTime() > TrayCountdownTime
+            ? workStationLocker.GetWarningTime()
+            : TrayCountdownTime;
+        icon = left > 0 && left <= countdownTime
+            ? TrayIcons.Countdown(double(left) / countdownTime)
+            : TrayIcons.Locked();
+        if (workStationLocker.Warning())
+            swprintf_s(tip, L"%s - Locking in %u seconds", szAppTitle, (left + 999) / 1000);
+    } else {
+        swprintf_s(tip, L"%s - Disabled", szAppTitle);
+        icon = TrayIcons.Open();
+    }
+
+    if (icon == nidApp.hIcon && wcscmp(tip, nidApp.szTip) == 0)
+        return;
 
-    nidApp.hIcon = LoadTrayIcon(hInstance, workStationLocker.Enabled() ? IDI_IDLELOCK : IDI_IDLELOCKOPEN);
+    TStats::Add(SC_IconUpdates);
+    TStatScope scope(ST_IconUpdate);
+    wcscpy_s(nidApp.szTip, tip);
+    nidApp.hIcon = icon;
     nidApp.uFlags = NIF_ICON | NIF_TIP;
     Shell_NotifyIcon(NIM_MODIFY, &nidApp);
 }
 
 
-HICON LoadTrayIcon(HINSTANCE hInstance, int resourceId)
+// Renders the tray icons for the current scaling. Does nothing if they
+// already have the right size, so the icons are reused until the DPI changes.
+void BuildTrayIcons()
 {
-    LPCTSTR resId = (LPCTSTR) MAKEINTRESOURCE(resourceId);
-    HICON icon;
+    if (Headless)
+        return;
+
+    int size = int(GetSystemMetrics(SM_CXSMICON) * IconScaling);
+    if (size == TrayIcons.Size())
+        return;
+
+    TrayIcons.Build(hInstance, size);
+    nidApp.hIcon = NULL;  // Destroyed, so make UpdateTrayIcon() show the new one.
+}
+
+
+void LoadPolicy(TLockEngine &engine, const wchar_t *fileName)
+{
+    std::string text, error;
+    TLockPolicy policy;
+
+    if (!ReadWholeFile(fileName, text)) {
+        Logger->Log(L"Could not read the policy file.");
+    } else if (!policy.Parse(text, error)) {
+        std::wstring message = L"Policy file: " + std::wstring(error.begin(), error.end());
+        Logger->Log(message.c_str());
+    } else {
+        engine.SetPolicy(policy);
+    }
+}
+
+
+// The sources named in the -inhibit list; names other than power and
+// fullscreen are programs.
+void AddInhibitors(TInhibitorSet &inhibitors, const wchar_t *list)
+{
+    std::vector<std::wstring> programs;
+    std::wstring rest = list;
+    while (!rest.empty()) {
+        size_t comma = rest.find(L',');
+        std::wstring name = rest.substr(0, comma);
+        rest = comma == std::wstring::npos ? std::wstring() : rest.substr(comma + 1);
+        if (name.empty())
+            continue;
+        if (lstrcmpiW(name.c_str(), L"power") == 0)
+            inhibitors.Add(new TPowerRequestInhibitor());
+        else if (lstrcmpiW(name.c_str(), L"fullscreen") == 0)
+            inhibitors.Add(new TFullScreenInhibitor());
+        else
+            programs.push_back(name);
+    }
+    if (!programs.empty())
+        inhibitors.Add(new TProcessInhibitor(programs));
+}
+
+
+void LoadInputRules(TInputFilter &filter, const wchar_t *fileName)
+{
+    std::string text, error;
+
+    if (!ReadWholeFile(fileName, text)) {
+        Logger->Log(L"Could not read the input rules file.");
+    } else if (!filter.Parse(text, error)) {
+        std::wstring message = L"Input rules file: " + std::wstring(error.begin(), error.end());
+        Logger->Log(message.c_str());
+    }
+}
+
+
+// An -action: "<kind>[:<seconds>]", and the command for run. Invalid ones
+// are logged and left out.
+void AddAction(TActionPipeline &actions, TPlatformBackend &backend, const wchar_t *spec, const wchar_t *command)
+{
+    std::wstring kind = spec;
+    uint32_t timeout = TTimeoutAction::DefaultTimeout;
+    size_t colon = kind.find(L':');
+    if (colon != std::wstring::npos) {
+        timeout = uint32_t(_wtoi(kind.c_str() + colon + 1)) * 1000;
+        kind.resize(colon);
+    }
+
+    if (lstrcmpiW(kind.c_str(), L"lock") == 0)
+        actions.Add(new TLockAction(backend));
+    else if (lstrcmpiW(kind.c_str(), L"disconnect") == 0)
+        actions.Add(new TDisconnectAction());
+    else if (lstrcmpiW(kind.c_str(), L"logoff") == 0)
+        actions.Add(new TLogOffAction(timeout));
+    else if (lstrcmpiW(kind.c_str(), L"sleep") == 0)
+        actions.Add(new TSleepAction());
+    else if (lstrcmpiW(kind.c_str(), L"signal") == 0)
+        actions.Add(new TSignalAction());
+    else if (lstrcmpiW(kind.c_str(), L"run") == 0 && command != NULL)
+        actions.Add(new TCommandAction(L"run", command, timeout));
+    else
+        Logger->Log((std::wstring(L"Invalid action: ") + spec).c_str());
+}
+
+
+// Applies the options of a later launch's command line, passed with
+// WM_COPYDATA, that can change while running; the others only take effect
+// at startup, and are logged. Returns false if the message isn't one.
+bool ApplyCommandLine(HWND hWnd, LPARAM copyData)
+{
+    std::wstring commandLine;
+    if (!TSingleInstance::CommandLine(copyData, commandLine))
+        return false;
+    Logger->Log((L"Command line from a later launch: " + commandLine).c_str());
+
+    int argc;
+    LPWSTR *argv = CommandLineToArgvW(commandLine.c_str(), &argc);
+    if (argv == NULL)
+        return true;
+
+    for (int i = 0; i < argc; i++) {
+        if (lstrcmpiW(argv[i], L"-logfile") == 0 && i + 1 < argc)
+            Logger->Reopen(argv[++i]);
+        else if (lstrcmpiW(argv[i], L"-policy") == 0 && i + 1 < argc)
+            LoadPolicy(*WorkStationLocker, argv[++i]);
+        else if (lstrcmpiW(argv[i], L"-warning") == 0 && i + 1 < argc)
+            WorkStationLocker->SetWarningTime(uint32_t(_wtoi(argv[++i])) * 1000);
+        else if (lstrcmpiW(argv[i], L"-adaptive") == 0 && i + 1 < argc)
+            WorkStationLocker->SetAdaptiveTimeout(uint32_t(_wtoi(argv[++i])) * 60000);
+        else if (argv[i][0] == L'-')
+            Logger->Log((std::wstring(L"Only applies at startup: ") + argv[i]).c_str());
+    }
+    LocalFree(argv);
+    CheckIdleTimeout(hWnd);
+    return true;
+}
+
+
+// For -status: the running instance's state, on the console we were
+// started from (we're a GUI program, so there's none of our own).
+int PrintStatus()
+{
+    TInstanceStateBlock state;
+    if (!TSingleInstance::ReadState(state))
+        return 1;
+
+    std::string line = FormatInstanceState(state, TEventJournal::TimeNow()) + "\n";
+    if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+        DWORD written;
+        WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), line.data(), DWORD(line.size()), &written, NULL);
+        FreeConsole();
+    }
+    return 0;
+}
 
-    int cx = int(GetSystemMetrics(SM_CXSMICON) * IconScaling);
-    int cy = int(GetSystemMetrics(SM_CYSMICON) * IconScaling);
-    icon = (HICON) LoadImage(hInstance, resId, IMAGE_ICON, cx, cy, 0);
 
-    return icon;
+// To the -stats file if given, otherwise to the log.
+void DumpStats()
+{
+    if (StatsFileName == NULL)
+        TStats::Dump(*Logger);
+    else if (!TStats::Dump(StatsFileName))
+        Logger->Log(L"Could not write the statistics file.");
 }
 
 
@@ -223,6 +816,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
     int wmId, wmEvent;
 
+    TStats::Add(SC_Messages);
+    TStatScope scope(ST_Message);
+
     switch (message) {
         case WM_USER_SHELLICON: 
             // Systray msg.
@@ -250,11 +846,13 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             switch (wmId) {
                 case IDM_REQUIRESCREENSAVER:
                     WorkStationLocker->RequireScreensaver(!WorkStationLocker->IsScreenSaverRequired());
+                    CheckIdleTimeout(hWnd);
                     break;
 
                 case IDM_DISABLE:
                     WorkStationLocker->Enable(!WorkStationLocker->Enabled());
                     UpdateTrayIcon(*WorkStationLocker);
+                    CheckIdleTimeout(hWnd);
                     break;
 
                 case IDM_ABOUT:
@@ -274,26 +872,163 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                         int timeout = (wmId - IDM_TIMEOUT) * 60000;
                         WorkStationLocker->SetTimeout(timeout);
                         UpdateTrayIcon(*WorkStationLocker);
+                        CheckIdleTimeout(hWnd);
                     }
 
                     return DefWindowProc(hWnd, message, wParam, lParam);
                 }
             break;
 
+        case WM_USER_SETTINGSCHANGED:
+            // Changed in the registry by someone else.
+            CheckMenuItem(hPopMenu, WorkStationLocker->GetTimeout() / 60000 + IDM_TIMEOUT, MF_BYCOMMAND | MF_UNCHECKED);
+            WorkStationLocker->ReloadSettings();
+            UpdateTrayIcon(*WorkStationLocker);
+            CheckIdleTimeout(hWnd);
+            break;
+
         case WM_TIMER:
-            WorkStationLocker->LockIfIdleTimeout();
+            if (wParam == CheckTimeoutTimerId)
+                CheckIdleTimeout(hWnd);
+            break;
+
+        case WM_POWERBROADCAST:
+            if (wParam == PBT_APMPOWERSTATUSCHANGE && WorkStationLocker != NULL) {
+                WorkStationLocker->PolicyInputsChanged();
+                CheckIdleTimeout(hWnd);
+            } else if (wParam == PBT_POWERSETTINGCHANGE && Backend != NULL && WorkStationLocker != NULL) {
+                // Headless, the power source comes this way too.
+                const POWERBROADCAST_SETTING *setting = (const POWERBROADCAST_SETTING *)lParam;
+                if (setting != NULL && setting->PowerSetting == PowerSourceGuid) {
+                    WorkStationLocker->PolicyInputsChanged();
+                    CheckIdleTimeout(hWnd);
+                } else if (Backend->PowerSettingChange(lParam)) {
+                    CheckIdleTimeout(hWnd);
+                }
+            } else if (wParam == PBT_APMSUSPEND && WorkStationLocker != NULL) {
+                // Checked again on resume.
+                WorkStationLocker->Suspending();
+                KillTimer(hWnd, CheckTimeoutTimerId);
+                UpdateWarning(*WorkStationLocker);
+                UpdateTrayIcon(*WorkStationLocker);
+            } else if (wParam == PBT_APMRESUMEAUTOMATIC && WorkStationLocker != NULL) {
+                // Sent on every resume, whether or not the user woke the
+                // system up. GetTickCount() includes the sleep, but the last
+                // input can be from before it. A message-only window
+                // doesn't hear about docking, which mostly happens asleep.
+                WorkStationLocker->Resumed();
+                if (Headless)
+                    WorkStationLocker->PolicyInputsChanged();
+                CheckIdleTimeout(hWnd);
+            }
+            return TRUE;
+
+        case WM_USER_DISPLAYEVENT:
+            // The screensaver has started or stopped.
+            if (WorkStationLocker != NULL)
+                CheckIdleTimeout(hWnd);
+            break;
+
+        case WM_DEVICECHANGE:
+            // Docking and undocking change the hardware profile.
+            if (wParam == DBT_CONFIGCHANGED && WorkStationLocker != NULL) {
+                WorkStationLocker->PolicyInputsChanged();
+                CheckIdleTimeout(hWnd);
+            }
+            return TRUE;
+
+        case WM_DPICHANGED:
+        case WM_DISPLAYCHANGE:
+            // The tray icon size may have changed.
+            IconScaling = GetIconScaling(hWnd);
+            BuildTrayIcons();
+            if (WorkStationLocker != NULL)
+                UpdateTrayIcon(*WorkStationLocker);
             break;
 
         case WM_WTSSESSION_CHANGE:
+            Backend->SessionChange(wParam);
             if (wParam == WTS_SESSION_UNLOCK) {
-                WorkStationLocker->ReportUnlock();
-            } else if (wParam == WTS_SESSION_LOCK) {
-                WorkStationLocker->ReportLock();
+                CheckIdleTimeout(hWnd);
+            } else {
+                if (ControlServer != NULL)
+                    ControlServer->Publish();
+                // Locked, the next check only stops the timer.
+                if (Instance != NULL)
+                    Instance->Publish(*WorkStationLocker, 0);
+            }
+            break;
+
+        case WM_COPYDATA:
+            // A later launch's command line (see TSingleInstance).
+            return WorkStationLocker != NULL && ApplyCommandLine(hWnd, lParam);
+
+        case WM_USER_CONTROL:
+            // From the control pipe's thread, with SendMessageTimeout().
+            if (ControlServer != NULL && ControlServer->HandleMessage(lParam))
+                CheckIdleTimeout(hWnd);
+            break;
+
+        case WM_USER_ACTIONS:
+            // From the timeout actions' worker.
+            if (WorkStationLocker != NULL)
+                WorkStationLocker->DispatchActionReports();
+            break;
+
+        case WM_USER_DUMPSTATS:
+            DumpStats();
+            break;
+
+        case WM_DESTROY:
+            if (!Headless)
+                Shell_NotifyIcon(NIM_DELETE, &nidApp); 
+            if (StatsFileName != NULL)
+                DumpStats();
+            PostQuitMessage(0);
+            break;
+
+        default:
+            return DefWindowProc(hWnd, message, wParam, lParam);
+    }
+    return 0;
+}
+
+
+// WndProc for the message-only window of RunSessionService().
+LRESULT CALLBACK ServiceWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    TStats::Add(SC_Messages);
+    TStatScope scope(ST_Message);
+
+    switch (message) {
+        case WM_TIMER:
+            if (wParam == CheckTimeoutTimerId)
+                CheckSessions(hWnd);
+            break;
+
+        case WM_WTSSESSION_CHANGE:
+            SessionBackend->SessionChange(wParam, lParam);
+            CheckSessions(hWnd);
+            break;
+
+        case WM_POWERBROADCAST:
+            if (wParam == PBT_APMRESUMEAUTOMATIC) {
+                SessionMonitor->Resumed();
+                CheckSessions(hWnd);
             }
+            return TRUE;
+
+        case WM_USER_DUMPSTATS:
+            DumpStats();
+            break;
+
+        case WM_CLOSE:
+            DestroyWindow(hWnd);
             break;
 
         case WM_DESTROY:
-            Shell_NotifyIcon(NIM_DELETE, &nidApp); 
+            if (StatsFileName != NULL)
+                DumpStats();
             PostQuitMessage(0);
             break;
 
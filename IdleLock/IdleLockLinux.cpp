@@ -0,0 +1,548 @@
+// IdleLockLinux.cpp
+// Linux front end: runs the lock engine on the evdev backend.
+// Locks the session by running a command after a specified amount of idle
+// time. There is no tray icon; settings are given on the command line:
+//
+//   idlelock -lockcmd <command> [-timeout <minutes>] [-input <path>]
+//            [-screensaver] [-settings <file>] [-logfile <file> [-asynclog]]
+//            [-journal <file>] [-stats <file>] [-policy <file>]
+//            [-control <socket>] [-warning <seconds>] [-activity <file>]
+//            [-adaptive <minutes>] [-inhibit <program>,...]
+//            [-inputfilter [-inputrules <file>]] [-checkpoint <file>]
+//            [-action lock | run[:<seconds>] <command> | sleep[:<seconds>]
+//                    | logoff[:<seconds>]]...
+//   idlelock -status
+//
+// -input defaults to /dev/input, which requires read access to the event
+// devices (usually membership of the "input" group). Devices plugged in
+// later are watched too.
+// With -settings, the timeout, screensaver requirement and enabled state
+// are kept in the given file instead (name=value lines, like the registry
+// values on Windows), and changes to it take effect immediately; -timeout
+// and -screensaver can't be given with it.
+// -policy gives rules for the timeout by time of day, power source and dock
+// state (see LockPolicy.h). Power supply and dock changes are picked up from
+// kernel uevents.
+// -control listens for control requests and event subscriptions on a Unix
+// domain socket (see ControlServer.h), e.g. $XDG_RUNTIME_DIR/idlelock.sock.
+// -warning logs a warning that many seconds before a lock, and sends it to
+// the control subscribers, with a countdown; input cancels it.
+// -activity records the minutes with input, and locks and unlocks, in a
+// file that keeps about a year of them (see ActivityLog.h).
+// -adaptive raises the timeout, up to the given minutes, while too many
+// locks are undone within seconds (see AdaptiveTimeout.h).
+// -inhibit holds off locks while one of the programs runs, by their names
+// in /proc/<pid>/comm, e.g. -inhibit mpv,vlc (see InhibitorSet.h); the idle
+// time then counts from when it was seen that the last one had exited.
+// -inputfilter only counts input that looks like a user's, so that mouse
+// jitter or a mouse jiggler doesn't keep the session unlocked; -inputrules
+// gives rules by device instead of the defaults (see InputFilter.h).
+// -action, given once or more, takes the actions in that order instead of
+// only locking when the timeout expires, on a thread of their own (see
+// ActionPipeline.h): lock runs the -lockcmd, run a command of its own,
+// sleep "systemctl suspend", and logoff "loginctl terminate-session" for
+// the session. The seconds are the action's timeout (default 60), after
+// which the command is ended and the next action taken; input ends them.
+// -checkpoint keeps whether the session is locked, when it was unlocked and
+// whether the screensaver was seen in the given file, on every change, and
+// carries on from there after a restart of the daemon (see
+// EngineCheckpoint.h); without the input history, the idle time still
+// counts from the restart.
+// Checks are timed with the thread's timer slack set to the engine's timer
+// tolerance, which is wider on battery, so that the kernel can coalesce the
+// wakeups. A timer on CLOCK_BOOTTIME, which poll() timeouts aren't, makes
+// sure that a check that fell due while the system was suspended is made
+// right after the resume, and the idle time then counts from the resume.
+// The state is published after each check in POSIX shared memory, as
+// /idlelock.<uid> (see InstanceStatePage.h), for status bars and agents;
+// -status prints the running daemon's, and exits with 1 if none runs.
+// SIGUSR1 dumps the counters and timings (Stats.h) to the -stats file, or to
+// stderr; the -stats file is also written on exit.
+//
+
+
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AsyncLogger.h"
+#include "EvdevBackend.h"
+#include "ActivityLog.h"
+#include "EventJournal.h"
+#include "FileSettingsStore.h"
+#include "InputFilter.h"
+#include "InstanceStatePage.h"
+#include "LockEngine.h"
+#include "Logger.h"
+#include "ProcessInhibitor.h"
+#include "SocketControlServer.h"
+#include "Stats.h"
+#include "TextUtil.h"
+#include "TimeoutActions.h"
+#include "WorkStationLocker.h"
+
+
+static std::wstring Widen(const char *s)
+{
+    std::wstring w(strlen(s) + 1, L'\0');
+    size_t n = mbstowcs(&w[0], s, w.size());
+    w.resize(n == (size_t)-1 ? 0 : n);
+    return w;
+}
+
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: idlelock -lockcmd <command> [-timeout <minutes>] [-input <path>]\n"
+                    "                [-screensaver] [-settings <file>] [-logfile <file> [-asynclog]]\n"
+                    "                [-journal <file>] [-stats <file>] [-policy <file>]\n"
+                    "                [-control <socket>] [-warning <seconds>] [-activity <file>]\n"
+                    "                [-adaptive <minutes>] [-inhibit <program>,...]\n"
+                    "                [-inputfilter [-inputrules <file>]] [-checkpoint <file>]\n"
+                    "                [-action lock | run[:<seconds>] <command> | sleep[:<seconds>]\n"
+                    "                        | logoff[:<seconds>]]...\n"
+                    "       idlelock -status\n");
+    return 2;
+}
+
+
+static void DumpStats(const std::wstring &fileName)
+{
+    if (fileName.empty())
+        fputs(ToUtf8(TStats::Format().c_str()).c_str(), stderr);
+    else if (!TStats::Dump(fileName.c_str()))
+        fprintf(stderr, "Could not write the statistics file.\n");
+}
+
+
+// Kernel uevents, which include power supply and dock changes. Returns -1 if
+// they can't be had.
+static int OpenUeventSocket()
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_nl address = {};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;  // Kernel events.
+    if (bind(fd, (sockaddr *)&address, sizeof address) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// Returns true if any of the pending uevents is for a power supply or dock.
+static bool ReadUevents(int fd)
+{
+    bool relevant = false;
+    char buf[8192];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof buf - 1, 0)) > 0) {
+        buf[n] = 0;
+        // "action@devpath", then NUL separated KEY=value pairs.
+        for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+            if (strcmp(p, "SUBSYSTEM=power_supply") == 0 || strncmp(p, "DEVPATH=/devices/platform/dock.", 31) == 0)
+                relevant = true;
+        }
+    }
+    return relevant;
+}
+
+
+// Prints the running daemon's state, like the Windows -status.
+static int PrintStatus()
+{
+    TInstanceStatePage page;
+    TInstanceStateBlock state;
+    if (!page.Open() || !page.Read(state))
+        return 1;
+    printf("%s\n", FormatInstanceState(state, TEventJournal::TimeNow()).c_str());
+    return 0;
+}
+
+
+// An -action, as given; command is only for run.
+struct TActionSpec
+{
+    std::string kind;
+    uint32_t timeout;
+    std::string command;
+};
+
+
+// Parses "<kind>[:<seconds>]" into spec. Returns false if it's not valid.
+static bool ParseActionSpec(const char *text, TActionSpec &spec)
+{
+    const char *colon = strchr(text, ':');
+    spec.kind.assign(text, colon != NULL ? colon - text : strlen(text));
+    spec.timeout = TTimeoutAction::DefaultTimeout;
+    if (colon != NULL) {
+        char *end;
+        long seconds = strtol(colon + 1, &end, 10);
+        if (*end != 0 || end == colon + 1 || seconds < 0 || seconds > 24 * 3600 || spec.kind == "lock")
+            return false;
+        spec.timeout = uint32_t(seconds) * 1000;
+    }
+    return spec.kind == "lock" || spec.kind == "run" || spec.kind == "sleep" || spec.kind == "logoff";
+}
+
+
+static TTimeoutAction *NewAction(const TActionSpec &spec, TPlatformBackend &backend)
+{
+    if (spec.kind == "lock")
+        return new TLockAction(backend);
+    if (spec.kind == "run")
+        return new TCommandAction(L"run", Widen(spec.command.c_str()), spec.timeout);
+    if (spec.kind == "sleep")
+        return new TCommandAction(L"sleep", L"systemctl suspend", spec.timeout);
+    return new TCommandAction(L"logoff", L"loginctl terminate-session \"$XDG_SESSION_ID\"", spec.timeout);
+}
+
+
+// Sets the timer slack to the engine's tolerance for the next check, and arms
+// the resume timer for a little after the check can come at the latest.
+static void ArmCheck(int resumeFd, uint32_t delay, uint32_t tolerance)
+{
+    prctl(PR_SET_TIMERSLACK, tolerance == 0 ? 0UL : tolerance * 1000000UL);  // 0: the default.
+
+    itimerspec spec = {};
+    if (delay != 0) {
+        uint64_t ms = uint64_t(delay) + tolerance + TLockScheduler::MinWakeDelay;
+        spec.it_value.tv_sec = time_t(ms / 1000);
+        spec.it_value.tv_nsec = long(ms % 1000) * 1000000;
+    }
+    timerfd_settime(resumeFd, 0, &spec, NULL);
+}
+
+
+int main(int argc, char *argv[])
+{
+    setlocale(LC_ALL, "");
+    if (argc == 2 && strcmp(argv[1], "-status") == 0)
+        return PrintStatus();
+
+    std::string lockCommand;
+    std::string inputPath = "/dev/input";
+    std::string settingsFileName;
+    std::wstring logFileName;
+    std::wstring journalFileName;
+    std::wstring activityFileName;
+    std::wstring checkpointFileName;
+    std::wstring statsFileName;
+    std::wstring policyFileName;
+    std::wstring inputRulesFileName;
+    std::string controlPath;
+    std::vector<std::wstring> inhibitPrograms;
+    std::vector<TActionSpec> actionSpecs;
+    int timeoutMinutes = TLockEngine::DefaultTimeout / 60000;
+    int warningSeconds = 0;
+    int adaptiveMinutes = 0;
+    bool timeoutGiven = false;
+    bool requireScreenSaver = false;
+    bool asyncLog = false;
+    bool filterInput = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-lockcmd") == 0 && i + 1 < argc)
+            lockCommand = argv[++i];
+        else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc) {
+            timeoutMinutes = atoi(argv[++i]);
+            timeoutGiven = true;
+        } else if (strcmp(argv[i], "-input") == 0 && i + 1 < argc)
+            inputPath = argv[++i];
+        else if (strcmp(argv[i], "-screensaver") == 0)
+            requireScreenSaver = true;
+        else if (strcmp(argv[i], "-settings") == 0 && i + 1 < argc)
+            settingsFileName = argv[++i];
+        else if (strcmp(argv[i], "-logfile") == 0 && i + 1 < argc)
+            logFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-asynclog") == 0)
+            asyncLog = true;
+        else if (strcmp(argv[i], "-journal") == 0 && i + 1 < argc)
+            journalFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+            statsFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-policy") == 0 && i + 1 < argc)
+            policyFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-control") == 0 && i + 1 < argc)
+            controlPath = argv[++i];
+        else if (strcmp(argv[i], "-warning") == 0 && i + 1 < argc)
+            warningSeconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-activity") == 0 && i + 1 < argc)
+            activityFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc)
+            checkpointFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-adaptive") == 0 && i + 1 < argc)
+            adaptiveMinutes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-inputfilter") == 0)
+            filterInput = true;
+        else if (strcmp(argv[i], "-inputrules") == 0 && i + 1 < argc)
+            inputRulesFileName = Widen(argv[++i]);
+        else if (strcmp(argv[i], "-inhibit") == 0 && i + 1 < argc) {
+            std::wstring list = Widen(argv[++i]);
+            for (size_t start = 0; start <= list.size(); ) {
+                size_t comma = list.find(L',', start);
+                if (comma == std::wstring::npos)
+                    comma = list.size();
+                if (comma > start)
+                    inhibitPrograms.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+        } else if (strcmp(argv[i], "-action") == 0 && i + 1 < argc) {
+            TActionSpec spec;
+            if (!ParseActionSpec(argv[++i], spec) || actionSpecs.size() >= TActionPipeline::MaxActions)
+                return Usage();
+            if (spec.kind == "run") {
+                if (i + 1 >= argc)
+                    return Usage();
+                spec.command = argv[++i];
+            }
+            actionSpecs.push_back(spec);
+        } else {
+            return Usage();
+        }
+    }
+    if (lockCommand.empty() || timeoutMinutes <= 0 || warningSeconds < 0 || adaptiveMinutes < 0
+        || (!inputRulesFileName.empty() && !filterInput))
+        return Usage();
+    // The settings file would override them on its next change.
+    if (!settingsFileName.empty() && (timeoutGiven || requireScreenSaver)) {
+        fprintf(stderr, "-timeout and -screensaver can't be used with -settings; set them in the file.\n");
+        return 2;
+    }
+
+    TLogger *logger;
+    if (logFileName.empty())
+        logger = new TLogger();
+    else if (asyncLog)
+        logger = new TAsyncLogger(logFileName.c_str());
+    else
+        logger = new TLogger(logFileName.c_str());
+
+    TEventJournal journal;
+    if (!journalFileName.empty() && !journal.Open(journalFileName.c_str()))
+        logger->Log(L"Could not open journal file.");
+    TActivityLog activityLog;
+    if (!activityFileName.empty() && !activityLog.Open(activityFileName.c_str()))
+        logger->Log(L"Could not open activity file.");
+    TEngineCheckpoint checkpoint;
+    if (!checkpointFileName.empty() && !checkpoint.Open(checkpointFileName.c_str()))
+        logger->Log(L"Could not open checkpoint file.");
+
+    // Handle termination and stats dump signals synchronously, in the main loop.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    TInputFilter inputFilter;
+    if (!inputRulesFileName.empty()) {
+        std::string text, error;
+        if (!ReadWholeFile(inputRulesFileName.c_str(), text))
+            fprintf(stderr, "Could not read the input rules file.\n");
+        else if (!inputFilter.Parse(text, error))
+            fprintf(stderr, "Input rules file: %s\n", error.c_str());
+    }
+
+    TEvdevBackend backend(inputPath, lockCommand);
+    if (filterInput)
+        backend.SetInputFilter(&inputFilter);
+    if (!backend.Start()) {
+        fprintf(stderr, "No input devices could be watched in %s.\n", inputPath.c_str());
+        delete logger;
+        return 1;
+    }
+
+    // Signalled by the settings store when the file has been changed.
+    int settingsFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    std::unique_ptr<TFileSettingsStore> settingsStore;
+
+    // Signalled by the timeout actions' worker when they have reports.
+    int actionsFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    std::unique_ptr<TActionPipeline> actions(new TActionPipeline([actionsFd] {
+        uint64_t one = 1;
+        if (write(actionsFd, &one, sizeof one) != sizeof one)
+            return;
+    }));
+    for (const TActionSpec &spec : actionSpecs)
+        actions->Add(NewAction(spec, backend));
+
+    {
+        std::unique_ptr<TLockEngine> engine;
+        TWorkStationLocker *locker = NULL;
+
+        if (settingsFileName.empty()) {
+            engine.reset(new TLockEngine(backend, *logger));
+            engine->SetTimeout(timeoutMinutes * 60000);
+            engine->RequireScreensaver(requireScreenSaver);
+        } else {
+            settingsStore.reset(new TFileSettingsStore(settingsFileName));
+            settingsStore->Start([settingsFd] {
+                uint64_t one = 1;
+                if (write(settingsFd, &one, sizeof one) != sizeof one)
+                    return;
+            });
+            engine.reset(locker = new TWorkStationLocker(backend, *logger, *settingsStore));
+        }
+        if (journal.IsOpen())
+            engine->SetJournal(&journal);
+        if (activityLog.IsOpen())
+            engine->SetActivityLog(&activityLog);
+        if (checkpoint.IsOpen())
+            engine->SetCheckpoint(&checkpoint);
+        engine->SetWarningTime(uint32_t(warningSeconds) * 1000);
+        engine->SetAdaptiveTimeout(uint32_t(adaptiveMinutes) * 60000);
+        TInhibitorSet inhibitors(backend);
+        if (!inhibitPrograms.empty()) {
+            inhibitors.Add(new TProcessInhibitor(inhibitPrograms));
+            engine->SetInhibitors(&inhibitors);
+        }
+        if (!actions->Empty())
+            engine->SetActions(actions.get());
+
+        // Power supply changes also change the timer tolerance.
+        int ueventFd = OpenUeventSocket();
+        if (!policyFileName.empty()) {
+            std::string text, error;
+            TLockPolicy policy;
+            if (!ReadWholeFile(policyFileName.c_str(), text)) {
+                fprintf(stderr, "Could not read the policy file.\n");
+            } else if (!policy.Parse(text, error)) {
+                fprintf(stderr, "Policy file: %s\n", error.c_str());
+            } else {
+                engine->SetPolicy(policy);
+            }
+        }
+
+        std::unique_ptr<TSocketControlServer> control;
+        if (!controlPath.empty()) {
+            control.reset(new TSocketControlServer(*engine, *logger));
+            if (!control->Start(controlPath)) {
+                fprintf(stderr, "Could not listen on %s.\n", controlPath.c_str());
+                control.reset();
+            }
+        }
+
+        TInstanceStatePage statePage;
+        if (statePage.Create())
+            InitInstanceState(*statePage.Block(), uint32_t(getpid()), 0, true);
+        else
+            logger->Log(L"Could not create the shared state.");
+
+        int resumeFd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        const int FixedFds = 6;
+        std::vector<pollfd> fds;
+        uint32_t delay = engine->LockIfIdleTimeout();
+        uint32_t checkTick = backend.TickCount() + delay;
+        ArmCheck(resumeFd, delay, engine->TimerTolerance());
+        if (statePage.IsOpen())
+            PublishInstanceState(*statePage.Block(), *engine, delay);
+        if (control)
+            control->Publish();
+
+        for (;;) {
+            fds.assign({
+                { backend.SessionEventFd(), POLLIN, 0 },
+                { signalFd, POLLIN, 0 },
+                { settingsFd, POLLIN, 0 },
+                { ueventFd, POLLIN, 0 },  // Ignored by poll() if -1.
+                { resumeFd, POLLIN, 0 },
+                { actionsFd, POLLIN, 0 }
+            });
+            if (control)
+                control->AddPollFds(fds);
+
+            // Control requests may wake us before the check is due.
+            int timeout = -1;
+            if (delay != 0) {
+                int32_t left = int32_t(checkTick - backend.TickCount());
+                timeout = left > 0 ? left : 0;
+            }
+            int ready = poll(fds.data(), fds.size(), timeout);
+            if (ready < 0)
+                continue;
+
+            // Control requests that only read don't need a check.
+            bool check = ready == 0 || (delay != 0 && int32_t(checkTick - backend.TickCount()) <= 0);
+            for (int i = 0; i < FixedFds; i++)
+                check |= fds[i].revents != 0;
+            if (control && control->Dispatch(&fds[FixedFds]))
+                check = true;
+
+            if (fds[1].revents & POLLIN) {
+                signalfd_siginfo info;
+                if (read(signalFd, &info, sizeof info) != sizeof info || info.ssi_signo != SIGUSR1)
+                    break;
+                DumpStats(statsFileName);
+            }
+            if (fds[0].revents & POLLIN)
+                backend.DispatchSessionEvents();
+            if ((fds[3].revents & POLLIN) && ReadUevents(ueventFd))
+                engine->PolicyInputsChanged();
+            if (fds[2].revents & POLLIN) {
+                uint64_t count;
+                if (read(settingsFd, &count, sizeof count) > 0 && locker != NULL)
+                    locker->ReloadSettings();
+            }
+            if (fds[4].revents & POLLIN) {
+                uint64_t expirations;
+                if (read(resumeFd, &expirations, sizeof expirations) != sizeof expirations)
+                    logger->Log(L"Could not read the resume timer.");
+            }
+            if (fds[5].revents & POLLIN) {
+                uint64_t count;
+                if (read(actionsFd, &count, sizeof count) > 0)
+                    engine->DispatchActionReports();
+            }
+            if (backend.SleptTime() != 0) {
+                engine->Resumed();
+                check = true;
+            }
+            if (check) {
+                delay = engine->LockIfIdleTimeout();
+                checkTick = backend.TickCount() + delay;
+                ArmCheck(resumeFd, delay, engine->TimerTolerance());
+                if (statePage.IsOpen())
+                    PublishInstanceState(*statePage.Block(), *engine, delay);
+            }
+            if (control)
+                control->Publish();
+        }
+
+        if (ueventFd >= 0)
+            close(ueventFd);
+        close(resumeFd);
+    }
+
+    if (!statsFileName.empty())
+        DumpStats(statsFileName);
+
+    settingsStore.reset();
+    close(settingsFd);
+    // Waits for the action that runs, which may use the backend.
+    actions.reset();
+    close(actionsFd);
+    backend.Stop();
+    close(signalFd);
+    delete logger;
+    return 0;
+}
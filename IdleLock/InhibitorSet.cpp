@@ -0,0 +1,80 @@
+#include "InhibitorSet.h"
+
+
+void TInhibitorSource::Report(bool active)
+{
+    if (set != NULL)
+        set->Report(id, active);
+}
+
+
+bool TInhibitorSet::Add(TInhibitorSource *source)
+{
+    std::unique_ptr<TInhibitorSource> owned(source);
+    if (sources.size() >= size_t(MaxSources))
+        return false;
+
+    source->set = this;
+    source->id = int(sources.size());
+    anyPolled |= source->Polled;
+    sources.push_back(std::move(owned));
+    if (!source->Polled)
+        source->Start();
+    return true;
+}
+
+
+uint32_t TInhibitorSet::Active()
+{
+    if (anyPolled) {
+        uint32_t now = Clock.TickCount();
+        if (!polled || now - lastPoll >= PollInterval) {
+            for (auto &source : sources) {
+                if (source->Polled)
+                    Report(source->id, source->Poll());
+            }
+            polled = true;
+            lastPoll = now;
+        }
+    }
+    return active.load(std::memory_order_acquire);
+}
+
+
+bool TInhibitorSet::Released(uint32_t &tick)
+{
+    if (!released.exchange(false, std::memory_order_acquire))
+        return false;
+    tick = releasedTick.load(std::memory_order_relaxed);
+    return true;
+}
+
+
+std::wstring TInhibitorSet::Describe(uint32_t mask) const
+{
+    std::wstring names;
+    for (auto &source : sources) {
+        if (!(mask & (1u << source->id)))
+            continue;
+        if (!names.empty())
+            names += L", ";
+        names += source->Name;
+    }
+    return names;
+}
+
+
+void TInhibitorSet::Report(int id, bool on)
+{
+    uint32_t bit = 1u << id;
+    if (on) {
+        active.fetch_or(bit, std::memory_order_release);
+        return;
+    }
+
+    // Only the last one to go counts; the idle time restarts then.
+    if (active.fetch_and(~bit, std::memory_order_acq_rel) == bit) {
+        releasedTick.store(Clock.TickCount(), std::memory_order_relaxed);
+        released.store(true, std::memory_order_release);
+    }
+}
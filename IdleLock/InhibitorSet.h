@@ -0,0 +1,106 @@
+#pragma once
+
+// Sources of "don't lock now" signals, such as a presentation, a video
+// playing full screen, or a program asking the system to keep the display
+// on, and their aggregate. Event sources report their changes as they
+// happen; polled sources, whose state can only be had by asking (e.g. the
+// process list), are asked at most every PollInterval ms, and only when the
+// engine wants to know, i.e. when a warning or lock is due. The aggregate
+// is a bit mask of the active sources, so asking for it costs the same no
+// matter how many sources there are.
+//
+// While a source is active, the engine treats it like input: the idle time
+// restarts, and when the last source goes inactive it counts from then; for
+// a polled source, from the poll that found it inactive.
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "LockScheduler.h"
+
+
+class TInhibitorSet;
+
+
+class TInhibitorSource
+{
+public:
+    TInhibitorSource(const wchar_t *aName, bool aPolled = false) : Name(aName), Polled(aPolled) {}
+    virtual ~TInhibitorSource() {}
+
+    // Polled sources: whether the source is active now.
+    virtual bool Poll() { return false; }
+
+    // Event sources: called once added to a set; start watching here, and
+    // report the current state and its changes with Report().
+    virtual void Start() {}
+
+    const std::wstring Name;  // For the log.
+    const bool Polled;
+
+protected:
+    // Sets the source's state in its set. May be called on any thread.
+    void Report(bool active);
+
+private:
+    friend class TInhibitorSet;
+
+    TInhibitorSet *set = NULL;
+    int id = 0;
+};
+
+
+// An event source that is set from outside, e.g. by a simulation.
+class TManualInhibitor : public TInhibitorSource
+{
+public:
+    TManualInhibitor(const wchar_t *aName) : TInhibitorSource(aName) {}
+
+    void Set(bool active) { Report(active); }
+};
+
+
+class TInhibitorSet
+{
+public:
+    static const int      MaxSources = 32;
+    static const uint32_t PollInterval = 30000;  // ms
+
+    TInhibitorSet(TClock &clock) : Clock(clock) {}
+
+    // Takes over the source. Returns false if there are MaxSources already.
+    bool Add(TInhibitorSource *source);
+
+    bool Empty() const { return sources.empty(); }
+
+    // The mask of the active sources (bit i for the i-th source added),
+    // after polling the polled sources if they haven't been polled within
+    // PollInterval.
+    uint32_t Active();
+
+    // The tick count at which the last active source went inactive, if it
+    // did since the last call.
+    bool Released(uint32_t &tick);
+
+    // The names of the sources in the mask, separated by commas.
+    std::wstring Describe(uint32_t mask) const;
+
+    // Sets the state of the source with the given id.
+    void Report(int id, bool on);
+
+private:
+    TInhibitorSet(const TInhibitorSet &) = delete;
+    TInhibitorSet &operator=(const TInhibitorSet &) = delete;
+
+    TClock &Clock;
+    std::vector<std::unique_ptr<TInhibitorSource>> sources;
+    bool     anyPolled = false;
+    bool     polled = false;       // Whether lastPoll is valid.
+    uint32_t lastPoll = 0;
+    std::atomic<uint32_t> active{ 0 };
+    std::atomic<uint32_t> releasedTick{ 0 };
+    std::atomic<bool>     released{ false };
+};
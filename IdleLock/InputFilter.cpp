@@ -0,0 +1,179 @@
+#include "InputFilter.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "Stats.h"
+
+
+static bool ParseCount(const std::string &text, uint32_t &value)
+{
+    char *end;
+    unsigned long n = strtoul(text.c_str(), &end, 10);
+    if (text.empty() || *end != 0 || !isdigit((unsigned char)text[0]) || n > 1000000)
+        return false;
+    value = uint32_t(n);
+    return true;
+}
+
+
+static bool ParseRule(const std::vector<std::string> &fields, TDeviceRule &rule)
+{
+    if (fields.size() < 2)
+        return false;
+    rule.pattern = fields[0] == "*" ? std::string() : fields[0];
+
+    const std::string &action = fields[1];
+    if (action == "ignore" || action == "count" || action == "keys") {
+        rule.action = action == "ignore" ? DA_Ignore : action == "count" ? DA_Count : DA_KeysOnly;
+        return fields.size() == 2;
+    }
+    if (action != "move" || fields.size() < 3 || fields.size() > 4)
+        return false;
+
+    rule.action = DA_Filter;
+    rule.moveEvents = TInputFilter::DefaultMoveEvents;
+    return ParseCount(fields[2], rule.moveThreshold)
+        && (fields.size() == 3 || ParseCount(fields[3], rule.moveEvents));
+}
+
+
+bool TInputFilter::Parse(const std::string &text, std::string &error)
+{
+    std::vector<TDeviceRule> parsed;
+    size_t start = 0;
+
+    for (int lineNo = 1; start < text.size(); lineNo++) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.resize(comment);
+
+        std::vector<std::string> fields;
+        for (size_t pos = 0;;) {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos == std::string::npos)
+                break;
+            size_t fieldEnd = line.find_first_of(" \t\r", pos);
+            if (fieldEnd == std::string::npos)
+                fieldEnd = line.size();
+            std::string field = line.substr(pos, fieldEnd - pos);
+            for (char &c : field)
+                c = char(tolower((unsigned char)c));
+            fields.push_back(field);
+            pos = fieldEnd;
+        }
+        if (fields.empty())
+            continue;
+
+        TDeviceRule rule;
+        if (!ParseRule(fields, rule)) {
+            error = "Line " + std::to_string(lineNo) + ": expected <device> ignore|count|keys|move <threshold> [<events>].";
+            return false;
+        }
+        parsed.push_back(rule);
+    }
+
+    rules.swap(parsed);
+    return true;
+}
+
+
+uint16_t TInputFilter::AddDevice(const std::string &name)
+{
+    if (devices.size() >= size_t(MaxDevices))
+        return uint16_t(MaxDevices - 1);
+
+    std::string lowerName = name;
+    for (char &c : lowerName)
+        c = char(tolower((unsigned char)c));
+
+    TDevice device;
+    device.action = DA_Filter;
+    device.moveThreshold = DefaultMoveThreshold;
+    device.moveEvents = DefaultMoveEvents;
+    for (const TDeviceRule &rule : rules) {
+        if (lowerName.find(rule.pattern) != std::string::npos) {
+            device.action = rule.action;
+            device.moveThreshold = rule.moveThreshold;
+            device.moveEvents = rule.moveEvents;
+            break;
+        }
+    }
+
+    devices.push_back(device);
+    return uint16_t(devices.size() - 1);
+}
+
+
+bool TInputFilter::Process(const TInputEvent *batch, size_t count)
+{
+    uint64_t batchAccepted = 0;
+    for (size_t i = 0; i < count; i++) {
+        const TInputEvent &event = batch[i];
+        if (event.device < devices.size() && Counts(devices[event.device], event))
+            batchAccepted++;
+    }
+    events += count;
+    accepted += batchAccepted;
+    TStats::Add(SC_InputEvents, count);
+    TStats::Add(SC_InputAccepted, batchAccepted);
+    return batchAccepted != 0;
+}
+
+
+bool TInputFilter::Counts(TDevice &device, const TInputEvent &event)
+{
+    if (event.kind == IK_Other || device.action == DA_Ignore)
+        return false;
+    if (device.action == DA_Count)
+        return true;
+
+    switch (event.kind) {
+    case IK_Key:
+        device.keyDownTime = event.time;
+        return true;
+
+    case IK_KeyRepeat:
+        // Unsigned, so this holds across the wraparound of the time.
+        return event.time - device.keyDownTime < MaxRepeatTime;
+
+    case IK_Move:
+        break;
+
+    default:
+        return true;
+    }
+
+    if (device.action == DA_KeysOnly) {
+        rejectedMoves++;
+        return false;
+    }
+
+    // A movement starts with the first move after a pause, or after the
+    // previous one was long enough to count.
+    if (device.moves == 0 || event.time - device.windowStart > MoveWindow) {
+        device.windowStart = event.time;
+        device.sumX = device.sumY = 0;
+        device.moves = 0;
+    }
+    // evdev reports x and y as separate events of the same time.
+    if (device.moves == 0 || event.time != device.lastMoveTime)
+        device.moves++;
+    device.lastMoveTime = event.time;
+    device.sumX += event.dx;
+    device.sumY += event.dy;
+
+    if (uint32_t(abs(device.sumX)) + uint32_t(abs(device.sumY)) < device.moveThreshold
+        || device.moves < device.moveEvents) {
+        rejectedMoves++;
+        return false;
+    }
+    device.moves = 0;
+    return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// Platform neutral filter that decides which raw keyboard and mouse events
+// are user activity. Any input resets the system's idle time, so a mouse
+// that drifts or twitches on the desk, or a mouse jiggler, keeps the
+// session from ever locking. Events are handed over in batches, as read
+// from the devices, on the thread that reads them; only the answer whether
+// the batch had activity needs to reach the engine.
+//
+// Keys, buttons and the wheel count. Movement only counts once a device has
+// moved at least the threshold (in device counts, |dx| + |dy| of the sum)
+// within MoveWindow ms, in at least the given number of reports (moves of
+// the same ms count as one), so jitter that goes back and forth, and single
+// jumps as a jiggler makes them, don't.
+// Key repeats count for MaxRepeatTime after the key went down, so a stuck
+// key doesn't either.
+//
+// Rules by device have one line each; the first one whose pattern matches
+// applies, and devices without a matching rule get the defaults:
+//
+//   <pattern> ignore                        nothing from the device counts
+//   <pattern> count                         everything counts, unfiltered
+//   <pattern> keys                          only keys, buttons and the wheel
+//   <pattern> move <threshold> [<events>]   moves count as described above
+//
+// pattern is * or a part of the device name without spaces, without regard
+// to case (the device path on Windows, e.g. \\?\HID#VID_046D&PID_C52B...,
+// or the evdev name and path on Linux); "injected" is the name of input
+// synthesized by programs on Windows, which has no device. Everything after
+// a # is a comment.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+enum TInputKind : uint8_t
+{
+    IK_Key,         // Down; ups don't count.
+    IK_KeyRepeat,
+    IK_Button,      // Down.
+    IK_Wheel,
+    IK_Move,        // Relative, by dx, dy.
+    IK_Other        // Ups, sync and the like, which never count.
+};
+
+
+struct TInputEvent
+{
+    uint32_t   time;    // ms, of any base; only differences matter.
+    uint16_t   device;  // From AddDevice().
+    TInputKind kind;
+    int32_t    dx;
+    int32_t    dy;
+};
+
+
+enum TDeviceAction : uint8_t
+{
+    DA_Filter,      // The movement rules.
+    DA_Ignore,
+    DA_Count,
+    DA_KeysOnly
+};
+
+
+struct TDeviceRule
+{
+    std::string   pattern;  // Lower case; empty matches any device.
+    TDeviceAction action = DA_Filter;
+    uint32_t      moveThreshold = 0;
+    uint32_t      moveEvents = 0;
+};
+
+
+class TInputFilter
+{
+public:
+    static const uint32_t DefaultMoveThreshold = 16;  // Device counts.
+    static const uint32_t DefaultMoveEvents = 3;
+    static const uint32_t MoveWindow = 500;           // ms
+    static const uint32_t MaxRepeatTime = 10000;      // ms
+    static const int      MaxDevices = 256;
+
+    // Replaces the rules with those in text. On failure, the rules are left
+    // unchanged and error tells which line is wrong. Applies to devices
+    // added after it.
+    bool Parse(const std::string &text, std::string &error);
+
+    // Returns the id for events from the named device, which gets the first
+    // matching rule. Devices beyond MaxDevices share the last id.
+    uint16_t AddDevice(const std::string &name);
+
+    // Returns true if any of the events is activity.
+    bool Process(const TInputEvent *events, size_t count);
+
+    uint64_t Events() const { return events; }
+    uint64_t Accepted() const { return accepted; }
+    uint64_t RejectedMoves() const { return rejectedMoves; }
+    size_t   Devices() const { return devices.size(); }
+
+private:
+    struct TDevice
+    {
+        TDeviceAction action;
+        uint32_t moveThreshold;
+        uint32_t moveEvents;
+        uint32_t windowStart = 0;   // Of the current movement.
+        int32_t  sumX = 0;
+        int32_t  sumY = 0;
+        uint32_t moves = 0;         // Reports in the current movement.
+        uint32_t lastMoveTime = 0;
+        uint32_t keyDownTime = 0;
+    };
+
+    bool Counts(TDevice &device, const TInputEvent &event);
+
+    std::vector<TDeviceRule> rules;
+    std::vector<TDevice> devices;
+    uint64_t events = 0;
+    uint64_t accepted = 0;
+    uint64_t rejectedMoves = 0;
+};
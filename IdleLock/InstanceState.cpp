@@ -0,0 +1,135 @@
+#include "InstanceState.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#include "EventJournal.h"
+#include "LockEngine.h"
+
+
+// What the seqlock covers, and what it doesn't: the header, which is only
+// written before the block is published, and the sequence itself.
+static const size_t StateOffset = offsetof(TInstanceStateBlock, pid);
+
+// The sequence is a plain field, so that the block can be copied, and is
+// accessed as an atomic, which has the same size and is lock-free.
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Atomic sequence has a different size.");
+
+
+static std::atomic<uint32_t> &Sequence(TInstanceStateBlock &block)
+{
+    return *reinterpret_cast<std::atomic<uint32_t> *>(&block.sequence);
+}
+
+
+static const std::atomic<uint32_t> &Sequence(const TInstanceStateBlock &block)
+{
+    return *reinterpret_cast<const std::atomic<uint32_t> *>(&block.sequence);
+}
+
+
+void InitInstanceState(TInstanceStateBlock &block, uint32_t pid, uint64_t window, bool headless)
+{
+    TInstanceStateBlock state = {};
+    state.pid = pid;
+    state.window = window;
+    state.flags = headless ? IF_Headless : 0;
+    state.startedTime = state.updatedTime = TEventJournal::TimeNow();
+    WriteInstanceState(block, state);
+
+    // Readers check the header after copying, so it can come last.
+    memcpy(block.magic, InstanceStateMagic, sizeof block.magic);
+    block.version = InstanceStateVersion;
+    block.size = sizeof block;
+}
+
+
+void WriteInstanceState(TInstanceStateBlock &block, const TInstanceStateBlock &state)
+{
+    std::atomic<uint32_t> &sequence = Sequence(block);
+    uint32_t start = sequence.load(std::memory_order_relaxed) | 1;
+
+    // Odd before any of the fields change.
+    sequence.store(start, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy((char *)&block + StateOffset, (const char *)&state + StateOffset, sizeof block - StateOffset);
+    sequence.store(start + 1, std::memory_order_release);
+}
+
+
+void PublishInstanceState(TInstanceStateBlock &block, TLockEngine &engine, uint32_t nextCheck)
+{
+    // Only we write, so our own reads need no retries.
+    TInstanceStateBlock state = block;
+    bool locked = engine.IsLocked();
+    state.flags = (block.flags & IF_Headless) | (engine.Enabled() ? IF_Enabled : 0) | (locked ? IF_Locked : 0)
+        | (engine.IsScreenSaverRequired() ? IF_RequireScreenSaver : 0) | (engine.Warning() ? IF_Warning : 0)
+        | (engine.InhibitedBy() != 0 ? IF_Inhibited : 0);
+    state.timeout = uint32_t(engine.GetTimeout());
+    state.effectiveTimeout = engine.EffectiveTimeout();
+    state.warningTime = engine.GetWarningTime();
+    state.idleTime = engine.IdleTime();
+    state.lockIn = engine.Enabled() && !locked ? engine.Scheduler().TimeUntilDeadline() : 0;
+    state.nextCheck = nextCheck;
+    state.checks = engine.Scheduler().Wakeups();
+    state.locks = engine.Scheduler().LockLatency().Count();
+    state.updatedTime = TEventJournal::TimeNow();
+    WriteInstanceState(block, state);
+}
+
+
+bool ReadInstanceState(const TInstanceStateBlock &block, TInstanceStateBlock &copy, uint32_t *attempts)
+{
+    const std::atomic<uint32_t> &sequence = Sequence(block);
+
+    for (uint32_t attempt = 1; attempt <= InstanceStateReadAttempts; attempt++) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        if ((before & 1) == 0) {
+            memcpy(&copy, &block, sizeof copy);
+            // The copy must be complete before the sequence is looked at again.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                copy.sequence = before;
+                if (attempts != NULL)
+                    *attempts = attempt;
+                return true;
+            }
+        }
+        // The instance is in the middle of an update, which takes well
+        // under a microsecond, unless it was preempted.
+        if (attempt % 16 == 0)
+            std::this_thread::yield();
+    }
+    if (attempts != NULL)
+        *attempts = InstanceStateReadAttempts;
+    return false;
+}
+
+
+bool InstanceStateValid(const TInstanceStateBlock &block)
+{
+    return memcmp(block.magic, InstanceStateMagic, sizeof block.magic) == 0
+        && block.version == InstanceStateVersion && block.size == sizeof block && block.pid != 0;
+}
+
+
+std::string FormatInstanceState(const TInstanceStateBlock &block, int64_t now)
+{
+    // What has passed since the update, but not more than is left.
+    int64_t age = now > block.updatedTime ? now - block.updatedTime : 0;
+    uint32_t lockIn = block.lockIn == 0 ? 0 : block.lockIn > age ? uint32_t(block.lockIn - age) : 1;
+    uint32_t nextCheck = block.nextCheck == 0 ? 0 : block.nextCheck > age ? uint32_t(block.nextCheck - age) : 1;
+
+    char buf[320];
+    snprintf(buf, sizeof buf, "pid=%u enabled=%d timeout=%u effective=%u screensaver=%d warning=%u locked=%d "
+        "warning_on=%d headless=%d inhibited=%d lockin=%u nextcheck=%u idle=%u checks=%llu locks=%llu age=%lld",
+        block.pid, (block.flags & IF_Enabled) != 0, block.timeout / 60000, block.effectiveTimeout / 60000,
+        (block.flags & IF_RequireScreenSaver) != 0, block.warningTime / 1000, (block.flags & IF_Locked) != 0,
+        (block.flags & IF_Warning) != 0, (block.flags & IF_Headless) != 0,
+        (block.flags & IF_Inhibited) != 0, lockIn, nextCheck, block.idleTime,
+        (unsigned long long)block.checks, (unsigned long long)block.locks, (long long)age);
+    return buf;
+}
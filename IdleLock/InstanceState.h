@@ -0,0 +1,87 @@
+#pragma once
+
+// The live state of the running instance, in a small block of shared memory
+// that later launches, status bars and agents can read without asking the
+// instance for it, and without a system call per read (see
+// InstanceStatePage.h for where the block lives). The instance rewrites the
+// block after every check and session change.
+// The block is a seqlock: the instance makes sequence odd before it writes,
+// and even again after, so a reader that copies the block, and finds the
+// same even sequence before and after, has a copy of one update. Readers
+// never write, so any number of them can't hold up the instance, and the
+// instance never waits for them. ReadInstanceState() does that.
+// Bump InstanceStateVersion on any change to the layout.
+
+#include <stdint.h>
+#include <string>
+
+
+class TLockEngine;
+
+
+static const uint32_t InstanceStateVersion = 2;
+static const char     InstanceStateMagic[8] = { 'I', 'D', 'L', 'S', 'T', 'A', 'T', 0 };
+
+
+// Flags
+static const uint32_t IF_Enabled = 0x01;
+static const uint32_t IF_Locked = 0x02;
+static const uint32_t IF_RequireScreenSaver = 0x04;
+static const uint32_t IF_Warning = 0x08;
+static const uint32_t IF_Headless = 0x10;
+static const uint32_t IF_Inhibited = 0x20;
+
+
+struct TInstanceStateBlock
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint32_t sequence;          // Odd while the instance writes; twice the updates.
+    uint32_t pid;               // 0 once the instance has exited.
+    uint32_t flags;             // IF_*
+    uint32_t reserved0;
+    uint64_t window;            // The instance's window (HWND), for handing it a command line.
+    int64_t  startedTime;       // ms since 1970-01-01 UTC.
+    int64_t  updatedTime;       // ms since 1970-01-01 UTC, of the last update.
+    uint32_t timeout;           // ms, as set.
+    uint32_t effectiveTimeout;  // ms, after the policy and the adaptive timeout.
+    uint32_t warningTime;       // ms
+    uint32_t idleTime;          // ms, as of the last check.
+    uint32_t lockIn;            // ms from updatedTime until a lock is due, 0 if not known.
+    uint32_t nextCheck;         // ms from updatedTime until the next check, 0 if none is due.
+    uint64_t checks;
+    uint64_t locks;             // Requested by the engine.
+    uint8_t  reserved[32];
+};
+
+static_assert(sizeof(TInstanceStateBlock) == 128, "Instance state layout changed.");
+
+
+// How often ReadInstanceState() tries before it gives up on an instance
+// that keeps writing.
+static const uint32_t InstanceStateReadAttempts = 1000;
+
+
+// Sets up the block for the instance with the given process id and window.
+void InitInstanceState(TInstanceStateBlock &block, uint32_t pid, uint64_t window, bool headless);
+
+// Writes everything after the sequence from state into the shared block,
+// as one update. Only the instance writes.
+void WriteInstanceState(TInstanceStateBlock &block, const TInstanceStateBlock &state);
+
+// Writes the engine's state into the block; nextCheck is the delay that the
+// last LockIfIdleTimeout() returned.
+void PublishInstanceState(TInstanceStateBlock &block, TLockEngine &engine, uint32_t nextCheck);
+
+// Copies one update of the shared block into copy. Returns false if the
+// instance was writing at every attempt. With attempts, also returns how
+// many it took.
+bool ReadInstanceState(const TInstanceStateBlock &block, TInstanceStateBlock &copy, uint32_t *attempts = NULL);
+
+// True if the block is in the current layout and its instance is running.
+bool InstanceStateValid(const TInstanceStateBlock &block);
+
+// The state as a line of name=value pairs, with the times until the lock
+// and the next check counted to now (ms since 1970-01-01 UTC).
+std::string FormatInstanceState(const TInstanceStateBlock &block, int64_t now);
@@ -0,0 +1,166 @@
+#include "InstanceStatePage.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "TextUtil.h"
+#endif
+
+
+bool TInstanceStatePage::Read(TInstanceStateBlock &state, uint32_t *attempts) const
+{
+    return block != NULL && ReadInstanceState(*block, state, attempts) && InstanceStateValid(state);
+}
+
+
+#ifdef _WIN32
+
+std::wstring TInstanceStatePage::DefaultName()
+{
+    return L"Local\\IdleLock.State";
+}
+
+
+bool TInstanceStatePage::Create(const std::wstring &name, int)
+{
+    Close();
+
+    // Backed by the paging file; gone when the last handle is closed.
+    hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(TInstanceStateBlock), name.c_str());
+    if (hMapping != NULL)
+        block = (TInstanceStateBlock *)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, sizeof(TInstanceStateBlock));
+    if (block == NULL) {
+        Close();
+        return false;
+    }
+    owner = true;
+    return true;
+}
+
+
+bool TInstanceStatePage::Open(const std::wstring &name)
+{
+    Close();
+
+    hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+    if (hMapping != NULL)
+        block = (TInstanceStateBlock *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, sizeof(TInstanceStateBlock));
+    if (block == NULL) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+
+void TInstanceStatePage::Close()
+{
+    if (block != NULL) {
+        // A reader that still has the block open sees that we're gone.
+        if (owner) {
+            TInstanceStateBlock state = *block;
+            state.pid = 0;
+            WriteInstanceState(*block, state);
+        }
+        UnmapViewOfFile(block);
+    }
+    if (hMapping != NULL)
+        CloseHandle(hMapping);
+
+    block = NULL;
+    hMapping = NULL;
+    owner = false;
+}
+
+#else
+
+std::wstring TInstanceStatePage::DefaultName()
+{
+    return L"/idlelock." + std::to_wstring(getuid());
+}
+
+
+// The name is predictable and /dev/shm open to all, so an object that
+// another user made, or could write to, may hold forged state.
+static bool Trusted(int fd, int mode)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && st.st_uid == getuid() && (st.st_mode & 022 & ~mode_t(mode)) == 0;
+}
+
+
+bool TInstanceStatePage::Create(const std::wstring &aName, int mode)
+{
+    Close();
+
+    // Not O_EXCL: the object outlives an instance that was killed. One that
+    // can't be trusted is removed and made anew, which fails if someone
+    // else's can't be removed.
+    std::string fName = ToUtf8(aName.c_str());
+    int fd = shm_open(fName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, mode_t(mode));
+    if (fd >= 0 && !Trusted(fd, mode)) {
+        close(fd);
+        shm_unlink(fName.c_str());
+        fd = shm_open(fName.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode_t(mode));
+    }
+    if (fd < 0)
+        return false;
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(TInstanceStateBlock)) == 0)
+        p = mmap(NULL, sizeof(TInstanceStateBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    block = (TInstanceStateBlock *)p;
+    owner = true;
+    name = aName;
+    return true;
+}
+
+
+bool TInstanceStatePage::Open(const std::wstring &aName)
+{
+    Close();
+
+    int fd = shm_open(ToUtf8(aName.c_str()).c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    // Only the user's own instance is believed. A block that is being
+    // created may not have its size yet.
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_uid == getuid() && size_t(st.st_size) >= sizeof(TInstanceStateBlock))
+        p = mmap(NULL, sizeof(TInstanceStateBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    block = (TInstanceStateBlock *)p;
+    return true;
+}
+
+
+void TInstanceStatePage::Close()
+{
+    if (block != NULL) {
+        // A reader that still has the block mapped sees that we're gone.
+        if (owner) {
+            TInstanceStateBlock state = *block;
+            state.pid = 0;
+            WriteInstanceState(*block, state);
+            shm_unlink(ToUtf8(name.c_str()).c_str());
+        }
+        munmap(block, sizeof(TInstanceStateBlock));
+    }
+
+    block = NULL;
+    owner = false;
+    name.clear();
+}
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+// Where the instance state block (InstanceState.h) lives: a named shared
+// memory object, Local\IdleLock.State in the session's namespace on
+// Windows, and /idlelock.<uid> (POSIX shared memory, in /dev/shm) for the
+// user on Linux. The instance creates it; readers open it read-only, and
+// keep it mapped, so that each sample is a copy of 128 bytes and nothing
+// else. This, InstanceState.cpp and its includes are the reader library;
+// e.g. a status bar:
+//
+//   TInstanceStatePage page;
+//   TInstanceStateBlock state;
+//   if (page.Open() && page.Read(state))
+//       ... state.flags & IF_Locked, state.lockIn ...
+//
+// The page stays usable when the instance exits, and says so (pid 0); a
+// new instance creates a new one, so reopen when Read() fails.
+
+#include <string>
+
+#include "InstanceState.h"
+
+
+class TInstanceStatePage
+{
+public:
+    TInstanceStatePage() {}
+    ~TInstanceStatePage() { Close(); }
+
+    // The session's (Windows) or user's (Linux) block.
+    static std::wstring DefaultName();
+
+    // For the instance: creates the block, or takes over one left behind,
+    // and maps it for writing. On Linux, mode is the permissions of the
+    // object; others may read it by default, like the status it replaces.
+    // An object of another user's, or that others may write to beyond mode,
+    // is replaced, or if it can't be removed, not used.
+    bool Create(const std::wstring &name = DefaultName(), int mode = 0644);
+
+    // For readers: maps an existing block read-only, if it is the user's.
+    bool Open(const std::wstring &name = DefaultName());
+
+    // Unmaps the block. The instance also marks it as exited, and on Linux
+    // removes the name, so that later readers don't find it.
+    void Close();
+
+    bool IsOpen() const { return block != NULL; }
+
+    // The instance's block, to write with WriteInstanceState() and
+    // PublishInstanceState(); NULL for readers.
+    TInstanceStateBlock *Block() const { return owner ? block : NULL; }
+
+    // Copies one update of the block, if it is in the current layout and
+    // its instance runs. With attempts, also returns how many it took.
+    bool Read(TInstanceStateBlock &state, uint32_t *attempts = NULL) const;
+
+private:
+    TInstanceStatePage(const TInstanceStatePage &) = delete;
+    TInstanceStatePage &operator=(const TInstanceStatePage &) = delete;
+
+    TInstanceStateBlock *block = NULL;
+    bool     owner = false;
+#ifdef _WIN32
+    void    *hMapping = NULL;
+#else
+    std::wstring name;  // To remove, for the instance.
+#endif
+};
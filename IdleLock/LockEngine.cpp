@@ -0,0 +1,534 @@
+#include "LockEngine.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "Stats.h"
+
+
+TLockEngine::TLockEngine(TPlatformBackend &backend, TLogger &logger)
+    : Backend(backend), Logger(logger), scheduler(backend)
+{
+    Backend.StartSessionEvents(*this);
+    displayEvents = Backend.StartDisplayEvents(*this);
+    onBattery = Backend.PowerSource() == PS_Battery;
+}
+
+
+TLockEngine::~TLockEngine()
+{
+    Backend.StopSessionEvents();
+    Backend.StopDisplayEvents();
+    Journal(JE_Stopped);
+
+    // The current minute's sample would have come after this.
+    if (activityLog != NULL && !isLocked)
+        SampleActivity(0);
+
+    const TLatencyHistogram &latency = scheduler.LockLatency();
+    wchar_t buf[200];
+    swprintf(buf, sizeof buf / sizeof buf[0], L"Checks: %llu, locks: %llu, lock latency ms mean/p99/max: %u/%u/%u.",
+        (unsigned long long)scheduler.Wakeups(), (unsigned long long)latency.Count(),
+        latency.Mean(), latency.Percentile(99), latency.Max());
+    Logger.Log(buf);
+}
+
+
+uint32_t TLockEngine::LockIfIdleTimeout()
+{
+    uint32_t delay = CheckIdleTimeout();
+    if (activityLog != NULL && !isLocked)
+        delay = SampleActivity(delay);
+    Checkpoint();
+    return delay;
+}
+
+
+uint32_t TLockEngine::CheckIdleTimeout()
+{
+    timerTolerance = 0;
+
+    // Nothing to do until re-enabled or unlocked.
+    if (!enabled || isLocked) {
+        UpdateWarning(false);
+        return 0;
+    }
+
+    TStats::Add(SC_Checks);
+    TStatScope scope(ST_Check);
+    scheduler.ReportWakeup();
+    UpdateIdleTime();
+
+    // The user came back while, or after, the timeout actions ran.
+    if (actionsStarted && idleTime < lockIdleTime)
+        CancelActions();
+
+    if (screenSaverActiveAt == 0 && !displayEvents)
+        TStats::Add(SC_ScreenSaverQueries);
+
+    // Indicate that screensaver has been started.
+    // If the monitor goes into power save mode, ScreenSaverRunning() will
+    // return false, so we need to remember that the screensaver was actually 
+    // activated at some point. With display events, ScreenBlanked() does this
+    // as it happens, also when the display turns off without a screensaver.
+    if (screenSaverActiveAt == 0 && !displayEvents && Backend.ScreenSaverRunning()) {
+        Logger.Log(L"Screensaver start detected.");
+        screenSaverActiveAt = idleTime != 0 ? idleTime : 1;  // 0 is "not seen".
+        Journal(JE_ScreenSaverStarted);
+    }
+    // If there have been events since the last ativation of the screensaver,
+    // we're no longer in screensaver/moniton power save mode, so clear
+    // screensaver status.
+    else if (idleTime < screenSaverActiveAt) {
+        screenSaverActiveAt = 0;
+        Journal(JE_ScreenSaverCleared);
+    }
+
+    uint32_t timeout = idleTimeout;
+    bool screenSaverRequired = requireScreenSaver;
+    uint32_t policyDelay = 0;
+    if (!ApplyPolicy(timeout, screenSaverRequired, policyDelay)) {
+        UpdateWarning(false);
+        timerTolerance = TLockScheduler::Tolerance(policyDelay, onBattery);
+        Journal(JE_Check, LR_None, policyDelay);
+        return policyDelay;
+    }
+    baseTimeout = timeout;
+    if (adaptive.Enabled())
+        timeout = adaptive.Timeout(timeout);
+    effectiveTimeout = timeout;
+
+    uint32_t threshold = TLockScheduler::LockThreshold(timeout);
+
+    // A warning that would take up most of the timeout is shortened.
+    uint32_t warningLength = warningTime < threshold / 2 ? warningTime : threshold / 2;
+    if (inhibitors != NULL)
+        ApplyInhibitors(idleTime + warningLength >= threshold);
+
+    bool screenSaverOk = !screenSaverRequired || screenSaverActiveAt != 0;
+
+    // Lock if timeout, but never sooner than after 60 sec as a safeguard.
+    // If the wrkstn is already locked, Win7 sometimes cancels the screensaver,
+    // which is why we never get here when isLocked.
+    if (idleTime >= threshold && screenSaverOk && actionsStarted) {
+        // They have had their run for this idle time.
+        timerTolerance = TLockScheduler::Tolerance(TLockScheduler::PollInterval, onBattery);
+        return TLockScheduler::PollInterval;
+    }
+    if (idleTime >= threshold && screenSaverOk) {
+        uint32_t dueIdleTime = std::max(threshold, screenSaverActiveAt);
+        scheduler.ReportLock(idleTime, dueIdleTime);
+        Journal(JE_LockRequested,
+            screenSaverRequired ? LR_IdleTimeoutScreenSaver : LR_IdleTimeout,
+            idleTime - dueIdleTime);
+        TStats::Add(SC_LockRequests);
+        lockRequested = true;
+        lockIdleTime = idleTime;
+        if (actions != NULL) {
+            // The warning ends here, whether the actions lock or not.
+            actionsStarted = true;
+            warning = false;
+            if (!actions->Start())
+                Logger.Log(L"Could not start the timeout actions: the last ones still run.");
+        } else if (!Backend.LockSession()) {
+            Logger.Log(L"Could not lock the session.");
+        }
+        // Check again in case the lock doesn't happen. Once the session lock
+        // has been reported, the next check stops the timer.
+        timerTolerance = TLockScheduler::Tolerance(TLockScheduler::PollInterval, onBattery);
+        return TLockScheduler::PollInterval;
+    }
+
+    uint32_t delay = scheduler.Schedule(idleTime, timeout, screenSaverOk, warningLength);
+    UpdateWarning(screenSaverOk && warningLength != 0 && idleTime + warningLength >= threshold);
+
+    // Past the timeout and waiting for the screensaver: with display events,
+    // its start wakes us up, so there's no need to poll for it.
+    if (displayEvents && !screenSaverOk && idleTime >= threshold)
+        delay = 0;
+
+    // Also wake up when the policy may switch to a shorter timeout.
+    if (policyDelay != 0 && (delay == 0 || policyDelay < delay))
+        delay = policyDelay < TLockScheduler::MinWakeDelay ? TLockScheduler::MinWakeDelay : policyDelay;
+
+    if (!(screenSaverOk && warningLength != 0))
+        timerTolerance = TLockScheduler::Tolerance(delay, onBattery);
+    Journal(JE_Check, LR_None, delay);
+    return delay;
+}
+
+
+// Uses the last input tick rather than idleTime, which may count from an
+// unlock or resume without input. The next sample is timed to come before
+// the end of the current minute (or the next one, if this is that sample),
+// even if the timer is as late as its tolerance allows: input in a minute
+// is then seen unless it all came after the sample. A sample after the end
+// would miss the whole minute whenever the next one starts with input. The
+// countdown during the warning already checks every second.
+uint32_t TLockEngine::SampleActivity(uint32_t delay)
+{
+    int64_t now = Backend.LocalTime();
+    int64_t lastInput = now - int64_t(Backend.TickCount() - Backend.LastInputTick());
+    if (lastInput >= activitySampledAt)
+        activityLog->Mark(AM_Active, lastInput);
+    activitySampledAt = now;
+
+    // A sample this close to the end is the one the minute was scheduled for.
+    uint32_t minuteEnd = uint32_t(60000 - (now % 60000 + 60000) % 60000);
+    if (minuteEnd < TLockScheduler::Tolerance(60000, onBattery) + 2 * TLockScheduler::MinWakeDelay)
+        minuteEnd += 60000;
+    uint32_t tolerance = TLockScheduler::Tolerance(minuteEnd, onBattery);
+    uint32_t sampleDelay = minuteEnd - tolerance - TLockScheduler::MinWakeDelay;
+
+    // Whichever check comes first, it must not be later than either allows;
+    // the one that starts the warning has no tolerance at all.
+    if (!warning) {
+        uint32_t latest = sampleDelay + tolerance;
+        if (delay != 0 && delay + timerTolerance < latest)
+            latest = delay + timerTolerance;
+        if (delay == 0 || sampleDelay < delay)
+            delay = sampleDelay;
+        timerTolerance = latest - delay;
+    }
+    return delay;
+}
+
+
+void TLockEngine::IdleLockEnded()
+{
+    uint32_t lockedTime = Backend.TickCount() - lockedTick;
+    bool falseLock = lockedTime <= TAdaptiveTimeout::FalseLockTime;
+    if (falseLock) {
+        wchar_t buf[100];
+        swprintf(buf, sizeof buf / sizeof buf[0], L"False lock: unlocked after %u seconds.", lockedTime / 1000);
+        Logger.Log(buf);
+        Journal(JE_FalseLock, LR_None, lockedTime);
+    }
+    if (!adaptive.Enabled())
+        return;
+
+    uint32_t before = adaptive.Timeout(baseTimeout);
+    adaptive.LockEnded(baseTimeout, lockIdleTime, lockedTime);
+    uint32_t after = adaptive.Timeout(baseTimeout);
+    if (after != before) {
+        wchar_t buf[100];
+        swprintf(buf, sizeof buf / sizeof buf[0], L"Adaptive timeout: %u:%02u minutes, %.0f%% false locks.",
+            after / 60000, after / 1000 % 60, adaptive.FalseLockShare() * 100);
+        Logger.Log(buf);
+        Journal(JE_TimeoutAdapted, LR_None, after);
+    }
+}
+
+
+void TLockEngine::Suspending()
+{
+    Logger.Log(L"Suspending.");
+    UpdateWarning(false);
+    Journal(JE_Suspended);
+}
+
+
+void TLockEngine::Resumed()
+{
+    Logger.Log(L"Resumed.");
+    unlockedTick = Backend.TickCount();
+    unlockedTickValid = true;
+    screenSaverActiveAt = 0;
+    UpdateWarning(false);
+    Journal(JE_Resumed);
+    Checkpoint();
+}
+
+
+void TLockEngine::UpdateIdleTime()
+{
+    // Get idle time, counting from the last input, or from the unlock if that
+    // was later. Tick counts wrap around after about 49.7 days, so compare
+    // elapsed times (modulo 2^32) rather than tick counts. The unlock tick only
+    // matters until there's input after it; forget it then, before it ages
+    // enough to alias.
+    uint32_t systemUpticks = Backend.TickCount();
+    idleTime = systemUpticks - Backend.LastInputTick();
+    TStats::Add(SC_LastInputQueries);
+
+    if (unlockedTickValid) {
+        uint32_t sinceUnlock = systemUpticks - unlockedTick;
+        if (sinceUnlock <= idleTime)
+            idleTime = sinceUnlock;
+        else
+            unlockedTickValid = false;
+    }
+}
+
+
+// The sources are only asked when a warning or the lock is due, which keeps
+// polled ones off the other checks; an inhibitor that ended is taken at
+// every check, before its tick count can age. Like after an unlock, the idle
+// time then counts from the end, or from now while one is active.
+void TLockEngine::ApplyInhibitors(bool due)
+{
+    uint32_t now = Backend.TickCount();
+    uint32_t start = now;
+    uint32_t active = due ? inhibitors->Active() : 0;
+    if (active != 0) {
+        if (active != inhibitedBy) {
+            std::wstring text = L"Lock inhibited by " + inhibitors->Describe(active) + L".";
+            Logger.Log(text.c_str());
+            Journal(JE_Inhibited, LR_None, active);
+            inhibitedBy = active;
+        }
+    } else {
+        if (!inhibitors->Released(start))
+            return;
+        if (inhibitedBy != 0) {
+            Logger.Log(L"Lock no longer inhibited.");
+            Journal(JE_InhibitionEnded);
+            inhibitedBy = 0;
+        }
+    }
+
+    uint32_t since = now - start;
+    if (since >= idleTime)
+        return;
+    idleTime = since;
+    unlockedTick = start;
+    unlockedTickValid = true;
+
+    // A screensaver that started while inhibited is still running.
+    if (screenSaverActiveAt > idleTime)
+        screenSaverActiveAt = idleTime != 0 ? idleTime : 1;
+}
+
+
+void TLockEngine::SetCheckpoint(TEngineCheckpoint *aCheckpoint)
+{
+    checkpoint = aCheckpoint;
+
+    TCheckpointState saved;
+    if (checkpoint != NULL && checkpoint->Load(saved))
+        RestoreCheckpoint(saved);
+
+    // Saved once now, whatever was restored, so that the file holds this
+    // run's state from the start. No flags are all set.
+    checkpointed = TCheckpointState();
+    checkpointed.flags = UINT32_MAX;
+    Checkpoint();
+}
+
+
+void TLockEngine::Checkpoint()
+{
+    if (checkpoint == NULL)
+        return;
+
+    // Only changes are saved, so checks that change nothing cost a compare.
+    uint32_t flags = (isLocked ? CF_Locked : 0) | (idleLocked ? CF_IdleLocked : 0)
+        | (unlockedTickValid ? CF_UnlockedTickValid : 0);
+    if (flags == checkpointed.flags && unlockedTick == checkpointed.unlockedTick
+        && screenSaverActiveAt == checkpointed.screenSaverActiveAt && lockedTick == checkpointed.lockedTick
+        && lockIdleTime == checkpointed.lockIdleTime)
+        return;
+
+    TCheckpointState state = {};
+    state.savedTime = Backend.LocalTime();
+    state.savedTick = Backend.TickCount();
+    state.lastInputTick = Backend.LastInputTick();
+    state.flags = flags;
+    state.unlockedTick = unlockedTick;
+    state.screenSaverActiveAt = screenSaverActiveAt;
+    state.lockedTick = lockedTick;
+    state.lockIdleTime = lockIdleTime;
+    checkpoint->Save(state);
+    checkpointed = state;
+    TStats::Add(SC_Checkpoints);
+}
+
+
+void TLockEngine::RestoreCheckpoint(const TCheckpointState &saved)
+{
+    // The tick count starts over when the system does, and then hasn't kept
+    // pace with the clock. A checkpoint more than 49.7 days old, or from
+    // before a daylight saving time change, fails this too.
+    uint32_t tick = Backend.TickCount();
+    int64_t now = Backend.LocalTime();
+    uint32_t age = tick - saved.savedTick;
+    int64_t drift = now - saved.savedTime - int64_t(age);
+    if (now < saved.savedTime || drift > CheckpointClockSlack || drift < -CheckpointClockSlack) {
+        Logger.Log(L"Checkpoint is from before a restart of the system, not restored.");
+        return;
+    }
+
+    TSessionState session = Backend.SessionState();
+    bool wasLocked = (saved.flags & CF_Locked) != 0;
+    bool locked = session == SS_Unknown ? wasLocked : session == SS_Locked;
+    if (locked) {
+        // Whether we locked it, and when, is only known if it was locked
+        // already; otherwise it was locked while we weren't running.
+        isLocked = true;
+        idleLocked = wasLocked && (saved.flags & CF_IdleLocked) != 0;
+        lockedTick = wasLocked ? saved.lockedTick : tick;
+        lockIdleTime = saved.lockIdleTime;
+    } else if (wasLocked) {
+        // Unlocked while we weren't running: the idle time counts from now,
+        // as after an unlock.
+        unlockedTick = tick;
+        unlockedTickValid = true;
+    } else {
+        unlockedTick = saved.unlockedTick;
+        unlockedTickValid = (saved.flags & CF_UnlockedTickValid) != 0;
+        if (Backend.LastInputTick() == saved.lastInputTick)
+            screenSaverActiveAt = saved.screenSaverActiveAt;
+    }
+
+    wchar_t buf[150];
+    swprintf(buf, sizeof buf / sizeof buf[0], L"Restored the checkpoint of %u seconds ago: %ls%ls.",
+        age / 1000, locked ? L"locked" : L"unlocked", screenSaverActiveAt != 0 ? L", screensaver seen" : L"");
+    Logger.Log(buf);
+    Journal(JE_Restored, LR_None, age);
+}
+
+
+void TLockEngine::CancelActions()
+{
+    actionsStarted = false;
+    lockRequested = false;
+    if (!actions->Running())
+        return;
+    actions->Cancel();
+    Logger.Log(L"Timeout actions cancelled.");
+    Journal(JE_ActionsCancelled);
+}
+
+
+void TLockEngine::DispatchActionReports()
+{
+    static const wchar_t *OutcomeNames[] = { L"done", L"failed", L"timed out", L"cancelled", L"skipped" };
+
+    if (actions == NULL)
+        return;
+    for (const TActionReport &report : actions->TakeReports()) {
+        wchar_t buf[200];
+        swprintf(buf, sizeof buf / sizeof buf[0], L"Timeout action %ls: %ls after %u ms.",
+            actions->Action(report.action).Name.c_str(), OutcomeNames[report.outcome], report.elapsed);
+        Logger.Log(buf);
+        if (report.outcome == AO_Done)
+            Journal(JE_ActionDone, LR_None, report.elapsed);
+        else if (report.outcome == AO_Failed || report.outcome == AO_TimedOut)
+            Journal(JE_ActionFailed, LR_None, report.elapsed);
+    }
+}
+
+
+void TLockEngine::UpdateWarning(bool on)
+{
+    if (on == warning)
+        return;
+    warning = on;
+
+    if (on) {
+        uint32_t left = scheduler.TimeUntilDeadline();
+        wchar_t buf[100];
+        swprintf(buf, sizeof buf / sizeof buf[0], L"Lock warning: locking in %u seconds.", (left + 999) / 1000);
+        Logger.Log(buf);
+        Journal(JE_WarningStarted, LR_None, left);
+    } else {
+        Logger.Log(L"Lock warning cancelled.");
+        Journal(JE_WarningCancelled);
+    }
+}
+
+
+void TLockEngine::ScreenBlanked(TJournalEvent event, const wchar_t *message)
+{
+    if (isLocked)
+        return;
+
+    // Known already, unless there has been input since.
+    UpdateIdleTime();
+    if (screenSaverActiveAt != 0 && idleTime >= screenSaverActiveAt)
+        return;
+
+    Logger.Log(message);
+    screenSaverActiveAt = idleTime != 0 ? idleTime : 1;  // 0 is "not seen".
+    Journal(event);
+    Checkpoint();
+}
+
+
+void TLockEngine::SetPolicy(const TLockPolicy &aPolicy)
+{
+    policy = aPolicy;
+    policyActive = !policy.Empty();
+    policy.Compile(Backend.PowerSource(), Backend.DockState());
+    policyDecision = TPolicyDecision();
+    SettingsChanged();
+}
+
+
+void TLockEngine::PolicyInputsChanged()
+{
+    onBattery = Backend.PowerSource() == PS_Battery;
+    if (policyActive && policy.Update(Backend.PowerSource(), Backend.DockState()))
+        Logger.Log(L"Power source or dock state changed, lock policy recompiled.");
+}
+
+
+bool TLockEngine::ApplyPolicy(uint32_t &timeout, bool &screenSaverRequired, uint32_t &policyDelay)
+{
+    if (!policyActive)
+        return true;
+
+    uint32_t second = Backend.SecondOfWeek() % (TLockPolicy::MinutesPerWeek * 60);
+    int minute = int(second / 60);
+    const TPolicyDecision &decision = policy.Decide(minute);
+
+    int minutesLeft = policy.MinutesUntilChange(minute);
+    policyDelay = minutesLeft == 0 ? 0 : (uint32_t(minutesLeft) * 60 - second % 60) * 1000;
+
+    if (!(decision == policyDecision)) {
+        wchar_t buf[100];
+        if (!decision.matched)
+            swprintf(buf, sizeof buf / sizeof buf[0], L"Lock policy: no rule applies.");
+        else if (decision.timeout == 0)
+            swprintf(buf, sizeof buf / sizeof buf[0], L"Lock policy: never lock.");
+        else
+            swprintf(buf, sizeof buf / sizeof buf[0], L"Lock policy: lock after %u minutes.", decision.timeout / 60000);
+        Logger.Log(buf);
+        policyDecision = decision;
+    }
+
+    if (!decision.matched)
+        return true;
+    if (decision.timeout == 0)
+        return false;
+
+    timeout = decision.timeout;
+    if (decision.requireScreenSaver >= 0)
+        screenSaverRequired = decision.requireScreenSaver != 0;
+    return true;
+}
+
+
+void TLockEngine::SettingsChanged()
+{
+    Journal(JE_SettingsChanged);
+}
+
+
+void TLockEngine::Journal(TJournalEvent event, TLockReason reason, uint32_t value)
+{
+    if (journal == NULL)
+        return;
+
+    TJournalRecord record = {};
+    record.tick = Backend.TickCount();
+    record.idleTime = idleTime;
+    record.screenSaverActiveAt = screenSaverActiveAt;
+    record.idleTimeout = idleTimeout;
+    record.event = event;
+    record.flags = (isLocked ? JF_Locked : 0) | (enabled ? JF_Enabled : 0)
+        | (requireScreenSaver ? JF_RequireScreenSaver : 0);
+    record.reason = reason;
+    record.value = value;
+    journal->Append(record);
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+// Platform neutral idle lock decisions.
+
+#include <stdint.h>
+
+#include "ActionPipeline.h"
+#include "ActivityLog.h"
+#include "AdaptiveTimeout.h"
+#include "EngineCheckpoint.h"
+#include "EventJournal.h"
+#include "InhibitorSet.h"
+#include "LockPolicy.h"
+#include "LockScheduler.h"
+#include "Logger.h"
+#include "PlatformBackend.h"
+#include "Stats.h"
+
+
+class TLockEngine : public TSessionEventSink, public TDisplayEventSink
+{
+public:
+    static const int DefaultTimeout = 20 * 60000;
+    // How far the clock may have moved against the tick count between a
+    // checkpoint and its restore before the system counts as restarted.
+    static const int CheckpointClockSlack = 10000;  // ms
+
+    TLockEngine(TPlatformBackend &backend, TLogger &logger);
+    virtual ~TLockEngine();
+
+    // Locks the session if the idle timeout has expired.
+    // Returns the number of ms until the next check is due, or 0 if no check
+    // is needed until something (unlock, settings change, screensaver or
+    // display event) happens. With an activity log, there is a check every
+    // minute while the session is unlocked.
+    uint32_t LockIfIdleTimeout();
+
+    // How late the check after the delay returned by LockIfIdleTimeout() may
+    // be, so that the timer can be coalesced with others. 0 during the
+    // warning and for the check that starts it, which must be on time.
+    uint32_t TimerTolerance() const { return timerTolerance; }
+
+    // The system is about to sleep, or has woken up. The last input tick may
+    // be from before the sleep, so after it the idle time counts from the
+    // resume, like after an unlock. Resumed() may come without Suspending()
+    // on systems that don't tell in advance.
+    void Suspending();
+    void Resumed();
+
+    void ReportLock()
+    {
+        Logger.Log(L"Workstation locked.");
+        isLocked = true;
+        warning = false;
+        idleLocked = lockRequested;
+        lockRequested = false;
+        lockedTick = Backend.TickCount();
+        Journal(JE_SessionLocked);
+        MarkActivity(AM_Lock);
+        Checkpoint();
+    }
+
+    void ReportUnlock()
+    {
+        Logger.Log(L"Workstation unlocked.");
+        isLocked = false;
+        unlockedTick = Backend.TickCount();
+        unlockedTickValid = true;
+        screenSaverActiveAt = 0L;
+        Journal(JE_SessionUnlocked);
+        MarkActivity(AM_Unlock);
+        if (idleLocked)
+            IdleLockEnded();
+        idleLocked = false;
+        if (actionsStarted)
+            CancelActions();
+        Checkpoint();
+    }
+
+    // TSessionEventSink
+    void SessionLocked() override
+    {
+        TStats::Add(SC_SessionEvents);
+        ReportLock();
+    }
+
+    void SessionUnlocked() override
+    {
+        TStats::Add(SC_SessionEvents);
+        ReportUnlock();
+    }
+
+    // TDisplayEventSink. Only the screensaver starting and the display turning
+    // off matter; input ends either, and that is seen in the idle time.
+    void ScreenSaverChanged(bool running) override
+    {
+        if (running)
+            ScreenBlanked(JE_ScreenSaverStarted, L"Screensaver start detected.");
+    }
+
+    void DisplayChanged(bool on) override
+    {
+        if (!on)
+            ScreenBlanked(JE_DisplayOff, L"Display off detected.");
+    }
+
+    // True if the backend delivers screensaver and display events, so that
+    // they need not be polled for.
+    bool DisplayEvents() const { return displayEvents; }
+
+    const TLockScheduler &Scheduler() { return scheduler; }
+
+    // Records decisions in the journal, if set.
+    void SetJournal(TEventJournal *aJournal)
+    {
+        journal = aJournal;
+        Journal(JE_Started);
+    }
+
+    // Records the minutes with input, and locks and unlocks, in the activity
+    // log, if set. Input is only seen as the last input tick, so the checks
+    // are made at least once a minute; each one marks the minute of the last
+    // input, if there was input since the one before.
+    void SetActivityLog(TActivityLog *aActivityLog)
+    {
+        activityLog = aActivityLog;
+        activitySampledAt = Backend.LocalTime();
+    }
+
+    // Holds off locks while any of the set's sources is active (see
+    // InhibitorSet.h), if set.
+    void SetInhibitors(TInhibitorSet *aInhibitors)
+    {
+        inhibitors = aInhibitors;
+        inhibitedBy = 0;
+    }
+
+    // The inhibitors that held off the last lock or warning that was due,
+    // until they have all ended.
+    uint32_t InhibitedBy() const { return inhibitedBy; }
+
+    // Keeps the lock state, the unlock tick and the screensaver's start in
+    // the checkpoint, if set, and restores them from it now, so that a
+    // restart carries on where the last run left off (see
+    // EngineCheckpoint.h). The checkpoint is only used if the tick count
+    // has kept pace with the clock since, i.e. the system hasn't restarted;
+    // the session's lock state, if the backend knows it, overrides the
+    // checkpoint's, and the screensaver only counts if there was no input
+    // since. Set the journal first, to have the restore journalled.
+    void SetCheckpoint(TEngineCheckpoint *aCheckpoint);
+
+    // Runs the pipeline's actions, instead of locking, when the idle timeout
+    // expires, if set (see ActionPipeline.h). They run once per idle time:
+    // input, or an unlock, cancels what is left of them, and the next time
+    // the timeout expires they run again.
+    void SetActions(TActionPipeline *aActions)
+    {
+        actions = aActions;
+        actionsStarted = false;
+    }
+
+    // Logs and journals how the actions ended; call on the engine's thread
+    // when the pipeline has notified.
+    void DispatchActionReports();
+
+    // Raises the timeout, up to maxTimeout, while too many idle locks are
+    // undone within seconds (see AdaptiveTimeout.h); 0 turns that off. The
+    // timeout set with SetTimeout() stays the lower bound.
+    void SetAdaptiveTimeout(uint32_t maxTimeout)
+    {
+        adaptive.SetMaxTimeout(maxTimeout);
+    }
+
+    const TAdaptiveTimeout &Adaptive() const { return adaptive; }
+
+    // The timeout of the last check, after the policy and the adaptation.
+    uint32_t EffectiveTimeout() const { return effectiveTimeout; }
+
+    // As of the last check.
+    uint32_t IdleTime() const { return idleTime; }
+
+    void SetTimeout(int aIdleTimeout)
+    {
+        idleTimeout = aIdleTimeout;
+        SettingsChanged();
+    }
+
+    int GetTimeout()
+    {
+        return idleTimeout;
+    }
+
+    void RequireScreensaver(bool require)
+    {
+        requireScreenSaver = require;
+        SettingsChanged();
+    }
+
+    bool IsScreenSaverRequired()
+    {
+        return requireScreenSaver;
+    }
+
+    bool Enabled()
+    {
+        return enabled;
+    }
+
+    void Enable(bool aEnable)
+    {
+        enabled = aEnable;
+        SettingsChanged();
+    }
+
+    bool IsLocked()
+    {
+        return isLocked;
+    }
+
+    // Warns warningTime ms before a lock, 0 for no warning, but at most half
+    // the timeout before. During the warning, checks are made every
+    // TLockScheduler::WarningTick, so that a countdown can be shown, and
+    // input cancels the warning.
+    void SetWarningTime(uint32_t aWarningTime)
+    {
+        warningTime = aWarningTime;
+        SettingsChanged();
+    }
+
+    uint32_t GetWarningTime()
+    {
+        return warningTime;
+    }
+
+    // True from the check that starts the warning until the lock has been
+    // reported, or until a check finds that input or a settings change has
+    // cancelled it. The time left is Scheduler().TimeUntilDeadline().
+    bool Warning()
+    {
+        return warning;
+    }
+
+    // Rules that override the timeout and screensaver setting by time of
+    // day, power source and dock state. An empty policy removes them.
+    void SetPolicy(const TLockPolicy &aPolicy);
+
+    // Call when the power source or dock state may have changed. The policy
+    // is only recompiled if they did. The power source also sets the timer
+    // tolerance.
+    void PolicyInputsChanged();
+
+protected:
+    // Called when a setting has been changed; override to persist settings.
+    virtual void SettingsChanged();
+
+    // LockIfIdleTimeout() without the activity log.
+    uint32_t CheckIdleTimeout();
+
+    // Marks the minute of the last input, if it is new, and shortens delay
+    // so that the next check comes before the current minute ends.
+    uint32_t SampleActivity(uint32_t delay);
+
+    // An idle lock has been undone: journals it if it was a false lock, and
+    // lets the adaptive timeout learn from it.
+    void IdleLockEnded();
+
+    void MarkActivity(TActivityMark mark)
+    {
+        if (activityLog != NULL)
+            activityLog->Mark(mark, Backend.LocalTime());
+    }
+
+    void Journal(TJournalEvent event, TLockReason reason = LR_None, uint32_t value = 0);
+
+    // Updates idleTime from the backend.
+    void UpdateIdleTime();
+
+    // Lets the inhibitors restart the idle time; due is whether a warning or
+    // the lock is due.
+    void ApplyInhibitors(bool due);
+
+    // Saves the state in the checkpoint, if set and changed.
+    void Checkpoint();
+
+    // Takes over what still holds of the saved state.
+    void RestoreCheckpoint(const TCheckpointState &saved);
+
+    // Cancels the run of the timeout actions, since the user is back.
+    void CancelActions();
+
+    // Starts or cancels the warning.
+    void UpdateWarning(bool on);
+
+    // Records that the screensaver started or the display turned off, unless
+    // already known.
+    void ScreenBlanked(TJournalEvent event, const wchar_t *message);
+
+    // Applies the policy, if any, to the timeout and screensaver requirement.
+    // Sets policyDelay to the ms until its decision may change (0 if never).
+    // Returns false if the policy says never to lock now.
+    bool ApplyPolicy(uint32_t &timeout, bool &screenSaverRequired, uint32_t &policyDelay);
+
+    TPlatformBackend &Backend;
+    TLogger  &Logger;
+    TLockScheduler scheduler;
+    TEventJournal *journal = NULL;
+    TActivityLog *activityLog = NULL;
+    TInhibitorSet *inhibitors = NULL;
+    uint32_t inhibitedBy = 0;        // Mask of the inhibitors, as logged.
+    TActionPipeline *actions = NULL;
+    bool     actionsStarted = false; // For this idle time; until input or an unlock.
+    TEngineCheckpoint *checkpoint = NULL;
+    TCheckpointState checkpointed = {};  // The last save.
+    int64_t  activitySampledAt = 0;  // Local time of the last activity sample.
+    int      idleTimeout = DefaultTimeout;
+    uint32_t effectiveTimeout = DefaultTimeout;
+    uint32_t baseTimeout = DefaultTimeout;  // As of the last check, after the policy.
+    TAdaptiveTimeout adaptive;
+    bool     lockRequested = false;  // Until the lock is reported.
+    uint32_t lockIdleTime = 0;       // The idleTime at the request.
+    bool     idleLocked = false;     // The session was locked by us, until it is unlocked.
+    uint32_t lockedTick = 0;
+    bool     requireScreenSaver = true;
+    bool     enabled = true;
+    bool     isLocked = false;
+    uint32_t screenSaverActiveAt = 0;  // The idleTime at which the screensaver was seen as active.
+    uint32_t unlockedTick = 0;  // The tick count at which the computer was unlocked.
+    bool     unlockedTickValid = false;  // Until there's been input after the unlock.
+    uint32_t idleTime = 0;      // As of the last check.
+    bool     displayEvents = false;
+    uint32_t warningTime = 0;
+    bool     warning = false;
+    bool     onBattery = false;
+    uint32_t timerTolerance = 0;
+    TLockPolicy policy;
+    bool     policyActive = false;
+    TPolicyDecision policyDecision;  // As of the last check, for logging changes.
+};
@@ -0,0 +1,283 @@
+#include "LockPolicy.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static const int MinutesPerDay = 24 * 60;
+
+static const char *DayNames[7] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+
+static int DayIndex(const std::string &name)
+{
+    for (int i = 0; i < 7; i++) {
+        if (name == DayNames[i])
+            return i;
+    }
+    return -1;
+}
+
+
+// hh:mm, 0:00 to 24:00.
+static bool ParseTime(const std::string &text, uint16_t &minute)
+{
+    int h, m;
+    char end;
+    if (sscanf(text.c_str(), "%d:%d%c", &h, &m, &end) != 2 || h < 0 || m < 0 || m > 59 || h * 60 + m > MinutesPerDay)
+        return false;
+    minute = uint16_t(h * 60 + m);
+    return true;
+}
+
+
+bool TLockPolicy::Parse(const std::string &text, std::string &error)
+{
+    std::vector<TPolicyRule> parsed;
+    size_t start = 0;
+
+    for (int lineNo = 1; start < text.size(); lineNo++) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.resize(comment);
+
+        std::vector<std::string> fields;
+        for (size_t pos = 0;;) {
+            pos = line.find_first_not_of(" \t\r", pos);
+            if (pos == std::string::npos)
+                break;
+            size_t fieldEnd = line.find_first_of(" \t\r", pos);
+            if (fieldEnd == std::string::npos)
+                fieldEnd = line.size();
+            std::string field = line.substr(pos, fieldEnd - pos);
+            for (char &c : field)
+                c = char(tolower((unsigned char)c));
+            fields.push_back(field);
+            pos = fieldEnd;
+        }
+        if (fields.empty())
+            continue;
+
+        TPolicyRule rule;
+        if (!ParseRule(fields, rule)) {
+            error = "Line " + std::to_string(lineNo) + ": expected <days> <time> <power> <dock> <timeout> [<screensaver>].";
+            return false;
+        }
+        parsed.push_back(rule);
+    }
+
+    rules.swap(parsed);
+    compiled = false;
+    return true;
+}
+
+
+bool TLockPolicy::ParseRule(const std::vector<std::string> &fields, TPolicyRule &rule)
+{
+    if (fields.size() < 5 || fields.size() > 6)
+        return false;
+
+    const std::string &days = fields[0];
+    if (days != "*") {
+        rule.days = 0;
+        size_t start = 0;
+        for (;;) {
+            size_t end = days.find(',', start);
+            std::string item = days.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            size_t dash = item.find('-');
+            int first = DayIndex(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : DayIndex(item.substr(dash + 1));
+            if (first < 0 || last < 0)
+                return false;
+            for (int d = first;; d = (d + 1) % 7) {  // Ranges may wrap, e.g. fri-mon.
+                rule.days |= uint8_t(1 << d);
+                if (d == last)
+                    break;
+            }
+            if (end == std::string::npos)
+                break;
+            start = end + 1;
+        }
+    }
+
+    const std::string &time = fields[1];
+    if (time != "*") {
+        size_t dash = time.find('-');
+        if (dash == std::string::npos
+            || !ParseTime(time.substr(0, dash), rule.startMinute)
+            || !ParseTime(time.substr(dash + 1), rule.endMinute)
+            || rule.startMinute == MinutesPerDay)
+            return false;
+        // Ends at midnight; 00:00-24:00 becomes 00:00-00:00, i.e. all day.
+        if (rule.endMinute == MinutesPerDay)
+            rule.endMinute = 0;
+    }
+
+    const std::string &power = fields[2];
+    if (power == "ac")
+        rule.power = PS_AC;
+    else if (power == "battery")
+        rule.power = PS_Battery;
+    else if (power != "*")
+        return false;
+
+    const std::string &dock = fields[3];
+    if (dock == "docked")
+        rule.dock = DS_Docked;
+    else if (dock == "undocked")
+        rule.dock = DS_Undocked;
+    else if (dock != "*")
+        return false;
+
+    const std::string &timeout = fields[4];
+    if (timeout == "never") {
+        rule.timeout = 0;
+    } else {
+        char *end;
+        long minutes = strtol(timeout.c_str(), &end, 10);
+        if (*end != 0 || minutes <= 0 || minutes > 24 * 60)
+            return false;
+        rule.timeout = uint32_t(minutes) * 60000;
+    }
+
+    if (fields.size() == 6) {
+        const std::string &screenSaver = fields[5];
+        if (screenSaver == "yes")
+            rule.requireScreenSaver = 1;
+        else if (screenSaver == "no")
+            rule.requireScreenSaver = 0;
+        else if (screenSaver != "*")
+            return false;
+    }
+
+    return true;
+}
+
+
+// Rules are painted into a per-minute table of rule numbers from the last
+// to the first, so that the first matching rule ends up on top. Runs of
+// equal decisions then become segments.
+void TLockPolicy::Compile(TPowerSource power, TDockState dock)
+{
+    std::vector<uint32_t> ruleAt(MinutesPerWeek, 0);  // Rule index + 1, 0 for none.
+
+    for (size_t r = rules.size(); r-- > 0;) {
+        const TPolicyRule &rule = rules[r];
+        if ((rule.power != PS_Unknown && rule.power != power) || (rule.dock != DS_Unknown && rule.dock != dock))
+            continue;
+
+        int length = rule.endMinute > rule.startMinute
+            ? rule.endMinute - rule.startMinute
+            : MinutesPerDay - rule.startMinute + rule.endMinute;  // Wraps past midnight, or all day.
+
+        for (int d = 0; d < 7; d++) {
+            if (!(rule.days & (1 << d)))
+                continue;
+            int first = d * MinutesPerDay + rule.startMinute;
+            for (int m = first; m < first + length; m++)
+                ruleAt[m < MinutesPerWeek ? m : m - MinutesPerWeek] = uint32_t(r + 1);
+        }
+    }
+
+    decisions.clear();
+    segments.clear();
+    segmentOf.assign(MinutesPerWeek, 0);
+
+    TPolicyDecision current;
+    for (int m = 0; m < MinutesPerWeek; m++) {
+        TPolicyDecision decision;
+        if (ruleAt[m] != 0) {
+            const TPolicyRule &rule = rules[ruleAt[m] - 1];
+            decision.matched = true;
+            decision.timeout = rule.timeout;
+            decision.requireScreenSaver = rule.requireScreenSaver;
+        }
+
+        if (segments.empty() || !(decision == current)) {
+            uint16_t index = 0;
+            while (index < decisions.size() && !(decisions[index] == decision))
+                index++;
+            if (index == decisions.size())
+                decisions.push_back(decision);
+
+            segments.push_back(TSegment{ uint16_t(m), index });
+            current = decision;
+        }
+        segmentOf[m] = uint16_t(segments.size() - 1);
+    }
+
+    compiled = true;
+    compiledPower = power;
+    compiledDock = dock;
+}
+
+
+bool TLockPolicy::Update(TPowerSource power, TDockState dock)
+{
+    if (compiled && power == compiledPower && dock == compiledDock)
+        return false;
+
+    Compile(power, dock);
+    return true;
+}
+
+
+// Neighbouring segments always decide differently, except that the last
+// one may continue into the first one, across the end of the week.
+int TLockPolicy::MinutesUntilChange(int minuteOfWeek) const
+{
+    if (segments.size() == 1)
+        return 0;
+
+    size_t i = segmentOf[minuteOfWeek];
+    int next;
+    if (i + 1 < segments.size())
+        next = segments[i + 1].start;
+    else if (segments[0].decision != segments[i].decision)
+        next = MinutesPerWeek;
+    else
+        next = MinutesPerWeek + segments[1].start;
+
+    return next - minuteOfWeek;
+}
+
+
+bool TLockPolicy::Matches(const TPolicyRule &rule, int minuteOfWeek)
+{
+    int day = minuteOfWeek / MinutesPerDay;
+    int minute = minuteOfWeek % MinutesPerDay;
+
+    if (rule.startMinute < rule.endMinute)
+        return (rule.days & (1 << day)) && minute >= rule.startMinute && minute < rule.endMinute;
+
+    // Wraps past midnight (or is all day): the part after midnight belongs
+    // to the range that started the day before.
+    if (minute >= rule.startMinute)
+        return (rule.days & (1 << day)) != 0;
+    int previousDay = (day + 6) % 7;
+    return minute < rule.endMinute && (rule.days & (1 << previousDay));
+}
+
+
+TPolicyDecision TLockPolicy::Evaluate(int minuteOfWeek, TPowerSource power, TDockState dock) const
+{
+    TPolicyDecision decision;
+    for (const TPolicyRule &rule : rules) {
+        if ((rule.power != PS_Unknown && rule.power != power) || (rule.dock != DS_Unknown && rule.dock != dock))
+            continue;
+        if (Matches(rule, minuteOfWeek)) {
+            decision.matched = true;
+            decision.timeout = rule.timeout;
+            decision.requireScreenSaver = rule.requireScreenSaver;
+            break;
+        }
+    }
+    return decision;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// Platform neutral lock policy: rules that pick the idle timeout and the
+// screensaver requirement by time of day, power source and dock state.
+// The rules are compiled into a flat table for the current power source and
+// dock state, indexed by minute of the week, so deciding is a table lookup.
+// Only a change of power source or dock state requires recompiling.
+//
+// Policy files have one rule per line; the first matching rule wins, and if
+// no rule matches, the user's own settings apply:
+//
+//   <days> <time> <power> <dock> <timeout> [<screensaver>]
+//
+//   days         * or a comma separated list of days and day ranges, e.g. mon-fri,sun
+//   time         * or hh:mm-hh:mm, e.g. 18:00-08:00 (which ends the next day)
+//   power        * | ac | battery
+//   dock         * | docked | undocked
+//   timeout      minutes, or never
+//   screensaver  * | yes | no, whether the screensaver must be active (default *,
+//                i.e. the user's setting)
+//
+// Everything after a # is a comment.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+enum TPowerSource
+{
+    PS_Unknown,
+    PS_AC,
+    PS_Battery
+};
+
+
+enum TDockState
+{
+    DS_Unknown,
+    DS_Docked,
+    DS_Undocked
+};
+
+
+struct TPolicyRule
+{
+    uint8_t      days = 0x7F;       // Bit 0 is Sunday.
+    uint16_t     startMinute = 0;   // Of the day. Equal to endMinute means all day.
+    uint16_t     endMinute = 0;
+    TPowerSource power = PS_Unknown;  // PS_Unknown matches any.
+    TDockState   dock = DS_Unknown;   // DS_Unknown matches any.
+    uint32_t     timeout = 0;       // ms, 0 means never lock.
+    int8_t       requireScreenSaver = -1;  // -1 means the user's setting.
+};
+
+
+struct TPolicyDecision
+{
+    bool     matched = false;       // If not, the user's settings apply.
+    uint32_t timeout = 0;
+    int8_t   requireScreenSaver = -1;
+
+    bool operator==(const TPolicyDecision &other) const
+    {
+        return matched == other.matched && timeout == other.timeout && requireScreenSaver == other.requireScreenSaver;
+    }
+};
+
+
+class TLockPolicy
+{
+public:
+    static const int MinutesPerWeek = 7 * 24 * 60;
+
+    TLockPolicy() { Compile(PS_Unknown, DS_Unknown); }
+
+    // Replaces the rules with those in text. On failure, the rules are left
+    // unchanged and error tells which line is wrong.
+    bool Parse(const std::string &text, std::string &error);
+
+    void AddRule(const TPolicyRule &rule) { rules.push_back(rule); compiled = false; }
+    void Clear() { rules.clear(); compiled = false; }
+    const std::vector<TPolicyRule> &Rules() const { return rules; }
+    bool Empty() const { return rules.empty(); }
+
+    // Builds the decision table for the given power source and dock state.
+    void Compile(TPowerSource power, TDockState dock);
+
+    // Compiles only if the rules or the inputs have changed since last time.
+    // Returns true if it did.
+    bool Update(TPowerSource power, TDockState dock);
+
+    // The decision at the given minute (0 = Sunday 00:00) for the compiled
+    // inputs. O(1).
+    const TPolicyDecision &Decide(int minuteOfWeek) const
+    {
+        return decisions[segments[segmentOf[minuteOfWeek]].decision];
+    }
+
+    // Minutes from minuteOfWeek until the decision may change, or 0 if it
+    // never does. O(1).
+    int MinutesUntilChange(int minuteOfWeek) const;
+
+    // Walks the rules without the table; for checking Compile().
+    TPolicyDecision Evaluate(int minuteOfWeek, TPowerSource power, TDockState dock) const;
+
+    size_t Segments() const { return segments.size(); }
+
+private:
+    struct TSegment
+    {
+        uint16_t start;     // Minute of the week.
+        uint16_t decision;  // Index into decisions.
+    };
+
+    static bool Matches(const TPolicyRule &rule, int minuteOfWeek);
+    static bool ParseRule(const std::vector<std::string> &fields, TPolicyRule &rule);
+
+    std::vector<TPolicyRule> rules;
+    bool         compiled = false;
+    TPowerSource compiledPower = PS_Unknown;
+    TDockState   compiledDock = DS_Unknown;
+
+    std::vector<TPolicyDecision> decisions;
+    std::vector<TSegment> segments;
+    std::vector<uint16_t> segmentOf;  // Minute of the week -> index into segments.
+};
@@ -0,0 +1,92 @@
+#include "LockScheduler.h"
+
+
+void TLatencyHistogram::Add(uint32_t ms)
+{
+    buckets[BucketIndex(ms)]++;
+    count++;
+    sum += ms;
+    if (ms > max)
+        max = ms;
+}
+
+
+void TLatencyHistogram::Reset()
+{
+    for (int i = 0; i < BucketCount; i++)
+        buckets[i] = 0;
+    count = sum = 0;
+    max = 0;
+}
+
+
+uint32_t TLatencyHistogram::Percentile(double percentile) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = uint64_t(count * percentile / 100.);
+    if (rank >= count)
+        rank = count - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += buckets[i];
+        if (seen > rank)
+            return BucketUpperBound(i) < max ? BucketUpperBound(i) : max;
+    }
+    return max;
+}
+
+
+uint32_t TLockScheduler::Schedule(uint32_t idleTime, uint32_t idleTimeout, bool deadlinePredictable, uint32_t warningTime)
+{
+    uint32_t threshold = LockThreshold(idleTimeout);
+    uint32_t remaining = idleTime < threshold ? threshold - idleTime : 0;
+
+    deadlineValid = deadlinePredictable;
+    deadline = Clock.TickCount() + remaining;
+
+    // While waiting for the screensaver, we can't tell when the deadline will
+    // be, so poll. But still don't bother to wake up before the timeout, or
+    // before the warning is due, in case the screensaver has started by then.
+    // During the warning, wake up when the time left is a whole number of
+    // ticks, and at the deadline.
+    uint32_t delay;
+    if (remaining > warningTime)
+        delay = remaining - warningTime;
+    else if (!deadlinePredictable)
+        delay = remaining > 0 ? remaining : PollInterval;
+    else if (remaining % WarningTick != 0)
+        delay = remaining % WarningTick;
+    else
+        delay = remaining < WarningTick ? remaining : WarningTick;
+
+    return delay < MinWakeDelay ? MinWakeDelay : delay;
+}
+
+
+uint32_t TLockScheduler::Tolerance(uint32_t delay, bool onBattery)
+{
+    if (onBattery)
+        return delay / 4 < MaxToleranceBattery ? delay / 4 : MaxToleranceBattery;
+    return delay / 16 < MaxToleranceAC ? delay / 16 : MaxToleranceAC;
+}
+
+
+void TLockScheduler::ReportLock(uint32_t idleTime, uint32_t dueIdleTime)
+{
+    lockLatency.Add(idleTime > dueIdleTime ? idleTime - dueIdleTime : 0);
+    deadlineValid = false;
+}
+
+
+uint32_t TLockScheduler::TimeUntilDeadline() const
+{
+    if (!deadlineValid)
+        return 0;
+
+    // Signed difference, to handle tick count wraparound.
+    int32_t left = int32_t(deadline - Clock.TickCount());
+    return left > 0 ? uint32_t(left) : 0;
+}
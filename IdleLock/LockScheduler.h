@@ -0,0 +1,129 @@
+#pragma once
+
+// Platform neutral scheduling of idle timeout checks.
+// Instead of polling at a fixed interval, the next check is scheduled at the
+// point in time when the idle timeout can expire at the earliest, i.e. when
+// the remaining idle budget has run out. User input can only push that
+// deadline further away, so waking up at it never makes a lock late.
+// With a warning time, the first wakeup is when the warning is due instead,
+// and from then on at every whole WarningTick before the deadline, so that
+// a countdown can be shown and input during it is noticed.
+
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// Source of a millisecond tick count that wraps around like GetTickCount().
+class TClock
+{
+public:
+    virtual ~TClock() {}
+
+    virtual uint32_t TickCount() = 0;
+};
+
+
+// Histogram with power-of-two millisecond buckets.
+// Bucket 0 holds 0 ms, bucket i holds [2^(i-1), 2^i) ms.
+class TLatencyHistogram
+{
+public:
+    static const int BucketCount = 32;
+
+    void Add(uint32_t ms);
+    void Reset();
+
+    uint64_t Count() const { return count; }
+    uint64_t Bucket(int i) const { return buckets[i]; }
+    uint32_t Max() const { return max; }
+    uint32_t Mean() const { return count ? uint32_t(sum / count) : 0; }
+
+    // Returns the upper bound of the bucket holding the given percentile (0..100).
+    uint32_t Percentile(double percentile) const;
+
+    // Inline and branch-free, since it is also used on hot paths (Stats.h).
+    static int BucketIndex(uint32_t ms)
+    {
+        // The number of significant bits, capped at the last bucket.
+#ifdef _MSC_VER
+        unsigned long bit;
+        int i = _BitScanReverse(&bit, ms) ? int(bit) + 1 : 0;
+#else
+        int i = ms != 0 ? 32 - __builtin_clz(ms) : 0;
+#endif
+        return i < BucketCount - 1 ? i : BucketCount - 1;
+    }
+
+    static uint32_t BucketUpperBound(int i)
+    {
+        return i == 0 ? 0 : uint32_t((uint64_t(1) << i) - 1);
+    }
+
+private:
+    uint64_t buckets[BucketCount] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint32_t max = 0;
+};
+
+
+class TLockScheduler
+{
+public:
+    static const uint32_t MinLockIdleTime = 60000;  // Never lock sooner than this, as a safeguard.
+    static const uint32_t PollInterval = 30000;     // Used while the deadline can't be predicted.
+    static const uint32_t MinWakeDelay = 250;
+    static const uint32_t WarningTick = 1000;       // Countdown step during the warning.
+    static const uint32_t MaxToleranceAC = 1000;
+    static const uint32_t MaxToleranceBattery = 10000;
+
+    TLockScheduler(TClock &clock) : Clock(clock) {}
+
+    // The idle time at which a lock is due for the given timeout.
+    static uint32_t LockThreshold(uint32_t idleTimeout)
+    {
+        return idleTimeout > MinLockIdleTime ? idleTimeout : MinLockIdleTime + 1;
+    }
+
+    // Returns the delay in ms until the next check should be made.
+    // deadlinePredictable is false when something else than the idle time
+    // (i.e. the screensaver) must happen before we may lock; there is no
+    // countdown then.
+    uint32_t Schedule(uint32_t idleTime, uint32_t idleTimeout, bool deadlinePredictable, uint32_t warningTime = 0);
+
+    // How late the wakeup after the given delay may come, so that the system
+    // can coalesce it with other timers and wake the CPU less often: 1/16 of
+    // the delay, up to MaxToleranceAC, or 1/4 up to MaxToleranceBattery on
+    // battery. A lock can be that much late.
+    static uint32_t Tolerance(uint32_t delay, bool onBattery);
+
+    // Call when the decision to lock has been made. Records the lock latency,
+    // i.e. how late we are compared to the idle time at which the lock was due.
+    void ReportLock(uint32_t idleTime, uint32_t dueIdleTime);
+
+    // Time left until the deadline set by the last Schedule(), 0 if passed or unknown.
+    uint32_t TimeUntilDeadline() const;
+
+    // The tick count of the deadline set by the last Schedule(). Returns
+    // false if it is unknown, or there has been a lock since.
+    bool Deadline(uint32_t &tick) const
+    {
+        tick = deadline;
+        return deadlineValid;
+    }
+
+    // Call on every timer wakeup.
+    void ReportWakeup() { wakeups++; }
+
+    uint64_t Wakeups() const { return wakeups; }
+    const TLatencyHistogram &LockLatency() const { return lockLatency; }
+
+private:
+    TClock &Clock;
+    bool     deadlineValid = false;
+    uint32_t deadline = 0;  // Tick count at which the idle timeout expires.
+    uint64_t wakeups = 0;
+    TLatencyHistogram lockLatency;
+};
@@ -1,39 +1,60 @@
-#include "stdafx.h"
 #include <time.h>
 
 #include "Logger.h"
+#include "Stats.h"
+#include "TextUtil.h"
 
 
 TLogger::TLogger(const wchar_t *fName)
 {
-    logFile.open(fName, ios::app);
+    logFile = OpenFile(fName, "ab");
+    Log(L"Logging started.");
+}
+
+
+void TLogger::Reopen(const wchar_t *fName)
+{
+    if (logFile != NULL) {
+        Log(L"Log moved.");
+        fclose(logFile);
+    }
+    logFile = OpenFile(fName, "ab");
     Log(L"Logging started.");
 }
 
 
 TLogger::~TLogger()
 {
-    if (logFile.is_open())
+    if (logFile != NULL) {
         Log(L"Closing log.");
-        logFile.close();
+        fclose(logFile);
+    }
 }
 
 
-void TLogger::Log(wchar_t *text)
+void TLogger::Log(const wchar_t *text)
 {
-    if (!logFile.is_open())
+    if (logFile == NULL)
         return;
 
-    wchar_t buf[1000];
+    TStats::Add(SC_LogLines);
+    TStatScope scope(ST_Log);
+    char stamp[32];
     time_t timer;
     tm tmStruct;
 
     time(&timer);
+#ifdef _WIN32
     localtime_s(&tmStruct, &timer);
+#else
+    localtime_r(&timer, &tmStruct);
+#endif
 
-    wcsftime(buf, 500, L"%Y-%m-%d %H:%M:%S  ", &tmStruct);
-    wcscat_s(buf, text);
+    strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S  ", &tmStruct);
+    line = stamp;
+    AppendUtf8(line, text);
+    line += '\n';
 
-    logFile << buf << endl;
-    logFile.flush();
+    fwrite(line.data(), 1, line.size(), logFile);
+    fflush(logFile);
 }
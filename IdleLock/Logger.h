@@ -1,9 +1,11 @@
 #pragma once
 
-#include <fstream>
-#include <iostream>
+// Writes each line to the file right away, in UTF-8 like TAsyncLogger.
+// Uses stdio rather than iostreams, which would pull their locale machinery
+// into every front end, headless ones included.
 
-using namespace std;
+#include <stdio.h>
+#include <string>
 
 
 class TLogger
@@ -11,10 +13,15 @@ class TLogger
 public:
     TLogger() {}  // ctor for dummy logger.
     TLogger(const wchar_t *fName);
-    ~TLogger();
+    virtual ~TLogger();
 
-    void Log(wchar_t *text);
+    virtual void Log(const wchar_t *text);
+
+    // Logs to the given file from now on, e.g. when a later launch hands
+    // over its -logfile.
+    virtual void Reopen(const wchar_t *fName);
 
 private:
-    wofstream &logFile = wofstream();
+    FILE *logFile = NULL;
+    std::string line;  // Kept to reuse its buffer.
 };
@@ -0,0 +1,94 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "TextUtil.h"
+#endif
+
+
+#ifdef _WIN32
+
+bool TMappedFile::Open(const wchar_t *fName, size_t aSize)
+{
+    Close();
+
+    hFile = CreateFileW(fName, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        hFile = NULL;
+        return false;
+    }
+
+    // Mapping more than the file size grows the file.
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, 0, (DWORD)aSize, NULL);
+    if (hMapping != NULL)
+        data = (uint8_t *)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, aSize);
+
+    if (data == NULL) {
+        Close();
+        return false;
+    }
+    size = aSize;
+    return true;
+}
+
+
+void TMappedFile::Close()
+{
+    if (data != NULL)
+        UnmapViewOfFile(data);
+    if (hMapping != NULL)
+        CloseHandle(hMapping);
+    if (hFile != NULL)
+        CloseHandle(hFile);
+
+    data = NULL;
+    size = 0;
+    hMapping = hFile = NULL;
+}
+
+#else
+
+bool TMappedFile::Open(const wchar_t *fName, size_t aSize)
+{
+    Close();
+
+    fd = open(ToUtf8(fName).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < aSize && ftruncate(fd, (off_t)aSize) != 0)) {
+        Close();
+        return false;
+    }
+
+    void *p = mmap(NULL, aSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    data = (uint8_t *)p;
+    size = aSize;
+    return true;
+}
+
+
+void TMappedFile::Close()
+{
+    if (data != NULL)
+        munmap(data, size);
+    if (fd >= 0)
+        close(fd);
+
+    data = NULL;
+    size = 0;
+    fd = -1;
+}
+
+#endif
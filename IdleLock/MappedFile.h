@@ -0,0 +1,37 @@
+#pragma once
+
+// A file mapped into memory, for small fixed-size data files that are
+// updated in place without any read/write calls.
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+class TMappedFile
+{
+public:
+    TMappedFile() {}
+    ~TMappedFile() { Close(); }
+
+    // Opens the file, creating it if needed, and maps size bytes of it.
+    // The file is grown (zero filled) if it is smaller than size.
+    bool Open(const wchar_t *fName, size_t size);
+    void Close();
+
+    bool     IsOpen() const { return data != NULL; }
+    uint8_t *Data() const { return data; }
+    size_t   Size() const { return size; }
+
+private:
+    TMappedFile(const TMappedFile &) = delete;
+    TMappedFile &operator=(const TMappedFile &) = delete;
+
+    uint8_t *data = NULL;
+    size_t   size = 0;
+#ifdef _WIN32
+    void    *hFile = NULL;
+    void    *hMapping = NULL;
+#else
+    int      fd = -1;
+#endif
+};
@@ -0,0 +1,307 @@
+#include "stdafx.h"
+#include "PipeControlServer.h"
+
+
+// Completion keys without an OVERLAPPED.
+static const ULONG_PTR WakeKey = 1;
+static const ULONG_PTR StopKey = 2;
+
+
+struct TPipeControlServer::TClient
+{
+    HANDLE      hPipe;
+    uint32_t    id = 0;
+    OVERLAPPED  connectIo = {};
+    OVERLAPPED  readIo = {};
+    OVERLAPPED  writeIo = {};
+    int         ioPending = 0;   // Operations whose completion hasn't been seen.
+    bool        closing = false;
+    char        readBuf[4096];
+    TLineBuffer input;
+    std::string writing;         // Being written.
+    std::string pending;         // To be written next.
+
+    TClient(HANDLE pipe) : hPipe(pipe) {}
+};
+
+
+TPipeControlServer::~TPipeControlServer()
+{
+    Stop();
+}
+
+
+std::wstring TPipeControlServer::PipeName()
+{
+    DWORD sessionId = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &sessionId);
+    return L"\\\\.\\pipe\\IdleLock." + std::to_wstring(sessionId);
+}
+
+
+bool TPipeControlServer::Start()
+{
+    pipeName = PipeName();
+    hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (hPort == NULL)
+        return false;
+
+    // The first instance is created here, so that a name that is taken
+    // already is reported.
+    if (!Listen()) {
+        CloseHandle(hPort);
+        hPort = NULL;
+        return false;
+    }
+
+    thread = std::thread(&TPipeControlServer::Run, this);
+    return true;
+}
+
+
+void TPipeControlServer::Stop()
+{
+    if (!thread.joinable())
+        return;
+
+    PostQueuedCompletionStatus(hPort, 0, StopKey, NULL);
+    thread.join();
+    CloseHandle(hPort);
+    hPort = NULL;
+}
+
+
+bool TPipeControlServer::HandleMessage(LPARAM lParam)
+{
+    TRequest &request = *(TRequest *)lParam;
+
+    if (request.closed) {
+        ClientClosed(request.client);
+        return false;
+    }
+
+    for (const std::string &line : request.lines) {
+        bool changed;
+        request.responses += Handle(request.client, line, changed);
+        request.responses += '\n';
+        request.settingsChanged |= changed;
+    }
+    return request.settingsChanged;
+}
+
+
+void TPipeControlServer::Push(uint32_t client, const std::string &line)
+{
+    std::lock_guard<std::mutex> lock(pushMutex);
+    if (pushed.empty())
+        PostQueuedCompletionStatus(hPort, 0, WakeKey, NULL);
+    pushed.push_back(std::make_pair(client, line));
+}
+
+
+void TPipeControlServer::Run()
+{
+    for (;;) {
+        DWORD bytes;
+        ULONG_PTR key;
+        OVERLAPPED *overlapped;
+        BOOL ok = GetQueuedCompletionStatus(hPort, &bytes, &key, &overlapped, INFINITE);
+
+        if (overlapped == NULL) {
+            if (key == StopKey)
+                break;
+            if (key == WakeKey)
+                TakePushed();
+            continue;
+        }
+
+        TClient *client = (TClient *)key;
+        client->ioPending--;
+
+        if (client->closing) {
+            // A cancelled operation.
+        } else if (overlapped == &client->connectIo) {
+            if (ok)
+                Connected(client);
+            else
+                Close(client);
+            Listen();
+        } else if (overlapped == &client->readIo) {
+            if (ok && bytes > 0)
+                Received(client, bytes);
+            else
+                Close(client);
+        } else {
+            client->writing.clear();
+            if (ok)
+                StartWrite(client);
+            else
+                Close(client);
+        }
+
+        if (client->closing && client->ioPending == 0)
+            delete client;
+    }
+
+    // The window may be gone; don't tell it about the clients.
+    stopping = true;
+    while (!clients.empty())
+        Close(clients.begin()->second);
+    if (listening != NULL)
+        Close(listening);
+
+    // Collect the cancelled operations.
+    DWORD bytes;
+    ULONG_PTR key;
+    OVERLAPPED *overlapped;
+    while (GetQueuedCompletionStatus(hPort, &bytes, &key, &overlapped, 100) || overlapped != NULL) {
+        if (overlapped == NULL)
+            continue;
+        TClient *client = (TClient *)key;
+        if (--client->ioPending == 0)
+            delete client;
+    }
+}
+
+
+// Creates the next pipe instance and waits for a client on it.
+bool TPipeControlServer::Listen()
+{
+    for (;;) {
+        HANDLE hPipe = CreateNamedPipeW(pipeName.c_str(),
+            PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (listening == NULL && clients.empty() ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, NULL);
+        if (hPipe == INVALID_HANDLE_VALUE) {
+            Logger.Log(L"Could not create the control pipe.");
+            listening = NULL;
+            return false;
+        }
+
+        TClient *client = new TClient(hPipe);
+        CreateIoCompletionPort(hPipe, hPort, (ULONG_PTR)client, 0);
+        listening = client;
+
+        if (ConnectNamedPipe(hPipe, &client->connectIo) || GetLastError() == ERROR_IO_PENDING) {
+            client->ioPending++;
+            return true;
+        }
+        if (GetLastError() != ERROR_PIPE_CONNECTED) {
+            Close(client);
+            delete client;
+            return false;
+        }
+
+        // A client came before we waited; no completion is queued for it.
+        Connected(client);
+        if (client->closing && client->ioPending == 0)
+            delete client;
+    }
+}
+
+
+void TPipeControlServer::Connected(TClient *client)
+{
+    if (listening == client)
+        listening = NULL;
+    client->id = nextId++;
+    clients[client->id] = client;
+    StartRead(client);
+}
+
+
+void TPipeControlServer::StartRead(TClient *client)
+{
+    if (!ReadFile(client->hPipe, client->readBuf, sizeof client->readBuf, NULL, &client->readIo)
+        && GetLastError() != ERROR_IO_PENDING) {
+        Close(client);
+        return;
+    }
+    client->ioPending++;
+}
+
+
+void TPipeControlServer::Received(TClient *client, DWORD bytes)
+{
+    if (!client->input.Add(client->readBuf, bytes)) {
+        Close(client);
+        return;
+    }
+
+    TRequest request = { client->id, false };
+    std::string line;
+    while (client->input.NextLine(line))
+        request.lines.push_back(line);
+
+    if (!request.lines.empty()) {
+        DWORD_PTR result;
+        if (!SendMessageTimeout(hMsgTargetWnd, requestMessage, 0, (LPARAM)&request, SMTO_NORMAL, RequestTimeout, &result)) {
+            Close(client);
+            return;
+        }
+        client->pending += request.responses;
+        StartWrite(client);
+        if (client->closing)
+            return;
+    }
+    StartRead(client);
+}
+
+
+void TPipeControlServer::StartWrite(TClient *client)
+{
+    if (!client->writing.empty() || client->pending.empty())
+        return;
+
+    client->writing.swap(client->pending);
+    if (!WriteFile(client->hPipe, client->writing.data(), DWORD(client->writing.size()), NULL, &client->writeIo)
+        && GetLastError() != ERROR_IO_PENDING) {
+        Close(client);
+        return;
+    }
+    client->ioPending++;
+}
+
+
+// Closing the pipe cancels the client's operations; Run() deletes it when
+// their completions have come in.
+void TPipeControlServer::Close(TClient *client)
+{
+    if (listening == client)
+        listening = NULL;
+    if (client->id != 0)
+        clients.erase(client->id);
+    if (client->id != 0 && !stopping) {
+        TRequest request = { client->id, true };
+        DWORD_PTR result;
+        SendMessageTimeout(hMsgTargetWnd, requestMessage, 0, (LPARAM)&request, SMTO_NORMAL, RequestTimeout, &result);
+    }
+
+    client->closing = true;
+    CloseHandle(client->hPipe);
+}
+
+
+void TPipeControlServer::TakePushed()
+{
+    std::vector<std::pair<uint32_t, std::string>> lines;
+    {
+        std::lock_guard<std::mutex> lock(pushMutex);
+        lines.swap(pushed);
+    }
+
+    for (auto &line : lines) {
+        auto i = clients.find(line.first);
+        if (i == clients.end())
+            continue;
+
+        TClient *client = i->second;
+        client->pending += line.second;
+        if (client->pending.size() > MaxPending) {
+            Logger.Log(L"Control client too slow, dropped.");
+            Close(client);
+        } else {
+            StartWrite(client);
+        }
+    }
+}
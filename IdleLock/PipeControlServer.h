@@ -0,0 +1,84 @@
+#pragma once
+
+// The control endpoint (see ControlServer.h) on a named pipe, for the tray
+// application. A background thread does the pipe I/O on a completion port.
+// Requests are handed to the window's thread with SendMessageTimeout(), so
+// the engine is only used on that thread: its WndProc must pass the message
+// given to the constructor on to HandleMessage(). Events are queued for the
+// background thread to write. The pipe only accepts local clients, and is
+// named after the session, so that every session can have its own instance.
+
+#include "stdafx.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ControlServer.h"
+#include "Logger.h"
+
+
+class TPipeControlServer : public TControlServer
+{
+public:
+    static const size_t MaxPending = 64 * 1024;
+    static const UINT RequestTimeout = 5000;  // ms to wait for the window's thread.
+
+    TPipeControlServer(TLockEngine &engine, TLogger &logger, HWND hWnd, UINT message)
+        : TControlServer(engine), Logger(logger), hMsgTargetWnd(hWnd), requestMessage(message) {}
+    ~TPipeControlServer();
+
+    // \\.\pipe\IdleLock.<session id>
+    static std::wstring PipeName();
+
+    bool Start();
+    void Stop();
+
+    // For the message given to the constructor. Returns true if a request
+    // changed a setting.
+    bool HandleMessage(LPARAM lParam);
+
+protected:
+    void Push(uint32_t client, const std::string &line) override;
+
+private:
+    struct TClient;
+
+    // Passed with the message, from the background thread.
+    struct TRequest
+    {
+        uint32_t client;
+        bool     closed;             // The client has gone; no lines.
+        std::vector<std::string> lines;
+        std::string responses;
+        bool     settingsChanged;
+    };
+
+    void Run();
+    bool Listen();
+    void Connected(TClient *client);
+    void StartRead(TClient *client);
+    void Received(TClient *client, DWORD bytes);
+    void StartWrite(TClient *client);
+    void Close(TClient *client);
+    void TakePushed();
+
+    TLogger &Logger;
+    HWND hMsgTargetWnd;
+    UINT requestMessage;
+    std::wstring pipeName;
+    HANDLE hPort = NULL;
+    std::thread thread;
+
+    // Only used by the background thread.
+    std::map<uint32_t, TClient *> clients;
+    TClient *listening = NULL;
+    uint32_t nextId = 1;
+    bool     stopping = false;
+
+    std::mutex pushMutex;
+    std::vector<std::pair<uint32_t, std::string>> pushed;  // Not yet taken by the background thread.
+};
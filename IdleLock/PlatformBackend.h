@@ -0,0 +1,109 @@
+#pragma once
+
+// The platform specific parts of idle locking: where the idle time comes
+// from, how to tell if the screensaver runs, how to lock, and where session
+// lock/unlock and screensaver/display events come from. TLockEngine only
+// talks to the platform through this interface.
+
+#include <stdint.h>
+#include <time.h>
+#include <chrono>
+
+#include "LockPolicy.h"
+#include "LockScheduler.h"
+
+
+enum TSessionState
+{
+    SS_Unknown,
+    SS_Unlocked,
+    SS_Locked
+};
+
+
+// Receives session lock state changes from a backend.
+class TSessionEventSink
+{
+public:
+    virtual ~TSessionEventSink() {}
+
+    virtual void SessionLocked() = 0;
+    virtual void SessionUnlocked() = 0;
+};
+
+
+// Receives screensaver and display power changes from a backend.
+class TDisplayEventSink
+{
+public:
+    virtual ~TDisplayEventSink() {}
+
+    virtual void ScreenSaverChanged(bool running) = 0;
+    virtual void DisplayChanged(bool on) = 0;
+};
+
+
+// TickCount() (from TClock) is the time base for LastInputTick().
+class TPlatformBackend : public TClock
+{
+public:
+    // The tick count at the last user input.
+    virtual uint32_t LastInputTick() = 0;
+
+    virtual bool ScreenSaverRunning() = 0;
+
+    // Starts locking the session. Returns false if that could not be done.
+    // The lock itself is reported through the session event sink.
+    virtual bool LockSession() = 0;
+
+    // Session events are delivered to sink until StopSessionEvents().
+    virtual void StartSessionEvents(TSessionEventSink &sink) = 0;
+    virtual void StopSessionEvents() = 0;
+
+    // Whether the session is locked now, for checking a restored state
+    // against; events only tell about changes.
+    virtual TSessionState SessionState() { return SS_Unknown; }
+
+    // Screensaver and display events are delivered to sink until
+    // StopDisplayEvents(), starting with the current state if the screensaver
+    // runs or the display is off. Returns false if the backend can't deliver
+    // them, in which case ScreenSaverRunning() is polled instead.
+    virtual bool StartDisplayEvents(TDisplayEventSink &) { return false; }
+    virtual void StopDisplayEvents() {}
+
+    // Inputs of the lock policy. The engine only asks for these when told
+    // that they may have changed.
+    virtual TPowerSource PowerSource() { return PS_Unknown; }
+    virtual TDockState DockState() { return DS_Unknown; }
+
+    // Local time, in seconds since Sunday 00:00.
+    virtual uint32_t SecondOfWeek()
+    {
+        time_t now = time(NULL);
+        tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return uint32_t(((local.tm_wday * 24 + local.tm_hour) * 60 + local.tm_min) * 60 + local.tm_sec);
+    }
+
+    // Local time, in ms since 1970-01-01 00:00 local time; i.e. UTC moved by
+    // the time zone offset in effect, so that whole days are local days.
+    virtual int64_t LocalTime()
+    {
+        using namespace std::chrono;
+        int64_t utc = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+        time_t now = time_t(utc / 1000);
+        tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+        int64_t localSeconds = _mkgmtime(&local);
+#else
+        localtime_r(&now, &local);
+        int64_t localSeconds = timegm(&local);
+#endif
+        return localSeconds * 1000 + utc % 1000;
+    }
+};
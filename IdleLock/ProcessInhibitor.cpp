@@ -0,0 +1,103 @@
+#include "ProcessInhibitor.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include "TextUtil.h"
+#endif
+
+
+static std::wstring ListName(const std::vector<std::wstring> &names)
+{
+    std::wstring name = L"programs (";
+    for (size_t i = 0; i < names.size(); i++) {
+        if (i > 0)
+            name += L", ";
+        name += names[i];
+    }
+    return name + L")";
+}
+
+
+#ifdef _WIN32
+
+TProcessInhibitor::TProcessInhibitor(const std::vector<std::wstring> &aNames)
+    : TInhibitorSource(ListName(aNames).c_str(), true), names(aNames)
+{
+}
+
+
+bool TProcessInhibitor::Poll()
+{
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool found = false;
+    PROCESSENTRY32W entry;
+    entry.dwSize = sizeof entry;
+    for (BOOL more = Process32FirstW(snapshot, &entry); more && !found; more = Process32NextW(snapshot, &entry)) {
+        for (const std::wstring &name : names) {
+            if (_wcsicmp(entry.szExeFile, name.c_str()) == 0) {
+                found = true;
+                break;
+            }
+        }
+    }
+    CloseHandle(snapshot);
+    return found;
+}
+
+#else
+
+static const size_t CommLength = 15;  // TASK_COMM_LEN, less the terminator.
+
+
+TProcessInhibitor::TProcessInhibitor(const std::vector<std::wstring> &aNames)
+    : TInhibitorSource(ListName(aNames).c_str(), true)
+{
+    for (const std::wstring &name : aNames)
+        names.push_back(ToUtf8(name.c_str()).substr(0, CommLength));
+}
+
+
+bool TProcessInhibitor::Poll()
+{
+    DIR *dir = opendir("/proc");
+    if (dir == NULL)
+        return false;
+
+    bool found = false;
+    char path[300];
+    char comm[32];
+    while (!found) {
+        dirent *entry = readdir(dir);
+        if (entry == NULL)
+            break;
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9')
+            continue;
+
+        snprintf(path, sizeof path, "/proc/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        if (fgets(comm, sizeof comm, f) != NULL) {
+            comm[strcspn(comm, "\n")] = 0;
+            for (const std::string &name : names) {
+                if (name == comm) {
+                    found = true;
+                    break;
+                }
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return found;
+}
+
+#endif
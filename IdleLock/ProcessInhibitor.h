@@ -0,0 +1,30 @@
+#pragma once
+
+// Inhibits locking while one of the listed programs runs, e.g. a video
+// player or a presentation program. Polled (see InhibitorSet.h), since
+// there are no process start and exit events without a driver or WMI;
+// listing the processes takes a snapshot of them on Windows, and reads
+// /proc/<pid>/comm on Linux, where names are cut to 15 characters.
+
+#include <string>
+#include <vector>
+
+#include "InhibitorSet.h"
+
+
+class TProcessInhibitor : public TInhibitorSource
+{
+public:
+    // The names of the executables, e.g. vlc.exe on Windows, or vlc on
+    // Linux; compared without regard to case on Windows.
+    TProcessInhibitor(const std::vector<std::wstring> &names);
+
+    bool Poll() override;
+
+private:
+#ifdef _WIN32
+    std::vector<std::wstring> names;
+#else
+    std::vector<std::string> names;  // UTF-8, as in /proc.
+#endif
+};
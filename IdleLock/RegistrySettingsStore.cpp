@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "RegistrySettingsStore.h"
+
+
+TRegistrySettingsStore::TRegistrySettingsStore(const wchar_t *keyName)
+{
+    RegCreateKeyEx(HKEY_CURRENT_USER, keyName, 0, NULL, REG_OPTION_NON_VOLATILE,
+        KEY_QUERY_VALUE | KEY_SET_VALUE | KEY_NOTIFY, NULL, &hKey, NULL);
+
+    hChangeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+
+TRegistrySettingsStore::~TRegistrySettingsStore()
+{
+    Stop();
+
+    if (hKey != NULL)
+        RegCloseKey(hKey);
+    CloseHandle(hChangeEvent);
+    CloseHandle(hWakeEvent);
+}
+
+
+bool TRegistrySettingsStore::Load(TSettings &stored)
+{
+    if (hKey == NULL)
+        return false;
+
+    DWORD regData;
+    DWORD dataLen = sizeof regData;
+
+    if (RegQueryValueEx(hKey, L"LockTimeout", NULL, NULL, (LPBYTE)&regData, &dataLen) == ERROR_SUCCESS)
+        stored.lockTimeout = regData;
+
+    dataLen = sizeof regData;
+    if (RegQueryValueEx(hKey, L"RequireScreenSaver", NULL, NULL, (LPBYTE)&regData, &dataLen) == ERROR_SUCCESS)
+        stored.requireScreenSaver = regData != 0;
+
+    dataLen = sizeof regData;
+    if (RegQueryValueEx(hKey, L"Enabled", NULL, NULL, (LPBYTE)&regData, &dataLen) == ERROR_SUCCESS)
+        stored.enabled = regData != 0;
+
+    return true;
+}
+
+
+bool TRegistrySettingsStore::Save(const TSettings &stored, unsigned fields)
+{
+    if (hKey == NULL)
+        return false;
+
+    DWORD regData;
+    DWORD dataLen = sizeof regData;
+    bool ok = true;
+
+    if (fields & SF_LockTimeout) {
+        regData = stored.lockTimeout;
+        ok &= RegSetValueEx(hKey, L"LockTimeout", 0, REG_DWORD, (BYTE *)&regData, dataLen) == ERROR_SUCCESS;
+    }
+    if (fields & SF_RequireScreenSaver) {
+        regData = stored.requireScreenSaver;
+        ok &= RegSetValueEx(hKey, L"RequireScreenSaver", 0, REG_DWORD, (BYTE *)&regData, dataLen) == ERROR_SUCCESS;
+    }
+    if (fields & SF_Enabled) {
+        regData = stored.enabled;
+        ok &= RegSetValueEx(hKey, L"Enabled", 0, REG_DWORD, (BYTE *)&regData, dataLen) == ERROR_SUCCESS;
+    }
+    return ok;
+}
+
+
+TSettingsStore::TWaitResult TRegistrySettingsStore::Wait(int timeout)
+{
+    // The notification is tied to the calling thread, and only fires once,
+    // so it's (re-)armed here, on the background thread.
+    if (!notifyArmed && hKey != NULL) {
+        notifyArmed = RegNotifyChangeKeyValue(hKey, FALSE, REG_NOTIFY_CHANGE_LAST_SET,
+            hChangeEvent, TRUE) == ERROR_SUCCESS;
+    }
+
+    HANDLE handles[2] = { hWakeEvent, hChangeEvent };
+    DWORD result = WaitForMultipleObjects(2, handles, FALSE, timeout < 0 ? INFINITE : (DWORD)timeout);
+
+    if (result == WAIT_OBJECT_0)
+        return WR_Woken;
+    if (result == WAIT_OBJECT_0 + 1) {
+        notifyArmed = false;
+        return WR_Changed;
+    }
+    return WR_Timeout;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "stdafx.h"
+
+#include "SettingsStore.h"
+
+
+// Settings stored as DWORD values under a key in HKEY_CURRENT_USER.
+// The key is opened once and kept open; RegNotifyChangeKeyValue signals
+// changes made by others.
+class TRegistrySettingsStore : public TSettingsStore
+{
+public:
+    TRegistrySettingsStore(const wchar_t *keyName);
+    ~TRegistrySettingsStore();
+
+protected:
+    bool Load(TSettings &stored) override;
+    bool Save(const TSettings &stored, unsigned fields) override;
+    TWaitResult Wait(int timeout) override;
+    void Wake() override { SetEvent(hWakeEvent); }
+
+private:
+    HKEY   hKey = NULL;
+    HANDLE hChangeEvent;
+    HANDLE hWakeEvent;
+    bool   notifyArmed = false;
+};
@@ -0,0 +1,157 @@
+#include "SessionMonitor.h"
+
+#include <stdio.h>
+
+#include "LockEngine.h"
+#include "Stats.h"
+
+
+TSessionMonitor::TSessionMonitor(TMultiSessionBackend &backend, TLogger &logger)
+    : Backend(backend), Logger(logger), idleTimeout(TLockEngine::DefaultTimeout)
+{
+}
+
+
+TSessionMonitor::~TSessionMonitor()
+{
+    wchar_t buf[200];
+    swprintf(buf, sizeof buf / sizeof buf[0], L"Session checks: %llu, wakeups: %llu, locks: %llu, lock latency ms mean/p99/max: %u/%u/%u.",
+        (unsigned long long)checks, (unsigned long long)wakeups, (unsigned long long)lockLatency.Count(),
+        lockLatency.Mean(), lockLatency.Percentile(99), lockLatency.Max());
+    Logger.Log(buf);
+}
+
+
+void TSessionMonitor::SetTimeout(uint32_t aIdleTimeout)
+{
+    idleTimeout = aIdleTimeout;
+
+    // A shorter timeout may be due sooner than the current deadlines.
+    uint32_t now = Backend.TickCount();
+    for (auto &entry : sessions) {
+        if (!entry.second.locked)
+            deadlines.Set(entry.first, now);
+    }
+}
+
+
+void TSessionMonitor::AddSession(uint32_t session)
+{
+    if (sessions.count(session) != 0)
+        return;
+
+    sessions[session] = TSession();
+    deadlines.Set(session, Backend.TickCount());
+}
+
+
+void TSessionMonitor::RemoveSession(uint32_t session)
+{
+    sessions.erase(session);
+    deadlines.Remove(session);
+}
+
+
+void TSessionMonitor::SessionLocked(uint32_t session)
+{
+    auto it = sessions.find(session);
+    if (it == sessions.end())
+        return;
+
+    it->second.locked = true;
+    deadlines.Remove(session);
+}
+
+
+void TSessionMonitor::SessionUnlocked(uint32_t session)
+{
+    AddSession(session);
+
+    TSession &s = sessions[session];
+    uint32_t now = Backend.TickCount();
+    s.locked = false;
+    s.unlockedTick = now;
+    s.unlockedTickValid = true;
+    deadlines.Set(session, now);
+}
+
+
+void TSessionMonitor::Resumed()
+{
+    uint32_t now = Backend.TickCount();
+    uint32_t deadline = now + TLockScheduler::LockThreshold(idleTimeout);
+    for (auto &entry : sessions) {
+        if (entry.second.locked)
+            continue;
+        entry.second.unlockedTick = now;
+        entry.second.unlockedTickValid = true;
+        deadlines.Set(entry.first, deadline);
+    }
+}
+
+
+uint32_t TSessionMonitor::CheckDueSessions()
+{
+    wakeups++;
+
+    uint32_t now = Backend.TickCount();
+    while (!deadlines.Empty() && !TDeadlineHeap::Before(now, deadlines.TopDeadline())) {
+        uint32_t id = deadlines.TopKey();
+        Check(id, sessions[id], now);
+    }
+
+    if (deadlines.Empty())
+        return 0;
+
+    uint32_t delay = deadlines.TopDeadline() - now;
+    return delay < TLockScheduler::MinWakeDelay ? TLockScheduler::MinWakeDelay : delay;
+}
+
+
+// Same decision as TLockEngine::LockIfIdleTimeout(), without the screensaver,
+// which can't be seen from outside the session.
+// Always removes the session from the top of the heap or moves its deadline.
+void TSessionMonitor::Check(uint32_t id, TSession &session, uint32_t now)
+{
+    checks++;
+    TStats::Add(SC_Checks);
+    TStats::Add(SC_LastInputQueries);
+
+    uint32_t lastInputTick;
+    if (!Backend.LastInputTick(id, lastInputTick)) {
+        RemoveSession(id);
+        return;
+    }
+
+    uint32_t idleTime = now - lastInputTick;
+    if (session.unlockedTickValid) {
+        uint32_t sinceUnlock = now - session.unlockedTick;
+        if (sinceUnlock <= idleTime)
+            idleTime = sinceUnlock;
+        else
+            session.unlockedTickValid = false;
+    }
+
+    uint32_t threshold = TLockScheduler::LockThreshold(idleTimeout);
+    if (idleTime < threshold) {
+        deadlines.Set(id, now + (threshold - idleTime));
+        return;
+    }
+
+    wchar_t buf[100];
+    TStats::Add(SC_LockRequests);
+    if (!Backend.LockSession(id)) {
+        swprintf(buf, sizeof buf / sizeof buf[0], L"Could not lock session %u.", id);
+        Logger.Log(buf);
+        deadlines.Set(id, now + TLockScheduler::PollInterval);
+        return;
+    }
+
+    lockLatency.Add(idleTime - threshold);
+    swprintf(buf, sizeof buf / sizeof buf[0], L"Session %u locked, idle for %u s.", id, idleTime / 1000);
+    Logger.Log(buf);
+
+    // Not checked again until unlocked.
+    session.locked = true;
+    deadlines.Remove(id);
+}
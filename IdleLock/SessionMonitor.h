@@ -0,0 +1,79 @@
+#pragma once
+
+// Platform neutral idle lock decisions for all sessions on a host, e.g. a
+// terminal server, from a single process.
+// Every unlocked session has one deadline in a heap: the tick count at which
+// its idle timeout can expire at the earliest. Only sessions whose deadline
+// has passed are looked at, and input in a session just moves its deadline,
+// so a check costs O(log n) per due session, however many sessions there are.
+
+#include <stdint.h>
+#include <unordered_map>
+
+#include "DeadlineHeap.h"
+#include "LockScheduler.h"
+#include "Logger.h"
+
+
+class TMultiSessionBackend : public TClock
+{
+public:
+    // Tick count of the last input in the session.
+    // Returns false if there's no such session (anymore).
+    virtual bool LastInputTick(uint32_t session, uint32_t &tick) = 0;
+
+    virtual bool LockSession(uint32_t session) = 0;
+};
+
+
+class TSessionMonitor
+{
+public:
+    TSessionMonitor(TMultiSessionBackend &backend, TLogger &logger);
+    ~TSessionMonitor();
+
+    // Applies to all sessions. The new timeout is checked right away.
+    void SetTimeout(uint32_t aIdleTimeout);
+    uint32_t GetTimeout() const { return idleTimeout; }
+
+    // Session notifications. A session is tracked from logon (or connect)
+    // until logoff, and only checked while it is unlocked.
+    void AddSession(uint32_t session);
+    void RemoveSession(uint32_t session);
+    void SessionLocked(uint32_t session);
+    void SessionUnlocked(uint32_t session);
+
+    // After the system has slept, the idle time of every unlocked session
+    // counts from the resume, since its last input tick may be from before.
+    void Resumed();
+
+    // Locks the sessions whose idle timeout has expired and reschedules the
+    // others. Returns the number of ms until the next check is due, or 0 if
+    // no session needs one.
+    uint32_t CheckDueSessions();
+
+    size_t Sessions() const { return sessions.size(); }
+    size_t Scheduled() const { return deadlines.Size(); }
+    uint64_t Checks() const { return checks; }
+    uint64_t Wakeups() const { return wakeups; }
+    const TLatencyHistogram &LockLatency() const { return lockLatency; }
+
+private:
+    struct TSession
+    {
+        bool     locked = false;
+        uint32_t unlockedTick = 0;          // The tick count at which it was unlocked.
+        bool     unlockedTickValid = false; // Until there's been input after the unlock.
+    };
+
+    void Check(uint32_t id, TSession &session, uint32_t now);
+
+    TMultiSessionBackend &Backend;
+    TLogger  &Logger;
+    uint32_t idleTimeout;
+    std::unordered_map<uint32_t, TSession> sessions;
+    TDeadlineHeap deadlines;
+    uint64_t checks = 0;
+    uint64_t wakeups = 0;
+    TLatencyHistogram lockLatency;
+};
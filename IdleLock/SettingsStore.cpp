@@ -0,0 +1,149 @@
+#include "SettingsStore.h"
+
+#include "LockEngine.h"
+#include "Stats.h"
+
+
+TSettingsStore::TSettingsStore() : settings(Defaults())
+{
+}
+
+
+TSettings TSettingsStore::Defaults()
+{
+    TSettings defaults;
+    defaults.lockTimeout = TLockEngine::DefaultTimeout;
+    defaults.requireScreenSaver = true;
+    defaults.enabled = true;
+    return defaults;
+}
+
+
+void TSettingsStore::Start(std::function<void()> aOnChange)
+{
+    {
+        TStats::Add(SC_SettingsLoads);
+        TStatScope scope(ST_SettingsLoad);
+        Load(settings);
+    }
+    onChange = aOnChange;
+    thread = std::thread(&TSettingsStore::Thread, this);
+}
+
+
+void TSettingsStore::Stop()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    Wake();
+    thread.join();
+}
+
+
+TSettings TSettingsStore::Get()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return settings;
+}
+
+
+void TSettingsStore::Set(const TSettings &newSettings)
+{
+    unsigned changed = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (newSettings.lockTimeout != settings.lockTimeout)
+            changed |= SF_LockTimeout;
+        if (newSettings.requireScreenSaver != settings.requireScreenSaver)
+            changed |= SF_RequireScreenSaver;
+        if (newSettings.enabled != settings.enabled)
+            changed |= SF_Enabled;
+
+        settings = newSettings;
+        dirty |= changed;
+        lastChange = std::chrono::steady_clock::now();
+    }
+
+    if (changed != 0)
+        Wake();
+}
+
+
+void TSettingsStore::Thread()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        int timeout = -1;
+        if (dirty != 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - lastChange).count();
+            timeout = elapsed < WriteDelay ? int(WriteDelay - elapsed) : 0;
+        }
+        if (stopping)
+            timeout = 0;
+
+        if (timeout != 0) {
+            lock.unlock();
+            if (Wait(timeout) == WR_Changed)
+                Reload();
+            lock.lock();
+            continue;
+        }
+
+        if (dirty != 0) {
+            TSettings toSave = settings;
+            unsigned fields = dirty;
+            dirty = 0;
+            lock.unlock();
+            {
+                TStats::Add(SC_SettingsSaves);
+                TStatScope scope(ST_SettingsSave);
+                Save(toSave, fields);
+            }
+            lock.lock();
+        }
+
+        if (stopping)
+            break;
+    }
+}
+
+
+// Takes over changes made from outside, except for fields with changes of
+// our own pending, which win.
+void TSettingsStore::Reload()
+{
+    TSettings stored = Defaults();
+    {
+        TStats::Add(SC_SettingsLoads);
+        TStatScope scope(ST_SettingsLoad);
+        if (!Load(stored))
+            return;
+    }
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!(dirty & SF_LockTimeout) && stored.lockTimeout != settings.lockTimeout) {
+            settings.lockTimeout = stored.lockTimeout;
+            changed = true;
+        }
+        if (!(dirty & SF_RequireScreenSaver) && stored.requireScreenSaver != settings.requireScreenSaver) {
+            settings.requireScreenSaver = stored.requireScreenSaver;
+            changed = true;
+        }
+        if (!(dirty & SF_Enabled) && stored.enabled != settings.enabled) {
+            settings.enabled = stored.enabled;
+            changed = true;
+        }
+    }
+
+    if (changed && onChange)
+        onChange();
+}
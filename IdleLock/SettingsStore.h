@@ -0,0 +1,75 @@
+#pragma once
+
+// Cached settings with write-back and live reload.
+// Get() and Set() only touch the in-memory copy. Changed fields are marked
+// dirty and written by a background thread once no more changes have come
+// in for WriteDelay ms, so a burst of menu clicks results in one write of
+// only the fields that changed. The same thread waits for change
+// notifications from the backing store and reloads, so changes made from
+// outside (e.g. pushed by policy) take effect without a restart.
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+struct TSettings
+{
+    int  lockTimeout;
+    bool requireScreenSaver;
+    bool enabled;
+};
+
+
+class TSettingsStore
+{
+public:
+    static const int WriteDelay = 2000;  // ms
+
+    // Dirty field flags.
+    static const unsigned SF_LockTimeout = 1;
+    static const unsigned SF_RequireScreenSaver = 2;
+    static const unsigned SF_Enabled = 4;
+
+    TSettingsStore();
+    virtual ~TSettingsStore() {}
+
+    // Loads the settings and starts the background thread. onChange is called
+    // on that thread after the settings have been changed from outside.
+    void Start(std::function<void()> onChange);
+
+    // Writes pending changes and stops the background thread. Derived classes
+    // must call this in their destructor.
+    void Stop();
+
+    TSettings Get();
+    void      Set(const TSettings &newSettings);
+
+    static TSettings Defaults();
+
+protected:
+    enum TWaitResult { WR_Timeout, WR_Woken, WR_Changed };
+
+    // Reads the stored settings; fields that aren't stored are left as is.
+    virtual bool Load(TSettings &stored) = 0;
+    // Writes the given fields.
+    virtual bool Save(const TSettings &stored, unsigned fields) = 0;
+    // Waits for Wake(), a change of the stored settings or the timeout
+    // (-1 for none). Only called on the background thread.
+    virtual TWaitResult Wait(int timeout) = 0;
+    virtual void Wake() = 0;
+
+private:
+    void Thread();
+    void Reload();
+
+    std::mutex mutex;
+    TSettings  settings;
+    unsigned   dirty = 0;
+    std::chrono::steady_clock::time_point lastChange;
+    bool       stopping = false;
+    std::function<void()> onChange;
+    std::thread thread;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+// Backend with a virtual clock, for running the real lock engine against
+// recorded or generated activity traces, much faster than real time.
+// The driver advances the clock and feeds input, screensaver, display and
+// session events; lock requests are turned into session lock events by
+// DispatchSessionEvents(), like the WTS notifications on Windows.
+// Screensaver and display changes are either delivered as events, or, like
+// on a system without display events, only the screensaver can be polled.
+
+#include <stdint.h>
+
+#include "PlatformBackend.h"
+
+
+class TSimBackend : public TPlatformBackend
+{
+public:
+    static const int32_t StartDay = 19729;  // 2024-01-07, a Sunday, in days since 1970-01-01.
+
+    // startTick is the tick count at virtual time 0. Start close to
+    // UINT32_MAX to exercise the tick count wraparound.
+    TSimBackend(uint32_t aStartTick = 0, bool aDisplayEvents = false)
+        : startTick(aStartTick), lastInputTick(aStartTick), displayEvents(aDisplayEvents) {}
+
+    // Virtual time in ms since the start.
+    uint64_t Now() const { return now; }
+    void     AdvanceTo(uint64_t time) { now = time; }
+
+    void Input() { lastInputTick = TickCount(); }
+
+    void SetScreenSaver(bool running)
+    {
+        screenSaverRunning = running;
+        if (displaySink != NULL)
+            displaySink->ScreenSaverChanged(running);
+    }
+
+    void SetDisplay(bool on)
+    {
+        displayOn = on;
+        if (displaySink != NULL)
+            displaySink->DisplayChanged(on);
+    }
+
+    void SetPowerSource(TPowerSource aPower) { power = aPower; }
+    void SetDockState(TDockState aDock) { dock = aDock; }
+
+    // The local time at virtual time 0, in seconds since Sunday 00:00 of
+    // StartDay, as far as LocalTime() is concerned.
+    void SetStartSecondOfWeek(uint32_t second) { startSecondOfWeek = second; }
+
+    // The user locks or unlocks the session.
+    void Lock()
+    {
+        locked = true;
+        if (sink != NULL)
+            sink->SessionLocked();
+    }
+
+    void Unlock()
+    {
+        locked = false;
+        if (sink != NULL)
+            sink->SessionUnlocked();
+    }
+
+    // Turns a pending lock request into a session lock event.
+    // Returns true if there was one.
+    bool DispatchSessionEvents()
+    {
+        if (!lockRequested)
+            return false;
+        lockRequested = false;
+        Lock();
+        return true;
+    }
+
+    bool     Locked() const { return locked; }
+    uint64_t LockRequests() const { return lockRequests; }
+
+    uint32_t TickCount() override { return uint32_t(startTick + now); }
+    uint32_t LastInputTick() override { return lastInputTick; }
+    bool ScreenSaverRunning() override { return screenSaverRunning; }
+
+    bool LockSession() override
+    {
+        lockRequested = true;
+        lockRequests++;
+        return true;
+    }
+
+    void StartSessionEvents(TSessionEventSink &aSink) override { sink = &aSink; }
+    void StopSessionEvents() override { sink = NULL; }
+    TSessionState SessionState() override { return locked ? SS_Locked : SS_Unlocked; }
+
+    bool StartDisplayEvents(TDisplayEventSink &aSink) override
+    {
+        if (!displayEvents)
+            return false;
+        displaySink = &aSink;
+        if (screenSaverRunning)
+            displaySink->ScreenSaverChanged(true);
+        if (!displayOn)
+            displaySink->DisplayChanged(false);
+        return true;
+    }
+
+    void StopDisplayEvents() override { displaySink = NULL; }
+
+    TPowerSource PowerSource() override { return power; }
+    TDockState DockState() override { return dock; }
+    uint32_t SecondOfWeek() override { return uint32_t((startSecondOfWeek + now / 1000) % (7 * 86400)); }
+    int64_t LocalTime() override { return (int64_t(StartDay) * 86400 + startSecondOfWeek) * 1000 + int64_t(now); }
+
+private:
+    uint64_t startTick;
+    uint64_t now = 0;
+    uint32_t lastInputTick;
+    bool     screenSaverRunning = false;
+    bool     displayOn = true;
+    bool     displayEvents;
+    bool     locked = false;
+    bool     lockRequested = false;
+    uint64_t lockRequests = 0;
+    TPowerSource power = PS_Unknown;
+    TDockState   dock = DS_Unknown;
+    uint32_t startSecondOfWeek = 0;
+    TSessionEventSink *sink = NULL;
+    TDisplayEventSink *displaySink = NULL;
+};
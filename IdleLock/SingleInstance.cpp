@@ -0,0 +1,94 @@
+#include "stdafx.h"
+#include "SingleInstance.h"
+
+
+static const wchar_t *MutexName = L"Local\\IdleLock.Instance";
+
+
+TSingleInstance::~TSingleInstance()
+{
+    page.Close();
+    if (hMutex != NULL)
+        CloseHandle(hMutex);
+}
+
+
+bool TSingleInstance::Claim(bool headless)
+{
+    hMutex = CreateMutexW(NULL, FALSE, MutexName);
+    if (hMutex == NULL || GetLastError() == ERROR_ALREADY_EXISTS) {
+        if (hMutex != NULL)
+            CloseHandle(hMutex);
+        hMutex = NULL;
+        return false;
+    }
+
+    // Without the block we're still the only instance, just not visible.
+    if (page.Create())
+        InitInstanceState(*page.Block(), GetCurrentProcessId(), 0, headless);
+    return true;
+}
+
+
+void TSingleInstance::SetWindow(HWND hWnd)
+{
+    if (!page.IsOpen())
+        return;
+    TInstanceStateBlock state = *page.Block();
+    state.window = (uint64_t)(UINT_PTR)hWnd;
+    WriteInstanceState(*page.Block(), state);
+}
+
+
+void TSingleInstance::Publish(TLockEngine &engine, uint32_t nextCheck)
+{
+    if (page.IsOpen())
+        PublishInstanceState(*page.Block(), engine, nextCheck);
+}
+
+
+bool TSingleInstance::HandOff(const wchar_t *commandLine)
+{
+    // The running instance may have only just claimed the session, and not
+    // have created its window yet.
+    TInstanceStateBlock block = {};
+    for (DWORD waited = 0; ; waited += 100) {
+        if (ReadState(block) && block.window != 0)
+            break;
+        if (waited >= HandOffTimeout)
+            return false;
+        Sleep(100);
+    }
+
+    COPYDATASTRUCT data;
+    data.dwData = CommandLineData;
+    data.cbData = DWORD((wcslen(commandLine) + 1) * sizeof(wchar_t));
+    data.lpData = (PVOID)commandLine;
+    DWORD_PTR result = 0;
+    return SendMessageTimeout((HWND)(UINT_PTR)block.window, WM_COPYDATA, 0, (LPARAM)&data,
+        SMTO_NORMAL | SMTO_ABORTIFHUNG, HandOffTimeout, &result) && result != 0;
+}
+
+
+bool TSingleInstance::ReadState(TInstanceStateBlock &block)
+{
+    TInstanceStatePage reader;
+    return reader.Open() && reader.Read(block);
+}
+
+
+bool TSingleInstance::CommandLine(LPARAM lParam, std::wstring &commandLine)
+{
+    const COPYDATASTRUCT *data = (const COPYDATASTRUCT *)lParam;
+    if (data == NULL || data->dwData != CommandLineData || data->cbData < sizeof(wchar_t)
+        || data->cbData % sizeof(wchar_t) != 0)
+        return false;
+
+    // Not trusting the terminator.
+    const wchar_t *text = (const wchar_t *)data->lpData;
+    size_t length = data->cbData / sizeof(wchar_t);
+    while (length > 0 && text[length - 1] == 0)
+        length--;
+    commandLine.assign(text, length);
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// Keeps IdleLock to one instance per session. The first launch claims a
+// named mutex and creates the shared state block (InstanceStatePage.h);
+// both live in the session's Local\ namespace, so every session can have its
+// own instance. A later launch finds the mutex taken, reads the running
+// instance's window from the block, hands it its command line with
+// WM_COPYDATA, and exits. Its WndProc passes WM_COPYDATA on to
+// CommandLine(), which returns the command line if the message is one.
+
+#include "stdafx.h"
+
+#include <string>
+
+#include "InstanceStatePage.h"
+#include "LockEngine.h"
+
+
+class TSingleInstance
+{
+public:
+    static const ULONG_PTR CommandLineData = 0x494C434C;  // WM_COPYDATA dwData: 'ILCL'.
+    static const DWORD HandOffTimeout = 5000;             // ms to wait for the window.
+
+    TSingleInstance() {}
+    ~TSingleInstance();
+
+    // Claims the session and creates the state block. Returns false if
+    // another instance has claimed it.
+    bool Claim(bool headless);
+
+    // The window to hand later command lines to.
+    void SetWindow(HWND hWnd);
+
+    // Updates the state block, if claimed.
+    void Publish(TLockEngine &engine, uint32_t nextCheck);
+
+    // From a later launch: hands the command line to the running instance.
+    // Returns false if it couldn't be delivered.
+    static bool HandOff(const wchar_t *commandLine);
+
+    // Copies the running instance's state block. Returns false if there is
+    // no running instance.
+    static bool ReadState(TInstanceStateBlock &state);
+
+    // The command line in a WM_COPYDATA message from HandOff(), if it is one.
+    static bool CommandLine(LPARAM lParam, std::wstring &commandLine);
+
+private:
+    TSingleInstance(const TSingleInstance &) = delete;
+    TSingleInstance &operator=(const TSingleInstance &) = delete;
+
+    HANDLE hMutex = NULL;
+    TInstanceStatePage page;
+};
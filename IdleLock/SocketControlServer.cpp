@@ -0,0 +1,179 @@
+#include "SocketControlServer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <iterator>
+
+
+TSocketControlServer::~TSocketControlServer()
+{
+    Stop();
+}
+
+
+bool TSocketControlServer::Start(const std::string &aPath)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (aPath.size() >= sizeof address.sun_path)
+        return false;
+    strcpy(address.sun_path, aPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listenFd < 0)
+        return false;
+
+    // A socket left behind by an instance that didn't exit cleanly.
+    unlink(aPath.c_str());
+
+    mode_t oldMask = umask(0177);
+    bool bound = bind(listenFd, (sockaddr *)&address, sizeof address) == 0;
+    umask(oldMask);
+    if (!bound || listen(listenFd, SOMAXCONN) < 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    path = aPath;
+    return true;
+}
+
+
+void TSocketControlServer::Stop()
+{
+    while (!clients.empty())
+        Close(clients.begin()->first);
+
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(path.c_str());
+        listenFd = -1;
+    }
+}
+
+
+void TSocketControlServer::AddPollFds(std::vector<pollfd> &fds)
+{
+    // Clients are only closed here, since Push() may mark them while the
+    // subscribers are being walked.
+    for (auto i = clients.begin(); i != clients.end();) {
+        auto next = std::next(i);
+        if (i->second.closing)
+            Close(i->first);
+        i = next;
+    }
+
+    fds.push_back(pollfd{ listenFd, POLLIN, 0 });
+    for (auto &i : clients)
+        fds.push_back(pollfd{ i.first, short(i.second.output.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+}
+
+
+bool TSocketControlServer::Dispatch(const pollfd *fds)
+{
+    bool settingsChanged = false;
+
+    const pollfd *p = fds + 1;
+    for (auto &i : clients) {
+        if (p->revents & POLLOUT)
+            Send(i.first, i.second);
+        if ((p->revents & (POLLIN | POLLHUP | POLLERR)) && !i.second.closing)
+            settingsChanged |= Receive(i.first, i.second);
+        p++;
+    }
+
+    if (fds[0].revents & POLLIN)
+        Accept();
+    return settingsChanged;
+}
+
+
+void TSocketControlServer::Push(uint32_t client, const std::string &line)
+{
+    auto i = clients.find(int(client));
+    if (i == clients.end() || i->second.closing)
+        return;
+
+    i->second.output += line;
+    Send(i->first, i->second);
+}
+
+
+void TSocketControlServer::Accept()
+{
+    for (;;) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0)
+            break;
+        clients[fd];
+    }
+}
+
+
+// Returns true if a request changed a setting.
+bool TSocketControlServer::Receive(int fd, TClient &client)
+{
+    bool settingsChanged = false;
+    char buf[4096];
+
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof buf, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || !client.input.Add(buf, size_t(n))) {
+            client.closing = true;
+            break;
+        }
+
+        std::string request;
+        while (client.input.NextLine(request)) {
+            bool changed;
+            client.output += Handle(uint32_t(fd), request, changed);
+            client.output += '\n';
+            settingsChanged |= changed;
+        }
+    }
+
+    if (!client.output.empty())
+        Send(fd, client);
+    return settingsChanged;
+}
+
+
+void TSocketControlServer::Send(int fd, TClient &client)
+{
+    while (!client.output.empty()) {
+        ssize_t n = send(fd, client.output.data(), client.output.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0) {
+            client.closing = true;
+            client.output.clear();
+            return;
+        }
+        client.output.erase(0, size_t(n));
+    }
+
+    if (client.output.size() > MaxPending) {
+        Logger.Log(L"Control client too slow, dropped.");
+        client.closing = true;
+        client.output.clear();
+    }
+}
+
+
+void TSocketControlServer::Close(int fd)
+{
+    ClientClosed(uint32_t(fd));
+    clients.erase(fd);
+    close(fd);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// The control endpoint (see ControlServer.h) on a Unix domain socket, for the
+// Linux front end. It runs in the main loop: AddPollFds() adds its
+// descriptors to the poll set, and Dispatch() handles what poll() found, so
+// requests are answered on the thread that runs the engine, without locking.
+// Output that a client doesn't take right away is buffered, up to MaxPending
+// bytes; a client that falls further behind is dropped.
+
+#include <poll.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ControlServer.h"
+#include "Logger.h"
+
+
+class TSocketControlServer : public TControlServer
+{
+public:
+    static const size_t MaxPending = 64 * 1024;
+
+    TSocketControlServer(TLockEngine &engine, TLogger &logger) : TControlServer(engine), Logger(logger) {}
+    ~TSocketControlServer();
+
+    // Listens on the given path, replacing a stale socket. The socket is only
+    // accessible to the user.
+    bool Start(const std::string &path);
+    void Stop();
+
+    // Appends the descriptors to poll.
+    void AddPollFds(std::vector<pollfd> &fds);
+
+    // Handles the poll() results of the descriptors added by AddPollFds(),
+    // starting at fds. Returns true if a request changed a setting.
+    bool Dispatch(const pollfd *fds);
+
+protected:
+    void Push(uint32_t client, const std::string &line) override;
+
+private:
+    struct TClient
+    {
+        TLineBuffer input;
+        std::string output;      // Not yet sent.
+        bool        closing = false;
+    };
+
+    void Accept();
+    bool Receive(int fd, TClient &client);
+    void Send(int fd, TClient &client);
+    void Close(int fd);
+
+    TLogger &Logger;
+    std::string path;
+    int listenFd = -1;
+    std::map<int, TClient> clients;  // By descriptor, which is also the client id.
+};
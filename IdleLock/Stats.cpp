@@ -0,0 +1,128 @@
+#include "Stats.h"
+
+#include <stdio.h>
+
+#include "TextUtil.h"
+
+
+std::atomic<uint64_t> TStats::counters[SC_CounterCount];
+TStatHistogram TStats::timers[ST_TimerCount];
+
+
+static const wchar_t *CounterNames[SC_CounterCount] = {
+    L"checks", L"last input queries", L"screensaver queries", L"lock requests", L"session events",
+    L"settings loads", L"settings saves", L"icon updates", L"log lines", L"window messages",
+    L"control requests", L"control events", L"input events", L"input accepted", L"checkpoints"
+};
+
+static const wchar_t *TimerNames[ST_TimerCount] = {
+    L"check", L"settings load", L"settings save", L"icon update", L"log", L"window message",
+    L"control request"
+};
+
+
+// The sum of the buckets, which saves keeping a count on the hot path.
+uint64_t TStatHistogram::Count() const
+{
+    uint64_t n = 0;
+    for (const auto &bucket : buckets)
+        n += bucket.load(std::memory_order_relaxed);
+    return n;
+}
+
+
+uint64_t TStatHistogram::Mean() const
+{
+    uint64_t n = Count();
+    return n ? sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+
+// Same as TLatencyHistogram::Percentile(), on a snapshot of the buckets.
+uint64_t TStatHistogram::Percentile(double percentile) const
+{
+    uint64_t snapshot[TLatencyHistogram::BucketCount];
+    uint64_t n = 0;
+    for (int i = 0; i < TLatencyHistogram::BucketCount; i++) {
+        snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+        n += snapshot[i];
+    }
+    if (n == 0)
+        return 0;
+
+    uint64_t rank = uint64_t(n * percentile / 100.);
+    if (rank >= n)
+        rank = n - 1;
+
+    uint64_t seen = 0;
+    uint64_t maxNs = Max();
+    for (int i = 0; i < TLatencyHistogram::BucketCount; i++) {
+        seen += snapshot[i];
+        if (seen > rank)
+            return TLatencyHistogram::BucketUpperBound(i) < maxNs ? TLatencyHistogram::BucketUpperBound(i) : maxNs;
+    }
+    return maxNs;
+}
+
+
+void TStatHistogram::Reset()
+{
+    for (auto &bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+
+std::wstring TStats::Format()
+{
+    std::wstring text;
+    wchar_t buf[200];
+
+    for (int i = 0; i < SC_CounterCount; i++) {
+        swprintf(buf, sizeof buf / sizeof buf[0], L"%-22ls %llu\n", CounterNames[i],
+            (unsigned long long)Counter(TStatCounter(i)));
+        text += buf;
+    }
+
+    for (int i = 0; i < ST_TimerCount; i++) {
+        const TStatHistogram &timer = timers[i];
+        swprintf(buf, sizeof buf / sizeof buf[0], L"%-22ls n %llu, ns mean/p50/p99/max: %llu/%llu/%llu/%llu\n",
+            (std::wstring(TimerNames[i]) + L" time").c_str(), (unsigned long long)timer.Count(),
+            (unsigned long long)timer.Mean(), (unsigned long long)timer.Percentile(50),
+            (unsigned long long)timer.Percentile(99), (unsigned long long)timer.Max());
+        text += buf;
+    }
+
+    return text;
+}
+
+
+bool TStats::Dump(const wchar_t *fileName)
+{
+    FILE *file = OpenFile(fileName, "wb");
+    if (file == NULL)
+        return false;
+
+    std::string text = ToUtf8(Format().c_str());
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    return fclose(file) == 0 && ok;
+}
+
+
+void TStats::Dump(TLogger &logger)
+{
+    std::wstring text = Format();
+    size_t start = 0;
+    for (size_t end; (end = text.find(L'\n', start)) != std::wstring::npos; start = end + 1)
+        logger.Log(text.substr(start, end - start).c_str());
+}
+
+
+void TStats::Reset()
+{
+    for (auto &counter : counters)
+        counter.store(0, std::memory_order_relaxed);
+    for (auto &timer : timers)
+        timer.Reset();
+}
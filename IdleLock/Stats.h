@@ -0,0 +1,126 @@
+#pragma once
+
+// Process-wide counters and latency histograms for the hot paths: idle
+// checks, platform queries, settings I/O, icon updates, logging, window
+// messages, control requests and input filtering. Updating them is a
+// relaxed atomic add or two, so they are always on, from any thread. Dump()
+// writes a snapshot on demand.
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "LockScheduler.h"
+#include "Logger.h"
+
+
+enum TStatCounter
+{
+    SC_Checks,
+    SC_LastInputQueries,
+    SC_ScreenSaverQueries,
+    SC_LockRequests,
+    SC_SessionEvents,
+    SC_SettingsLoads,
+    SC_SettingsSaves,
+    SC_IconUpdates,
+    SC_LogLines,
+    SC_Messages,
+    SC_ControlRequests,
+    SC_ControlEvents,
+    SC_InputEvents,         // Seen by the input filter.
+    SC_InputAccepted,       // Of those, counted as activity.
+    SC_Checkpoints,         // Saves of the engine's state.
+    SC_CounterCount
+};
+
+
+enum TStatTimer
+{
+    ST_Check,
+    ST_SettingsLoad,
+    ST_SettingsSave,
+    ST_IconUpdate,
+    ST_Log,
+    ST_Message,
+    ST_ControlRequest,
+    ST_TimerCount
+};
+
+
+// Like TLatencyHistogram, but in ns and safe to update from several threads.
+class TStatHistogram
+{
+public:
+    TStatHistogram() { Reset(); }
+
+    void Add(uint64_t ns)
+    {
+        uint32_t clamped = ns < UINT32_MAX ? uint32_t(ns) : UINT32_MAX;
+        buckets[TLatencyHistogram::BucketIndex(clamped)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t oldMax = max.load(std::memory_order_relaxed);
+        while (ns > oldMax && !max.compare_exchange_weak(oldMax, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t Count() const;
+    uint64_t Mean() const;
+    uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+    uint64_t Percentile(double percentile) const;
+
+    void Reset();
+
+private:
+    std::atomic<uint64_t> buckets[TLatencyHistogram::BucketCount];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+
+class TStats
+{
+public:
+    static void Add(TStatCounter counter, uint64_t n = 1)
+    {
+        counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void AddTime(TStatTimer timer, uint64_t ns) { timers[timer].Add(ns); }
+
+    static uint64_t Counter(TStatCounter counter) { return counters[counter].load(std::memory_order_relaxed); }
+    static const TStatHistogram &Timer(TStatTimer timer) { return timers[timer]; }
+
+    // One line per counter and timer.
+    static std::wstring Format();
+
+    // Writes Format() to the file, replacing it. Returns false on failure.
+    static bool Dump(const wchar_t *fileName);
+    static void Dump(TLogger &logger);
+
+    static void Reset();
+
+private:
+    static std::atomic<uint64_t> counters[SC_CounterCount];
+    static TStatHistogram timers[ST_TimerCount];
+};
+
+
+// Times the enclosing scope.
+class TStatScope
+{
+public:
+    TStatScope(TStatTimer aTimer) : timer(aTimer), start(std::chrono::steady_clock::now()) {}
+
+    ~TStatScope()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        TStats::AddTime(timer, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+private:
+    TStatTimer timer;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,109 @@
+#include "TextUtil.h"
+
+#ifdef _WIN32
+#include <share.h>
+#endif
+
+
+void AppendUtf8(std::string &out, const wchar_t *text)
+{
+    for (const wchar_t *p = text; *p; p++) {
+        unsigned long c = (unsigned long)*p;
+
+        // Combine UTF-16 surrogate pairs.
+        if (c >= 0xD800 && c <= 0xDBFF && p[1] >= 0xDC00 && p[1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)p[1] - 0xDC00);
+            p++;
+        }
+
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xC0 | (c >> 6));
+            out += char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += char(0xE0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        } else {
+            out += char(0xF0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3F));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+}
+
+
+std::string ToUtf8(const wchar_t *text)
+{
+    std::string s;
+    AppendUtf8(s, text);
+    return s;
+}
+
+
+#ifdef _WIN32
+
+FILE *OpenFile(const wchar_t *fName, const char *mode)
+{
+    wchar_t wMode[8];
+    size_t i;
+    for (i = 0; mode[i] && i < 7; i++)
+        wMode[i] = wchar_t(mode[i]);
+    wMode[i] = 0;
+
+    // Others may read the file, e.g. to tail the log, but not write it.
+    return _wfsopen(fName, wMode, _SH_DENYWR);
+}
+
+
+bool RenameFile(const wchar_t *from, const wchar_t *to)
+{
+    return _wrename(from, to) == 0;
+}
+
+
+bool RemoveFile(const wchar_t *fName)
+{
+    return _wremove(fName) == 0;
+}
+
+#else
+
+FILE *OpenFile(const wchar_t *fName, const char *mode)
+{
+    return fopen(ToUtf8(fName).c_str(), mode);
+}
+
+
+bool RenameFile(const wchar_t *from, const wchar_t *to)
+{
+    return rename(ToUtf8(from).c_str(), ToUtf8(to).c_str()) == 0;
+}
+
+
+bool RemoveFile(const wchar_t *fName)
+{
+    return remove(ToUtf8(fName).c_str()) == 0;
+}
+
+#endif
+
+
+bool ReadWholeFile(const wchar_t *fName, std::string &contents)
+{
+    FILE *f = OpenFile(fName, "rb");
+    if (f == NULL)
+        return false;
+
+    contents.clear();
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+        contents.append(buf, n);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
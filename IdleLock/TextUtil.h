@@ -0,0 +1,22 @@
+#pragma once
+
+// Platform neutral helpers for wide strings and file names.
+// The app works with wchar_t throughout, like the Win32 API does, but
+// wchar_t is 16 bits (UTF-16) on Windows and 32 bits (UTF-32) on Linux.
+
+#include <stdio.h>
+#include <string>
+
+
+// Appends the UTF-8 encoding of text to out.
+void AppendUtf8(std::string &out, const wchar_t *text);
+
+std::string ToUtf8(const wchar_t *text);
+
+// fopen()/rename()/remove() taking wide file names.
+FILE *OpenFile(const wchar_t *fName, const char *mode);
+bool  RenameFile(const wchar_t *from, const wchar_t *to);
+bool  RemoveFile(const wchar_t *fName);
+
+// Reads a whole file. Returns false if it can't be read.
+bool  ReadWholeFile(const wchar_t *fName, std::string &contents);
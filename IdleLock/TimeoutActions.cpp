@@ -0,0 +1,103 @@
+#include "TimeoutActions.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "TextUtil.h"
+#endif
+
+
+#ifdef _WIN32
+
+// The job ends the command's own children with it; they are put in it
+// before the command starts, so none can get away.
+bool TCommandAction::Run(TActionToken &token)
+{
+    HANDLE hJob = CreateJobObjectW(NULL, NULL);
+    if (hJob == NULL)
+        return false;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+    limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(hJob, JobObjectExtendedLimitInformation, &limits, sizeof limits);
+
+    std::wstring commandLine = L"cmd.exe /c " + command;
+    STARTUPINFOW startup = {};
+    startup.cb = sizeof startup;
+    PROCESS_INFORMATION process;
+    if (!CreateProcessW(NULL, &commandLine[0], NULL, NULL, FALSE, CREATE_NO_WINDOW | CREATE_SUSPENDED,
+            NULL, NULL, &startup, &process)) {
+        CloseHandle(hJob);
+        return false;
+    }
+    AssignProcessToJobObject(hJob, process.hProcess);
+    ResumeThread(process.hThread);
+    CloseHandle(process.hThread);
+
+    bool terminated = false;
+    while (WaitForSingleObject(process.hProcess, PollInterval) == WAIT_TIMEOUT) {
+        if (!token.Ok()) {
+            TerminateJobObject(hJob, 1);
+            WaitForSingleObject(process.hProcess, INFINITE);
+            terminated = true;
+            break;
+        }
+    }
+    DWORD exitCode = 1;
+    GetExitCodeProcess(process.hProcess, &exitCode);
+    CloseHandle(process.hProcess);
+    CloseHandle(hJob);
+    return !terminated && exitCode == 0;
+}
+
+#else
+
+// The command gets a process group of its own, so that what it starts can
+// be ended with it; SIGKILL only goes to the group if the command itself
+// outlives the SIGTERM.
+bool TCommandAction::Run(TActionToken &token)
+{
+    std::string commandLine = ToUtf8(command.c_str());
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The daemon blocks the signals it takes with signalfd().
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        setpgid(0, 0);
+        execl("/bin/sh", "sh", "-c", commandLine.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        return false;
+    setpgid(pid, pid);  // Also here, in case the child hasn't yet.
+
+    int status = 0;
+    bool ended = false;
+    while (!ended) {
+        pid_t result = waitpid(pid, &status, WNOHANG);
+        if (result == pid || (result < 0 && errno != EINTR))
+            ended = true;
+        else if (!token.Wait(PollInterval))
+            break;
+    }
+
+    if (!ended) {
+        kill(-pid, SIGTERM);
+        for (uint32_t waited = 0; waitpid(pid, &status, WNOHANG) == 0; waited += PollInterval) {
+            if (waited >= 1000) {
+                kill(-pid, SIGKILL);
+                waitpid(pid, &status, 0);
+                break;
+            }
+            usleep(PollInterval * 1000);
+        }
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+// The timeout actions that work the same everywhere (see ActionPipeline.h):
+// locking through the backend, and running a command. The Windows only ones
+// are in Win32Actions.h.
+
+#include <string>
+
+#include "ActionPipeline.h"
+#include "PlatformBackend.h"
+
+
+// Starts locking the session, like the engine does without actions. The
+// backend's LockSession() must be safe to call from the worker, which the
+// Windows and evdev ones are.
+class TLockAction : public TTimeoutAction
+{
+public:
+    TLockAction(TPlatformBackend &aBackend) : TTimeoutAction(L"lock"), backend(aBackend) {}
+
+    bool Run(TActionToken &) override { return backend.LockSession(); }
+
+private:
+    TPlatformBackend &backend;
+};
+
+
+// Runs a command line with the shell (cmd.exe on Windows, /bin/sh on Linux),
+// without a window, and fails unless it exits with 0. When the run is
+// cancelled or the time is up, the command is ended, with whatever it
+// started: its job is terminated on Windows, and its process group sent
+// SIGTERM, then SIGKILL a second later, on Linux.
+class TCommandAction : public TTimeoutAction
+{
+public:
+    static const uint32_t PollInterval = 20;  // ms between looks at the process.
+
+    TCommandAction(const wchar_t *name, const std::wstring &aCommand, uint32_t timeout = DefaultTimeout)
+        : TTimeoutAction(name, timeout), command(aCommand) {}
+
+    bool Run(TActionToken &token) override;
+
+private:
+    std::wstring command;
+};
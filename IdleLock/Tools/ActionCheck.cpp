@@ -0,0 +1,343 @@
+// ActionCheck.cpp
+// Checks the timeout actions pipeline (ActionPipeline.h) with stub actions:
+// the order of the actions, that a failure or timeout doesn't stop the ones
+// after it, that a cancel stops the running one and skips the rest, how
+// long that takes, and that starting a run never blocks; then the lock
+// engine with a pipeline, on the simulated backend, with input and an
+// unlock cancelling the run; and the command action, which must end a
+// command that outlives its timeout or the run.
+// Builds with the CMake build (target actioncheck), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o actioncheck ActionCheck.cpp ../ActionPipeline.cpp
+//       ../TimeoutActions.cpp ../LockEngine.cpp ../LockScheduler.cpp ../LockPolicy.cpp
+//       ../Logger.cpp ../TextUtil.cpp ../EventJournal.cpp ../MappedFile.cpp ../Stats.cpp
+//       ../ActivityLog.cpp ../AdaptiveTimeout.cpp ../InhibitorSet.cpp ../EngineCheckpoint.cpp
+//       -pthread
+//
+// Usage: actioncheck [-nocommands]
+//   -nocommands   Leave out the command action checks, which run /bin/sh.
+//
+// Prints each check with ok or FAILED, and the cancel latencies. Exits with
+// 1 if any check failed.
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../ActionPipeline.h"
+#include "../LockEngine.h"
+#include "../Logger.h"
+#include "../SimBackend.h"
+#include "../TimeoutActions.h"
+
+
+static const uint32_t MaxCancelLatency = 50;    // ms, for actions that wait with the token.
+static const uint32_t MaxCommandLatency = 1500; // ms, including the second before SIGKILL.
+
+static bool failed = false;
+
+
+static void Check(bool ok, const char *what)
+{
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+    failed |= !ok;
+}
+
+
+static uint32_t MsSince(std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+
+// Waits for the run to end, for at most ms. Returns false if it didn't.
+static bool WaitForRun(const TActionPipeline &pipeline, uint32_t ms)
+{
+    auto start = std::chrono::steady_clock::now();
+    while (pipeline.Running()) {
+        if (MsSince(start) > ms)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+
+// The run's outcomes, in the order of the actions.
+static std::vector<TActionOutcome> Outcomes(TActionPipeline &pipeline)
+{
+    std::vector<TActionOutcome> outcomes;
+    for (const TActionReport &report : pipeline.TakeReports()) {
+        if (report.action != outcomes.size())
+            return std::vector<TActionOutcome>();
+        outcomes.push_back(report.outcome);
+    }
+    return outcomes;
+}
+
+
+// Records that it ran, waits for duration ms, or until the token says to
+// stop, and returns result.
+class TStubAction : public TTimeoutAction
+{
+public:
+    TStubAction(const wchar_t *name, std::vector<std::wstring> &aLog, std::mutex &aLogMutex,
+                uint32_t aDuration = 0, bool aResult = true, uint32_t timeout = DefaultTimeout)
+        : TTimeoutAction(name, timeout), log(aLog), logMutex(aLogMutex), duration(aDuration), result(aResult) {}
+
+    bool Run(TActionToken &token) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            log.push_back(Name);
+        }
+        runs++;
+        if (duration != 0 && !token.Wait(duration))
+            return false;
+        return result;
+    }
+
+    std::atomic<int> runs{ 0 };
+
+private:
+    std::vector<std::wstring> &log;
+    std::mutex &logMutex;
+    uint32_t duration;
+    bool result;
+};
+
+
+static void CheckPipeline()
+{
+    std::vector<std::wstring> log;
+    std::mutex logMutex;
+
+    {
+        // Order, and a failure in the middle.
+        std::atomic<int> notified{ 0 };
+        TActionPipeline pipeline([&notified] { notified++; });
+        pipeline.Add(new TStubAction(L"first", log, logMutex, 10));
+        pipeline.Add(new TStubAction(L"second", log, logMutex, 0, false));
+        pipeline.Add(new TStubAction(L"third", log, logMutex));
+        Check(pipeline.Start(), "pipeline: starts");
+        Check(WaitForRun(pipeline, 1000), "pipeline: run ends");
+        Check(log == std::vector<std::wstring>({ L"first", L"second", L"third" }), "pipeline: actions run in order");
+        Check(Outcomes(pipeline) == std::vector<TActionOutcome>({ AO_Done, AO_Failed, AO_Done }),
+            "pipeline: a failure doesn't stop the next action");
+        Check(notified == 4, "pipeline: notified per action and at the end");
+
+        log.clear();
+        Check(pipeline.Start() && WaitForRun(pipeline, 1000) && log.size() == 3, "pipeline: runs again");
+        pipeline.TakeReports();
+    }
+
+    {
+        // A timeout.
+        log.clear();
+        TActionPipeline pipeline(nullptr);
+        pipeline.Add(new TStubAction(L"slow", log, logMutex, 10000, true, 100));
+        pipeline.Add(new TStubAction(L"next", log, logMutex));
+        auto start = std::chrono::steady_clock::now();
+        pipeline.Start();
+        bool ended = WaitForRun(pipeline, 2000);
+        uint32_t elapsed = MsSince(start);
+        std::vector<TActionReport> reports = pipeline.TakeReports();
+        Check(ended && reports.size() == 2 && reports[0].outcome == AO_TimedOut && reports[1].outcome == AO_Done,
+            "pipeline: a timeout doesn't stop the next action");
+        Check(elapsed >= 100 && elapsed < 100 + MaxCancelLatency, "pipeline: the timeout is kept");
+    }
+
+    {
+        // Start() doesn't block, and a cancel ends the run.
+        log.clear();
+        TActionPipeline pipeline(nullptr);
+        pipeline.Add(new TStubAction(L"endless", log, logMutex, 10000, true, 0));
+        pipeline.Add(new TStubAction(L"skipped", log, logMutex));
+        auto start = std::chrono::steady_clock::now();
+        pipeline.Start();
+        uint32_t startTime = MsSince(start);
+        Check(startTime < 5, "pipeline: Start() returns right away");
+        Check(!pipeline.Start(), "pipeline: no second run while one runs");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        start = std::chrono::steady_clock::now();
+        pipeline.Cancel();
+        bool ended = WaitForRun(pipeline, 1000);
+        uint32_t latency = MsSince(start);
+        Check(ended && Outcomes(pipeline) == std::vector<TActionOutcome>({ AO_Cancelled, AO_Skipped }),
+            "pipeline: a cancel stops the action and skips the rest");
+        Check(latency < MaxCancelLatency, "pipeline: the cancel is quick");
+        printf("  cancel latency: %u ms\n", latency);
+        Check(log == std::vector<std::wstring>({ L"endless" }), "pipeline: skipped actions don't run");
+    }
+
+    {
+        // Destroyed while an action runs.
+        log.clear();
+        auto start = std::chrono::steady_clock::now();
+        {
+            TActionPipeline pipeline(nullptr);
+            pipeline.Add(new TStubAction(L"endless", log, logMutex, 10000, true, 0));
+            pipeline.Start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        Check(MsSince(start) < 10 + MaxCancelLatency, "pipeline: the destructor stops the run");
+    }
+}
+
+
+// The engine on the simulated backend, with a 1 minute timeout, a lock
+// action and a long one after it.
+static void CheckEngine()
+{
+    std::vector<std::wstring> log;
+    std::mutex logMutex;
+    TLogger logger;
+    TSimBackend backend;
+    TActionPipeline pipeline(nullptr);
+    TStubAction *wait = new TStubAction(L"wait", log, logMutex, 10000, true, 0);
+    pipeline.Add(new TLockAction(backend));
+    pipeline.Add(wait);
+    TLockEngine engine(backend, logger);
+    engine.SetTimeout(60000);
+    engine.RequireScreensaver(false);
+    engine.SetActions(&pipeline);
+
+    // The lock action touches the backend from the worker; wait for the
+    // wait action, which runs after it, before looking.
+    auto waitForStart = [&wait](int runs) {
+        auto start = std::chrono::steady_clock::now();
+        while (wait->runs < runs && MsSince(start) < 1000)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return wait->runs == runs;
+    };
+
+    backend.AdvanceTo(30000);
+    engine.LockIfIdleTimeout();
+    Check(!pipeline.Running(), "engine: no actions before the timeout");
+    backend.AdvanceTo(61000);
+    engine.LockIfIdleTimeout();
+    Check(pipeline.Running() && waitForStart(1), "engine: the timeout starts the actions");
+    Check(backend.LockRequests() == 1, "engine: the lock action locks");
+    backend.AdvanceTo(70000);
+    engine.LockIfIdleTimeout();
+    Check(pipeline.Running() && wait->runs == 1, "engine: no second run in the same idle time");
+
+    backend.Input();
+    backend.AdvanceTo(71000);
+    engine.LockIfIdleTimeout();
+    Check(WaitForRun(pipeline, MaxCancelLatency), "engine: input cancels the run");
+    engine.DispatchActionReports();
+
+    // The run stops when the session is unlocked, too.
+    backend.AdvanceTo(132000);
+    engine.LockIfIdleTimeout();
+    Check(waitForStart(2), "engine: the next idle time starts them again");
+    backend.DispatchSessionEvents();
+    Check(engine.IsLocked(), "engine: locked");
+    backend.AdvanceTo(140000);
+    backend.Input();
+    backend.Unlock();
+    Check(WaitForRun(pipeline, MaxCancelLatency), "engine: the unlock cancels the run");
+    engine.DispatchActionReports();
+    backend.AdvanceTo(141000);
+    engine.LockIfIdleTimeout();
+    Check(!pipeline.Running() && wait->runs == 2, "engine: not started again after the unlock");
+}
+
+
+// True unless the process has exited; one that is left a zombie, since
+// nobody reaps it, has.
+static bool ProcessRuns(int pid)
+{
+    char path[32], stat[256] = "";
+    snprintf(path, sizeof path, "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+    size_t n = fread(stat, 1, sizeof stat - 1, f);
+    fclose(f);
+    stat[n] = 0;
+    const char *end = strrchr(stat, ')');  // "pid (comm) state ..."
+    return end != NULL && end[1] == ' ' && end[2] != 'Z';
+}
+
+
+// Runs command alone, with timeout ms, cancelling after cancelAfter ms
+// unless 0. Returns the outcome, and the ms from the cancel, or the start,
+// to the end in latency.
+static TActionOutcome RunCommand(const wchar_t *command, uint32_t timeout, uint32_t cancelAfter, uint32_t &latency)
+{
+    TActionPipeline pipeline(nullptr);
+    pipeline.Add(new TCommandAction(L"run", command, timeout));
+    auto start = std::chrono::steady_clock::now();
+    pipeline.Start();
+    if (cancelAfter != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(cancelAfter));
+        start = std::chrono::steady_clock::now();
+        pipeline.Cancel();
+    }
+    if (!WaitForRun(pipeline, 20000))
+        return AO_Skipped;
+    latency = MsSince(start);
+    std::vector<TActionReport> reports = pipeline.TakeReports();
+    return reports.size() == 1 ? reports[0].outcome : AO_Skipped;
+}
+
+
+static void CheckCommands()
+{
+    uint32_t latency;
+    Check(RunCommand(L"exit 0", 5000, 0, latency) == AO_Done, "command: exit 0 is done");
+    Check(RunCommand(L"exit 3", 5000, 0, latency) == AO_Failed, "command: exit 3 failed");
+    Check(RunCommand(L"sleep 10", 200, 0, latency) == AO_TimedOut && latency < 200 + MaxCancelLatency,
+        "command: ended at the timeout");
+    Check(RunCommand(L"sleep 10", 0, 100, latency) == AO_Cancelled && latency < MaxCancelLatency,
+        "command: ended at a cancel");
+    printf("  command cancel latency: %u ms\n", latency);
+    Check(RunCommand(L"trap '' TERM; sleep 10", 0, 100, latency) == AO_Cancelled && latency < MaxCommandLatency,
+        "command: killed if it ignores SIGTERM");
+
+    // The background sleep must go with the shell.
+    const char *pidFile = "/tmp/actioncheck.pid";
+    std::wstring command = L"sleep 10 & echo $! > /tmp/actioncheck.pid; wait";
+    bool ended = RunCommand(command.c_str(), 200, 0, latency) == AO_TimedOut;
+    int pid = 0;
+    FILE *f = fopen(pidFile, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &pid) != 1)
+            pid = 0;
+        fclose(f);
+        remove(pidFile);
+    }
+    auto start = std::chrono::steady_clock::now();
+    while (pid > 0 && ProcessRuns(pid) && MsSince(start) < 1000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Check(ended && pid > 0 && !ProcessRuns(pid), "command: what it started is ended too");
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool commands = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-nocommands") == 0) {
+            commands = false;
+        } else {
+            fprintf(stderr, "Usage: actioncheck [-nocommands]\n");
+            return 2;
+        }
+    }
+
+    CheckPipeline();
+    CheckEngine();
+    if (commands)
+        CheckCommands();
+    return failed ? 1 : 0;
+}
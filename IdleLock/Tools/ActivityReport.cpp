@@ -0,0 +1,149 @@
+// ActivityReport.cpp
+// Reports on an IdleLock activity log (see ActivityLog.h): when the user is
+// active, by hour of the day, over a span of days.
+// Builds anywhere with a C++14 compiler, e.g.
+//   g++ -std=c++14 -O2 -I.. -o activityreport ActivityReport.cpp ../ActivityLog.cpp
+//       ../MappedFile.cpp ../TextUtil.cpp ../EventJournal.cpp
+//
+// Usage: activityreport [-days <n>] [-daily] [-csv] file
+//   -days <n>   The span, ending with the newest day in the log (default 90).
+//   -daily      Also list each day: active minutes, locks and unlocks.
+//   -csv        Hours (and days) as comma separated values, with header lines.
+//
+// For each hour of the day, the report gives the minutes with input per day,
+// averaged over the days in the span that the log holds, and the minutes
+// with a lock or an unlock. The counts come from popcounts over the day
+// bitmaps, so the query time, which is reported too, doesn't depend on how
+// active the user was. Exits with 1 if the file isn't an activity log; it
+// is only read, never started over.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+#include "../ActivityLog.h"
+
+
+// "YYYY-MM-DD" of a day number (days since 1970-01-01).
+static std::string DateOf(int32_t day)
+{
+    // Howard Hinnant's civil_from_days().
+    int64_t z = int64_t(day) + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t d = doy - (153 * mp + 2) / 5 + 1;
+    int64_t m = mp < 10 ? mp + 3 : mp - 9;
+    int64_t y = yoe + era * 400 + (m <= 2);
+
+    char buf[40];
+    snprintf(buf, sizeof buf, "%04d-%02d-%02d", int(y), int(m), int(d));
+    return buf;
+}
+
+
+// Reads the capacity from the header, so that opening the log with it
+// doesn't start it over. Returns 0 if the file isn't an activity log.
+static uint32_t LogCapacity(const char *fileName)
+{
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL)
+        return 0;
+    TActivityHeader header;
+    bool ok = fread(&header, sizeof header, 1, f) == 1
+        && memcmp(header.magic, ActivityLogMagic, sizeof ActivityLogMagic) == 0
+        && header.version == ActivityLogVersion
+        && header.headerSize == sizeof(TActivityHeader)
+        && header.daySize == sizeof(TActivityDay);
+    fclose(f);
+    return ok ? header.capacity : 0;
+}
+
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: activityreport [-days <n>] [-daily] [-csv] file\n");
+    return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int days = 90;
+    bool daily = false;
+    bool csv = false;
+    const char *fileName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-days") == 0 && i + 1 < argc)
+            days = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-daily") == 0)
+            daily = true;
+        else if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (argv[i][0] != '-' && fileName == NULL)
+            fileName = argv[i];
+        else
+            return Usage();
+    }
+    if (fileName == NULL || days < 1)
+        return Usage();
+
+    uint32_t capacity = LogCapacity(fileName);
+    TActivityLog log;
+    if (capacity == 0 || !log.Open(std::wstring(fileName, fileName + strlen(fileName)).c_str(), capacity)) {
+        fprintf(stderr, "%s: not an activity log.\n", fileName);
+        return 1;
+    }
+
+    int32_t lastDay = log.LastDay();
+    if (lastDay == TActivityDay::UnusedDay) {
+        printf("%s: no activity recorded.\n", fileName);
+        return 0;
+    }
+    int32_t firstDay = lastDay - (days - 1);
+
+    uint32_t active[24] = {}, locks[24] = {}, unlocks[24] = {};
+    auto start = std::chrono::steady_clock::now();
+    int found = log.HourTotals(AM_Active, firstDay, lastDay, active);
+    double queryUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    log.HourTotals(AM_Lock, firstDay, lastDay, locks);
+    log.HourTotals(AM_Unlock, firstDay, lastDay, unlocks);
+
+    uint32_t totalActive = 0, totalLocks = 0, totalUnlocks = 0;
+    for (int hour = 0; hour < 24; hour++) {
+        totalActive += active[hour];
+        totalLocks += locks[hour];
+        totalUnlocks += unlocks[hour];
+    }
+    double perDay = found > 0 ? 1. / found : 0.;
+
+    if (csv) {
+        printf("hour,active_minutes_per_day,lock_minutes,unlock_minutes\n");
+        for (int hour = 0; hour < 24; hour++)
+            printf("%d,%.2f,%u,%u\n", hour, active[hour] * perDay, locks[hour], unlocks[hour]);
+    } else {
+        printf("days:        %d of %d recorded, %s .. %s\n", found, days, DateOf(firstDay).c_str(), DateOf(lastDay).c_str());
+        printf("active:      %u minutes, %.1f per day\n", totalActive, totalActive * perDay);
+        printf("locks:       %u minutes with a lock, %u with an unlock\n", totalLocks, totalUnlocks);
+        printf("query:       %.1f us\n", queryUs);
+        printf("\nhour  active min/day  locks  unlocks\n");
+        for (int hour = 0; hour < 24; hour++)
+            printf("%4d  %14.1f  %5u  %7u\n", hour, active[hour] * perDay, locks[hour], unlocks[hour]);
+    }
+
+    if (daily) {
+        printf(csv ? "\ndate,active_minutes,lock_minutes,unlock_minutes\n" : "\ndate        active  locks  unlocks\n");
+        for (int32_t day = firstDay; day <= lastDay; day++) {
+            if (log.Day(day) == NULL)
+                continue;
+            printf(csv ? "%s,%u,%u,%u\n" : "%s  %6u  %5u  %7u\n", DateOf(day).c_str(), log.Count(AM_Active, day),
+                log.Count(AM_Lock, day), log.Count(AM_Unlock, day));
+        }
+    }
+    return 0;
+}
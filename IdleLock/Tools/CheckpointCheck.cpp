@@ -0,0 +1,296 @@
+// CheckpointCheck.cpp
+// Checks the engine's checkpoint (EngineCheckpoint.h) across restarts, on
+// the simulated backend: a restart while locked stays locked without a
+// second lock, an unlock while the engine didn't run counts the idle time
+// from the restart, a restart after an unlock without input keeps counting
+// from the unlock, the screensaver that was seen still counts unless there
+// was input since, and a checkpoint from before a restart of the system is
+// ignored. Then the file itself: a save that was cut short leaves the one
+// before it, a file of another layout is started over, and checks that
+// change nothing save nothing. Last, it measures what a save costs.
+// Builds with the CMake build (target checkpointcheck), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o checkpointcheck CheckpointCheck.cpp ../EngineCheckpoint.cpp
+//       ../LockEngine.cpp ../LockScheduler.cpp ../LockPolicy.cpp ../Logger.cpp
+//       ../TextUtil.cpp ../EventJournal.cpp ../MappedFile.cpp ../Stats.cpp
+//       ../ActivityLog.cpp ../AdaptiveTimeout.cpp ../InhibitorSet.cpp
+//       ../ActionPipeline.cpp -pthread
+//
+// Usage: checkpointcheck [-file <file>] [-saves <n>]
+//   -file <file>  The checkpoint file to use, which is overwritten and
+//                 removed (default checkpointcheck.dat).
+//   -saves <n>    Saves to time (default 1000000).
+//
+// Prints each check with ok or FAILED, and the ns per save. Exits with 1 if
+// any check failed or the file couldn't be opened.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+
+#include "../EngineCheckpoint.h"
+#include "../LockEngine.h"
+#include "../Logger.h"
+#include "../SimBackend.h"
+#include "../Stats.h"
+
+
+// Close to the wraparound, which the first run's lock then crosses.
+static const uint32_t StartTick = UINT32_MAX - 50000;
+static const int Timeout = 60000;
+
+static bool failed = false;
+
+
+static void Check(bool ok, const char *what)
+{
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+    failed |= !ok;
+}
+
+
+static void Remove(const std::wstring &fileName)
+{
+    remove(std::string(fileName.begin(), fileName.end()).c_str());
+}
+
+
+// One run of the engine, with the checkpoint in fileName, from virtual time
+// start on. The last input before it was at inputAt, and lockedSession is
+// the session's state at the start.
+class TRun
+{
+public:
+    TRun(const std::wstring &fileName, uint64_t start, uint64_t inputAt = 0, bool lockedSession = false,
+            bool requireScreenSaver = false, uint32_t startTick = StartTick)
+        : backend(startTick), engine(Prepare(start, inputAt, lockedSession), logger)
+    {
+        engine.SetTimeout(Timeout);
+        engine.RequireScreensaver(requireScreenSaver);
+        if (checkpoint.Open(fileName.c_str()))
+            engine.SetCheckpoint(&checkpoint);
+        else
+            Check(false, "open the checkpoint file");
+    }
+
+    // A check at virtual time; true if it asked for a lock.
+    bool CheckAt(uint64_t time)
+    {
+        uint64_t requests = backend.LockRequests();
+        backend.AdvanceTo(time);
+        engine.LockIfIdleTimeout();
+        return backend.LockRequests() != requests;
+    }
+
+    TSimBackend backend;
+    TLogger logger;
+    TEngineCheckpoint checkpoint;
+    TLockEngine engine;
+
+private:
+    TSimBackend &Prepare(uint64_t start, uint64_t inputAt, bool lockedSession)
+    {
+        backend.AdvanceTo(inputAt);
+        backend.Input();
+        backend.AdvanceTo(start);
+        if (lockedSession)
+            backend.Lock();
+        return backend;
+    }
+};
+
+
+// The first run locks at 61 s and stops at 80 s.
+static void LockAndStop(const std::wstring &fileName)
+{
+    TRun run(fileName, 0);
+    run.CheckAt(30000);
+    run.CheckAt(61000);
+    run.backend.DispatchSessionEvents();
+    run.backend.AdvanceTo(80000);
+}
+
+
+static void CheckRestarts(const std::wstring &fileName)
+{
+    LockAndStop(fileName);
+    {
+        TRun run(fileName, 90000, 0, true);
+        Check(run.engine.IsLocked(), "locked: still locked after the restart");
+        Check(!run.CheckAt(95000), "locked: no second lock");
+        run.backend.Input();
+        run.backend.Unlock();
+        Check(!run.engine.IsLocked(), "locked: the unlock is seen");
+    }
+
+    // The user unlocked while the engine didn't run, without input since;
+    // otherwise the idle time would already be past the timeout.
+    Remove(fileName);
+    LockAndStop(fileName);
+    {
+        TRun run(fileName, 100000);
+        Check(!run.engine.IsLocked(), "unlocked while down: not locked");
+        Check(!run.CheckAt(130000), "unlocked while down: idle time counts from the restart");
+        Check(run.CheckAt(161000), "unlocked while down: locks a timeout after the restart");
+    }
+
+    // Unlocked before the restart, without input.
+    Remove(fileName);
+    {
+        TRun run(fileName, 0);
+        run.CheckAt(61000);
+        run.backend.DispatchSessionEvents();
+        run.backend.AdvanceTo(100000);
+        run.backend.Unlock();
+        run.CheckAt(101000);
+    }
+    {
+        TRun run(fileName, 120000);
+        Check(!run.CheckAt(150000), "unlocked: idle time counts from the unlock");
+        Check(run.CheckAt(161000), "unlocked: locks a timeout after the unlock");
+    }
+
+    // A restart of the system: the tick count started over, so the
+    // checkpoint's unlock can't be told from the idle time.
+    Remove(fileName);
+    LockAndStop(fileName);
+    {
+        TRun run(fileName, 100000, 0, false, false, 5000);
+        Check(run.CheckAt(100000), "system restart: the checkpoint is ignored");
+    }
+}
+
+
+static void CheckScreenSaver(const std::wstring &fileName)
+{
+    // The screensaver is seen at 30 s, then the display turns off, which
+    // polling can't see.
+    auto firstRun = [&fileName] {
+        Remove(fileName);
+        TRun run(fileName, 0, 0, false, true);
+        run.backend.AdvanceTo(30000);
+        run.backend.SetScreenSaver(true);
+        run.CheckAt(30000);
+        run.backend.SetScreenSaver(false);
+        run.backend.AdvanceTo(40000);
+    };
+
+    firstRun();
+    {
+        TRun run(fileName, 50000, 0, false, true);
+        Check(run.CheckAt(61000), "screensaver: still counts after the restart");
+    }
+
+    firstRun();
+    {
+        TRun run(fileName, 50000, 45000, false, true);
+        Check(!run.CheckAt(106000), "screensaver: not after input");
+    }
+}
+
+
+static void CheckFile(const std::wstring &fileName)
+{
+    std::string narrowName(fileName.begin(), fileName.end());
+    remove(narrowName.c_str());
+
+    TEngineCheckpoint checkpoint;
+    TCheckpointState state = {};
+    Check(checkpoint.Open(fileName.c_str()) && !checkpoint.Load(state), "file: a new file has no save");
+    state.lockIdleTime = 1;
+    checkpoint.Save(state);
+    state.lockIdleTime = 2;
+    checkpoint.Save(state);
+    checkpoint.Close();
+
+    // Spoil the last save's checksum.
+    FILE *f = fopen(narrowName.c_str(), "r+b");
+    TCheckpointFile data;
+    if (f == NULL || fread(&data, sizeof data, 1, f) != 1) {
+        Check(false, "file: read");
+        if (f != NULL)
+            fclose(f);
+        return;
+    }
+    int last = data.slots[1].sequence > data.slots[0].sequence ? 1 : 0;
+    data.slots[last].checksum ^= 1;
+    fseek(f, 0, SEEK_SET);
+    fwrite(&data, sizeof data, 1, f);
+    fclose(f);
+
+    Check(checkpoint.Open(fileName.c_str()) && checkpoint.Load(state) && state.lockIdleTime == 1,
+        "file: a save cut short leaves the one before");
+    state.lockIdleTime = 3;
+    checkpoint.Save(state);
+    checkpoint.Close();
+    Check(checkpoint.Open(fileName.c_str()) && checkpoint.Load(state) && state.lockIdleTime == 3,
+        "file: saves carry on after it");
+    checkpoint.Close();
+
+    f = fopen(narrowName.c_str(), "r+b");
+    if (f != NULL) {
+        fputc('X', f);
+        fclose(f);
+    }
+    Check(checkpoint.Open(fileName.c_str()) && !checkpoint.Load(state), "file: another layout is started over");
+    checkpoint.Close();
+
+    remove(narrowName.c_str());
+    {
+        TRun run(fileName, 0);
+        run.CheckAt(1000);
+        uint64_t saves = TStats::Counter(SC_Checkpoints);
+        for (uint64_t time = 2000; time < 50000; time += 1000)
+            run.CheckAt(time);
+        Check(TStats::Counter(SC_Checkpoints) == saves, "file: checks that change nothing save nothing");
+    }
+}
+
+
+static void MeasureSaves(const std::wstring &fileName, uint32_t saves)
+{
+    TEngineCheckpoint checkpoint;
+    if (!checkpoint.Open(fileName.c_str())) {
+        Check(false, "open the checkpoint file");
+        return;
+    }
+
+    TCheckpointState state = {};
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < saves; i++) {
+        state.savedTick = i;
+        checkpoint.Save(state);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    printf("  %u saves, %.1f ns per save\n", saves, saves != 0 ? ns / saves : 0.0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::string fileName = "checkpointcheck.dat";
+    uint32_t saves = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-file") == 0 && i + 1 < argc) {
+            fileName = argv[++i];
+        } else if (strcmp(argv[i], "-saves") == 0 && i + 1 < argc) {
+            saves = uint32_t(strtoul(argv[++i], NULL, 10));
+        } else {
+            fprintf(stderr, "Usage: checkpointcheck [-file <file>] [-saves <n>]\n");
+            return 2;
+        }
+    }
+    std::wstring wideName(fileName.begin(), fileName.end());
+
+    CheckRestarts(wideName);
+    CheckScreenSaver(wideName);
+    CheckFile(wideName);
+    MeasureSaves(wideName, saves);
+    remove(fileName.c_str());
+
+    printf("%s\n", failed ? "FAILED" : "All checks ok.");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+// ControlBench.cpp
+// Load test for the control endpoint (ControlServer.h): measures request
+// throughput and latency with several clients, and the delay of pushed
+// events. Without -socket, it runs the Linux server (SocketControlServer.cpp)
+// in-process, on a simulated backend.
+// Builds on Linux, e.g.
+//   g++ -std=c++14 -O2 -I.. -o controlbench ControlBench.cpp ../ControlServer.cpp
+//       ../SocketControlServer.cpp ../LockEngine.cpp ../LockScheduler.cpp ../LockPolicy.cpp
+//       ../Logger.cpp ../TextUtil.cpp ../EventJournal.cpp ../MappedFile.cpp ../Stats.cpp
+//       ../ActivityLog.cpp ../AdaptiveTimeout.cpp ../InhibitorSet.cpp
+//       ../ActionPipeline.cpp ../EngineCheckpoint.cpp -pthread
+//
+// Usage: controlbench [options]
+//   -socket <path>     Connect to a running idlelock -control <path>.
+//   -clients <n>       Number of concurrent clients (default: 1, 4 and 16).
+//   -requests <n>      Requests per client (default 50000).
+//   -request <text>    The request to send (default "get").
+//
+// Each client sends a request and waits for the answer before sending the
+// next one. Then a subscriber measures how long it takes for a settings
+// change made by another client to arrive as an event. Exits with 1 if any
+// answer is an error or an event doesn't arrive.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../SimBackend.h"
+#include "../SocketControlServer.h"
+#include "../Stats.h"
+
+
+// The in-process server, with its own main loop like IdleLockLinux.cpp.
+class TLocalServer
+{
+public:
+    TLocalServer(const std::string &path) : engine(backend, logger), server(engine, logger)
+    {
+        ok = server.Start(path);
+        if (ok)
+            thread = std::thread(&TLocalServer::Run, this);
+    }
+
+    ~TLocalServer()
+    {
+        stop = true;
+        if (thread.joinable())
+            thread.join();
+    }
+
+    bool Ok() const { return ok; }
+
+private:
+    void Run()
+    {
+        std::vector<pollfd> fds;
+        while (!stop) {
+            fds.clear();
+            server.AddPollFds(fds);
+            if (poll(fds.data(), fds.size(), 50) <= 0)
+                continue;
+            if (server.Dispatch(fds.data()))
+                engine.LockIfIdleTimeout();
+            server.Publish();
+        }
+    }
+
+    TSimBackend backend;
+    TLogger logger;
+    TLockEngine engine;
+    TSocketControlServer server;
+    std::thread thread;
+    std::atomic<bool> stop{ false };
+    bool ok;
+};
+
+
+class TClient
+{
+public:
+    ~TClient()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool Connect(const std::string &path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof address.sun_path - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        return fd >= 0 && connect(fd, (sockaddr *)&address, sizeof address) == 0;
+    }
+
+    bool Send(const std::string &line)
+    {
+        std::string data = line + "\n";
+        return send(fd, data.data(), data.size(), MSG_NOSIGNAL) == ssize_t(data.size());
+    }
+
+    // Waits up to timeout ms for a line.
+    bool Receive(std::string &line, int timeout = 5000)
+    {
+        while (!input.NextLine(line)) {
+            pollfd p = { fd, POLLIN, 0 };
+            char buf[4096];
+            ssize_t n;
+            if (poll(&p, 1, timeout) <= 0 || (n = recv(fd, buf, sizeof buf, 0)) <= 0)
+                return false;
+            input.Add(buf, size_t(n));
+        }
+        return true;
+    }
+
+private:
+    int fd = -1;
+    TLineBuffer input;
+};
+
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Returns the number of failed requests.
+static uint64_t RunClient(const std::string &path, const std::string &request, int requests, TStatHistogram &latency)
+{
+    TClient client;
+    if (!client.Connect(path))
+        return uint64_t(requests);
+
+    uint64_t errors = 0;
+    std::string answer;
+    for (int i = 0; i < requests; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (!client.Send(request) || !client.Receive(answer))
+            return errors + uint64_t(requests - i);
+        latency.Add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+        if (answer.compare(0, 3, "ok ") != 0)
+            errors++;
+    }
+    return errors;
+}
+
+
+static bool RunLoad(const std::string &path, const std::string &request, int clientCount, int requests)
+{
+    TStatHistogram latency;
+    std::atomic<uint64_t> errors{ 0 };
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clientCount; i++)
+        threads.emplace_back([&] { errors += RunClient(path, request, requests, latency); });
+    for (std::thread &t : threads)
+        t.join();
+    double seconds = Seconds(start);
+
+    double total = double(clientCount) * requests;
+    printf("%3d clients: %9.0f requests/s, latency us p50/p99/max: %.1f/%.1f/%.1f, errors %llu\n",
+        clientCount, total / seconds, latency.Percentile(50) / 1e3, latency.Percentile(99) / 1e3,
+        latency.Max() / 1e3, (unsigned long long)errors.load());
+    return errors == 0;
+}
+
+
+// A subscriber sees settings changes made by another client.
+static bool RunEvents(const std::string &path)
+{
+    const int Changes = 1000;
+    TClient subscriber, changer;
+    std::string line;
+    if (!subscriber.Connect(path) || !changer.Connect(path)
+        || !subscriber.Send("subscribe") || !subscriber.Receive(line) || line.compare(0, 3, "ok ") != 0
+        || !changer.Send("get") || !changer.Receive(line)) {
+        printf("events: could not subscribe\n");
+        return false;
+    }
+    int timeout = atoi(line.c_str() + line.find("timeout=") + 8);
+
+    TStatHistogram latency;
+    for (int i = 0; i < Changes; i++) {
+        // Alternate between two timeouts, ending with the original one.
+        int minutes = i % 2 == 0 ? timeout % 60 + 1 : timeout;
+        auto start = std::chrono::steady_clock::now();
+        if (!changer.Send("timeout " + std::to_string(minutes)) || !changer.Receive(line))
+            return false;
+
+        std::string expected = "timeout=" + std::to_string(minutes) + " ";
+        bool seen = false;
+        while (!seen && subscriber.Receive(line, 1000))
+            seen = line.compare(0, 15, "event settings ") == 0 && line.find(expected) != std::string::npos;
+        if (!seen) {
+            printf("events: no settings event after change %d\n", i);
+            return false;
+        }
+        latency.Add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+    }
+
+    printf("events:      change to event latency us p50/p99/max: %.1f/%.1f/%.1f\n",
+        latency.Percentile(50) / 1e3, latency.Percentile(99) / 1e3, latency.Max() / 1e3);
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::string path;
+    std::string request = "get";
+    std::vector<int> clientCounts;
+    int requests = 50000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-socket") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "-clients") == 0 && i + 1 < argc)
+            clientCounts.push_back(atoi(argv[++i]));
+        else if (strcmp(argv[i], "-requests") == 0 && i + 1 < argc)
+            requests = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-request") == 0 && i + 1 < argc)
+            request = argv[++i];
+        else {
+            fprintf(stderr, "Usage: controlbench [-socket <path>] [-clients <n>] [-requests <n>] [-request <text>]\n");
+            return 2;
+        }
+    }
+    if (clientCounts.empty())
+        clientCounts = { 1, 4, 16 };
+
+    std::unique_ptr<TLocalServer> local;
+    if (path.empty()) {
+        path = "/tmp/controlbench-" + std::to_string(getpid()) + ".sock";
+        local.reset(new TLocalServer(path));
+        if (!local->Ok()) {
+            fprintf(stderr, "Could not listen on %s.\n", path.c_str());
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    for (int n : clientCounts) {
+        if (n > 0)
+            ok &= RunLoad(path, request, n, requests);
+    }
+    ok &= RunEvents(path);
+
+    return ok ? 0 : 1;
+}
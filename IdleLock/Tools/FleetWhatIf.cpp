@@ -0,0 +1,513 @@
+// FleetWhatIf.cpp
+// Evaluates lock timeout settings against the recorded activity of many
+// users: for each timeout, with and without the screensaver requirement,
+// how often the session would have been locked, how many of those locks
+// were likely false, how many absences ended without a lock, and how long
+// an absence left the session unlocked. The rules are those of
+// TLockEngine::CheckIdleTimeout(): a lock is due when the idle time reaches
+// the timeout, but never sooner than after 60 s
+// (TLockScheduler::LockThreshold()), and if the screensaver is required,
+// not before it has started.
+// Builds with the CMake build (target fleetwhatif), or anywhere with a C++14
+// compiler, e.g.
+//   g++ -std=c++14 -O2 -I.. -o fleetwhatif FleetWhatIf.cpp -pthread
+//
+// Usage: fleetwhatif [options] [file...]
+//   -list <file>       Also read the activity logs named in the file, one
+//                      per line.
+//   -generate <n>      Evaluate n generated users instead of recorded ones.
+//   -days <n>          Days per generated user (default 365).
+//   -seed <n>          Random seed for the generated users (default 1).
+//   -timeouts <min,...>  The timeouts to evaluate (default 5..60 in steps of
+//                      5, the tray menu's).
+//   -sstimeout <min>   The users' screensaver timeout (default 10).
+//   -false <min>       A lock undone within that many minutes after the
+//                      minute of the lock counts as false (default 1).
+//   -away <min>        Idle times this long count as absences (default 10).
+//   -userlocks         Count the recorded locks as the users' own: an
+//                      absence recorded as locked sooner isn't locked by the
+//                      setting. By default they are ignored, since the
+//                      logs record IdleLock's own locks too.
+//   -threads <n>       Worker threads (default the number of processors).
+//   -csv               The settings as comma separated values, with a
+//                      header line.
+//
+// The files are activity logs (ActivityLog.h), which are only read. They
+// record input by the minute, so an idle time is taken to be the minutes
+// from one minute with input to the next: it lasts that long give or take
+// a minute. The idle time before a user's first input, after the last,
+// and around days missing from a log are unknown and left out.
+//
+// Each worker takes the next user, finds the idle times in the minute
+// bitmaps 64 minutes at a time, from the bits where input starts again,
+// and counts them in a histogram by length (and by where a recorded lock
+// came, with -userlocks), capped just past the longest timeout. The
+// settings are evaluated from the merged histogram at the end, so adding
+// settings costs next to nothing, and the time goes into reading the
+// bitmaps. Exits with 1 if no user could be read, 2 on a usage error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "../ActivityLog.h"
+
+
+static const uint32_t MinLockIdleTime = 60000;  // TLockScheduler::MinLockIdleTime
+static const int32_t  FirstGeneratedDay = 19723;  // 2024-01-01, a Monday.
+
+
+static inline int LowestBit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return int(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, uint32_t(x)))
+        return int(index);
+    _BitScanForward(&index, uint32_t(x >> 32));
+    return int(index) + 32;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+
+static inline int HighestBit(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return int(index);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanReverse(&index, uint32_t(x >> 32)))
+        return int(index) + 32;
+    _BitScanReverse(&index, uint32_t(x));
+    return int(index);
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+
+// Idle times by length in minutes, and by the minute of the first recorded
+// lock in them; both capped at Cap() - 1, which also stands for no lock.
+class TIdleHistogram
+{
+public:
+    explicit TIdleHistogram(int aCap) : cap(aCap), counts(size_t(aCap) * aCap) {}
+
+    int Cap() const { return cap; }
+
+    void Add(int64_t minutes, int64_t lockAt)
+    {
+        int length = minutes < cap - 1 ? int(minutes) : cap - 1;
+        int lock = lockAt >= 0 && lockAt < cap - 1 ? int(lockAt) : cap - 1;
+        counts[size_t(length) * cap + lock]++;
+        idleTimes++;
+    }
+
+    uint64_t Count(int length, int lock) const { return counts[size_t(length) * cap + lock]; }
+
+    void Merge(const TIdleHistogram &other)
+    {
+        for (size_t i = 0; i < counts.size(); i++)
+            counts[i] += other.counts[i];
+        idleTimes += other.idleTimes;
+        users += other.users;
+        days += other.days;
+    }
+
+    uint64_t idleTimes = 0;
+    uint64_t users = 0;
+    uint64_t days = 0;
+
+private:
+    int cap;
+    std::vector<uint64_t> counts;
+};
+
+
+// Finds the idle times in a user's days, in order, a word at a time.
+class TIdleScanner
+{
+public:
+    TIdleScanner(TIdleHistogram &aHistogram, bool aUserLocks) : histogram(aHistogram), userLocks(aUserLocks) {}
+
+    void Scan(const std::vector<TActivityDay> &days)
+    {
+        int32_t previousDay = TActivityDay::UnusedDay;
+        for (const TActivityDay &day : days) {
+            // What went on in a missing day isn't known.
+            if (previousDay == TActivityDay::UnusedDay || day.day != previousDay + 1) {
+                lastActive = -1;
+                firstLock = -1;
+            }
+            previousDay = day.day;
+
+            int64_t dayBase = int64_t(day.day) * TActivityDay::MinutesPerDay;
+            for (int i = 0; i < TActivityDay::Words; i++)
+                Word(dayBase + i * 64, day.bits[AM_Active][i], userLocks ? day.bits[AM_Lock][i] : 0);
+        }
+        histogram.users++;
+        histogram.days += days.size();
+    }
+
+private:
+    // base is the minute of bit 0. The bits past the end of a day are never
+    // set, and base counts on from the day's first minute, so an idle time
+    // across midnight comes out whole.
+    void Word(int64_t base, uint64_t active, uint64_t locks)
+    {
+        if (active == 0) {
+            if (firstLock < 0 && locks != 0)
+                firstLock = base + LowestBit(locks);
+            return;
+        }
+
+        // The minutes with input after a minute without: each ends an idle time.
+        uint64_t carry = lastActive == base - 1 ? 1 : 0;
+        uint64_t starts = active & ~(active << 1 | carry);
+        while (starts != 0) {
+            int bit = LowestBit(starts);
+            starts &= starts - 1;
+
+            uint64_t before = active & ((uint64_t(1) << bit) - 1);
+            int64_t lockAt = -1;
+            if (before != 0) {
+                int last = HighestBit(before);
+                lastActive = base + last;
+                uint64_t between = locks & ~((uint64_t(1) << last) - 1) & ((uint64_t(1) << bit) - 1);
+                if (between != 0)
+                    lockAt = base + LowestBit(between);
+            } else if (firstLock >= 0) {
+                lockAt = firstLock;
+            } else if ((locks & ((uint64_t(1) << bit) - 1)) != 0) {
+                lockAt = base + LowestBit(locks);
+            }
+            if (lastActive >= 0)
+                histogram.Add(base + bit - lastActive, lockAt >= 0 ? lockAt - lastActive : -1);
+        }
+
+        int last = HighestBit(active);
+        lastActive = base + last;
+        uint64_t after = locks & ~((uint64_t(1) << last) - 1);
+        firstLock = after != 0 ? base + LowestBit(after) : -1;
+    }
+
+    TIdleHistogram &histogram;
+    bool userLocks;
+    int64_t lastActive = -1;  // The last minute with input, -1 if not known.
+    int64_t firstLock = -1;   // The first lock from lastActive on, -1 if none.
+};
+
+
+// Reads the days that an activity log holds, in order. Returns false if the
+// file isn't an activity log.
+static bool ReadLog(const std::string &fileName, std::vector<TActivityDay> &days)
+{
+    days.clear();
+    FILE *f = fopen(fileName.c_str(), "rb");
+    if (f == NULL)
+        return false;
+    TActivityHeader header;
+    bool ok = fread(&header, sizeof header, 1, f) == 1
+        && memcmp(header.magic, ActivityLogMagic, sizeof ActivityLogMagic) == 0
+        && header.version == ActivityLogVersion
+        && header.headerSize == sizeof(TActivityHeader)
+        && header.daySize == sizeof(TActivityDay);
+    if (ok) {
+        days.resize(header.capacity);
+        ok = fread(days.data(), sizeof(TActivityDay), days.size(), f) == days.size();
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+
+    days.erase(std::remove_if(days.begin(), days.end(),
+        [](const TActivityDay &day) { return day.day == TActivityDay::UnusedDay; }), days.end());
+    std::sort(days.begin(), days.end(),
+        [](const TActivityDay &a, const TActivityDay &b) { return a.day < b.day; });
+    return true;
+}
+
+
+// Marks the minutes first..end - 1 as active, a word at a time.
+static void SetMinutes(TActivityDay &day, int first, int end)
+{
+    while (first < end) {
+        int bit = first % 64;
+        int count = std::min(end - first, 64 - bit);
+        uint64_t mask = count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1) << bit;
+        day.bits[AM_Active][first / 64] |= mask;
+        first += count;
+    }
+}
+
+
+// A working week: weekdays of 8 to 10 hours from 8 to 9:30, of stretches of
+// input and absences, mostly short ones (some of them pauses in which the
+// user reads or listens, which the log can't tell apart), a quarter of
+// them meetings and such, and a few that last the rest of the day. Each
+// user's habits are drawn from the seed and the user's number, so a user
+// comes out the same on any thread.
+static void GenerateUser(uint64_t user, int days, unsigned seed, std::vector<TActivityDay> &out)
+{
+    std::mt19937 random(seed * 1000003u + unsigned(user));
+    auto uniform = [&random](double low, double high) { return std::uniform_real_distribution<double>(low, high)(random); };
+    auto exponential = [&random](double mean) { return std::exponential_distribution<double>(1. / mean)(random); };
+
+    double activeMean = uniform(20, 60);
+    double shortMean = uniform(2, 6);
+    out.assign(size_t(days), TActivityDay());
+
+    for (int i = 0; i < days; i++) {
+        TActivityDay &day = out[i];
+        day.day = FirstGeneratedDay + i;
+        int weekday = (day.day + 4) % 7;  // 1970-01-01 was a Thursday.
+        if (weekday == 0 || weekday == 6)
+            continue;
+
+        int minute = 480 + int(uniform(0, 90));
+        int end = minute + 480 + int(uniform(0, 120));
+        while (minute < end) {
+            int active = 1 + int(exponential(activeMean));
+            SetMinutes(day, minute, std::min(minute + active, end));
+            double p = uniform(0, 1);
+            double mean = p < .7 ? shortMean : p < .95 ? 25 : 240;
+            minute += active + 1 + int(exponential(mean));
+        }
+    }
+}
+
+
+struct TSetting
+{
+    int timeout;             // Minutes.
+    bool screenSaver;
+    int due;                 // The idle minutes at which the lock comes.
+    uint64_t locks = 0;
+    uint64_t falseLocks = 0;
+    uint64_t absences = 0;
+    uint64_t missed = 0;     // Absences that ended with the session unlocked.
+    uint64_t openMinutes = 0;  // Unlocked minutes of the absences.
+};
+
+
+// The minutes of idle time at which the lock comes, rounded up.
+static int DueMinutes(int timeout, bool screenSaver, int ssTimeout)
+{
+    uint32_t ms = uint32_t(timeout) * 60000;
+    uint32_t threshold = ms > MinLockIdleTime ? ms : MinLockIdleTime + 1;
+    uint32_t due = (threshold + 59999) / 60000;
+    return screenSaver && ssTimeout > int(due) ? ssTimeout : int(due);
+}
+
+
+// Idle times of the same length and lock minute fare the same, so each
+// histogram bin is weighed once per setting.
+static void Evaluate(const TIdleHistogram &histogram, int falseMinutes, int away, std::vector<TSetting> &settings)
+{
+    int cap = histogram.Cap();
+    for (int length = 1; length < cap; length++) {
+        for (int lock = 0; lock < cap; lock++) {
+            uint64_t n = histogram.Count(length, lock);
+            if (n == 0)
+                continue;
+            bool recordedLock = lock < cap - 1;
+            for (TSetting &setting : settings) {
+                bool userLocked = recordedLock && lock < setting.due;
+                bool locked = !userLocked && length >= setting.due;
+                if (locked) {
+                    setting.locks += n;
+                    if (length - setting.due <= falseMinutes)
+                        setting.falseLocks += n;
+                }
+                if (length >= away) {
+                    setting.absences += n;
+                    if (!locked && !userLocked)
+                        setting.missed += n;
+                    setting.openMinutes += n * uint64_t(userLocked ? lock : std::min(length, setting.due));
+                }
+            }
+        }
+    }
+}
+
+
+static bool ParseTimeouts(const char *list, std::vector<int> &timeouts)
+{
+    timeouts.clear();
+    for (const char *p = list; *p != 0; ) {
+        char *end;
+        long minutes = strtol(p, &end, 10);
+        if (end == p || minutes < 1 || minutes > 24 * 60 || (*end != ',' && *end != 0))
+            return false;
+        timeouts.push_back(int(minutes));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !timeouts.empty();
+}
+
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: fleetwhatif [-list <file>] [-generate <n> [-days <n>] [-seed <n>]]\n"
+                    "                   [-timeouts <min,...>] [-sstimeout <min>] [-false <min>] [-away <min>]\n"
+                    "                   [-userlocks] [-threads <n>] [-csv] [file...]\n");
+    return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> fileNames;
+    uint64_t generate = 0;
+    int days = 365;
+    unsigned seed = 1;
+    std::vector<int> timeouts;
+    int ssTimeout = 10;
+    int falseMinutes = 1;
+    int away = 10;
+    bool userLocks = false;
+    unsigned threadCount = std::thread::hardware_concurrency();
+    bool csv = false;
+
+    for (int minutes = 5; minutes <= 60; minutes += 5)
+        timeouts.push_back(minutes);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-list") == 0 && i + 1 < argc) {
+            FILE *f = fopen(argv[++i], "r");
+            if (f == NULL) {
+                fprintf(stderr, "Could not read %s.\n", argv[i]);
+                return 1;
+            }
+            char line[4096];
+            while (fgets(line, sizeof line, f) != NULL) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (line[0] != 0)
+                    fileNames.push_back(line);
+            }
+            fclose(f);
+        } else if (strcmp(argv[i], "-generate") == 0 && i + 1 < argc) {
+            generate = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-days") == 0 && i + 1 < argc) {
+            days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = unsigned(strtoul(argv[++i], NULL, 10));
+        } else if (strcmp(argv[i], "-timeouts") == 0 && i + 1 < argc) {
+            if (!ParseTimeouts(argv[++i], timeouts))
+                return Usage();
+        } else if (strcmp(argv[i], "-sstimeout") == 0 && i + 1 < argc) {
+            ssTimeout = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-false") == 0 && i + 1 < argc) {
+            falseMinutes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-away") == 0 && i + 1 < argc) {
+            away = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-userlocks") == 0) {
+            userLocks = true;
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threadCount = unsigned(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-csv") == 0) {
+            csv = true;
+        } else if (argv[i][0] != '-') {
+            fileNames.push_back(argv[i]);
+        } else {
+            return Usage();
+        }
+    }
+    uint64_t users = generate != 0 ? generate : fileNames.size();
+    if (users == 0 || days < 1 || ssTimeout < 0 || falseMinutes < 0 || away < 1)
+        return Usage();
+    if (threadCount == 0)
+        threadCount = 1;
+    if (threadCount > users)
+        threadCount = unsigned(users);
+
+    std::vector<TSetting> settings;
+    int longest = away;
+    for (int screenSaver = 0; screenSaver < 2; screenSaver++) {
+        for (int timeout : timeouts) {
+            TSetting setting;
+            setting.timeout = timeout;
+            setting.screenSaver = screenSaver != 0;
+            setting.due = DueMinutes(timeout, setting.screenSaver, ssTimeout);
+            longest = std::max(longest, setting.due + falseMinutes);
+            settings.push_back(setting);
+        }
+    }
+    int cap = longest + 2;
+
+    // The users are handed out one at a time, so that a thread that drew
+    // the long logs doesn't hold up the rest. Each thread counts in a
+    // histogram of its own, and hands it in at the end.
+    std::vector<TIdleHistogram> histograms(threadCount, TIdleHistogram(cap));
+    std::atomic<uint64_t> nextUser(0);
+    std::atomic<uint64_t> unreadable(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            TIdleHistogram histogram(cap);
+            TIdleScanner scanner(histogram, userLocks);
+            std::vector<TActivityDay> userDays;
+            for (uint64_t user; (user = nextUser.fetch_add(1)) < users; ) {
+                if (generate != 0)
+                    GenerateUser(user, days, seed, userDays);
+                else if (!ReadLog(fileNames[size_t(user)], userDays)) {
+                    unreadable++;
+                    continue;
+                }
+                scanner.Scan(userDays);
+            }
+            histograms[t] = std::move(histogram);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    TIdleHistogram total(cap);
+    for (const TIdleHistogram &histogram : histograms)
+        total.Merge(histogram);
+    Evaluate(total, falseMinutes, away, settings);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (unreadable != 0)
+        fprintf(stderr, "%llu files were not activity logs.\n", (unsigned long long)unreadable.load());
+    if (total.users == 0)
+        return 1;
+
+    double perDay = total.days != 0 ? 1. / total.days : 0.;
+    if (csv) {
+        printf("timeout_minutes,screensaver,locks_per_day,false_per_day,false_share,missed_per_day,"
+            "open_minutes_per_absence\n");
+    } else {
+        printf("%llu users, %llu days, %llu idle times, in %.2f s on %u threads (%.2f M days/s)\n",
+            (unsigned long long)total.users, (unsigned long long)total.days, (unsigned long long)total.idleTimes,
+            seconds, threadCount, seconds > 0 ? total.days / seconds / 1e6 : 0.);
+        printf("\ntimeout  screensaver  locks/day  false/day  false %%  missed/day  open min/absence\n");
+    }
+    for (const TSetting &setting : settings) {
+        double falseShare = setting.locks != 0 ? double(setting.falseLocks) / setting.locks : 0.;
+        double open = setting.absences != 0 ? double(setting.openMinutes) / setting.absences : 0.;
+        printf(csv ? "%d,%s,%.3f,%.3f,%.4f,%.3f,%.2f\n" : "%3d min  %-11s  %9.2f  %9.2f  %7.1f  %10.2f  %16.1f\n",
+            setting.timeout, csv ? (setting.screenSaver ? "1" : "0") : (setting.screenSaver ? "yes" : "no"),
+            setting.locks * perDay, setting.falseLocks * perDay, csv ? falseShare : falseShare * 100,
+            setting.missed * perDay, open);
+    }
+    return 0;
+}
@@ -0,0 +1,270 @@
+// Footprint.cpp
+// Measures the memory footprint of a front end: starts it, lets it settle,
+// samples its working set, and stops it with SIGTERM. Also reports the size
+// of the binary, so that both can be compared before and after a change
+// (e.g. the headless mode, or what the logger links in).
+// Builds on Linux, e.g.
+//   g++ -std=c++14 -O2 -o footprint Footprint.cpp
+//
+// Usage: footprint [options] program [arguments...]
+//   -settle <ms>    Time to let the program start up (default 2000).
+//   -samples <n>    Samples taken a second apart after that (default 5).
+//   -csv            One line of values, with a header line.
+//
+// The working set is taken from /proc/<pid>/status and smaps_rollup: the
+// resident set split into anonymous and file pages, the peak, and the
+// private and proportional sizes, which leave out what shared libraries
+// share with other processes. The largest of the samples is reported. The
+// binary size is the file size and the sizes of its code and data segments.
+// Exits with 1 if the program can't be run, exits before it is measured, or
+// doesn't exit on SIGTERM.
+
+#include <elf.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+
+struct TBinarySize
+{
+    uint64_t file = 0;
+    uint64_t code = 0;          // Executable load segments.
+    uint64_t data = 0;          // Writable load segments, bss included.
+    uint64_t readOnly = 0;      // Other load segments.
+};
+
+
+// kB, like /proc reports them.
+struct TWorkingSet
+{
+    uint64_t rss = 0;
+    uint64_t rssAnon = 0;
+    uint64_t rssFile = 0;
+    uint64_t peak = 0;
+    uint64_t privateSize = 0;
+    uint64_t pss = 0;
+
+    void Max(const TWorkingSet &other)
+    {
+        Max(rss, other.rss);
+        Max(rssAnon, other.rssAnon);
+        Max(rssFile, other.rssFile);
+        Max(peak, other.peak);
+        Max(privateSize, other.privateSize);
+        Max(pss, other.pss);
+    }
+
+private:
+    static void Max(uint64_t &value, uint64_t other)
+    {
+        if (other > value)
+            value = other;
+    }
+};
+
+
+// Looks the program up on PATH, like execvp() will.
+static std::string FindProgram(const char *name)
+{
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    const char *path = getenv("PATH");
+    std::string dirs = path != NULL ? path : "/usr/bin:/bin";
+    size_t start = 0;
+    for (;;) {
+        size_t end = dirs.find(':', start);
+        std::string candidate = dirs.substr(start, end == std::string::npos ? std::string::npos : end - start) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+        if (end == std::string::npos)
+            return name;
+        start = end + 1;
+    }
+}
+
+
+static bool ReadBinarySize(const std::string &fileName, TBinarySize &size)
+{
+    struct stat st;
+    if (stat(fileName.c_str(), &st) != 0)
+        return false;
+    size.file = uint64_t(st.st_size);
+
+    // Only 64-bit ELF files are taken apart; others just have the file size.
+    FILE *f = fopen(fileName.c_str(), "rb");
+    if (f == NULL)
+        return false;
+    Elf64_Ehdr header;
+    if (fread(&header, sizeof header, 1, f) == 1 && memcmp(header.e_ident, ELFMAG, SELFMAG) == 0
+        && header.e_ident[EI_CLASS] == ELFCLASS64 && header.e_phentsize == sizeof(Elf64_Phdr)) {
+        for (int i = 0; i < header.e_phnum; i++) {
+            Elf64_Phdr segment;
+            if (fseek(f, long(header.e_phoff + uint64_t(i) * sizeof segment), SEEK_SET) != 0
+                || fread(&segment, sizeof segment, 1, f) != 1)
+                break;
+            if (segment.p_type != PT_LOAD)
+                continue;
+            if (segment.p_flags & PF_X)
+                size.code += segment.p_memsz;
+            else if (segment.p_flags & PF_W)
+                size.data += segment.p_memsz;
+            else
+                size.readOnly += segment.p_memsz;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+
+// Adds the "<key>: <n> kB" lines of the given keys in a /proc file.
+static bool ReadProcValues(pid_t pid, const char *file, const char *const *keys, uint64_t *const *values, int count)
+{
+    char fileName[64];
+    snprintf(fileName, sizeof fileName, "/proc/%d/%s", int(pid), file);
+    FILE *f = fopen(fileName, "r");
+    if (f == NULL)
+        return false;
+
+    char line[256];
+    while (fgets(line, sizeof line, f) != NULL) {
+        for (int i = 0; i < count; i++) {
+            size_t length = strlen(keys[i]);
+            if (strncmp(line, keys[i], length) == 0 && line[length] == ':')
+                *values[i] += strtoull(line + length + 1, NULL, 10);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+
+static bool SampleWorkingSet(pid_t pid, TWorkingSet &ws)
+{
+    static const char *const StatusKeys[] = { "VmRSS", "RssAnon", "RssFile", "VmHWM" };
+    static const char *const RollupKeys[] = { "Private_Clean", "Private_Dirty", "Pss" };
+    uint64_t *statusValues[] = { &ws.rss, &ws.rssAnon, &ws.rssFile, &ws.peak };
+    uint64_t *rollupValues[] = { &ws.privateSize, &ws.privateSize, &ws.pss };
+
+    ws = TWorkingSet();
+    if (!ReadProcValues(pid, "status", StatusKeys, statusValues, 4))
+        return false;
+    // smaps_rollup is Linux 4.14 and later; the private sizes stay 0 before.
+    ReadProcValues(pid, "smaps_rollup", RollupKeys, rollupValues, 3);
+    return ws.rss > 0;
+}
+
+
+static void Sleep(int ms)
+{
+    timespec t = { ms / 1000, long(ms % 1000) * 1000000 };
+    nanosleep(&t, NULL);
+}
+
+
+// Returns true if the child has exited; sets its status.
+static bool Exited(pid_t pid, int &status)
+{
+    return waitpid(pid, &status, WNOHANG) == pid;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int settle = 2000;
+    int samples = 5;
+    bool csv = false;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-settle") == 0 && i + 1 < argc)
+            settle = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else
+            break;
+    }
+    if (i >= argc || argv[i][0] == '-' || samples < 1) {
+        fprintf(stderr, "Usage: footprint [-settle <ms>] [-samples <n>] [-csv] program [arguments...]\n");
+        return 2;
+    }
+
+    std::string program = FindProgram(argv[i]);
+    TBinarySize binary;
+    if (!ReadBinarySize(program, binary)) {
+        fprintf(stderr, "Could not read %s.\n", program.c_str());
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(program.c_str(), argv + i);
+        _exit(127);
+    }
+    if (pid < 0) {
+        fprintf(stderr, "Could not start %s.\n", program.c_str());
+        return 1;
+    }
+
+    int status = 0;
+    TWorkingSet ws;
+    bool measured = true;
+    Sleep(settle);
+    for (int n = 0; n < samples && measured; n++) {
+        if (n > 0)
+            Sleep(1000);
+        TWorkingSet sample;
+        measured = !Exited(pid, status) && SampleWorkingSet(pid, sample);
+        ws.Max(sample);
+    }
+    if (!measured) {
+        fprintf(stderr, "%s exited before it was measured.\n", program.c_str());
+        return 1;
+    }
+
+    kill(pid, SIGTERM);
+    bool stopped = false;
+    for (int waited = 0; waited < 5000 && !stopped; waited += 10) {
+        stopped = Exited(pid, status);
+        if (!stopped)
+            Sleep(10);
+    }
+    if (!stopped) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+
+    if (csv) {
+        printf("program,file_bytes,code_bytes,data_bytes,rodata_bytes,rss_kb,rss_anon_kb,rss_file_kb,peak_kb,private_kb,pss_kb\n");
+        printf("%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", program.c_str(),
+            (unsigned long long)binary.file, (unsigned long long)binary.code, (unsigned long long)binary.data,
+            (unsigned long long)binary.readOnly, (unsigned long long)ws.rss, (unsigned long long)ws.rssAnon,
+            (unsigned long long)ws.rssFile, (unsigned long long)ws.peak, (unsigned long long)ws.privateSize,
+            (unsigned long long)ws.pss);
+    } else {
+        printf("binary:      %llu bytes, segments code/data/read-only: %llu/%llu/%llu\n",
+            (unsigned long long)binary.file, (unsigned long long)binary.code,
+            (unsigned long long)binary.data, (unsigned long long)binary.readOnly);
+        printf("working set: %llu kB (anonymous %llu, file %llu), peak %llu kB\n",
+            (unsigned long long)ws.rss, (unsigned long long)ws.rssAnon,
+            (unsigned long long)ws.rssFile, (unsigned long long)ws.peak);
+        printf("private:     %llu kB, proportional %llu kB\n",
+            (unsigned long long)ws.privateSize, (unsigned long long)ws.pss);
+    }
+
+    if (!stopped) {
+        fprintf(stderr, "%s didn't exit on SIGTERM.\n", program.c_str());
+        return 1;
+    }
+    return 0;
+}
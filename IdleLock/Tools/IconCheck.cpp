@@ -0,0 +1,155 @@
+// IconCheck.cpp
+// Checks the tray icon rasterization (IconRaster.h) that the countdown of
+// the warning uses: the number and size of the frames, a ring that covers
+// more with each frame and is whole in the last, nothing drawn outside the
+// ring, and Blend() at no and full coverage. Then it measures what
+// rendering the frames costs, which happens once per icon set.
+// Builds with the CMake build (target iconcheck), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o iconcheck IconCheck.cpp ../IconRaster.cpp
+//
+// Usage: iconcheck [-renders <n>]
+//   -renders <n>  Renders of the frames to time, per size (default 100).
+//
+// Prints each check with ok or FAILED, and the us per render of the frames
+// at 16, 32 and 48 pixels. Exits with 1 if any check failed.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "../IconRaster.h"
+
+
+// As many as the tray icon cache renders.
+static const int Frames = 12;
+
+static bool failed = false;
+
+
+static void Check(bool ok, const char *what)
+{
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+    failed |= !ok;
+}
+
+
+// The ring's coverage: the sum of the alpha of all pixels.
+static uint64_t Coverage(const TIconImage &image)
+{
+    uint64_t sum = 0;
+    for (uint32_t pixel : image.pixels)
+        sum += pixel >> 24;
+    return sum;
+}
+
+
+// True if no pixel that lies wholly outside the ring, or wholly inside it,
+// has been drawn on. A pixel reaches at most half its diagonal from its
+// center.
+static bool OnlyRingDrawn(const TIconImage &image)
+{
+    double center = image.size / 2.;
+    double inner = center - (image.size >= 32 ? image.size / 8. : 2.);
+    double reach = sqrt(.5);
+    for (int y = 0; y < image.size; y++) {
+        for (int x = 0; x < image.size; x++) {
+            double dx = x + .5 - center;
+            double dy = y + .5 - center;
+            double r = sqrt(dx * dx + dy * dy);
+            if ((r > center + reach || r < inner - reach) && image.pixels[size_t(y) * image.size + x] != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+
+static void CheckFrames(int size)
+{
+    char what[80];
+    TIconImage base(size);
+    std::vector<TIconImage> frames = TIconRaster::RenderCountdownFrames(base, Frames);
+
+    bool sized = frames.size() == size_t(Frames);
+    for (const TIconImage &frame : frames)
+        sized &= frame.size == size && frame.pixels.size() == size_t(size) * size;
+    snprintf(what, sizeof what, "%d px: %d frames of the base's size", size, Frames);
+    Check(sized, what);
+    if (!sized)
+        return;
+
+    bool growing = Coverage(frames[0]) > 0;
+    for (int i = 1; i < Frames; i++)
+        growing &= Coverage(frames[i]) > Coverage(frames[i - 1]);
+    snprintf(what, sizeof what, "%d px: the ring covers more with each frame", size);
+    Check(growing, what);
+
+    TIconImage full(size);
+    TIconRaster::DrawCountdownRing(full, 1);
+    snprintf(what, sizeof what, "%d px: the last frame has the whole ring", size);
+    Check(frames[Frames - 1].pixels == full.pixels, what);
+
+    bool outside = true;
+    for (const TIconImage &frame : frames)
+        outside &= OnlyRingDrawn(frame);
+    snprintf(what, sizeof what, "%d px: transparent outside the ring", size);
+    Check(outside, what);
+}
+
+
+static void CheckBlend()
+{
+    Check(TIconRaster::Blend(0x80102030, TIconRaster::RingColor, 0) == 0x80102030,
+        "blend: no coverage leaves the pixel");
+    Check(TIconRaster::Blend(0, TIconRaster::RingColor, 0) == 0, "blend: no coverage over nothing is nothing");
+    Check(TIconRaster::Blend(0xFF102030, TIconRaster::RingColor, 1) == TIconRaster::RingColor,
+        "blend: full coverage of an opaque color replaces the pixel");
+    Check(TIconRaster::Blend(0, 0x80FFB000, 1) == 0x80FFB000, "blend: full coverage over nothing is the color");
+
+    uint32_t half = TIconRaster::Blend(0xFF000000, 0xFFFFFFFF, .5);
+    Check((half >> 24) == 0xFF && (half & 0xFF) >= 0x7F && (half & 0xFF) <= 0x80,
+        "blend: half coverage is halfway");
+}
+
+
+static void MeasureRenders(int size, int renders)
+{
+    TIconImage base(size);
+    auto start = std::chrono::steady_clock::now();
+    size_t frames = 0;
+    for (int i = 0; i < renders; i++)
+        frames += TIconRaster::RenderCountdownFrames(base, Frames).size();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double us = double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / 1000;
+    printf("  %2d px: %d renders of %d frames, %.1f us per render\n", size, renders, int(frames / renders),
+        us / renders);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int renders = 100;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-renders") == 0 && i + 1 < argc) {
+            renders = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: iconcheck [-renders <n>]\n");
+            return 2;
+        }
+    }
+    if (renders < 1)
+        return 2;
+
+    for (int size : { 16, 32, 48 })
+        CheckFrames(size);
+    CheckBlend();
+    for (int size : { 16, 32, 48 })
+        MeasureRenders(size, renders);
+
+    printf("%s\n", failed ? "FAILED" : "All checks ok.");
+    return failed ? 1 : 0;
+}
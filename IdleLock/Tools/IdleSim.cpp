@@ -0,0 +1,902 @@
+// IdleSim.cpp
+// Replays activity traces through the real lock engine (LockEngine.cpp) on a
+// virtual clock, and checks its decisions against what should have happened.
+// Builds on Linux (or anywhere with a C++14 compiler), e.g.
+//   g++ -std=c++14 -O2 -I.. -o idlesim IdleSim.cpp ../LockEngine.cpp ../LockScheduler.cpp
+//       ../Logger.cpp ../TextUtil.cpp ../EventJournal.cpp ../MappedFile.cpp ../Stats.cpp
+//       ../LockPolicy.cpp ../ActivityLog.cpp ../AdaptiveTimeout.cpp ../InhibitorSet.cpp
+//       ../ActionPipeline.cpp ../EngineCheckpoint.cpp -pthread
+//
+// Usage: idlesim [options]
+//   -trace <file>      Replay a recorded trace instead of generating one.
+//   -days <n>          Length of the generated trace (default 90).
+//   -seed <n>          Random seed for the generated trace.
+//   -timeout <min>     Lock timeout (default 20).
+//   -screensaver       Only lock if the screensaver is active.
+//   -sstimeout <min>   Screensaver timeout of the generated trace (default 10).
+//   -displaytimeout <min>  Display off timeout of the generated trace (default
+//                      never). If shorter than the screensaver timeout, the
+//                      screensaver never starts.
+//   -events            Deliver screensaver and display changes to the engine as
+//                      events, instead of letting it poll the screensaver.
+//   -warning <s>       Warn that many seconds before a lock (default none).
+//   -sleep <min>       The system sleeps after that much idle time in the
+//                      generated trace (default never).
+//   -power ac|battery|both  The power source (default ac); both runs the
+//                      simulation for each and compares the wakeups.
+//   -systemwake <ms>   Period of other timers on the system, with which the
+//                      engine's timers can be coalesced (default none).
+//   -activity <file>   Record the activity log (ActivityLog.h) in the file,
+//                      which is started over, and compare it to the trace.
+//   -reading <pct>     Share of the absences in the generated trace in which
+//                      the user stays, reading (default 0).
+//   -adaptive <min>    Let the engine raise the timeout up to that many minutes
+//                      on false locks (AdaptiveTimeout.h).
+//   -watching <pct>    Share of the absences in the generated trace that start
+//                      with the user watching a video, which inhibits locking
+//                      (InhibitorSet.h), and then leaving (default 0).
+//   -starttick <n>     Tick count at the start (default 2 days before wraparound).
+//   -v                 Print every lock.
+//
+// A trace is a text file with one event per line: "<ms> <event>", where the
+// time is ms since the start of the trace and event is one of input,
+// saver_on, saver_off, display_off, display_on, lock, unlock, suspend,
+// resume, present, inhibit_on and inhibit_off. Lines starting with # are
+// ignored. Input while the session is locked counts as the user unlocking
+// it. present marks the idle time up to the next input as a pause in which
+// the user stays. inhibit_on and inhibit_off start and end an inhibition,
+// like a video playing, which the engine sees through an event source.
+//
+// A lock is due when the idle time reaches the timeout (at least 60 s) and,
+// if required, the screensaver has started or the display has turned off.
+// Without -events, the engine can't see the display turning off, like on
+// Windows without display notifications, so such locks are missed. The
+// report lists locks that came too early, locks that never came although the
+// user stayed away long enough, the lock latency measured on the virtual
+// clock, and the number of timer wakeups the engine asked for.
+//
+// With -warning, a warning is due the warning time (at most half the
+// timeout) before the lock is, or as soon as the screensaver has started if
+// that is later. Warnings that start early or more than MinWakeDelay late,
+// and countdown wakeups that are not a whole number of WarningTicks before
+// the deadline, are reported as errors; late warnings are not, with
+// -screensaver but without -events, where the engine only sees the
+// screensaver when it polls. Cancelled warnings and how long input took to
+// cancel them are listed too.
+//
+// Timers fire with the first other system timer within their tolerance
+// (TLockEngine::TimerTolerance()), if there is one, otherwise as late as the
+// tolerance allows. Wakeups that came with another timer don't wake the CPU
+// by themselves; the report gives both. While the system sleeps, timers
+// don't fire; the engine is told about the resume, and the idle time then
+// counts from there.
+//
+// While an inhibition lasts, no lock is due; after it, the idle time counts
+// from its end.
+//
+// With -activity, every minute with input in the trace should be marked in
+// the activity log, as far as the log reaches back. Marked minutes without
+// input are errors; minutes missed because a check came late, with input
+// in the next minute before it, are only counted.
+//
+// A lock during such a pause is a false lock: the user unlocks ReactTime
+// later, and goes on pausing. The report gives their share of the locks,
+// and the range of the timeout; with -adaptive, locks are due at the
+// timeout the engine used, and a lock at more idle time than the maximum
+// (plus the tolerance) is an error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "../ActivityLog.h"
+#include "../LockEngine.h"
+#include "../SimBackend.h"
+
+
+enum TSimEventKind
+{
+    SE_Input,
+    SE_ScreenSaverOn,
+    SE_ScreenSaverOff,
+    SE_DisplayOff,
+    SE_DisplayOn,
+    SE_Lock,
+    SE_Unlock,
+    SE_Suspend,
+    SE_Resume,
+    SE_Present,
+    SE_InhibitOn,
+    SE_InhibitOff
+};
+
+
+struct TSimEvent
+{
+    uint64_t      time;
+    TSimEventKind kind;
+};
+
+
+class TTraceSource
+{
+public:
+    virtual ~TTraceSource() {}
+
+    virtual bool Next(TSimEvent &event) = 0;
+};
+
+
+class TFileTrace : public TTraceSource
+{
+public:
+    TFileTrace(FILE *aFile) : file(aFile) {}
+
+    bool Next(TSimEvent &event) override
+    {
+        char line[256];
+        char name[32];
+        unsigned long long time;
+
+        while (fgets(line, sizeof line, file) != NULL) {
+            if (line[0] == '#' || sscanf(line, "%llu %31s", &time, name) != 2)
+                continue;
+
+            event.time = time;
+            if (strcmp(name, "input") == 0)
+                event.kind = SE_Input;
+            else if (strcmp(name, "saver_on") == 0)
+                event.kind = SE_ScreenSaverOn;
+            else if (strcmp(name, "saver_off") == 0)
+                event.kind = SE_ScreenSaverOff;
+            else if (strcmp(name, "display_off") == 0)
+                event.kind = SE_DisplayOff;
+            else if (strcmp(name, "display_on") == 0)
+                event.kind = SE_DisplayOn;
+            else if (strcmp(name, "lock") == 0)
+                event.kind = SE_Lock;
+            else if (strcmp(name, "unlock") == 0)
+                event.kind = SE_Unlock;
+            else if (strcmp(name, "suspend") == 0)
+                event.kind = SE_Suspend;
+            else if (strcmp(name, "resume") == 0)
+                event.kind = SE_Resume;
+            else if (strcmp(name, "present") == 0)
+                event.kind = SE_Present;
+            else if (strcmp(name, "inhibit_on") == 0)
+                event.kind = SE_InhibitOn;
+            else if (strcmp(name, "inhibit_off") == 0)
+                event.kind = SE_InhibitOff;
+            else
+                continue;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    FILE *file;
+};
+
+
+// Alternates between active periods, with input every few seconds, and
+// absences of mostly short, sometimes long duration. The screensaver starts
+// after ssTimeout of idle time, and the display turns off after
+// displayTimeout (0 for never); like on Windows, the screensaver doesn't
+// start once the display is off. The system sleeps after sleepTimeout (0 for
+// never), and resumes when the user comes back. A readingShare of the
+// absences are pauses in which the user stays, mostly of a few minutes; a
+// watchingShare start with a video, which keeps the display on and the
+// system awake while it plays, like display power requests do on Windows.
+class TGeneratedTrace : public TTraceSource
+{
+public:
+    TGeneratedTrace(uint64_t aEnd, uint64_t aSsTimeout, uint64_t aDisplayTimeout, uint64_t aSleepTimeout,
+        double aReadingShare, double aWatchingShare, unsigned seed)
+        : end(aEnd), ssTimeout(aSsTimeout), displayTimeout(aDisplayTimeout), sleepTimeout(aSleepTimeout),
+          readingShare(aReadingShare), watchingShare(aWatchingShare), random(seed)
+    {
+        StartActivity(0);
+    }
+
+    bool Next(TSimEvent &event) override
+    {
+        if (!pending.empty()) {
+            event = pending.front();
+            pending.pop_front();
+            return true;
+        }
+        if (time >= end)
+            return false;
+
+        event.time = time;
+        event.kind = SE_Input;
+
+        if (time + 10000 < activeEnd) {
+            time += std::uniform_int_distribution<uint64_t>(1000, 10000)(random);
+        } else {
+            // Start of an absence, or of a pause in which the user stays.
+            double p = std::uniform_real_distribution<double>(0, 1)(random);
+            bool reading = p < readingShare;
+            bool watching = !reading && p < readingShare + watchingShare;
+            uint64_t video = watching ? Video() : 0;
+            uint64_t gap = video + (reading ? Reading() : Absence());
+            if (reading)
+                pending.push_back(TSimEvent{ time, SE_Present });
+            if (watching) {
+                pending.push_back(TSimEvent{ time, SE_InhibitOn });
+                pending.push_back(TSimEvent{ time + video, SE_InhibitOff });
+            }
+            // The system's idle timers start after the video.
+            uint64_t quiet = time + video;
+            bool sleeps = sleepTimeout != 0 && gap - video > sleepTimeout;
+            uint64_t awake = sleeps ? sleepTimeout : gap - video;
+            bool saver = awake > ssTimeout && (displayTimeout == 0 || ssTimeout < displayTimeout);
+            bool displayOff = displayTimeout != 0 && awake > displayTimeout;
+            if (saver)
+                pending.push_back(TSimEvent{ quiet + ssTimeout, SE_ScreenSaverOn });
+            if (displayOff)
+                pending.push_back(TSimEvent{ quiet + displayTimeout, SE_DisplayOff });
+            if (sleeps) {
+                pending.push_back(TSimEvent{ quiet + sleepTimeout, SE_Suspend });
+                pending.push_back(TSimEvent{ time + gap, SE_Resume });
+            }
+            if (displayOff)
+                pending.push_back(TSimEvent{ time + gap, SE_DisplayOn });
+            if (saver)
+                pending.push_back(TSimEvent{ time + gap, SE_ScreenSaverOff });
+            StartActivity(time + gap);
+        }
+        return true;
+    }
+
+private:
+    void StartActivity(uint64_t at)
+    {
+        time = at;
+        activeEnd = at + uint64_t(std::exponential_distribution<double>(1. / (40 * 60000))(random));
+    }
+
+    uint64_t Absence()
+    {
+        double p = std::uniform_real_distribution<double>(0, 1)(random);
+        double mean = p < .7 ? 3 * 60000. : p < .95 ? 25 * 60000. : 4 * 3600000.;
+        return 10000 + uint64_t(std::exponential_distribution<double>(1. / mean)(random));
+    }
+
+    uint64_t Reading()
+    {
+        return 10000 + uint64_t(std::exponential_distribution<double>(1. / (8 * 60000))(random));
+    }
+
+    uint64_t Video()
+    {
+        return 60000 + uint64_t(std::exponential_distribution<double>(1. / (30 * 60000))(random));
+    }
+
+    uint64_t end;
+    uint64_t ssTimeout;
+    uint64_t displayTimeout;
+    uint64_t sleepTimeout;
+    double   readingShare;
+    double   watchingShare;
+    std::mt19937 random;
+    uint64_t time = 0;
+    uint64_t activeEnd = 0;
+    std::deque<TSimEvent> pending;  // The rest of the current absence.
+};
+
+
+static const uint64_t Never = UINT64_MAX;
+
+// How long a user who was there takes to undo a false lock.
+static const uint64_t ReactTime = 5000;
+
+
+struct TSimConfig
+{
+    uint32_t     startTick;
+    uint32_t     timeout;
+    bool         requireScreenSaver;
+    bool         displayEvents;
+    uint32_t     warningTime;
+    TPowerSource power;
+    uint32_t     systemWake;
+    const char  *activityFile;
+    uint32_t     adaptiveMax;
+    bool         verbose;
+};
+
+
+class TSimulator
+{
+public:
+    TSimulator(const TSimConfig &config)
+        : backend(config.startTick, config.displayEvents), inhibitors(backend), engine(backend, logger),
+          verbose(config.verbose), warningTime(config.warningTime), systemWake(config.systemWake)
+    {
+        inhibitor = new TManualInhibitor(L"video");
+        inhibitors.Add(inhibitor);
+        engine.SetInhibitors(&inhibitors);
+        backend.SetPowerSource(config.power);
+        engine.PolicyInputsChanged();
+        engine.SetTimeout(int(config.timeout));
+        engine.RequireScreensaver(config.requireScreenSaver);
+        engine.SetWarningTime(warningTime);
+        engine.SetAdaptiveTimeout(config.adaptiveMax);
+        warningsExact = config.displayEvents || !config.requireScreenSaver;
+        maxTimeout = config.adaptiveMax > config.timeout ? config.adaptiveMax : config.timeout;
+        if (config.activityFile != NULL) {
+            remove(config.activityFile);
+            if (activityLog.Open(Widen(config.activityFile).c_str()))
+                engine.SetActivityLog(&activityLog);
+            else
+                fprintf(stderr, "%s: cannot open.\n", config.activityFile);
+        }
+        tolerance = TLockScheduler::MinWakeDelay + 1000 + (config.requireScreenSaver ? TLockScheduler::PollInterval : 0)
+            + (config.power == PS_Battery ? TLockScheduler::MaxToleranceBattery : TLockScheduler::MaxToleranceAC);
+        wakeAt = Check();
+    }
+
+    void Run(TTraceSource &trace)
+    {
+        TSimEvent event;
+        bool haveEvent = trace.Next(event);
+
+        while (haveEvent) {
+            if (reactAt <= event.time && (reactAt <= wakeAt || suspended)) {
+                backend.AdvanceTo(reactAt);
+                reactAt = Never;
+                Reacted();
+                continue;
+            }
+            if (wakeAt <= event.time && !suspended) {
+                backend.AdvanceTo(wakeAt);
+                wakeups++;
+                if (wakeCoalesced)
+                    coalescedWakeups++;
+                bool inWarning = warningOn;
+                wakeAt = Check();
+                if (inWarning) {
+                    warningWakeups++;
+                    if (warningOn && engine.Scheduler().TimeUntilDeadline() % TLockScheduler::WarningTick != 0)
+                        offTickWakeups++;
+                }
+                continue;
+            }
+
+            backend.AdvanceTo(event.time);
+            Apply(event);
+            events++;
+            haveEvent = trace.Next(event);
+        }
+        EndGap();
+    }
+
+    void Report(double seconds)
+    {
+        double days = backend.Now() / 86400000.;
+        const TLatencyHistogram &engineLatency = engine.Scheduler().LockLatency();
+
+        printf("simulated:       %.1f days in %.2f s (%.0f days/s), %llu events\n",
+            days, seconds, seconds > 0 ? days / seconds : 0., (unsigned long long)events);
+        printf("wakeups:         %llu (%.1f per hour), %llu during warnings (%.1f per hour outside)\n",
+            (unsigned long long)wakeups, days > 0 ? wakeups / (days * 24) : 0., (unsigned long long)warningWakeups,
+            days > 0 ? (wakeups - warningWakeups) / (days * 24) : 0.);
+        printf("CPU wakeups:     %llu (%.1f per hour), %llu coalesced with other timers\n",
+            (unsigned long long)(wakeups - coalescedWakeups), days > 0 ? (wakeups - coalescedWakeups) / (days * 24) : 0.,
+            (unsigned long long)coalescedWakeups);
+        if (resumes != 0)
+            printf("sleeps:          %llu\n", (unsigned long long)resumes);
+        printf("locks:           %llu of %llu due\n", (unsigned long long)locks, (unsigned long long)dueLocks);
+        printf("missed locks:    %llu\n", (unsigned long long)missedLocks);
+        printf("early locks:     %llu\n", (unsigned long long)earlyLocks);
+        printf("lock latency ms: mean %u, p50 %u, p99 %u, max %u\n",
+            latency.Mean(), latency.Percentile(50), latency.Percentile(99), latency.Max());
+        printf("engine reported: mean %u, p99 %u, max %u over %llu locks\n",
+            engineLatency.Mean(), engineLatency.Percentile(99), engineLatency.Max(),
+            (unsigned long long)engineLatency.Count());
+        if (presentGaps != 0 || engine.Adaptive().Enabled()) {
+            printf("false locks:     %llu (%.1f%% of locks), in %llu pauses with the user present\n",
+                (unsigned long long)falseLocks, locks != 0 ? falseLocks * 100. / locks : 0., (unsigned long long)presentGaps);
+            printf("timeout:         %.1f..%.1f min, %.1f at the end; idle at lock mean %.1f min, max %.1f (limit %.1f)\n",
+                minTimeout / 60000., maxTimeoutSeen / 60000., engine.EffectiveTimeout() / 60000.,
+                locks != 0 ? lockIdleTotal / 60000. / locks : 0., maxLockIdle / 60000.,
+                (TLockScheduler::LockThreshold(maxTimeout) + tolerance) / 60000.);
+            if (overMaxLocks != 0)
+                printf("over the maximum: %llu locks\n", (unsigned long long)overMaxLocks);
+        }
+        if (inhibitions != 0)
+            printf("inhibitions:     %llu, %.1f h in all\n", (unsigned long long)inhibitions, inhibitedTime / 3600000.);
+        if (warningTime != 0) {
+            printf("warnings:        %llu, %llu cancelled, %llu early, %llu late, %llu off-tick wakeups\n",
+                (unsigned long long)warnings, (unsigned long long)cancelledWarnings, (unsigned long long)earlyWarnings,
+                (unsigned long long)lateWarnings, (unsigned long long)offTickWakeups);
+            printf("cancel ms:       mean %u, p99 %u, max %u\n",
+                cancelLatency.Mean(), cancelLatency.Percentile(99), cancelLatency.Max());
+        }
+        if (activityLog.IsOpen())
+            ActivityReport();
+    }
+
+    bool Failed() const
+    {
+        return missedLocks != 0 || earlyLocks != 0 || earlyWarnings != 0 || offTickWakeups != 0
+            || (lateWarnings != 0 && warningsExact) || extraMinutes != 0 || overMaxLocks != 0;
+    }
+
+private:
+    static std::wstring Widen(const char *text)
+    {
+        return std::wstring(text, text + strlen(text));
+    }
+
+    // Compares the activity log with the minutes that had input, for the
+    // days that the log still holds.
+    void ActivityReport()
+    {
+        uint64_t active = 0, recorded = 0, missed = 0, days = 0;
+        for (size_t day = 0; day * TActivityDay::MinutesPerDay < inputMinutes.size(); day++) {
+            const TActivityDay *record = activityLog.Day(TSimBackend::StartDay + int32_t(day));
+            if (record == NULL)
+                continue;
+            days++;
+            recorded += TActivityLog::CountBits(record->bits[AM_Active], 0, TActivityDay::MinutesPerDay);
+            for (int minute = 0; minute < TActivityDay::MinutesPerDay; minute++) {
+                size_t i = day * TActivityDay::MinutesPerDay + size_t(minute);
+                bool input = i < inputMinutes.size() && inputMinutes[i];
+                bool marked = (record->bits[AM_Active][minute / 64] >> (minute % 64)) & 1;
+                active += input;
+                missed += input && !marked;
+                extraMinutes += marked && !input;
+            }
+        }
+
+        uint32_t hours[24] = {};
+        int32_t lastDay = TActivityLog::DayOf(backend.LocalTime());
+        auto start = std::chrono::steady_clock::now();
+        int queryDays = activityLog.HourTotals(AM_Active, lastDay - 89, lastDay, hours);
+        double queryUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        printf("activity:        %llu days, %llu minutes with input, %llu recorded, %llu missed, %llu without input\n",
+            (unsigned long long)days, (unsigned long long)active, (unsigned long long)recorded,
+            (unsigned long long)missed, (unsigned long long)extraMinutes);
+        printf("hour totals:     %d days in %.1f us\n", queryDays, queryUs);
+    }
+
+    void InputMinute()
+    {
+        size_t minute = size_t(backend.Now() / 60000);
+        if (minute >= inputMinutes.size())
+            inputMinutes.resize(minute + 1);
+        inputMinutes[minute] = true;
+    }
+
+    // Like CheckIdleTimeout() in IdleLock.cpp.
+    uint64_t Check()
+    {
+        uint32_t delay = engine.LockIfIdleTimeout();
+        bool locked = backend.DispatchSessionEvents();
+        WarningCheck(locked);
+        if (locked)
+            LockDone();
+        return delay == 0 ? Never : FireTime(backend.Now() + delay, engine.TimerTolerance());
+    }
+
+    // When a timer that is due at the given time fires.
+    uint64_t FireTime(uint64_t due, uint32_t timerTolerance)
+    {
+        wakeCoalesced = false;
+        if (systemWake != 0) {
+            uint64_t other = (due + systemWake - 1) / systemWake * systemWake;
+            wakeCoalesced = other <= due + timerTolerance;
+            if (wakeCoalesced)
+                return other;
+        }
+        return due + timerTolerance;
+    }
+
+    // Follows the engine's warning after a check.
+    void WarningCheck(bool locked)
+    {
+        bool warning = engine.Warning();
+        if (warning == warningOn)
+            return;
+        warningOn = warning;
+
+        if (warning) {
+            warnings++;
+            warningInputAt = Never;
+
+            // Due the warning time before the lock (at most half the timeout),
+            // but not before the screensaver has started.
+            uint64_t idle = backend.Now() - gapStart;
+            uint64_t due = DueIdleTime();
+            uint64_t warningLength = warningTime < Threshold() / 2 ? warningTime : Threshold() / 2;
+            uint64_t expected = due == Never ? Never : due > warningLength ? due - warningLength : 0;
+            if (engine.IsScreenSaverRequired() && expected != Never && screenSaverOnAt - gapStart > expected)
+                expected = screenSaverOnAt - gapStart;
+
+            if (expected == Never || idle < expected) {
+                earlyWarnings++;
+                printf("early warning at %.3f h: idle %llu ms, due at %s%llu ms\n", backend.Now() / 3600000.,
+                    (unsigned long long)idle, expected == Never ? "never " : "", expected == Never ? 0ULL : (unsigned long long)expected);
+            } else if (idle > expected + TLockScheduler::MinWakeDelay) {
+                lateWarnings++;
+                if (verbose)
+                    printf("late warning at %.3f h: idle %llu ms, due at %llu ms\n", backend.Now() / 3600000.,
+                        (unsigned long long)idle, (unsigned long long)expected);
+            }
+        } else if (!locked) {
+            cancelledWarnings++;
+            if (warningInputAt != Never)
+                cancelLatency.Add(uint32_t(backend.Now() - warningInputAt));
+        }
+    }
+
+    void Apply(const TSimEvent &event)
+    {
+        switch (event.kind) {
+            case SE_Input:
+                if (warningOn && warningInputAt == Never)
+                    warningInputAt = event.time;
+                InputMinute();
+                EndGap();
+                backend.Input();
+                if (backend.Locked()) {
+                    backend.Unlock();
+                    wakeAt = Check();
+                }
+                break;
+
+            case SE_ScreenSaverOn:
+                backend.SetScreenSaver(true);
+                if (screenSaverOnAt == Never)
+                    screenSaverOnAt = event.time;
+                DisplayEventCheck();
+                break;
+
+            case SE_ScreenSaverOff:
+                backend.SetScreenSaver(false);
+                break;
+
+            case SE_DisplayOff:
+                backend.SetDisplay(false);
+                if (screenSaverOnAt == Never)
+                    screenSaverOnAt = event.time;
+                DisplayEventCheck();
+                break;
+
+            case SE_DisplayOn:
+                backend.SetDisplay(true);
+                break;
+
+            case SE_Lock:
+                backend.Lock();
+                lockedByUser = true;
+                break;
+
+            case SE_Unlock:
+                InputMinute();
+                EndGap();
+                backend.Input();
+                backend.Unlock();
+                wakeAt = Check();
+                break;
+
+            // A lock from before the sleep still holds, and isn't expected
+            // again; after it, the idle time counts from the resume.
+            case SE_Suspend:
+                EndGap();
+                reactAt = Never;
+                lockedByUser = backend.Locked();
+                engine.Suspending();
+                suspended = true;
+                break;
+
+            case SE_Resume:
+                gapStart = event.time;
+                screenSaverOnAt = Never;
+                suspended = false;
+                resumes++;
+                engine.Resumed();
+                wakeups++;
+                wakeAt = Check();
+                break;
+
+            case SE_Present:
+                present = true;
+                presentGaps++;
+                break;
+
+            case SE_InhibitOn:
+                if (!inhibited)
+                    inhibitions++;
+                inhibited = true;
+                inhibitedAt = event.time;
+                inhibitor->Set(true);
+                break;
+
+            case SE_InhibitOff:
+                if (inhibited)
+                    inhibitedTime += event.time - inhibitedAt;
+                inhibited = false;
+                releasedAt = event.time;
+                inhibitor->Set(false);
+                break;
+        }
+    }
+
+    // The user undoes a false lock, which also ends the screensaver, and
+    // goes on pausing.
+    void Reacted()
+    {
+        InputMinute();
+        EndGap();
+        backend.Input();
+        backend.SetScreenSaver(false);
+        backend.SetDisplay(true);
+        if (backend.Locked()) {
+            backend.Unlock();
+            wakeAt = Check();
+        }
+        present = true;
+    }
+
+    // Like the display event handling in IdleLock.cpp, which checks the idle
+    // timeout after the engine has seen the event.
+    void DisplayEventCheck()
+    {
+        if (engine.DisplayEvents()) {
+            wakeups++;
+            wakeAt = Check();
+        }
+    }
+
+    // The engine's threshold; the adaptive timeout only changes on unlocks,
+    // so it holds for the whole gap.
+    uint64_t Threshold()
+    {
+        return TLockScheduler::LockThreshold(engine.EffectiveTimeout());
+    }
+
+    // The idle time at which a lock is due in the current gap.
+    uint64_t DueIdleTime()
+    {
+        if (inhibited)
+            return Never;
+        uint64_t threshold = Threshold() + (releasedAt > gapStart ? releasedAt - gapStart : 0);
+        if (!engine.IsScreenSaverRequired())
+            return threshold;
+        if (screenSaverOnAt == Never)
+            return Never;
+        uint64_t screenSaverIdle = screenSaverOnAt - gapStart;
+        return screenSaverIdle > threshold ? screenSaverIdle : threshold;
+    }
+
+    void LockDone()
+    {
+        uint64_t idle = backend.Now() - gapStart;
+        uint64_t due = DueIdleTime();
+
+        locks++;
+        lockedInGap = true;
+        lockIdleTotal += idle;
+        if (idle > maxLockIdle)
+            maxLockIdle = idle;
+        uint64_t limit = TLockScheduler::LockThreshold(maxTimeout) + (releasedAt > gapStart ? releasedAt - gapStart : 0);
+        if (engine.IsScreenSaverRequired() && screenSaverOnAt != Never && screenSaverOnAt - gapStart > limit)
+            limit = screenSaverOnAt - gapStart;
+        if (idle > limit + tolerance) {
+            overMaxLocks++;
+            printf("lock over the maximum at %.3f h: idle %llu ms\n", backend.Now() / 3600000., (unsigned long long)idle);
+        }
+        uint32_t timeout = engine.EffectiveTimeout();
+        if (timeout < minTimeout)
+            minTimeout = timeout;
+        if (timeout > maxTimeoutSeen)
+            maxTimeoutSeen = timeout;
+        if (present) {
+            falseLocks++;
+            reactAt = backend.Now() + ReactTime;
+        }
+        if (due == Never || idle < due) {
+            earlyLocks++;
+            printf("early lock at %.3f h: idle %llu ms, due at %s%llu ms\n", backend.Now() / 3600000.,
+                (unsigned long long)idle, due == Never ? "never " : "", due == Never ? 0ULL : (unsigned long long)due);
+        } else {
+            latency.Add(uint32_t(idle - due));
+            if (verbose)
+                printf("lock at %.3f h: idle %llu ms, latency %llu ms\n", backend.Now() / 3600000.,
+                    (unsigned long long)idle, (unsigned long long)(idle - due));
+        }
+    }
+
+    // The user is back; was the absence handled right?
+    void EndGap()
+    {
+        uint64_t gap = backend.Now() - gapStart;
+        uint64_t due = DueIdleTime();
+
+        if (due != Never && gap > due + tolerance && !lockedByUser) {
+            dueLocks++;
+            if (!lockedInGap) {
+                missedLocks++;
+                printf("missed lock at %.3f h: away %llu ms, due at %llu ms\n", backend.Now() / 3600000.,
+                    (unsigned long long)gap, (unsigned long long)due);
+            }
+        } else if (lockedInGap) {
+            dueLocks++;
+        }
+
+        gapStart = backend.Now();
+        screenSaverOnAt = Never;
+        lockedInGap = false;
+        lockedByUser = false;
+        present = false;
+    }
+
+    TSimBackend backend;
+    TLogger     logger;
+    TActivityLog activityLog;   // Before the engine, which uses it until it is gone.
+    TInhibitorSet inhibitors;   // Ditto.
+    TManualInhibitor *inhibitor;  // Owned by inhibitors.
+    TLockEngine engine;
+    std::vector<bool> inputMinutes;  // By minute of the trace.
+    uint64_t    extraMinutes = 0;
+    bool        verbose;
+    uint32_t    warningTime;
+    bool        warningsExact;   // The engine can see when the screensaver starts.
+    uint32_t    maxTimeout;      // Locks are never due later than at this timeout.
+    uint64_t    tolerance;
+    uint32_t    systemWake;
+    uint64_t    wakeAt;
+    bool        wakeCoalesced = false;
+    bool        suspended = false;
+
+    uint64_t gapStart = 0;
+    uint64_t screenSaverOnAt = Never;
+    bool     lockedInGap = false;
+    bool     lockedByUser = false;
+    bool     present = false;     // The user is there in this gap.
+    uint64_t reactAt = Never;     // When the user undoes a false lock.
+    bool     inhibited = false;
+    uint64_t inhibitedAt = 0;
+    uint64_t releasedAt = 0;      // When the last inhibition ended.
+    bool     warningOn = false;
+    uint64_t warningInputAt = Never;  // First input during the warning.
+
+    uint64_t events = 0;
+    uint64_t wakeups = 0;
+    uint64_t coalescedWakeups = 0;
+    uint64_t resumes = 0;
+    uint64_t locks = 0;
+    uint64_t dueLocks = 0;
+    uint64_t missedLocks = 0;
+    uint64_t earlyLocks = 0;
+    TLatencyHistogram latency;
+    uint64_t presentGaps = 0;
+    uint64_t falseLocks = 0;
+    uint64_t overMaxLocks = 0;
+    uint64_t inhibitions = 0;
+    uint64_t inhibitedTime = 0;
+    uint64_t lockIdleTotal = 0;
+    uint64_t maxLockIdle = 0;
+    uint32_t minTimeout = UINT32_MAX;
+    uint32_t maxTimeoutSeen = 0;
+
+    uint64_t warnings = 0;
+    uint64_t cancelledWarnings = 0;
+    uint64_t earlyWarnings = 0;
+    uint64_t lateWarnings = 0;
+    uint64_t warningWakeups = 0;
+    uint64_t offTickWakeups = 0;
+    TLatencyHistogram cancelLatency;
+};
+
+
+int main(int argc, char *argv[])
+{
+    const char *traceFile = NULL;
+    double days = 90;
+    unsigned seed = 1;
+    int timeout = 20;
+    int ssTimeout = 10;
+    int displayTimeout = 0;
+    int sleepTimeout = 0;
+    int warningSeconds = 0;
+    int readingPercent = 0;
+    int watchingPercent = 0;
+    int adaptiveMinutes = 0;
+    const char *power = "ac";
+    TSimConfig config = {};
+    config.startTick = UINT32_MAX - 2 * 86400000u;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+            traceFile = argv[++i];
+        else if (strcmp(argv[i], "-days") == 0 && i + 1 < argc)
+            days = atof(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc)
+            timeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-screensaver") == 0)
+            config.requireScreenSaver = true;
+        else if (strcmp(argv[i], "-sstimeout") == 0 && i + 1 < argc)
+            ssTimeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-displaytimeout") == 0 && i + 1 < argc)
+            displayTimeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-events") == 0)
+            config.displayEvents = true;
+        else if (strcmp(argv[i], "-warning") == 0 && i + 1 < argc)
+            warningSeconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-sleep") == 0 && i + 1 < argc)
+            sleepTimeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-power") == 0 && i + 1 < argc)
+            power = argv[++i];
+        else if (strcmp(argv[i], "-systemwake") == 0 && i + 1 < argc)
+            config.systemWake = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "-activity") == 0 && i + 1 < argc)
+            config.activityFile = argv[++i];
+        else if (strcmp(argv[i], "-reading") == 0 && i + 1 < argc)
+            readingPercent = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-watching") == 0 && i + 1 < argc)
+            watchingPercent = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-adaptive") == 0 && i + 1 < argc)
+            adaptiveMinutes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-starttick") == 0 && i + 1 < argc)
+            config.startTick = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-v") == 0)
+            config.verbose = true;
+        else {
+            fprintf(stderr, "Usage: idlesim [-trace <file> | -days <n> -seed <n> -sstimeout <min> -displaytimeout <min> -sleep <min>]\n"
+                            "               [-reading <pct>] [-watching <pct>]\n"
+                            "               [-timeout <min>] [-screensaver] [-events] [-warning <s>] [-power ac|battery|both]\n"
+                            "               [-systemwake <ms>] [-activity <file>] [-adaptive <min>] [-starttick <n>] [-v]\n");
+            return 2;
+        }
+    }
+    config.timeout = uint32_t(timeout) * 60000;
+    config.warningTime = uint32_t(warningSeconds) * 1000;
+    config.adaptiveMax = uint32_t(adaptiveMinutes) * 60000;
+
+    std::vector<TPowerSource> powers;
+    if (strcmp(power, "ac") == 0 || strcmp(power, "both") == 0)
+        powers.push_back(PS_AC);
+    if (strcmp(power, "battery") == 0 || strcmp(power, "both") == 0)
+        powers.push_back(PS_Battery);
+
+    // The same trace for each power source.
+    bool failed = false;
+    for (TPowerSource source : powers) {
+        if (powers.size() > 1)
+            printf("%s%s:\n", source == powers.front() ? "" : "\n", source == PS_AC ? "AC" : "Battery");
+        config.power = source;
+        TSimulator simulator(config);
+        auto start = std::chrono::steady_clock::now();
+
+        if (traceFile != NULL) {
+            FILE *f = fopen(traceFile, "r");
+            if (f == NULL) {
+                fprintf(stderr, "%s: cannot open.\n", traceFile);
+                return 1;
+            }
+            TFileTrace trace(f);
+            simulator.Run(trace);
+            fclose(f);
+        } else {
+            TGeneratedTrace trace(uint64_t(days * 86400000.), uint64_t(ssTimeout) * 60000, uint64_t(displayTimeout) * 60000,
+                uint64_t(sleepTimeout) * 60000, readingPercent / 100., watchingPercent / 100., seed);
+            simulator.Run(trace);
+        }
+
+        simulator.Report(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        failed |= simulator.Failed();
+    }
+    return failed ? 1 : 0;
+}
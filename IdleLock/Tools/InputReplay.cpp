@@ -0,0 +1,191 @@
+// InputReplay.cpp
+// Replays recorded evdev input through the input filter (InputFilter.h),
+// the way the Linux backend passes it, in batches of what one read() would
+// have got, to show what would have counted as activity, and measures how
+// many events per second the filter keeps up with.
+// Record a device with e.g. "cat /dev/input/event5 > mouse.ev" (its events
+// are the raw input_event records), and stop with Ctrl+C.
+// Builds with the CMake build (target inputreplay), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o inputreplay InputReplay.cpp ../InputFilter.cpp
+//       ../EvdevBackend.cpp ../Stats.cpp ../LockScheduler.cpp ../Logger.cpp
+//       ../TextUtil.cpp -pthread
+//
+// Usage: inputreplay [options] file...
+//   -rules <file>      Rules by device (see InputFilter.h) instead of the
+//                      defaults.
+//   -name <text>       The device name the rules see, for all files
+//                      (default: the file name).
+//   -repeat <n>        Replay each file that many more times, from memory,
+//                      for the throughput (default 100).
+//   -csv               Comma separated values, with a header line.
+//
+// Each file is a device of its own. For each, the events, those that
+// counted, the moves that didn't, the seconds with activity, and the
+// longest stretch without any, by the events' timestamps, are given, and
+// the events per second and ns per event of the filtering, including the
+// translation of the records. Exits with 1 if a file can't be read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+
+#include "../EvdevBackend.h"
+#include "../InputFilter.h"
+#include "../TextUtil.h"
+
+
+static const size_t BatchSize = 64;  // At most, as TEvdevBackend reads them.
+
+
+struct TReplayResult
+{
+    uint64_t events = 0;
+    uint64_t accepted = 0;
+    uint64_t rejectedMoves = 0;
+    size_t   activeSeconds = 0;
+    uint32_t span = 0;           // ms from the first to the last event.
+    uint32_t longestGap = 0;     // ms without activity, including to the ends.
+};
+
+
+// Passes the records through a new filter, batch by batch; a batch ends
+// with a SYN_REPORT, since a device hands over a frame at a time, and the
+// backend reads it right away. With result, also takes down when there was
+// activity.
+static TInputFilter Replay(const std::vector<input_event> &records, const std::string &rules,
+    const std::string &name, TReplayResult *result)
+{
+    TInputFilter filter;
+    std::string error;
+    filter.Parse(rules, error);
+    TEvdevBackend::TInputDevice device;
+    device.fd = -1;
+    device.id = filter.AddDevice(name);
+
+    std::set<uint32_t> seconds;
+    uint32_t first = 0, previous = 0;
+    TInputEvent batch[BatchSize];
+    for (size_t start = 0; start < records.size(); ) {
+        size_t n = 0;
+        while (n < BatchSize && start < records.size()) {
+            const input_event &record = records[start++];
+            batch[n++] = TEvdevBackend::Translate(device, record);
+            if (record.type == EV_SYN && record.code == SYN_REPORT)
+                break;
+        }
+        if (start == n)
+            first = previous = batch[0].time;
+        if (!filter.Process(batch, n) || result == NULL)
+            continue;
+
+        // The backend takes the time of the read, i.e. of the last event.
+        uint32_t time = batch[n - 1].time;
+        seconds.insert(time / 1000);
+        if (time - previous > result->longestGap)
+            result->longestGap = time - previous;
+        previous = time;
+    }
+
+    if (result != NULL && !records.empty()) {
+        uint32_t last = TEvdevBackend::Translate(device, records.back()).time;
+        result->span = last - first;
+        if (last - previous > result->longestGap)
+            result->longestGap = last - previous;
+        result->events = filter.Events();
+        result->accepted = filter.Accepted();
+        result->rejectedMoves = filter.RejectedMoves();
+        result->activeSeconds = seconds.size();
+    }
+    return filter;
+}
+
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: inputreplay [-rules <file>] [-name <text>] [-repeat <n>] [-csv] file...\n");
+    return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::string rules;
+    std::string name;
+    std::vector<std::string> files;
+    int repeat = 100;
+    bool csv = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-rules") == 0 && i + 1 < argc) {
+            std::string error;
+            std::wstring fileName(argv[i + 1], argv[i + 1] + strlen(argv[i + 1]));
+            if (!ReadWholeFile(fileName.c_str(), rules) || !TInputFilter().Parse(rules, error)) {
+                fprintf(stderr, "Rules file %s: %s\n", argv[i + 1], error.empty() ? "could not be read." : error.c_str());
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-name") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (argv[i][0] == '-')
+            return Usage();
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty() || repeat < 0)
+        return Usage();
+
+    if (csv)
+        printf("file,events,accepted,rejected_moves,active_seconds,span_s,longest_gap_s,events_per_s,ns_per_event\n");
+
+    bool ok = true;
+    for (const std::string &file : files) {
+        std::string data;
+        std::wstring fileName(file.begin(), file.end());
+        if (!ReadWholeFile(fileName.c_str(), data)) {
+            fprintf(stderr, "Could not read %s.\n", file.c_str());
+            ok = false;
+            continue;
+        }
+        std::vector<input_event> records(data.size() / sizeof(input_event));
+        if (!records.empty())
+            memcpy(records.data(), data.data(), records.size() * sizeof(input_event));
+
+        const std::string &deviceName = name.empty() ? file : name;
+        TReplayResult result;
+        Replay(records, rules, deviceName, &result);
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t replayed = 0;
+        for (int i = 0; i < repeat; i++)
+            replayed += Replay(records, rules, deviceName, NULL).Events();
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double perSecond = s > 0 ? replayed / s : 0;
+        double nsPerEvent = replayed != 0 ? s * 1e9 / replayed : 0;
+
+        if (csv) {
+            printf("%s,%llu,%llu,%llu,%zu,%.1f,%.1f,%.0f,%.1f\n", file.c_str(), (unsigned long long)result.events,
+                (unsigned long long)result.accepted, (unsigned long long)result.rejectedMoves, result.activeSeconds,
+                result.span / 1000.0, result.longestGap / 1000.0, perSecond, nsPerEvent);
+            continue;
+        }
+        printf("%s\n", file.c_str());
+        printf("  events:         %llu over %.1f s\n", (unsigned long long)result.events, result.span / 1000.0);
+        printf("  counted:        %llu (%.1f%%)\n", (unsigned long long)result.accepted,
+            result.events != 0 ? 100.0 * result.accepted / result.events : 0.0);
+        printf("  moves rejected: %llu\n", (unsigned long long)result.rejectedMoves);
+        printf("  active seconds: %zu\n", result.activeSeconds);
+        printf("  longest idle:   %.1f s\n", result.longestGap / 1000.0);
+        if (replayed != 0)
+            printf("  throughput:     %.1f M events/s, %.1f ns/event\n", perSecond / 1e6, nsPerEvent);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+// JournalDecode.cpp
+// Offline decoder for IdleLock event journals (see EventJournal.h).
+// Builds anywhere with a C++14 compiler, e.g.
+//   g++ -std=c++14 -O2 -o journaldecode JournalDecode.cpp
+//
+// Usage: journaldecode [-csv | -json | -summary] journal...
+//   -csv      One line per record, with a header line.
+//   -json     One JSON object per record and line (JSON Lines).
+//   -summary  Aggregates all given journals (the default).
+// Records are output oldest first. When several journals are given, they
+// are processed one after the other; the file name is part of each record.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../EventJournal.h"
+
+
+static const char *EventNames[JE_EventCount] = {
+    "", "started", "stopped", "check", "lock_requested", "session_locked",
+    "session_unlocked", "screensaver_started", "screensaver_cleared", "settings_changed",
+    "display_off", "warning_started", "warning_cancelled",
+    "suspended", "resumed", "false_lock", "timeout_adapted", "inhibited", "inhibition_ended",
+    "action_done", "action_failed", "actions_cancelled", "restored"
+};
+
+static const char *ReasonNames[LR_ReasonCount] = {
+    "", "idle_timeout", "idle_timeout_screensaver"
+};
+
+
+static const char *EventName(uint8_t event)
+{
+    return event < JE_EventCount ? EventNames[event] : "unknown";
+}
+
+
+static const char *ReasonName(uint8_t reason)
+{
+    return reason < LR_ReasonCount ? ReasonNames[reason] : "unknown";
+}
+
+
+// Output buffer with cheap number formatting; printf per field is the
+// bottleneck otherwise.
+class TOutput
+{
+public:
+    ~TOutput() { Flush(); }
+
+    void Flush()
+    {
+        fwrite(buf.data(), 1, buf.size(), stdout);
+        buf.clear();
+    }
+
+    TOutput &operator<<(const char *s)
+    {
+        buf += s;
+        if (buf.size() > (1 << 16))
+            Flush();
+        return *this;
+    }
+
+    TOutput &operator<<(uint64_t n)
+    {
+        char digits[24];
+        int i = sizeof digits;
+        do {
+            digits[--i] = char('0' + n % 10);
+            n /= 10;
+        } while (n != 0);
+        buf.append(digits + i, sizeof digits - i);
+        return *this;
+    }
+
+    TOutput &operator<<(int64_t n)
+    {
+        if (n < 0) {
+            buf += '-';
+            return *this << uint64_t(-n);
+        }
+        return *this << uint64_t(n);
+    }
+
+    TOutput &operator<<(uint32_t n) { return *this << uint64_t(n); }
+
+private:
+    std::string buf;
+};
+
+
+struct TSummary
+{
+    uint64_t records = 0;
+    uint64_t events[JE_EventCount + 1] = {};
+    uint64_t lockReasons[LR_ReasonCount + 1] = {};
+    uint64_t lockLatencySum = 0;
+    uint32_t lockLatencyMax = 0;
+    uint64_t idleAtLockSum = 0;
+    int64_t  firstTime = INT64_MAX;
+    int64_t  lastTime = INT64_MIN;
+};
+
+
+static void Aggregate(TSummary &summary, const TJournalRecord *records, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        const TJournalRecord &r = records[i];
+        summary.events[r.event < JE_EventCount ? r.event : int(JE_EventCount)]++;
+        if (r.time < summary.firstTime)
+            summary.firstTime = r.time;
+        if (r.time > summary.lastTime)
+            summary.lastTime = r.time;
+        if (r.event == JE_LockRequested) {
+            summary.lockReasons[r.reason < LR_ReasonCount ? r.reason : int(LR_ReasonCount)]++;
+            summary.lockLatencySum += r.value;
+            if (r.value > summary.lockLatencyMax)
+                summary.lockLatencyMax = r.value;
+            summary.idleAtLockSum += r.idleTime;
+        }
+    }
+    summary.records += n;
+}
+
+
+// The file name as a CSV field, quoted if it needs to be (RFC 4180).
+static std::string CsvField(const char *s)
+{
+    if (strpbrk(s, ",\"\r\n") == NULL)
+        return s;
+    std::string field = "\"";
+    for (; *s != 0; s++) {
+        if (*s == '"')
+            field += '"';
+        field += *s;
+    }
+    return field + "\"";
+}
+
+
+// The file name as the contents of a JSON string; Windows paths have
+// backslashes.
+static std::string JsonString(const char *s)
+{
+    std::string escaped;
+    for (; *s != 0; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += char(c);
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof buf, "\\u%04x", c);
+            escaped += buf;
+        } else {
+            escaped += char(c);
+        }
+    }
+    return escaped;
+}
+
+
+static void WriteCsv(TOutput &out, const char *fName, const TJournalRecord *records, size_t n)
+{
+    std::string file = CsvField(fName);
+    for (size_t i = 0; i < n; i++) {
+        const TJournalRecord &r = records[i];
+        out << file.c_str() << "," << r.time << "," << r.tick << "," << EventName(r.event) << ","
+            << ReasonName(r.reason) << "," << r.idleTime << "," << r.screenSaverActiveAt << ","
+            << r.idleTimeout << "," << uint32_t((r.flags & JF_Locked) != 0) << ","
+            << uint32_t((r.flags & JF_Enabled) != 0) << "," << uint32_t((r.flags & JF_RequireScreenSaver) != 0)
+            << "," << r.value << "\n";
+    }
+}
+
+
+static void WriteJson(TOutput &out, const char *fName, const TJournalRecord *records, size_t n)
+{
+    std::string file = JsonString(fName);
+    for (size_t i = 0; i < n; i++) {
+        const TJournalRecord &r = records[i];
+        out << "{\"file\":\"" << file.c_str() << "\",\"time\":" << r.time << ",\"tick\":" << r.tick
+            << ",\"event\":\"" << EventName(r.event) << "\",\"reason\":\"" << ReasonName(r.reason)
+            << "\",\"idle_time\":" << r.idleTime << ",\"screensaver_active_at\":" << r.screenSaverActiveAt
+            << ",\"idle_timeout\":" << r.idleTimeout
+            << ",\"locked\":" << ((r.flags & JF_Locked) ? "true" : "false")
+            << ",\"enabled\":" << ((r.flags & JF_Enabled) ? "true" : "false")
+            << ",\"require_screensaver\":" << ((r.flags & JF_RequireScreenSaver) ? "true" : "false")
+            << ",\"value\":" << r.value << "}\n";
+    }
+}
+
+
+// Reads the records of a journal, oldest first.
+static bool ReadJournal(const char *fName, std::vector<TJournalRecord> &records)
+{
+    FILE *f = fopen(fName, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: cannot open.\n", fName);
+        return false;
+    }
+
+    // The file is only ever grown, so it may hold more than the ring, but
+    // never less; this also bounds what a corrupt capacity can allocate.
+    long fileSize = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+    rewind(f);
+
+    TJournalHeader header;
+    if (fread(&header, sizeof header, 1, f) != 1
+        || memcmp(header.magic, JournalMagic, sizeof JournalMagic) != 0
+        || header.headerSize != sizeof(TJournalHeader)
+        || header.recordSize != sizeof(TJournalRecord)
+        || header.capacity == 0
+        || fileSize < 0
+        || (uint64_t(fileSize) - sizeof(TJournalHeader)) / sizeof(TJournalRecord) < header.capacity) {
+        fprintf(stderr, "%s: not an IdleLock journal.\n", fName);
+        fclose(f);
+        return false;
+    }
+    if (header.version != JournalVersion) {
+        fprintf(stderr, "%s: unsupported journal version %u.\n", fName, header.version);
+        fclose(f);
+        return false;
+    }
+
+    // The ring starts at the oldest record once it has wrapped around.
+    uint64_t count = header.writeCount < header.capacity ? header.writeCount : header.capacity;
+    uint64_t start = header.writeCount < header.capacity ? 0 : header.writeCount % header.capacity;
+
+    std::vector<TJournalRecord> ring(header.capacity);
+    size_t got = fread(ring.data(), sizeof(TJournalRecord), header.capacity, f);
+    fclose(f);
+    if (got < count) {
+        fprintf(stderr, "%s: truncated journal.\n", fName);
+        return false;
+    }
+
+    records.resize(count);
+    for (uint64_t i = 0; i < count; i++)
+        records[i] = ring[(start + i) % header.capacity];
+    return true;
+}
+
+
+static void PrintSummary(const TSummary &s, double seconds)
+{
+    printf("records: %llu\n", (unsigned long long)s.records);
+    for (int e = 1; e <= JE_EventCount; e++) {
+        if (s.events[e] != 0)
+            printf("  %-22s %llu\n", e < JE_EventCount ? EventNames[e] : "unknown", (unsigned long long)s.events[e]);
+    }
+
+    uint64_t locks = s.events[JE_LockRequested];
+    if (locks != 0) {
+        printf("lock reasons:\n");
+        for (int r = 0; r <= LR_ReasonCount; r++) {
+            if (s.lockReasons[r] != 0)
+                printf("  %-22s %llu\n", r < LR_ReasonCount ? ReasonNames[r] : "unknown", (unsigned long long)s.lockReasons[r]);
+        }
+        printf("lock latency ms mean/max: %llu/%u\n", (unsigned long long)(s.lockLatencySum / locks), s.lockLatencyMax);
+        printf("idle time at lock ms mean: %llu\n", (unsigned long long)(s.idleAtLockSum / locks));
+    }
+
+    if (s.lastTime > s.firstTime) {
+        double hours = (s.lastTime - s.firstTime) / 3600000.;
+        printf("span: %.1f hours, checks per hour: %.1f\n", hours, s.events[JE_Check] / hours);
+    }
+    if (seconds > 0)
+        fprintf(stderr, "%.1f M records/s\n", s.records / seconds / 1e6);
+}
+
+
+int main(int argc, char *argv[])
+{
+    enum { Summary, Csv, Json } mode = Summary;
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-'; first++) {
+        if (strcmp(argv[first], "-csv") == 0)
+            mode = Csv;
+        else if (strcmp(argv[first], "-json") == 0)
+            mode = Json;
+        else if (strcmp(argv[first], "-summary") == 0)
+            mode = Summary;
+        else
+            first = argc;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "Usage: journaldecode [-csv | -json | -summary] journal...\n");
+        return 2;
+    }
+
+    TOutput out;
+    TSummary summary;
+    std::vector<TJournalRecord> records;
+    int errors = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    if (mode == Csv)
+        out << "file,time,tick,event,reason,idle_time,screensaver_active_at,idle_timeout,locked,enabled,require_screensaver,value\n";
+
+    for (int i = first; i < argc; i++) {
+        if (!ReadJournal(argv[i], records)) {
+            errors++;
+            continue;
+        }
+        if (mode == Csv)
+            WriteCsv(out, argv[i], records.data(), records.size());
+        else if (mode == Json)
+            WriteJson(out, argv[i], records.data(), records.size());
+        else
+            Aggregate(summary, records.data(), records.size());
+    }
+    out.Flush();
+
+    if (mode == Summary)
+        PrintSummary(summary, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+// LogBench.cpp
+// Compares the loggers' throughput and what a Log() call costs the thread
+// that makes it: TAsyncLogger, TLogger, and a copy of the TLogger that
+// TAsyncLogger was added next to, which wrote each line through a
+// wofstream and flushed it, so that the gain over it can still be measured.
+// Builds with the CMake build (target logbench), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o logbench LogBench.cpp ../Logger.cpp ../AsyncLogger.cpp
+//       ../TextUtil.cpp ../Stats.cpp ../EventJournal.cpp ../MappedFile.cpp -pthread
+//
+// Usage: logbench [-lines <n>] [-threads <n>] [-dir <dir>]
+//   -lines <n>     Lines per logger and thread (default 100000).
+//   -threads <n>   Threads logging to the async logger at once (default 4);
+//                  the others aren't thread-safe and get one.
+//   -dir <dir>     Where the log files go (default $TMPDIR or /tmp); they
+//                  are removed afterwards.
+//
+// For each logger: the lines per second, counting until the last one is in
+// the file, and the mean, 99th percentile and maximum ns of a Log() call.
+// The async logger is run twice: flushed every half ring, so that no line
+// is dropped, and in a burst without flushes, in which it drops lines
+// rather than block; the lines dropped are given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../AsyncLogger.h"
+#include "../Logger.h"
+#include "../TextUtil.h"
+
+
+static const wchar_t *Line = L"Lock policy: lock after 20 minutes.";
+
+
+// The TLogger that TAsyncLogger was added next to.
+class TStreamLogger : public TLogger
+{
+public:
+    TStreamLogger(const std::string &fName)
+    {
+        logFile.open(fName.c_str(), std::ios::app);
+        Log(L"Logging started.");
+    }
+
+    ~TStreamLogger()
+    {
+        if (logFile.is_open())
+            Log(L"Closing log.");
+    }
+
+    void Log(const wchar_t *text) override
+    {
+        if (!logFile.is_open())
+            return;
+
+        wchar_t buf[1000];
+        time_t timer;
+        tm tmStruct;
+
+        time(&timer);
+#ifdef _WIN32
+        localtime_s(&tmStruct, &timer);
+#else
+        localtime_r(&timer, &tmStruct);
+#endif
+        wcsftime(buf, 500, L"%Y-%m-%d %H:%M:%S  ", &tmStruct);
+        wcsncat(buf, text, 1000 - wcslen(buf) - 1);
+
+        logFile << buf << std::endl;
+        logFile.flush();
+    }
+
+private:
+    std::wofstream logFile;
+};
+
+
+struct TResult
+{
+    uint64_t lines = 0;
+    double   seconds = 0;
+    std::vector<uint32_t> callNs;
+    uint64_t dropped = 0;
+};
+
+
+// Logs lines from the thread, timing each call. flushEvery, if not 0, is
+// how many lines go between flushes of the async logger.
+static void LogLines(TLogger &logger, TAsyncLogger *async, uint64_t lines, uint32_t flushEvery,
+    std::vector<uint32_t> &callNs)
+{
+    callNs.reserve(size_t(lines));
+    for (uint64_t i = 0; i < lines; i++) {
+        auto start = std::chrono::steady_clock::now();
+        logger.Log(Line);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        callNs.push_back(uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        if (async != NULL && flushEvery != 0 && (i + 1) % flushEvery == 0)
+            async->Flush();
+    }
+}
+
+
+static TResult Run(TLogger &logger, TAsyncLogger *async, uint64_t lines, int threadCount, uint32_t flushEvery)
+{
+    TResult result;
+    std::vector<std::vector<uint32_t>> callNs((size_t)threadCount);
+    std::vector<std::thread> threads;
+    uint64_t droppedBefore = async != NULL ? async->Dropped() : 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threadCount; t++)
+        threads.emplace_back(LogLines, std::ref(logger), async, lines, flushEvery, std::ref(callNs[size_t(t)]));
+    for (std::thread &thread : threads)
+        thread.join();
+    if (async != NULL)
+        async->Flush();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    result.lines = lines * uint64_t(threadCount);
+    for (const std::vector<uint32_t> &ns : callNs)
+        result.callNs.insert(result.callNs.end(), ns.begin(), ns.end());
+    if (async != NULL)
+        result.dropped = async->Dropped() - droppedBefore;
+    return result;
+}
+
+
+static void Print(const char *name, int threadCount, TResult &result)
+{
+    std::vector<uint32_t> &ns = result.callNs;
+    std::sort(ns.begin(), ns.end());
+    double sum = 0;
+    for (uint32_t n : ns)
+        sum += n;
+    size_t count = ns.size();
+    printf("%-20s %7d %12.0f %9.0f %9u %9u %9llu\n", name, threadCount,
+        result.seconds > 0 ? result.lines / result.seconds : 0., count != 0 ? sum / count : 0.,
+        count != 0 ? ns[std::min(count - 1, count * 99 / 100)] : 0, count != 0 ? ns[count - 1] : 0,
+        (unsigned long long)result.dropped);
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint64_t lines = 100000;
+    int threadCount = 4;
+    const char *tmp = getenv("TMPDIR");
+    std::string dir = tmp != NULL && tmp[0] != 0 ? tmp : "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-lines") == 0 && i + 1 < argc) {
+            lines = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+            threadCount = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: logbench [-lines <n>] [-threads <n>] [-dir <dir>]\n");
+            return 2;
+        }
+    }
+    if (lines == 0 || threadCount < 1)
+        return 2;
+
+    std::string fileName = dir + "/logbench.log";
+    std::wstring wideName(fileName.begin(), fileName.end());
+
+    printf("%-20s %7s %12s %9s %9s %9s %9s\n", "logger", "threads", "lines/s", "mean ns", "p99 ns", "max ns",
+        "dropped");
+    {
+        TStreamLogger logger(fileName);
+        TResult result = Run(logger, NULL, lines, 1, 0);
+        Print("wofstream (before)", 1, result);
+    }
+    RemoveFile(wideName.c_str());
+    {
+        TLogger logger(wideName.c_str());
+        TResult result = Run(logger, NULL, lines, 1, 0);
+        Print("TLogger", 1, result);
+    }
+    RemoveFile(wideName.c_str());
+
+    // Never rotated, so that every logger writes one file.
+    for (int threads : { 1, threadCount }) {
+        {
+            TAsyncLogger logger(wideName.c_str(), UINT64_MAX);
+            TResult result = Run(logger, &logger, lines, threads, TAsyncLogger::RingSize / 2 / threads);
+            Print("TAsyncLogger", threads, result);
+        }
+        RemoveFile(wideName.c_str());
+        {
+            TAsyncLogger logger(wideName.c_str(), UINT64_MAX);
+            TResult result = Run(logger, &logger, lines, threads, 0);
+            Print("TAsyncLogger burst", threads, result);
+        }
+        RemoveFile(wideName.c_str());
+        if (threadCount == 1)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,716 @@
+// MicroBench.cpp
+// Micro-benchmarks of the platform neutral core: the idle check that runs on
+// every timer tick (plain, with a policy, the journal, the activity log or
+// inhibitors), the scheduler's tick arithmetic across the wraparound, an
+// inhibitor's poll of the process list, input filtering, the statistics
+// counters and timers, logging, and settings round-trips, with results that scripts can keep and compare, so
+// that performance regressions are caught.
+// Builds with the CMake build (target microbench), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o microbench MicroBench.cpp ../LockEngine.cpp ../LockScheduler.cpp
+//       ../LockPolicy.cpp ../Logger.cpp ../AsyncLogger.cpp ../TextUtil.cpp ../EventJournal.cpp
+//       ../MappedFile.cpp ../Stats.cpp ../ActivityLog.cpp ../AdaptiveTimeout.cpp
+//       ../SettingsStore.cpp ../WorkStationLocker.cpp ../FileSettingsStore.cpp ../InhibitorSet.cpp
+//       ../ProcessInhibitor.cpp ../InputFilter.cpp ../ActionPipeline.cpp ../EngineCheckpoint.cpp
+//       -pthread
+//
+// Usage: microbench [options]
+//   -filter <text>      Only the benchmarks whose name contains the text.
+//   -time <ms>          Time to spend on each benchmark (default 500).
+//   -runs <n>           Timed runs per benchmark (default 5); the median counts.
+//   -json               One JSON object per benchmark and line (JSON Lines).
+//   -csv                Comma separated values, with a header line.
+//   -baseline <file>    Compare with the -json output of an earlier run.
+//   -tolerance <pct>    How much slower than the baseline is a regression
+//                       (default 25).
+//   -dir <dir>          Where the files of the logging, journal, activity and
+//                       settings benchmarks go (default $TMPDIR or /tmp).
+//   -list               Only list the benchmarks.
+//
+// Each benchmark is calibrated to about the time divided by the runs, and
+// then timed that many times; the median and the fastest run are given in
+// ns per operation. With -baseline, a benchmark whose median is more than
+// the tolerance slower than in the baseline is reported, and the exit code
+// is 1; benchmarks missing from the baseline are only listed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../ActivityLog.h"
+#include "../AsyncLogger.h"
+#include "../EventJournal.h"
+#include "../InputFilter.h"
+#include "../LockEngine.h"
+#include "../LockPolicy.h"
+#include "../Logger.h"
+#include "../ProcessInhibitor.h"
+#include "../SettingsStore.h"
+#include "../SimBackend.h"
+#include "../Stats.h"
+#include "../TextUtil.h"
+#include "../WorkStationLocker.h"
+#ifdef __linux__
+#include "../FileSettingsStore.h"
+#endif
+
+
+static volatile uint64_t Sink;  // Keeps the timed loops from being optimized away.
+
+static std::string Dir;
+
+
+static const char *SamplePolicy =
+    "mon-fri 08:00-18:00 *       docked   30 no\n"
+    "*       *           battery *        5  yes\n"
+    "fri-mon 22:00-06:00 *       *        never\n"
+    "sat,sun 00:00-24:00 ac      *        60\n";
+
+
+static std::wstring FileName(const char *name)
+{
+    std::string path = Dir + "/microbench." + name;
+    return std::wstring(path.begin(), path.end());
+}
+
+
+class TBenchmark
+{
+public:
+    virtual ~TBenchmark() {}
+
+    // Does n operations.
+    virtual void Run(uint64_t n) = 0;
+};
+
+
+// Settings kept in memory, like the registry store's cache without the
+// registry.
+class TMemorySettingsStore : public TSettingsStore
+{
+public:
+    ~TMemorySettingsStore() { Stop(); }
+
+protected:
+    bool Load(TSettings &stored) override { stored = saved; return true; }
+    bool Save(const TSettings &stored, unsigned) override { saved = stored; return true; }
+    TWaitResult Wait(int) override { return WR_Woken; }
+    void Wake() override {}
+
+private:
+    TSettings saved = Defaults();
+};
+
+
+// The engine on the simulated backend, checking once a second with input
+// every minute, so that it never locks: the cost of the check itself.
+class TCheckBenchmark : public TBenchmark
+{
+public:
+    TCheckBenchmark(uint32_t startTick = 0) : backend(startTick), engine(backend, logger)
+    {
+        engine.SetTimeout(20 * 60000);
+    }
+
+    void Run(uint64_t n) override
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            now += 1000;
+            backend.AdvanceTo(now);
+            if (now % 60000 == 0)
+                backend.Input();
+            sum += engine.LockIfIdleTimeout();
+        }
+        Sink += sum;
+    }
+
+protected:
+    TSimBackend backend;
+    TLogger     logger;
+    TActivityLog activityLog;  // Before the engine, which uses it until it is gone.
+    TEventJournal journal;
+    TLockEngine engine;
+    uint64_t    now = 0;
+};
+
+
+class TPolicyCheckBenchmark : public TCheckBenchmark
+{
+public:
+    TPolicyCheckBenchmark()
+    {
+        TLockPolicy policy;
+        std::string error;
+        policy.Parse(SamplePolicy, error);
+        backend.SetPowerSource(PS_Battery);
+        engine.SetPolicy(policy);
+        engine.PolicyInputsChanged();
+    }
+};
+
+
+class TJournalCheckBenchmark : public TCheckBenchmark
+{
+public:
+    TJournalCheckBenchmark()
+    {
+        fileName = FileName("jrn");
+        if (journal.Open(fileName.c_str()))
+            engine.SetJournal(&journal);
+    }
+
+    ~TJournalCheckBenchmark()
+    {
+        engine.SetJournal(NULL);
+        journal.Close();
+        RemoveFile(fileName.c_str());
+    }
+
+private:
+    std::wstring fileName;
+};
+
+
+class TActivityCheckBenchmark : public TCheckBenchmark
+{
+public:
+    TActivityCheckBenchmark()
+    {
+        fileName = FileName("act");
+        if (activityLog.Open(fileName.c_str()))
+            engine.SetActivityLog(&activityLog);
+    }
+
+    ~TActivityCheckBenchmark()
+    {
+        engine.SetActivityLog(NULL);
+        activityLog.Close();
+        RemoveFile(fileName.c_str());
+    }
+
+private:
+    std::wstring fileName;
+};
+
+
+// Without input, while a video plays: one of the set's event sources is
+// active, and a polled one is asked every PollInterval once a lock is due.
+class TInhibitedCheckBenchmark : public TCheckBenchmark
+{
+public:
+    class TPolled : public TInhibitorSource
+    {
+    public:
+        TPolled() : TInhibitorSource(L"polled", true) {}
+        bool Poll() override { return false; }
+    };
+
+    TInhibitedCheckBenchmark() : inhibitors(backend)
+    {
+        TManualInhibitor *video = NULL;
+        for (int i = 0; i < TInhibitorSet::MaxSources - 1; i++)
+            inhibitors.Add(video = new TManualInhibitor(L"video"));
+        inhibitors.Add(new TPolled());
+        video->Set(true);
+        engine.SetInhibitors(&inhibitors);
+    }
+
+    ~TInhibitedCheckBenchmark()
+    {
+        engine.SetInhibitors(NULL);
+    }
+
+    void Run(uint64_t n) override
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            now += 1000;
+            backend.AdvanceTo(now);
+            sum += engine.LockIfIdleTimeout();
+        }
+        Sink += sum;
+    }
+
+private:
+    TInhibitorSet inhibitors;
+};
+
+
+// Scheduling and the time left, with the tick count wrapping around every
+// 2^16 operations.
+class TSchedulerBenchmark : public TBenchmark
+{
+public:
+    TSchedulerBenchmark() : backend(UINT32_MAX - 30000), scheduler(backend) {}
+
+    void Run(uint64_t n) override
+    {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            backend.AdvanceTo((i & 0xFFFF) * 65537);
+            uint32_t idle = uint32_t(i % 1200) * 1000;
+            sum += scheduler.Schedule(idle, 20 * 60000, true, 30000);
+            sum += scheduler.TimeUntilDeadline();
+        }
+        Sink += sum;
+    }
+
+private:
+    TSimBackend    backend;
+    TLockScheduler scheduler;
+};
+
+
+// A statistics counter, which every check and query adds to.
+class TStatCounterBenchmark : public TBenchmark
+{
+public:
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++)
+            TStats::Add(SC_Checks);
+        Sink += TStats::Counter(SC_Checks);
+    }
+};
+
+
+// A timed scope: two clock reads and a histogram update.
+class TStatScopeBenchmark : public TBenchmark
+{
+public:
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++) {
+            TStatScope scope(ST_Check);
+            Sink += i;
+        }
+    }
+};
+
+
+class TLogBenchmark : public TBenchmark
+{
+public:
+    TLogBenchmark(bool async)
+    {
+        fileName = FileName(async ? "async.log" : "log");
+        RemoveFile(fileName.c_str());
+        if (async)
+            logger.reset(asyncLogger = new TAsyncLogger(fileName.c_str(), UINT64_MAX));
+        else
+            logger.reset(new TLogger(fileName.c_str()));
+    }
+
+    ~TLogBenchmark()
+    {
+        logger.reset();
+        RemoveFile(fileName.c_str());
+    }
+
+    // The async logger is flushed before its ring fills up, so that every
+    // line is written, and the time includes the writer thread's work.
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++) {
+            logger->Log(L"Lock policy: lock after 20 minutes.");
+            if (asyncLogger != NULL && i % (TAsyncLogger::RingSize / 2) == 0)
+                asyncLogger->Flush();
+        }
+        if (asyncLogger != NULL)
+            asyncLogger->Flush();
+    }
+
+private:
+    std::wstring fileName;
+    std::unique_ptr<TLogger> logger;
+    TAsyncLogger *asyncLogger = NULL;
+};
+
+
+// Without a log file, what every log line costs when logging is off.
+class TNullLogBenchmark : public TBenchmark
+{
+public:
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++)
+            logger.Log(L"Lock policy: lock after 20 minutes.");
+    }
+
+private:
+    TLogger logger;
+};
+
+
+class TJournalBenchmark : public TBenchmark
+{
+public:
+    TJournalBenchmark()
+    {
+        fileName = FileName("append.jrn");
+        journal.Open(fileName.c_str());
+    }
+
+    ~TJournalBenchmark()
+    {
+        journal.Close();
+        RemoveFile(fileName.c_str());
+    }
+
+    void Run(uint64_t n) override
+    {
+        TJournalRecord record = {};
+        record.event = JE_Check;
+        for (uint64_t i = 0; i < n; i++) {
+            record.tick = uint32_t(i);
+            journal.Append(record);
+        }
+    }
+
+private:
+    std::wstring  fileName;
+    TEventJournal journal;
+};
+
+
+class TActivityMarkBenchmark : public TBenchmark
+{
+public:
+    TActivityMarkBenchmark()
+    {
+        fileName = FileName("mark.act");
+        activityLog.Open(fileName.c_str());
+    }
+
+    ~TActivityMarkBenchmark()
+    {
+        activityLog.Close();
+        RemoveFile(fileName.c_str());
+    }
+
+    // A minute a time, so that a new day is started every 1440.
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++) {
+            time += 60000;
+            activityLog.Mark(AM_Active, time);
+        }
+    }
+
+private:
+    std::wstring fileName;
+    TActivityLog activityLog;
+    int64_t      time = int64_t(TSimBackend::StartDay) * TActivityLog::MsPerDay;
+};
+
+
+// A settings change through the locker and back: what a menu click and a
+// reload after an outside change cost, without the background write.
+class TCachedSettingsBenchmark : public TBenchmark
+{
+public:
+    TCachedSettingsBenchmark() : locker(backend, logger, store) {}
+
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++) {
+            locker.SetTimeout(int(i % 12 + 1) * 5 * 60000);
+            locker.ReloadSettings();
+        }
+        Sink += uint64_t(locker.GetTimeout());
+    }
+
+private:
+    TSimBackend backend;
+    TLogger     logger;
+    TMemorySettingsStore store;
+    TWorkStationLocker locker;
+};
+
+
+// What a polled inhibitor costs, each time it is asked.
+class TProcessPollBenchmark : public TBenchmark
+{
+public:
+    TProcessPollBenchmark() : inhibitor(std::vector<std::wstring>{ L"no-such-program" }) {}
+
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i++)
+            Sink += inhibitor.Poll();
+    }
+
+private:
+    TProcessInhibitor inhibitor;
+};
+
+
+// Filtering the input of a 1000 Hz mouse that jitters, in batches of 16
+// events, x and y of 8 reports, as they are read from the device.
+class TInputFilterBenchmark : public TBenchmark
+{
+public:
+    static const size_t BatchSize = 16;
+
+    TInputFilterBenchmark()
+    {
+        uint16_t device = filter.AddDevice("mouse");
+        for (size_t i = 0; i < BatchSize; i++)
+            batch[i] = TInputEvent{ uint32_t(i / 2), device, IK_Move, i % 4 < 2 ? 1 : -1, 0 };
+    }
+
+    void Run(uint64_t n) override
+    {
+        for (uint64_t i = 0; i < n; i += BatchSize) {
+            Sink += filter.Process(batch, BatchSize);
+            for (TInputEvent &event : batch)
+                event.time += uint32_t(BatchSize / 2);
+        }
+    }
+
+private:
+    TInputFilter filter;
+    TInputEvent  batch[BatchSize];
+};
+
+
+#ifdef __linux__
+
+// Writing the settings file and reading it back, like the store's
+// background thread does on a change.
+class TFileSettingsBenchmark : public TBenchmark
+{
+public:
+    class TStore : public TFileSettingsStore
+    {
+    public:
+        TStore(const std::string &fileName) : TFileSettingsStore(fileName) {}
+        using TFileSettingsStore::Load;
+        using TFileSettingsStore::Save;
+    };
+
+    TFileSettingsBenchmark() : fileName(Dir + "/microbench.settings"), store(fileName) {}
+
+    ~TFileSettingsBenchmark()
+    {
+        remove(fileName.c_str());
+    }
+
+    void Run(uint64_t n) override
+    {
+        TSettings settings = TSettingsStore::Defaults();
+        for (uint64_t i = 0; i < n; i++) {
+            settings.lockTimeout = int(i % 12 + 1) * 5 * 60000;
+            store.Save(settings, TSettingsStore::SF_LockTimeout);
+            TSettings loaded = TSettingsStore::Defaults();
+            store.Load(loaded);
+            Sink += uint64_t(loaded.lockTimeout);
+        }
+    }
+
+private:
+    std::string fileName;
+    TStore      store;
+};
+
+#endif
+
+
+struct TBenchmarkInfo
+{
+    const char *name;
+    const char *operation;
+    TBenchmark *(*create)();
+};
+
+
+static const TBenchmarkInfo Benchmarks[] = {
+    { "check/idle",         "check",    [] () -> TBenchmark * { return new TCheckBenchmark(); } },
+    { "check/wraparound",   "check",    [] () -> TBenchmark * { return new TCheckBenchmark(UINT32_MAX - 600000); } },
+    { "check/policy",       "check",    [] () -> TBenchmark * { return new TPolicyCheckBenchmark(); } },
+    { "check/journal",      "check",    [] () -> TBenchmark * { return new TJournalCheckBenchmark(); } },
+    { "check/activity",     "check",    [] () -> TBenchmark * { return new TActivityCheckBenchmark(); } },
+    { "check/inhibited",    "check",    [] () -> TBenchmark * { return new TInhibitedCheckBenchmark(); } },
+    { "inhibitor/process",  "poll",     [] () -> TBenchmark * { return new TProcessPollBenchmark(); } },
+    { "input/filter",       "event",    [] () -> TBenchmark * { return new TInputFilterBenchmark(); } },
+    { "scheduler/schedule", "schedule", [] () -> TBenchmark * { return new TSchedulerBenchmark(); } },
+    { "stats/counter",      "add",      [] () -> TBenchmark * { return new TStatCounterBenchmark(); } },
+    { "stats/scope",        "scope",    [] () -> TBenchmark * { return new TStatScopeBenchmark(); } },
+    { "log/off",            "line",     [] () -> TBenchmark * { return new TNullLogBenchmark(); } },
+    { "log/sync",           "line",     [] () -> TBenchmark * { return new TLogBenchmark(false); } },
+    { "log/async",          "line",     [] () -> TBenchmark * { return new TLogBenchmark(true); } },
+    { "journal/append",     "record",   [] () -> TBenchmark * { return new TJournalBenchmark(); } },
+    { "activity/mark",      "mark",     [] () -> TBenchmark * { return new TActivityMarkBenchmark(); } },
+    { "settings/cached",    "change",   [] () -> TBenchmark * { return new TCachedSettingsBenchmark(); } },
+#ifdef __linux__
+    { "settings/file",      "save+load", [] () -> TBenchmark * { return new TFileSettingsBenchmark(); } },
+#endif
+};
+
+
+struct TResult
+{
+    const TBenchmarkInfo *info;
+    uint64_t iterations;    // Per run.
+    double   median;        // ns per operation.
+    double   fastest;
+};
+
+
+static double TimeRun(TBenchmark &benchmark, uint64_t n)
+{
+    auto start = std::chrono::steady_clock::now();
+    benchmark.Run(n);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static TResult Measure(const TBenchmarkInfo &info, double timeNs, int runs)
+{
+    std::unique_ptr<TBenchmark> benchmark(info.create());
+
+    // Double until a run takes a tenth of its share, then scale up to it.
+    double runNs = timeNs / runs;
+    uint64_t n = 1;
+    double ns = TimeRun(*benchmark, n);
+    while (ns < runNs / 10 && n < (uint64_t(1) << 40)) {
+        n *= 2;
+        ns = TimeRun(*benchmark, n);
+    }
+    if (ns < runNs)
+        n = std::max<uint64_t>(1, uint64_t(n * runNs / std::max(ns, 1.)));
+
+    std::vector<double> perOp;
+    for (int i = 0; i < runs; i++)
+        perOp.push_back(TimeRun(*benchmark, n) / n);
+    std::sort(perOp.begin(), perOp.end());
+
+    TResult result;
+    result.info = &info;
+    result.iterations = n;
+    result.median = perOp[perOp.size() / 2];
+    result.fastest = perOp.front();
+    return result;
+}
+
+
+// The name and ns_per_op of each line of -json output.
+static bool ReadBaseline(const char *fileName, std::map<std::string, double> &baseline)
+{
+    FILE *f = fopen(fileName, "r");
+    if (f == NULL)
+        return false;
+
+    char line[512];
+    while (fgets(line, sizeof line, f) != NULL) {
+        const char *name = strstr(line, "\"name\":\"");
+        const char *value = strstr(line, "\"ns_per_op\":");
+        if (name == NULL || value == NULL)
+            continue;
+        name += 8;
+        const char *end = strchr(name, '"');
+        if (end != NULL)
+            baseline[std::string(name, end)] = atof(value + 12);
+    }
+    fclose(f);
+    return true;
+}
+
+
+static int Usage()
+{
+    fprintf(stderr, "Usage: microbench [-filter <text>] [-time <ms>] [-runs <n>] [-json | -csv]\n"
+                    "                  [-baseline <file> [-tolerance <pct>]] [-dir <dir>] [-list]\n");
+    return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    int timeMs = 500;
+    int runs = 5;
+    bool json = false;
+    bool csv = false;
+    bool list = false;
+    const char *baselineFile = NULL;
+    double tolerance = 25;
+    const char *tmp = getenv("TMPDIR");
+    Dir = tmp != NULL && tmp[0] != 0 ? tmp : "/tmp";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc)
+            timeMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-json") == 0)
+            json = true;
+        else if (strcmp(argv[i], "-csv") == 0)
+            csv = true;
+        else if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)
+            baselineFile = argv[++i];
+        else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "-dir") == 0 && i + 1 < argc)
+            Dir = argv[++i];
+        else if (strcmp(argv[i], "-list") == 0)
+            list = true;
+        else
+            return Usage();
+    }
+    if (timeMs <= 0 || runs <= 0 || (json && csv))
+        return Usage();
+
+    std::map<std::string, double> baseline;
+    if (baselineFile != NULL && !ReadBaseline(baselineFile, baseline)) {
+        fprintf(stderr, "%s: cannot open.\n", baselineFile);
+        return 1;
+    }
+
+    if (csv)
+        printf("name,operation,iterations,ns_per_op,min_ns_per_op,ops_per_s\n");
+
+    int regressions = 0;
+    for (const TBenchmarkInfo &info : Benchmarks) {
+        if (filter != NULL && strstr(info.name, filter) == NULL)
+            continue;
+        if (list) {
+            printf("%s\n", info.name);
+            continue;
+        }
+
+        TResult r = Measure(info, timeMs * 1e6, runs);
+        double opsPerSecond = r.median > 0 ? 1e9 / r.median : 0.;
+        if (json)
+            printf("{\"name\":\"%s\",\"operation\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,"
+                "\"min_ns_per_op\":%.2f,\"ops_per_s\":%.0f}\n", info.name, info.operation,
+                (unsigned long long)r.iterations, r.median, r.fastest, opsPerSecond);
+        else if (csv)
+            printf("%s,%s,%llu,%.2f,%.2f,%.0f\n", info.name, info.operation,
+                (unsigned long long)r.iterations, r.median, r.fastest, opsPerSecond);
+        else
+            printf("%-20s %10.1f ns/%-9s (fastest %.1f) %14.0f per s\n", info.name, r.median, info.operation,
+                r.fastest, opsPerSecond);
+        fflush(stdout);
+
+        if (baselineFile == NULL)
+            continue;
+        auto i = baseline.find(info.name);
+        if (i == baseline.end()) {
+            fprintf(stderr, "%s: not in the baseline.\n", info.name);
+        } else if (r.median > i->second * (1 + tolerance / 100)) {
+            fprintf(stderr, "%s: regression, %.1f ns vs %.1f ns in the baseline (+%.0f%%).\n", info.name,
+                r.median, i->second, (r.median / i->second - 1) * 100);
+            regressions++;
+        }
+    }
+    return regressions != 0 ? 1 : 0;
+}
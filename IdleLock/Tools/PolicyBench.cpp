@@ -0,0 +1,163 @@
+// PolicyBench.cpp
+// Checks the compiled lock policy (LockPolicy.cpp) against walking the rules,
+// and measures compiling and deciding with large random rule sets.
+// Builds on Linux (or anywhere with a C++14 compiler), e.g.
+//   g++ -std=c++14 -O2 -I.. -o policybench PolicyBench.cpp ../LockPolicy.cpp
+//
+// Usage: policybench [-rules <n>] [-seed <n>]
+//   -rules <n>   Number of rules (default: 10, 100, 1000 and 10000).
+//   -seed <n>    Random seed.
+//
+// For every power source and dock state, the compiled decision must equal
+// the first matching rule at every minute of the week (sampled for large
+// rule sets), and MinutesUntilChange() must point at the next minute where
+// the decision differs. Exits with 1 if not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "../LockPolicy.h"
+
+
+static const char *SamplePolicy =
+    "# Office hours on the dock: relaxed.\n"
+    "mon-fri 08:00-18:00 *       docked   30 no\n"
+    "# On battery, outside the office: strict.\n"
+    "*       *           battery *        5  yes\n"
+    "fri-mon 22:00-06:00 *       *        never\n"
+    "sat,sun 00:00-24:00 ac      *        60\n";
+
+
+static volatile uint32_t Sink;  // Keeps the timed loops from being optimized away.
+
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Mostly narrow rules, one day and up to two hours, so that deciding by
+// walking the rules has to look at many of them.
+static TPolicyRule RandomRule(std::mt19937 &random)
+{
+    TPolicyRule rule;
+    rule.days = random() % 8 == 0 ? uint8_t(random() % 127 + 1) : uint8_t(1 << random() % 7);
+    rule.startMinute = uint16_t(random() % 96 * 15);
+    rule.endMinute = uint16_t((rule.startMinute + (random() % 8 + 1) * 15) % (24 * 60));
+    rule.power = TPowerSource(random() % 3);
+    rule.dock = TDockState(random() % 3);
+    rule.timeout = random() % 10 == 0 ? 0 : uint32_t(random() % 60 + 1) * 60000;
+    rule.requireScreenSaver = int8_t(random() % 3) - 1;
+    return rule;
+}
+
+
+// Returns the number of mismatches.
+static uint64_t Check(TLockPolicy &policy, TPowerSource power, TDockState dock, int step)
+{
+    uint64_t errors = 0;
+    policy.Compile(power, dock);
+
+    for (int m = 0; m < TLockPolicy::MinutesPerWeek; m += step) {
+        if (!(policy.Decide(m) == policy.Evaluate(m, power, dock))) {
+            if (errors++ == 0)
+                printf("decision mismatch at minute %d, power %d, dock %d\n", m, power, dock);
+        }
+
+        int left = policy.MinutesUntilChange(m);
+        if (left == 0)
+            continue;
+        int next = (m + left) % TLockPolicy::MinutesPerWeek;
+        int before = (m + left - 1) % TLockPolicy::MinutesPerWeek;
+        if (policy.Decide(next) == policy.Decide(m) || !(policy.Decide(before) == policy.Decide(m))) {
+            if (errors++ == 0)
+                printf("wrong change time at minute %d: %d minutes\n", m, left);
+        }
+    }
+    return errors;
+}
+
+
+static bool Run(int ruleCount, unsigned seed)
+{
+    std::mt19937 random(seed);
+    TLockPolicy policy;
+    for (int i = 0; i < ruleCount; i++)
+        policy.AddRule(RandomRule(random));
+
+    auto start = std::chrono::steady_clock::now();
+    const int Compiles = 20;
+    for (int i = 0; i < Compiles; i++)
+        policy.Compile(TPowerSource(i % 3), TDockState(i / 3 % 3));
+    double compileSeconds = Seconds(start) / Compiles;
+
+    policy.Compile(PS_AC, DS_Docked);
+    const int Decisions = 20000000;
+    uint32_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Decisions; i++)
+        sum += policy.Decide(int((i * 7919u) % TLockPolicy::MinutesPerWeek)).timeout;
+    double decideSeconds = Seconds(start) / Decisions;
+
+    const int Evaluations = ruleCount > 1000 ? 20000 : 1000000;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < Evaluations; i++)
+        sum += policy.Evaluate(int((i * 7919u) % TLockPolicy::MinutesPerWeek), PS_AC, DS_Docked).timeout;
+    double evaluateSeconds = Seconds(start) / Evaluations;
+
+    uint64_t errors = 0;
+    int step = ruleCount > 1000 ? 97 : 1;
+    for (int p = 0; p < 3; p++) {
+        for (int d = 0; d < 3; d++)
+            errors += Check(policy, TPowerSource(p), TDockState(d), step);
+    }
+
+    Sink = sum;
+    printf("%6d rules: compile %8.1f us, %5zu segments, decide %5.2f ns, walk rules %9.1f ns, errors %llu\n",
+        ruleCount, compileSeconds * 1e6, policy.Segments(), decideSeconds * 1e9, evaluateSeconds * 1e9,
+        (unsigned long long)errors);
+    return errors == 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> ruleCounts;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-rules") == 0 && i + 1 < argc)
+            ruleCounts.push_back(atoi(argv[++i]));
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = (unsigned)atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: policybench [-rules <n>] [-seed <n>]\n");
+            return 2;
+        }
+    }
+    if (ruleCounts.empty())
+        ruleCounts = { 10, 100, 1000, 10000 };
+
+    bool ok = true;
+
+    TLockPolicy sample;
+    std::string error;
+    if (!sample.Parse(SamplePolicy, error) || sample.Rules().size() != 4) {
+        printf("sample policy: %s\n", error.c_str());
+        ok = false;
+    }
+    for (int p = 0; p < 3 && ok; p++) {
+        for (int d = 0; d < 3; d++)
+            ok &= Check(sample, TPowerSource(p), TDockState(d), 1) == 0;
+    }
+
+    for (int n : ruleCounts)
+        ok &= Run(n, seed);
+
+    return ok ? 0 : 1;
+}
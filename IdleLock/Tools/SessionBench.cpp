@@ -0,0 +1,233 @@
+// SessionBench.cpp
+// Runs the multi-session monitor (SessionMonitor.cpp) against simulated
+// sessions on a virtual clock, to see how it scales with the number of
+// sessions, and compares the wakeups with one polling process per session.
+// Builds on Linux (or anywhere with a C++14 compiler), e.g.
+//   g++ -std=c++14 -O2 -I.. -o sessionbench SessionBench.cpp ../SessionMonitor.cpp
+//       ../DeadlineHeap.cpp ../LockScheduler.cpp ../Logger.cpp ../TextUtil.cpp ../Stats.cpp
+//
+// Usage: sessionbench [options]
+//   -sessions <n>      Number of sessions (default: 100, 1000 and 10000).
+//   -hours <n>         Simulated time (default 24).
+//   -timeout <min>     Lock timeout (default 20).
+//   -seed <n>          Random seed.
+//
+// Each simulated user gives input at random, mostly seconds apart, but now and
+// then stays away for up to 90 minutes. Input in a locked session unlocks it.
+// Locks that come before the timeout, and absences longer than the timeout
+// (plus the minimum wake delay) that didn't end in a lock, are counted as
+// failures.
+// Also measures the deadline heap on its own: the cost of moving a deadline
+// among n others.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "../SessionMonitor.h"
+
+
+class TBenchBackend : public TMultiSessionBackend
+{
+public:
+    TBenchBackend(uint32_t sessionCount, uint32_t aThreshold)
+        : lastInput(sessionCount, 0), locked(sessionCount, false), threshold(aThreshold) {}
+
+    uint32_t TickCount() override { return StartTick + uint32_t(now); }
+
+    bool LastInputTick(uint32_t session, uint32_t &tick) override
+    {
+        tick = StartTick + uint32_t(lastInput[session]);
+        return true;
+    }
+
+    bool LockSession(uint32_t session) override
+    {
+        if (now - lastInput[session] < threshold)
+            earlyLocks++;
+        locked[session] = true;
+        locks++;
+        return true;
+    }
+
+    // Close to the tick count wraparound, to exercise it.
+    static const uint32_t StartTick = UINT32_MAX - 3600000;
+
+    uint64_t now = 0;
+    std::vector<uint64_t> lastInput;
+    std::vector<bool> locked;
+    uint32_t threshold;
+    uint64_t locks = 0;
+    uint64_t earlyLocks = 0;
+};
+
+
+struct TInputEvent
+{
+    uint64_t time;
+    uint32_t session;
+
+    bool operator>(const TInputEvent &other) const { return time > other.time; }
+};
+
+
+// Returns true if there were no failures.
+static bool RunSessions(uint32_t sessionCount, double hours, uint32_t timeout, unsigned seed)
+{
+    uint32_t threshold = TLockScheduler::LockThreshold(timeout);
+    uint64_t end = uint64_t(hours * 3600000.);
+
+    TLogger logger;
+    TBenchBackend backend(sessionCount, threshold);
+    TSessionMonitor monitor(backend, logger);
+    monitor.SetTimeout(timeout);
+
+    std::mt19937_64 random(seed);
+    std::exponential_distribution<double> activeGap(1 / 15000.);
+    std::uniform_int_distribution<uint64_t> awayGap(60000, 90 * 60000);
+    std::bernoulli_distribution away(0.002);
+
+    std::priority_queue<TInputEvent, std::vector<TInputEvent>, std::greater<TInputEvent>> inputs;
+    for (uint32_t s = 0; s < sessionCount; s++) {
+        monitor.AddSession(s);
+        inputs.push(TInputEvent{ uint64_t(activeGap(random)), s });
+    }
+
+    uint64_t inputCount = 0;
+    uint64_t dueLocks = 0;
+    uint64_t missedLocks = 0;
+    double checkSeconds = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t nextCheck = 0;
+    bool checkPending = true;
+
+    for (;;) {
+        uint64_t nextInput = inputs.top().time;
+        if (checkPending && nextCheck <= nextInput) {
+            if (nextCheck >= end)
+                break;
+            backend.now = nextCheck;
+
+            auto checkStart = std::chrono::steady_clock::now();
+            uint32_t delay = monitor.CheckDueSessions();
+            checkSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - checkStart).count();
+
+            checkPending = delay != 0;
+            nextCheck = backend.now + delay;
+            continue;
+        }
+        if (nextInput >= end)
+            break;
+
+        TInputEvent event = inputs.top();
+        inputs.pop();
+        backend.now = event.time;
+        inputCount++;
+
+        uint32_t s = event.session;
+        // A lock may come up to one minimum wake delay late.
+        if (event.time - backend.lastInput[s] >= threshold + TLockScheduler::MinWakeDelay) {
+            dueLocks++;
+            if (!backend.locked[s])
+                missedLocks++;
+        }
+        backend.lastInput[s] = event.time;
+        if (backend.locked[s]) {
+            backend.locked[s] = false;
+            monitor.SessionUnlocked(s);
+
+            // Like the session change notification, this wakes the monitor.
+            uint32_t delay = monitor.CheckDueSessions();
+            checkPending = delay != 0;
+            nextCheck = backend.now + delay;
+        }
+
+        uint64_t gap = away(random) ? awayGap(random) : uint64_t(activeGap(random)) + 1;
+        inputs.push(TInputEvent{ event.time + gap, s });
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const TLatencyHistogram &latency = monitor.LockLatency();
+    uint64_t pollingWakeups = uint64_t(sessionCount * (end / double(TLockScheduler::PollInterval)));
+
+    printf("sessions:        %u, %.1f h simulated in %.2f s, %llu input events\n",
+        sessionCount, hours, seconds, (unsigned long long)inputCount);
+    printf("wakeups:         %llu (%.1f per hour), polling per session: %llu\n",
+        (unsigned long long)monitor.Wakeups(), monitor.Wakeups() / hours, (unsigned long long)pollingWakeups);
+    printf("session checks:  %llu, %.0f ns per check\n",
+        (unsigned long long)monitor.Checks(), monitor.Checks() ? checkSeconds * 1e9 / monitor.Checks() : 0.);
+    printf("locks:           %llu, absences due a lock: %llu, missed %llu, early %llu\n",
+        (unsigned long long)backend.locks, (unsigned long long)dueLocks,
+        (unsigned long long)missedLocks, (unsigned long long)backend.earlyLocks);
+    printf("lock latency ms: mean %u, p99 %u, max %u\n\n", latency.Mean(), latency.Percentile(99), latency.Max());
+
+    return missedLocks == 0 && backend.earlyLocks == 0;
+}
+
+
+static void BenchHeap(uint32_t keyCount, unsigned seed)
+{
+    const int Moves = 2000000;
+
+    std::mt19937 random(seed);
+    TDeadlineHeap heap;
+    for (uint32_t k = 0; k < keyCount; k++)
+        heap.Set(k, random() % 3600000);
+
+    // Like input in a session: its deadline moves later than it was.
+    auto start = std::chrono::steady_clock::now();
+    uint32_t now = 0;
+    for (int i = 0; i < Moves; i++) {
+        uint32_t key = random() % keyCount;
+        now += 1;
+        heap.Set(key, now + 3600000 - random() % 60000);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("heap, %6u keys: %.0f ns per deadline move\n", keyCount, seconds * 1e9 / Moves);
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::vector<uint32_t> sessionCounts;
+    double hours = 24;
+    int timeout = 20;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-sessions") == 0 && i + 1 < argc)
+            sessionCounts.push_back((uint32_t)atoi(argv[++i]));
+        else if (strcmp(argv[i], "-hours") == 0 && i + 1 < argc)
+            hours = atof(argv[++i]);
+        else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc)
+            timeout = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = (unsigned)atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: sessionbench [-sessions <n>] [-hours <n>] [-timeout <min>] [-seed <n>]\n");
+            return 2;
+        }
+    }
+    if (sessionCounts.empty())
+        sessionCounts = { 100, 1000, 10000 };
+
+    bool ok = true;
+    for (uint32_t n : sessionCounts) {
+        if (n > 0)
+            ok &= RunSessions(n, hours, uint32_t(timeout) * 60000, seed);
+    }
+
+    for (uint32_t n : sessionCounts) {
+        if (n > 0)
+            BenchHeap(n, seed);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+// StateBench.cpp
+// Measures the shared state block (InstanceState.h) under contention: a
+// writer thread publishes updates while reader threads, each with a
+// mapping of its own as if they were other processes, sample the block as
+// fast as they can, and checks that no reader ever gets a mix of two
+// updates.
+// Builds with the CMake build (target statebench), or on Linux e.g.
+//   g++ -std=c++14 -O2 -I.. -o statebench StateBench.cpp ../InstanceState.cpp
+//       ../InstanceStatePage.cpp ../LockEngine.cpp ../LockScheduler.cpp ../LockPolicy.cpp
+//       ../Logger.cpp ../TextUtil.cpp ../EventJournal.cpp ../MappedFile.cpp ../Stats.cpp
+//       ../ActivityLog.cpp ../AdaptiveTimeout.cpp ../InhibitorSet.cpp
+//       ../ActionPipeline.cpp ../EngineCheckpoint.cpp -pthread
+//
+// Usage: statebench [options]
+//   -readers <n>    Number of reader threads (default: 1, 2, 4 and the
+//                   number of processors).
+//   -rate <n>       Updates per second (default 0: as fast as possible,
+//                   the worst case; the daemon makes a few per minute).
+//   -ms <n>         Time per round (default 1000).
+//
+// For each round: the reads per second and ns per read, the mean and
+// maximum attempts a read took, the reads that gave up on a writer that
+// kept writing, the torn copies, and the updates per second and ns per
+// update. Exits with 1 if there was a torn copy, or the block couldn't be
+// created.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../InstanceStatePage.h"
+
+
+struct TReaderResult
+{
+    uint64_t reads = 0;
+    uint64_t attempts = 0;
+    uint32_t maxAttempts = 0;
+    uint64_t failed = 0;
+    uint64_t torn = 0;
+};
+
+
+// Every field of update n is made from n, so a copy that mixes two updates
+// shows.
+static void MakeUpdate(TInstanceStateBlock &state, uint32_t n)
+{
+    state.flags = n & 0x3F;
+    state.updatedTime = int64_t(n) * 1000;
+    state.timeout = n;
+    state.effectiveTimeout = n * 3;
+    state.warningTime = ~n;
+    state.idleTime = n ^ 0x5A5A5A5A;
+    state.lockIn = n + 1;
+    state.nextCheck = n + 2;
+    state.checks = n;
+    state.locks = uint64_t(n) << 32 | n;
+    memset(state.reserved, int(n & 0xFF), sizeof state.reserved);
+}
+
+
+static bool Consistent(const TInstanceStateBlock &state)
+{
+    TInstanceStateBlock expected = state;
+    MakeUpdate(expected, state.timeout);
+    return memcmp(&expected, &state, sizeof state) == 0;
+}
+
+
+static void ReaderThread(const std::wstring &name, const std::atomic<bool> &stop, TReaderResult &result)
+{
+    TInstanceStatePage page;
+    if (!page.Open(name))
+        return;
+
+    TInstanceStateBlock state;
+    while (!stop.load(std::memory_order_relaxed)) {
+        uint32_t attempts;
+        if (page.Read(state, &attempts)) {
+            result.reads++;
+            if (!Consistent(state))
+                result.torn++;
+        } else {
+            result.failed++;
+        }
+        result.attempts += attempts;
+        if (attempts > result.maxAttempts)
+            result.maxAttempts = attempts;
+    }
+}
+
+
+// Returns false if there were torn copies.
+static bool Round(TInstanceStatePage &page, const std::wstring &name, unsigned readers, uint32_t rate, uint32_t ms)
+{
+    // Consistent before the readers start.
+    TInstanceStateBlock state = *page.Block();
+    MakeUpdate(state, 0);
+    WriteInstanceState(*page.Block(), state);
+
+    std::atomic<bool> stop(false);
+    std::vector<TReaderResult> results(readers);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < readers; i++)
+        threads.emplace_back(ReaderThread, std::cref(name), std::cref(stop), std::ref(results[i]));
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::milliseconds(ms);
+    uint32_t updates = 0;
+    double writeTime = 0;
+    for (auto now = start; now < end; ) {
+        MakeUpdate(state, updates);
+        auto before = std::chrono::steady_clock::now();
+        WriteInstanceState(*page.Block(), state);
+        now = std::chrono::steady_clock::now();
+        writeTime += std::chrono::duration<double>(now - before).count();
+        updates++;
+        if (rate != 0) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(uint64_t(updates) * 1000000 / rate));
+            now = std::chrono::steady_clock::now();
+        }
+    }
+    stop = true;
+    for (std::thread &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    TReaderResult total;
+    for (const TReaderResult &result : results) {
+        total.reads += result.reads;
+        total.attempts += result.attempts;
+        total.failed += result.failed;
+        total.torn += result.torn;
+        if (result.maxAttempts > total.maxAttempts)
+            total.maxAttempts = result.maxAttempts;
+    }
+    uint64_t tries = total.reads + total.failed;
+    printf("%7u %13.0f %9.1f %9.3f %9u %9llu %6llu %11.0f %9.1f\n",
+        readers, total.reads / seconds, tries != 0 ? seconds * readers * 1e9 / tries : 0.,
+        tries != 0 ? double(total.attempts) / tries : 0., total.maxAttempts,
+        (unsigned long long)total.failed, (unsigned long long)total.torn,
+        updates / seconds, updates != 0 ? writeTime * 1e9 / updates : 0.);
+    return total.torn == 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::vector<unsigned> readerCounts;
+    uint32_t rate = 0;
+    uint32_t ms = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-readers") == 0 && i + 1 < argc)
+            readerCounts.push_back(unsigned(atoi(argv[++i])));
+        else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+            rate = uint32_t(atoi(argv[++i]));
+        else if (strcmp(argv[i], "-ms") == 0 && i + 1 < argc)
+            ms = uint32_t(atoi(argv[++i]));
+        else {
+            fprintf(stderr, "Usage: statebench [-readers <n>] [-rate <n>] [-ms <n>]\n");
+            return 2;
+        }
+    }
+    if (readerCounts.empty()) {
+        unsigned processors = std::thread::hardware_concurrency();
+        readerCounts = { 1, 2, 4 };
+        if (processors > 4)
+            readerCounts.push_back(processors);
+    }
+
+    // Not the daemon's block, which may be in use.
+    std::wstring name = TInstanceStatePage::DefaultName() + L".bench";
+    TInstanceStatePage page;
+    if (!page.Create(name, 0600)) {
+        fprintf(stderr, "Could not create the shared state block.\n");
+        return 1;
+    }
+    InitInstanceState(*page.Block(), 1, 0, true);
+
+    printf("readers       reads/s   ns/read  attempts       max    failed   torn   updates/s ns/update\n");
+    bool ok = true;
+    for (unsigned readers : readerCounts)
+        ok &= Round(page, name, readers, rate, ms);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "IdleLock.h"
+#include "TrayIconCache.h"
+
+
+void TTrayIconCache::Build(HINSTANCE hInstance, int aSize)
+{
+    if (aSize == size && locked != NULL)
+        return;
+
+    Clear();
+    size = aSize;
+
+    locked = (HICON) LoadImage(hInstance, MAKEINTRESOURCE(IDI_IDLELOCK), IMAGE_ICON, size, size, 0);
+    open = (HICON) LoadImage(hInstance, MAKEINTRESOURCE(IDI_IDLELOCKOPEN), IMAGE_ICON, size, size, 0);
+
+    TIconImage base;
+    if (locked == NULL || !GetPixels(locked, base))
+        return;
+
+    std::vector<TIconImage> frames = TIconRaster::RenderCountdownFrames(base, CountdownFrames);
+    for (const TIconImage &frame : frames) {
+        HICON icon = CreateIconFromImage(frame);
+        if (icon == NULL)
+            break;
+        countdown.push_back(icon);
+    }
+}
+
+
+HICON TTrayIconCache::Countdown(double remaining) const
+{
+    if (countdown.empty())
+        return locked;
+
+    // Round up, so that the ring doesn't disappear until the time is up.
+    int i = int(remaining * countdown.size() + .999999) - 1;
+    if (i < 0)
+        i = 0;
+    else if (i >= int(countdown.size()))
+        i = int(countdown.size()) - 1;
+    return countdown[i];
+}
+
+
+void TTrayIconCache::Clear()
+{
+    for (HICON icon : countdown)
+        DestroyIcon(icon);
+    countdown.clear();
+
+    if (locked != NULL)
+        DestroyIcon(locked);
+    if (open != NULL)
+        DestroyIcon(open);
+    locked = open = NULL;
+    size = 0;
+}
+
+
+// Reads the icon as a top-down 32 bpp image. Icons without an alpha channel
+// get their transparency from the AND mask.
+bool TTrayIconCache::GetPixels(HICON icon, TIconImage &image)
+{
+    ICONINFO info;
+    if (!GetIconInfo(icon, &info))
+        return false;
+
+    BITMAP bm;
+    bool ok = info.hbmColor != NULL && GetObject(info.hbmColor, sizeof bm, &bm) == sizeof bm;
+    if (ok) {
+        image = TIconImage(bm.bmWidth);
+
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof bmi.bmiHeader;
+        bmi.bmiHeader.biWidth = image.size;
+        bmi.bmiHeader.biHeight = -image.size;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        HDC dc = GetDC(NULL);
+        ok = GetDIBits(dc, info.hbmColor, 0, image.size, image.pixels.data(), &bmi, DIB_RGB_COLORS) == image.size;
+
+        bool hasAlpha = false;
+        for (uint32_t pixel : image.pixels)
+            hasAlpha |= (pixel & 0xFF000000) != 0;
+
+        if (ok && !hasAlpha) {
+            std::vector<uint32_t> mask(image.pixels.size());
+            ok = GetDIBits(dc, info.hbmMask, 0, image.size, mask.data(), &bmi, DIB_RGB_COLORS) == image.size;
+            for (size_t i = 0; ok && i < mask.size(); i++)
+                if ((mask[i] & 0xFFFFFF) == 0)
+                    image.pixels[i] |= 0xFF000000;
+        }
+        ReleaseDC(NULL, dc);
+    }
+
+    if (info.hbmColor != NULL)
+        DeleteObject(info.hbmColor);
+    DeleteObject(info.hbmMask);
+    return ok;
+}
+
+
+HICON TTrayIconCache::CreateIconFromImage(const TIconImage &image)
+{
+    BITMAPV5HEADER header = {};
+    header.bV5Size = sizeof header;
+    header.bV5Width = image.size;
+    header.bV5Height = -image.size;
+    header.bV5Planes = 1;
+    header.bV5BitCount = 32;
+    header.bV5Compression = BI_BITFIELDS;
+    header.bV5RedMask = 0x00FF0000;
+    header.bV5GreenMask = 0x0000FF00;
+    header.bV5BlueMask = 0x000000FF;
+    header.bV5AlphaMask = 0xFF000000;
+
+    void *bits;
+    HDC dc = GetDC(NULL);
+    HBITMAP color = CreateDIBSection(dc, (BITMAPINFO *) &header, DIB_RGB_COLORS, &bits, NULL, 0);
+    ReleaseDC(NULL, dc);
+    if (color == NULL)
+        return NULL;
+    memcpy(bits, image.pixels.data(), image.pixels.size() * sizeof image.pixels[0]);
+
+    // With an alpha channel, the mask is ignored, but must be there; all
+    // zero, rather than whatever CreateBitmap() would leave in it. Its rows
+    // are padded to 16 bits.
+    std::vector<uint8_t> maskBits(size_t((image.size + 15) / 16 * 2) * image.size, 0);
+    HBITMAP mask = CreateBitmap(image.size, image.size, 1, 1, maskBits.data());
+
+    ICONINFO info = {};
+    info.fIcon = TRUE;
+    info.hbmColor = color;
+    info.hbmMask = mask;
+    HICON icon = CreateIconIndirect(&info);
+
+    DeleteObject(mask);
+    DeleteObject(color);
+    return icon;
+}
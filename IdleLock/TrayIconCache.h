@@ -0,0 +1,44 @@
+#pragma once
+
+// Tray icons rendered once per icon size.
+// All icons, including the countdown frames, are created when the size is
+// first known and then reused, so updating the tray icon never loads or
+// renders anything. They are only rebuilt when the size changes, e.g. when
+// the DPI does.
+
+#include "stdafx.h"
+
+#include <vector>
+
+#include "IconRaster.h"
+
+
+class TTrayIconCache
+{
+public:
+    static const int CountdownFrames = 12;
+
+    ~TTrayIconCache() { Clear(); }
+
+    // Creates the icons for the given size, unless they already exist.
+    void Build(HINSTANCE hInstance, int size);
+
+    HICON Locked() const { return locked; }
+    HICON Open() const { return open; }
+
+    // Icon showing the fraction (0..1) of the countdown that remains.
+    HICON Countdown(double remaining) const;
+
+    int Size() const { return size; }
+
+private:
+    void Clear();
+
+    static bool GetPixels(HICON icon, TIconImage &image);
+    static HICON CreateIconFromImage(const TIconImage &image);
+
+    int   size = 0;
+    HICON locked = NULL;
+    HICON open = NULL;
+    std::vector<HICON> countdown;
+};
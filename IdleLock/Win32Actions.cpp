@@ -0,0 +1,43 @@
+#include "stdafx.h"
+#include "Win32Actions.h"
+
+#include <powrprof.h>
+#include "wtsapi32.h"
+
+
+bool TDisconnectAction::Run(TActionToken &)
+{
+    return WTSDisconnectSession(WTS_CURRENT_SERVER_HANDLE, WTS_CURRENT_SESSION, FALSE) != FALSE;
+}
+
+
+// ExitWindowsEx() only starts the logoff, and returns right away. Programs
+// get the time to close until EWX_FORCEIFHUNG, which is Windows' own hung
+// app timeout; a second request forces it.
+bool TLogOffAction::Run(TActionToken &token)
+{
+    DWORD reason = SHTDN_REASON_MAJOR_OTHER | SHTDN_REASON_MINOR_OTHER | SHTDN_REASON_FLAG_PLANNED;
+    if (!ExitWindowsEx(EWX_LOGOFF | EWX_FORCEIFHUNG, reason))
+        return false;
+
+    // Still here when the time is up: some program is holding it up. The
+    // user who came back can deal with it.
+    while (token.Wait(1000))
+        ;
+    if (token.Cancelled())
+        return false;
+    return ExitWindowsEx(EWX_LOGOFF | EWX_FORCE, reason) != FALSE;
+}
+
+
+bool TSleepAction::Run(TActionToken &)
+{
+    return SetSuspendState(FALSE, FALSE, FALSE) != FALSE;
+}
+
+
+bool TSignalAction::Run(TActionToken &)
+{
+    UINT message = RegisterWindowMessageW(L"IdleLock.Timeout");
+    return message != 0 && PostMessageW(HWND_BROADCAST, message, 0, 0) != FALSE;
+}
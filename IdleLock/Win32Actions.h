@@ -0,0 +1,52 @@
+#pragma once
+
+// The Windows timeout actions (see ActionPipeline.h): disconnecting the
+// session, logging off, sleeping, and telling a kiosk program.
+
+#include "stdafx.h"
+
+#include "ActionPipeline.h"
+
+
+// Disconnects the session: the programs keep running, and the console goes
+// to the logon screen, like with Switch user.
+class TDisconnectAction : public TTimeoutAction
+{
+public:
+    TDisconnectAction() : TTimeoutAction(L"disconnect") {}
+
+    bool Run(TActionToken &) override;
+};
+
+
+// Logs off; programs that hold it up are forced to close once the timeout
+// is up, as Windows does at a forced logoff.
+class TLogOffAction : public TTimeoutAction
+{
+public:
+    TLogOffAction(uint32_t timeout = DefaultTimeout) : TTimeoutAction(L"logoff", timeout) {}
+
+    bool Run(TActionToken &) override;
+};
+
+
+// Puts the system to sleep; returns after the resume. The time asleep
+// doesn't count against the timeout.
+class TSleepAction : public TTimeoutAction
+{
+public:
+    TSleepAction() : TTimeoutAction(L"sleep", 0) {}
+
+    bool Run(TActionToken &) override;
+};
+
+
+// Posts the registered message "IdleLock.Timeout" to all top-level windows,
+// for kiosk programs that reset themselves when nobody uses them.
+class TSignalAction : public TTimeoutAction
+{
+public:
+    TSignalAction() : TTimeoutAction(L"signal") {}
+
+    bool Run(TActionToken &) override;
+};
@@ -0,0 +1,195 @@
+#include "stdafx.h"
+#include "Win32Backend.h"
+
+#include <VersionHelpers.h>
+
+#include "Stats.h"
+
+
+// Defined here rather than taken from the SDK, which would need initguid.h.
+// The console display state (Windows 8 and later) also tells when the
+// display is dimmed; the monitor power setting is what Windows 7 has.
+static const GUID ConsoleDisplayStateGuid = { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
+static const GUID MonitorPowerOnGuid = { 0x02731015, 0x4510, 0x4526, { 0x99, 0xe6, 0xe5, 0xa1, 0x7e, 0xbd, 0x1a, 0xea } };
+
+TWin32Backend *TWin32Backend::hookOwner = NULL;
+
+
+uint32_t TWin32Backend::LastInputTick()
+{
+    if (rawInput != NULL)
+        return rawInput->LastInputTick();
+
+    LASTINPUTINFO lastInputInfo;
+    lastInputInfo.cbSize = sizeof lastInputInfo;
+
+    if (!GetLastInputInfo(&lastInputInfo))
+        throw "Error calling GetLastInputInfo.";
+
+    return lastInputInfo.dwTime;
+}
+
+
+bool TWin32Backend::ScreenSaverRunning()
+{
+    BOOL bSaver;
+    SystemParametersInfo(SPI_GETSCREENSAVERRUNNING, 0, &bSaver, 0);
+    return bSaver == TRUE;
+}
+
+
+void TWin32Backend::StartSessionEvents(TSessionEventSink &aSink)
+{
+    sink = &aSink;
+    WTSRegisterSessionNotification(hMsgTargetWnd, NOTIFY_FOR_THIS_SESSION);
+}
+
+
+void TWin32Backend::StopSessionEvents()
+{
+    WTSUnRegisterSessionNotification(hMsgTargetWnd);
+    sink = NULL;
+}
+
+
+// WTSSessionInfoEx is Windows 7 and later; on Windows 7 and Server 2008 R2,
+// the lock and unlock values of SessionFlags are swapped.
+TSessionState TWin32Backend::SessionState()
+{
+    WTSINFOEXW *info = NULL;
+    DWORD size = 0;
+    if (!WTSQuerySessionInformationW(WTS_CURRENT_SERVER_HANDLE, WTS_CURRENT_SESSION, WTSSessionInfoEx,
+            (LPWSTR *)&info, &size))
+        return SS_Unknown;
+
+    TSessionState state = SS_Unknown;
+    if (size >= sizeof(WTSINFOEXW) && info->Level == 1) {
+        LONG flags = info->Data.WTSInfoExLevel1.SessionFlags;
+        bool swapped = !IsWindows8OrGreater();
+        if (flags == WTS_SESSIONSTATE_LOCK)
+            state = swapped ? SS_Unlocked : SS_Locked;
+        else if (flags == WTS_SESSIONSTATE_UNLOCK)
+            state = swapped ? SS_Locked : SS_Unlocked;
+    }
+    WTSFreeMemory(info);
+    return state;
+}
+
+
+// Windows doesn't notify anyone when the screensaver starts. Instead, its
+// window becoming the foreground window, or (for a secure screensaver) the
+// switch to its desktop, is taken as a hint to ask.
+bool TWin32Backend::StartDisplayEvents(TDisplayEventSink &aSink)
+{
+    const GUID &displayGuid = IsWindows8OrGreater() ? ConsoleDisplayStateGuid : MonitorPowerOnGuid;
+    hDisplayNotify = RegisterPowerSettingNotification(hMsgTargetWnd, &displayGuid, DEVICE_NOTIFY_WINDOW_HANDLE);
+    if (hDisplayNotify == NULL)
+        return false;
+
+    hookOwner = this;
+    hForegroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, WinEventProc,
+        0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    hDesktopHook = SetWinEventHook(EVENT_SYSTEM_DESKTOPSWITCH, EVENT_SYSTEM_DESKTOPSWITCH, NULL, WinEventProc,
+        0, 0, WINEVENT_OUTOFCONTEXT);
+    if (hForegroundHook == NULL || hDesktopHook == NULL) {
+        StopDisplayEvents();
+        return false;
+    }
+
+    // The display state is sent right after registering.
+    displaySink = &aSink;
+    screenSaverRunning = ScreenSaverRunning();
+    if (screenSaverRunning)
+        displaySink->ScreenSaverChanged(true);
+    return true;
+}
+
+
+void TWin32Backend::StopDisplayEvents()
+{
+    if (hForegroundHook != NULL)
+        UnhookWinEvent(hForegroundHook);
+    if (hDesktopHook != NULL)
+        UnhookWinEvent(hDesktopHook);
+    if (hDisplayNotify != NULL)
+        UnregisterPowerSettingNotification(hDisplayNotify);
+    hForegroundHook = hDesktopHook = NULL;
+    hDisplayNotify = NULL;
+    hookOwner = NULL;
+    displaySink = NULL;
+}
+
+
+void CALLBACK TWin32Backend::WinEventProc(HWINEVENTHOOK, DWORD, HWND, LONG, LONG, DWORD, DWORD)
+{
+    if (hookOwner != NULL)
+        hookOwner->ScreenSaverChange();
+}
+
+
+void TWin32Backend::ScreenSaverChange()
+{
+    TStats::Add(SC_ScreenSaverQueries);
+    bool running = ScreenSaverRunning();
+    if (running == screenSaverRunning || displaySink == NULL)
+        return;
+
+    screenSaverRunning = running;
+    displaySink->ScreenSaverChanged(running);
+    PostMessage(hMsgTargetWnd, displayEventMessage, 0, 0);
+}
+
+
+bool TWin32Backend::PowerSettingChange(LPARAM lParam)
+{
+    const POWERBROADCAST_SETTING *setting = (const POWERBROADCAST_SETTING *)lParam;
+    if (displaySink == NULL || setting == NULL || setting->DataLength < sizeof(DWORD)
+        || (setting->PowerSetting != ConsoleDisplayStateGuid && setting->PowerSetting != MonitorPowerOnGuid))
+        return false;
+
+    // 0 is off, 1 on and 2 dimmed, which still counts as on.
+    bool on = *(const DWORD *)setting->Data != 0;
+    if (on == displayOn)
+        return false;
+
+    displayOn = on;
+    displaySink->DisplayChanged(on);
+    return true;
+}
+
+
+TPowerSource TWin32Backend::PowerSource()
+{
+    SYSTEM_POWER_STATUS status;
+    if (!GetSystemPowerStatus(&status) || status.ACLineStatus == 255)
+        return PS_Unknown;
+    return status.ACLineStatus == 1 ? PS_AC : PS_Battery;
+}
+
+
+TDockState TWin32Backend::DockState()
+{
+    HW_PROFILE_INFO profile;
+    if (!GetCurrentHwProfile(&profile))
+        return DS_Unknown;
+
+    DWORD dock = profile.dwDockInfo & (DOCKINFO_DOCKED | DOCKINFO_UNDOCKED);
+    if (dock == DOCKINFO_DOCKED)
+        return DS_Docked;
+    if (dock == DOCKINFO_UNDOCKED)
+        return DS_Undocked;
+    return DS_Unknown;  // Not a dockable computer.
+}
+
+
+void TWin32Backend::SessionChange(WPARAM wParam)
+{
+    if (sink == NULL)
+        return;
+
+    if (wParam == WTS_SESSION_UNLOCK) {
+        sink->SessionUnlocked();
+    } else if (wParam == WTS_SESSION_LOCK) {
+        sink->SessionLocked();
+    }
+}
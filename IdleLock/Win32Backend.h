@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stdafx.h"
+#include "wtsapi32.h"
+
+#include "PlatformBackend.h"
+#include "Win32RawInput.h"
+
+
+class TWin32Backend : public TPlatformBackend
+{
+public:
+    // Session notifications are sent to hWnd, whose WndProc must pass
+    // WM_WTSSESSION_CHANGE on to SessionChange(), and the display power
+    // notifications of WM_POWERBROADCAST on to PowerSettingChange(). When the
+    // screensaver starts or stops, displayMessage is posted to hWnd.
+    TWin32Backend(HWND hWnd, UINT displayMessage) : hMsgTargetWnd(hWnd), displayEventMessage(displayMessage) {}
+
+    uint32_t TickCount() override { return GetTickCount(); }
+    uint32_t LastInputTick() override;
+    bool ScreenSaverRunning() override;
+    bool LockSession() override { return LockWorkStation() != FALSE; }
+    void StartSessionEvents(TSessionEventSink &aSink) override;
+    void StopSessionEvents() override;
+    TSessionState SessionState() override;
+    bool StartDisplayEvents(TDisplayEventSink &aSink) override;
+    void StopDisplayEvents() override;
+    TPowerSource PowerSource() override;
+    TDockState DockState() override;
+
+    // Takes the last input time from reader, once it has started, instead
+    // of GetLastInputInfo().
+    void SetRawInput(TRawInputReader *reader) { rawInput = reader; }
+
+    void SessionChange(WPARAM wParam);
+
+    // For PBT_POWERSETTINGCHANGE. Returns true if the display was turned on or off.
+    bool PowerSettingChange(LPARAM lParam);
+
+private:
+    static void CALLBACK WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hWnd,
+        LONG idObject, LONG idChild, DWORD idEventThread, DWORD eventTime);
+
+    void ScreenSaverChange();
+
+    static TWin32Backend *hookOwner;  // WinEventProc() has no context of its own.
+
+    HWND hMsgTargetWnd;
+    UINT displayEventMessage;
+    TSessionEventSink *sink = NULL;
+    TDisplayEventSink *displaySink = NULL;
+    TRawInputReader *rawInput = NULL;
+    HPOWERNOTIFY hDisplayNotify = NULL;
+    HWINEVENTHOOK hForegroundHook = NULL;
+    HWINEVENTHOOK hDesktopHook = NULL;
+    bool screenSaverRunning = false;
+    bool displayOn = true;
+};
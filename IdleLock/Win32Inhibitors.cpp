@@ -0,0 +1,71 @@
+#include "stdafx.h"
+#include "Win32Inhibitors.h"
+
+#include <powrprof.h>
+
+
+TFullScreenInhibitor *TFullScreenInhibitor::hookOwner = NULL;
+
+
+bool TPowerRequestInhibitor::Poll()
+{
+    EXECUTION_STATE state = 0;
+    if (CallNtPowerInformation(SystemExecutionState, NULL, 0, &state, sizeof state) != 0)
+        return false;
+    return (state & ES_DISPLAY_REQUIRED) != 0;
+}
+
+
+TFullScreenInhibitor::~TFullScreenInhibitor()
+{
+    if (hForegroundHook != NULL)
+        UnhookWinEvent(hForegroundHook);
+    if (hLocationHook != NULL)
+        UnhookWinEvent(hLocationHook);
+    if (hookOwner == this)
+        hookOwner = NULL;
+}
+
+
+void TFullScreenInhibitor::Start()
+{
+    hookOwner = this;
+    hForegroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, WinEventProc,
+        0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    hLocationHook = SetWinEventHook(EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, NULL, WinEventProc,
+        0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+    Report(IsFullScreen(GetForegroundWindow()));
+}
+
+
+// Location changes come for every caret and cursor move too; only the
+// foreground window's own matter.
+void CALLBACK TFullScreenInhibitor::WinEventProc(HWINEVENTHOOK, DWORD event, HWND hWnd, LONG idObject, LONG, DWORD, DWORD)
+{
+    if (hookOwner == NULL)
+        return;
+    HWND foreground = GetForegroundWindow();
+    if (event == EVENT_OBJECT_LOCATIONCHANGE && (idObject != OBJID_WINDOW || hWnd != foreground))
+        return;
+    hookOwner->Report(IsFullScreen(foreground));
+}
+
+
+bool TFullScreenInhibitor::IsFullScreen(HWND hWnd)
+{
+    // The desktop covers the monitor, but is no full screen program.
+    if (hWnd == NULL || hWnd == GetDesktopWindow() || hWnd == GetShellWindow() || !IsWindowVisible(hWnd))
+        return false;
+    wchar_t className[16];
+    if (GetClassNameW(hWnd, className, sizeof className / sizeof className[0]) != 0
+        && (lstrcmpW(className, L"WorkerW") == 0 || lstrcmpW(className, L"Progman") == 0))
+        return false;
+
+    RECT window;
+    MONITORINFO monitor;
+    monitor.cbSize = sizeof monitor;
+    if (!GetWindowRect(hWnd, &window) || !GetMonitorInfoW(MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST), &monitor))
+        return false;
+    return window.left <= monitor.rcMonitor.left && window.top <= monitor.rcMonitor.top
+        && window.right >= monitor.rcMonitor.right && window.bottom >= monitor.rcMonitor.bottom;
+}
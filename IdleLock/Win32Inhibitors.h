@@ -0,0 +1,46 @@
+#pragma once
+
+// The Windows inhibitor sources (see InhibitorSet.h).
+
+#include "stdafx.h"
+
+#include "InhibitorSet.h"
+
+
+// Active while some program asks for the display to stay on, like video
+// players and presentation programs do with SetThreadExecutionState() or
+// power requests; i.e. while the system's execution state has
+// ES_DISPLAY_REQUIRED. Polled, since there is no notification for it.
+class TPowerRequestInhibitor : public TInhibitorSource
+{
+public:
+    TPowerRequestInhibitor() : TInhibitorSource(L"display power requests", true) {}
+
+    bool Poll() override;
+};
+
+
+// Active while the foreground window covers its whole monitor, like a
+// presentation or a video played full screen. Follows foreground changes,
+// and the foreground window's moves and resizes, with WinEvent hooks, which
+// are delivered to the thread that adds it, so that thread must pump
+// messages.
+class TFullScreenInhibitor : public TInhibitorSource
+{
+public:
+    TFullScreenInhibitor() : TInhibitorSource(L"full screen window") {}
+    ~TFullScreenInhibitor();
+
+    void Start() override;
+
+private:
+    static void CALLBACK WinEventProc(HWINEVENTHOOK hook, DWORD event, HWND hWnd,
+        LONG idObject, LONG idChild, DWORD idEventThread, DWORD eventTime);
+
+    static bool IsFullScreen(HWND hWnd);
+
+    static TFullScreenInhibitor *hookOwner;  // WinEventProc() has no context of its own.
+
+    HWINEVENTHOOK hForegroundHook = NULL;
+    HWINEVENTHOOK hLocationHook = NULL;
+};
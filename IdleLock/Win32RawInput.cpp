@@ -0,0 +1,223 @@
+#include "stdafx.h"
+#include "Win32RawInput.h"
+
+#include "TextUtil.h"
+
+
+static const wchar_t *WindowClass = L"IdleLockRawInput";
+static const size_t BufferInputs = 64;     // Read per GetRawInputBuffer() call, roughly.
+static const LONG AbsoluteScale = 32;      // 65536 across the screen, to about pixels.
+
+
+TRawInputReader::TRawInputReader(TInputFilter &aFilter)
+    : filter(aFilter)
+{
+    // No input seen yet; count from startup.
+    lastInputTick = GetTickCount();
+}
+
+
+TRawInputReader::~TRawInputReader()
+{
+    Stop();
+}
+
+
+bool TRawInputReader::Start()
+{
+    // A 32 bit process on 64 bit Windows gets the 64 bit layout from
+    // GetRawInputBuffer(), whose header is 8 bytes longer.
+    BOOL wow64 = FALSE;
+    if (IsWow64Process(GetCurrentProcess(), &wow64) && wow64)
+        wowOffset = 8;
+
+    hStarted = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (hStarted == NULL)
+        return false;
+    thread = std::thread(&TRawInputReader::InputThread, this);
+    WaitForSingleObject(hStarted, INFINITE);
+    CloseHandle(hStarted);
+    hStarted = NULL;
+
+    if (!started)
+        thread.join();
+    return started;
+}
+
+
+void TRawInputReader::Stop()
+{
+    if (!thread.joinable())
+        return;
+    PostThreadMessageW(threadId, WM_QUIT, 0, 0);
+    thread.join();
+    started = false;
+}
+
+
+void TRawInputReader::InputThread()
+{
+    threadId = GetCurrentThreadId();
+
+    WNDCLASSEXW wcex = {};
+    wcex.cbSize = sizeof wcex;
+    wcex.lpfnWndProc = DefWindowProcW;
+    wcex.hInstance = GetModuleHandleW(NULL);
+    wcex.lpszClassName = WindowClass;
+    RegisterClassExW(&wcex);
+    HWND hWnd = CreateWindowExW(0, WindowClass, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, wcex.hInstance, NULL);
+
+    // Generic desktop mice and keyboards, also while other programs have
+    // the focus; and arrivals and removals, for the device names.
+    RAWINPUTDEVICE rid[2];
+    rid[0].usUsagePage = 0x01;
+    rid[0].usUsage = 0x02;
+    rid[0].dwFlags = RIDEV_INPUTSINK | RIDEV_DEVNOTIFY;
+    rid[0].hwndTarget = hWnd;
+    rid[1] = rid[0];
+    rid[1].usUsage = 0x06;
+    started = hWnd != NULL && RegisterRawInputDevices(rid, 2, sizeof rid[0]);
+
+    // Makes sure the thread has a message queue for WM_QUIT before Start()
+    // returns.
+    MSG msg;
+    PeekMessageW(&msg, NULL, 0, 0, PM_NOREMOVE);
+    SetEvent(hStarted);
+
+    while (started) {
+        MsgWaitForMultipleObjects(0, NULL, FALSE, INFINITE, QS_RAWINPUT | QS_POSTMESSAGE | QS_SENDMESSAGE);
+        ReadInput();
+
+        // What GetRawInputBuffer() left: notifications, and WM_INPUT that
+        // came after it, which DefWindowProc() frees.
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                started = false;
+                break;
+            }
+            if (msg.message == WM_INPUT_DEVICE_CHANGE && msg.wParam == GIDC_REMOVAL)
+                devices.erase((HANDLE)msg.lParam);  // Handles are reused.
+            DispatchMessageW(&msg);
+        }
+    }
+
+    if (hWnd != NULL) {
+        rid[0].dwFlags = rid[1].dwFlags = RIDEV_REMOVE;
+        rid[0].hwndTarget = rid[1].hwndTarget = NULL;
+        RegisterRawInputDevices(rid, 2, sizeof rid[0]);
+        DestroyWindow(hWnd);
+    }
+    UnregisterClassW(WindowClass, GetModuleHandleW(NULL));
+}
+
+
+// Reads all queued input, a buffer full at a time, and passes each buffer
+// full through the filter.
+void TRawInputReader::ReadInput()
+{
+    UINT largest = 0;
+    if (GetRawInputBuffer(NULL, &largest, sizeof(RAWINPUTHEADER)) != 0 || largest == 0)
+        return;
+    size_t bytes = (largest + wowOffset) * BufferInputs;
+    if (buffer.size() * sizeof buffer[0] < bytes)
+        buffer.resize((bytes + sizeof buffer[0] - 1) / sizeof buffer[0]);
+
+    for (;;) {
+        UINT size = UINT(buffer.size() * sizeof buffer[0]);
+        UINT count = GetRawInputBuffer((PRAWINPUT)buffer.data(), &size, sizeof(RAWINPUTHEADER));
+        if (count == 0 || count == (UINT)-1)
+            break;
+
+        uint32_t time = GetTickCount();
+        events.clear();
+        PRAWINPUT input = (PRAWINPUT)buffer.data();
+        for (UINT i = 0; i < count; i++) {
+            Translate(*input, time);
+            input = NEXTRAWINPUTBLOCK(input);
+        }
+        if (filter.Process(events.data(), events.size()))
+            lastInputTick.store(time, std::memory_order_relaxed);
+    }
+}
+
+
+// Input that programs synthesize, e.g. with SendInput(), has no device.
+TRawInputReader::TDevice &TRawInputReader::Device(HANDLE hDevice)
+{
+    auto it = devices.find(hDevice);
+    if (it != devices.end())
+        return it->second;
+
+    std::string name = "injected";
+    UINT chars = 0;
+    if (hDevice != NULL && GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, NULL, &chars) == 0 && chars != 0) {
+        std::wstring wideName(chars, L'\0');
+        if (GetRawInputDeviceInfoW(hDevice, RIDI_DEVICENAME, &wideName[0], &chars) != (UINT)-1)
+            name = ToUtf8(wideName.c_str());
+    }
+
+    TDevice device;
+    device.id = filter.AddDevice(name);
+    return devices.emplace(hDevice, device).first->second;
+}
+
+
+// Appends the input's events: a move, and a button or wheel, may come
+// together.
+void TRawInputReader::Translate(const RAWINPUT &input, uint32_t time)
+{
+    TDevice &device = Device(input.header.hDevice);
+    const BYTE *data = (const BYTE *)&input.data + wowOffset;
+
+    TInputEvent event;
+    event.time = time;
+    event.device = device.id;
+    event.dx = event.dy = 0;
+
+    if (input.header.dwType == RIM_TYPEKEYBOARD) {
+        const RAWKEYBOARD &keyboard = *(const RAWKEYBOARD *)data;
+        if (keyboard.Flags & RI_KEY_BREAK) {
+            event.kind = IK_Other;
+            if (keyboard.VKey == device.downKey)
+                device.downKey = 0;
+        } else {
+            event.kind = keyboard.VKey == device.downKey ? IK_KeyRepeat : IK_Key;
+            device.downKey = keyboard.VKey;
+        }
+        events.push_back(event);
+        return;
+    }
+    if (input.header.dwType != RIM_TYPEMOUSE)
+        return;
+
+    const RAWMOUSE &mouse = *(const RAWMOUSE *)data;
+    if (mouse.usFlags & MOUSE_MOVE_ABSOLUTE) {
+        // Tablets, and mice in remote sessions and virtual machines.
+        if (device.absValid) {
+            event.dx = (mouse.lLastX - device.absX) / AbsoluteScale;
+            event.dy = (mouse.lLastY - device.absY) / AbsoluteScale;
+        }
+        device.absX = mouse.lLastX;
+        device.absY = mouse.lLastY;
+        device.absValid = true;
+    } else {
+        event.dx = mouse.lLastX;
+        event.dy = mouse.lLastY;
+    }
+    if (event.dx != 0 || event.dy != 0) {
+        event.kind = IK_Move;
+        events.push_back(event);
+        event.dx = event.dy = 0;
+    }
+
+    const USHORT ButtonDowns = RI_MOUSE_BUTTON_1_DOWN | RI_MOUSE_BUTTON_2_DOWN | RI_MOUSE_BUTTON_3_DOWN
+        | RI_MOUSE_BUTTON_4_DOWN | RI_MOUSE_BUTTON_5_DOWN;
+    if (mouse.usButtonFlags & ButtonDowns) {
+        event.kind = IK_Button;
+        events.push_back(event);
+    }
+    if (mouse.usButtonFlags & (RI_MOUSE_WHEEL | RI_MOUSE_HWHEEL)) {
+        event.kind = IK_Wheel;
+        events.push_back(event);
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// Reads raw keyboard and mouse input on a thread of its own and passes it
+// through the input filter (see InputFilter.h), for the last input time
+// instead of GetLastInputInfo(), which any input, e.g. a twitching mouse,
+// resets. The thread has a message-only window that gets the input of the
+// whole session (RIDEV_INPUTSINK), and reads what has queued up in batches
+// with GetRawInputBuffer() whenever it wakes, so a 1000 Hz mouse costs a
+// wakeup per batch rather than a WM_INPUT message each, and the UI thread
+// isn't involved at all. Input of the same batch has the same time.
+// Touch and pen input, which isn't keyboard or mouse input, doesn't count.
+
+#include "stdafx.h"
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "InputFilter.h"
+
+
+class TRawInputReader
+{
+public:
+    // filter must outlive the reader, and is only used by its thread.
+    TRawInputReader(TInputFilter &filter);
+    ~TRawInputReader();
+
+    // Returns false if the input can't be had.
+    bool Start();
+    void Stop();
+
+    // GetTickCount() of the last input the filter let through, or of the
+    // construction.
+    uint32_t LastInputTick() const { return lastInputTick.load(std::memory_order_relaxed); }
+
+private:
+    struct TDevice
+    {
+        uint16_t id;            // The filter's.
+        USHORT   downKey = 0;   // To tell repeats, which raw input doesn't mark.
+        bool     absValid = false;
+        LONG     absX = 0;      // Last absolute position, to make moves of.
+        LONG     absY = 0;
+    };
+
+    void InputThread();
+    void ReadInput();
+    TDevice &Device(HANDLE hDevice);
+    void Translate(const RAWINPUT &input, uint32_t time);
+
+    TInputFilter &filter;
+    std::thread thread;
+    DWORD threadId = 0;
+    HANDLE hStarted = NULL;     // Set when the thread has registered, or failed to.
+    bool started = false;
+    size_t wowOffset = 0;       // See ReadInput().
+
+    std::atomic<uint32_t> lastInputTick;
+    std::unordered_map<HANDLE, TDevice> devices;
+    std::vector<uint64_t> buffer;     // RAWINPUT blocks, 8 byte aligned.
+    std::vector<TInputEvent> events;
+};
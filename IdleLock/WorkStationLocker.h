@@ -1,80 +1,23 @@
 #pragma once
 
 
-#include "stdafx.h"
-#include "wtsapi32.h"
-
+#include "LockEngine.h"
 #include "Logger.h"
+#include "SettingsStore.h"
 
 
-class TWorkStationLocker
+// The lock engine with its settings persisted in a settings store.
+class TWorkStationLocker : public TLockEngine
 {
 public:
-    static const int DefaultTimeout = 20 * 60000;
-
-    TWorkStationLocker(HWND hWnd, TLogger &logger);
-    ~TWorkStationLocker();
-
-    void LockIfIdleTimeout();
-
-    void ReportLock()
-    {
-        Logger.Log(L"Workstation locked.");
-        isLocked = true;
-    }
-
-    void ReportUnlock()
-    {
-        Logger.Log(L"Workstation unlocked.");
-        isLocked = false;
-        unlockedTick = GetTickCount();
-        screenSaverActiveAt = 0L;
-    }
-
-    void SetTimeout(int aIdleTimeout)
-    {
-        idleTimeout = aIdleTimeout;
-        WriteSettings();
-    }
-
-    int GetTimeout()
-    {
-        return idleTimeout;
-    }
-
-    void RequireScreensaver(bool require)
-    {
-        requireScreenSaver = require;
-        WriteSettings();
-    }
-
-    bool IsScreenSaverRequired()
-    {
-        return requireScreenSaver;
-    }
-
-    bool Enabled()
-    {
-        return enabled;
-    }
+    TWorkStationLocker(TPlatformBackend &backend, TLogger &logger, TSettingsStore &settingsStore);
 
-    void Enable(bool aEnable)
-    {
-        enabled = aEnable;
-        WriteSettings();
-    }
+    // Takes over the settings from the store, after they have been changed
+    // from outside.
+    void ReloadSettings();
 
 protected:
-    void  ReadSettings();
-    void  WriteSettings();
-    bool  ScreenSaverRunning();
+    void SettingsChanged() override;
 
-    HWND  hMsgTargetWnd;
-    TLogger &Logger;
-    int   idleTimeout = DefaultTimeout;
-    bool  requireScreenSaver;
-    bool  enabled;
-    bool  isLocked = false;
-    DWORD screenSaverActiveAt = 0;  // The idleTime at which the screensaver was seen as active.
-    DWORD unlockedTick = 0;  // The tick count at which the computer was unlocked.
+    TSettingsStore &SettingsStore;
 };
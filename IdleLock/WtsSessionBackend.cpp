@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "WtsSessionBackend.h"
+
+
+// WTSINFO times are FILETIMEs, in 100 ns units.
+bool TWtsSessionBackend::LastInputTick(uint32_t session, uint32_t &tick)
+{
+    WTSINFOW *info;
+    DWORD bytes;
+    if (!WTSQuerySessionInformationW(WTS_CURRENT_SERVER_HANDLE, session, WTSSessionInfo, (LPWSTR *) &info, &bytes))
+        return false;
+
+    bool active = info->State == WTSActive;
+    LONGLONG idle = info->CurrentTime.QuadPart - info->LastInputTime.QuadPart;
+
+    // The console session doesn't always report its last input. Count it
+    // as active then, rather than locking it by mistake.
+    if (info->LastInputTime.QuadPart == 0 || idle < 0)
+        idle = 0;
+
+    WTSFreeMemory(info);
+
+    LONGLONG idleMs = idle / 10000;
+    tick = GetTickCount() - (idleMs > UINT32_MAX / 2 ? UINT32_MAX / 2 : uint32_t(idleMs));
+    return active;
+}
+
+
+// A service can't call LockWorkStation() on behalf of another session, so
+// disconnect it instead. That leaves the user's programs running, and the
+// user must log on again to reconnect, just like unlocking.
+bool TWtsSessionBackend::LockSession(uint32_t session)
+{
+    return WTSDisconnectSession(WTS_CURRENT_SERVER_HANDLE, session, FALSE) != FALSE;
+}
+
+
+void TWtsSessionBackend::Start(TSessionMonitor &aMonitor)
+{
+    monitor = &aMonitor;
+    WTSRegisterSessionNotification(hMsgTargetWnd, NOTIFY_FOR_ALL_SESSIONS);
+
+    WTS_SESSION_INFOW *sessions;
+    DWORD count;
+    if (WTSEnumerateSessionsW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &sessions, &count)) {
+        for (DWORD i = 0; i < count; i++) {
+            // Session 0 is where services run; nobody logs on to it.
+            if (sessions[i].SessionId != 0 && sessions[i].State == WTSActive)
+                monitor->AddSession(sessions[i].SessionId);
+        }
+        WTSFreeMemory(sessions);
+    }
+}
+
+
+void TWtsSessionBackend::Stop()
+{
+    WTSUnRegisterSessionNotification(hMsgTargetWnd);
+    monitor = NULL;
+}
+
+
+// lParam is the session id.
+void TWtsSessionBackend::SessionChange(WPARAM wParam, LPARAM lParam)
+{
+    if (monitor == NULL)
+        return;
+
+    uint32_t session = uint32_t(lParam);
+    switch (wParam) {
+        case WTS_SESSION_LOGON:
+        case WTS_CONSOLE_CONNECT:
+        case WTS_REMOTE_CONNECT:
+        case WTS_SESSION_UNLOCK:
+            // The user has just authenticated, so count from now.
+            monitor->SessionUnlocked(session);
+            break;
+
+        case WTS_SESSION_LOCK:
+            monitor->SessionLocked(session);
+            break;
+
+        case WTS_SESSION_LOGOFF:
+        case WTS_CONSOLE_DISCONNECT:
+        case WTS_REMOTE_DISCONNECT:
+            monitor->RemoveSession(session);
+            break;
+    }
+}
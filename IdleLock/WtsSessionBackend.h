@@ -0,0 +1,30 @@
+#pragma once
+
+#include "stdafx.h"
+#include "wtsapi32.h"
+
+#include "SessionMonitor.h"
+
+
+// All sessions on this host, through the Remote Desktop Services API.
+// Session notifications are sent to hWnd, whose WndProc must pass
+// WM_WTSSESSION_CHANGE on to SessionChange().
+class TWtsSessionBackend : public TMultiSessionBackend
+{
+public:
+    TWtsSessionBackend(HWND hWnd) : hMsgTargetWnd(hWnd) {}
+
+    uint32_t TickCount() override { return GetTickCount(); }
+    bool LastInputTick(uint32_t session, uint32_t &tick) override;
+    bool LockSession(uint32_t session) override;
+
+    // Adds the sessions that are active now, and reports later changes.
+    void Start(TSessionMonitor &aMonitor);
+    void Stop();
+
+    void SessionChange(WPARAM wParam, LPARAM lParam);
+
+private:
+    HWND hMsgTargetWnd;
+    TSessionMonitor *monitor = NULL;
+};